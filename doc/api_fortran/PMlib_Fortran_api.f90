@@ -110,6 +110,22 @@ subroutine f_pm_stop_usermode (fc, fpt, tic)
 end subroutine
 
 
+!!	@brief
+!!	subroutine f_pm_stop_roofline (fc, fpt, tic, bpt) : with the memory traffic for the roofline report
+!!
+!!   @param[in] character*(*)	fc	測定区間を識別するラベル文字列。
+!!   @param[in] real(kind=8)	fpt	 計算量。演算量(Flop)
+!!   @param[in] integer			tic  計算量に乗じる係数。
+!!   @param[in] real(kind=8)	bpt	 メモリ転送量(Byte)
+!!
+!!   @note  環境変数PMLIB_ROOFLINEを指定した場合のルーフラインレポートでは、
+!!          HWPCで計測されない演算量とメモリ転送量として fpt*tic と bpt*tic が
+!!          モードによらず利用される。
+!!
+subroutine f_pm_stop_roofline (fc, fpt, tic, bpt)
+end subroutine
+
+
 !> PMlib Fortran 測定区間のリセット
 !!
 !!   @param[in] character*(*) fc	測定区間を識別するラベル文字列。
@@ -307,6 +323,38 @@ subroutine f_pm_posttrace ()
 end subroutine
 
 
+!> PMlib Fortran trace flight recorder の直近の記録の出力
+!!
+!!   @note  PMLIB_TRACE=flight:<秒> の時のみ有効. 各プロセスが独立に呼び出せる
+!!      出力ファイル名は PMLIB_TRACE_FILE=<stem>.json に対して <stem>.<rank>.<n>.json
+!!
+subroutine f_pm_dumptrace ()
+end subroutine
+
+
+!> PMlib Fortran 事象の記録
+!!
+!!   @param[in] character*(*) fc	事象の名前
+!!
+!!   @note  実行中の最も内側の測定区間の事象として回数が基本統計レポートに出力される.
+!!      trace出力 (PMLIB_TRACE) では instant event になる
+!!
+subroutine f_pm_mark (fc)
+end subroutine
+
+
+!> PMlib Fortran 値の記録
+!!
+!!   @param[in] character*(*) fc	counterの名前
+!!   @param[in] real(kind=8) value	値
+!!
+!!   @note  実行中の最も内側の測定区間ごとの回数、最小値、平均値、最大値が
+!!      基本統計レポートに出力される. trace出力 (PMLIB_TRACE) では counter track になる
+!!
+subroutine f_pm_counter (fc, value)
+end subroutine
+
+
 !! PMlib Fortran interface
 !! @brief Power knob interface - Read the current value for the given power control knob
 !!
@@ -348,3 +396,14 @@ end subroutine
 subroutine  f_pm_setpowerknob (knob, value)
 end subroutine
 
+
+!> PMlib Fortran HWPC_CHOOSERで多重化したグループのうち計測するグループを切り替える
+!!
+!!   @param[in] character*(*) fc	グループ名、または'+'で連結したグループ名。
+!!		"ALL"を指定すると多重化した全グループの計測に戻る。
+!!
+!!   @note  HWPC_CHOOSERに含まれないグループを指定した場合は無視される。
+!!
+subroutine  f_pm_setcountergroup (fc)
+end subroutine
+
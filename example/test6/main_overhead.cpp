@@ -0,0 +1,109 @@
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 RIKEN Center for Computational Science(R-CCS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+//	Measure the cost of a PMlib start/stop pair with the perf HWPC backend,
+//	once with the user space counter read (rdpmc) and once with read(2),
+//	and report the difference.
+//	The program runs itself twice with PMLIB_HWPC_RDPMC=yes and =no, since
+//	the read method is chosen when PMlib is initialized.
+//	HWPC_CHOOSER and PMLIB_HWPC_BACKEND can be given, e.g.
+//	$ HWPC_CHOOSER=FLOPS ./example6
+
+#include <PerfMonitor.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/time.h>
+using namespace pm_lib;
+
+PerfMonitor PM;
+
+const int n_pairs = 100000;
+
+double wtime()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return (double)tv.tv_sec + (double)tv.tv_usec * 1.0e-6;
+}
+
+//	the child run : time the start/stop pairs and print the report
+int measure()
+{
+	double t1, t2;
+
+	PM.initialize();
+	PM.setProperties("section", PerfMonitor::CALC);
+
+	t1 = wtime();
+	for (int i=0; i<n_pairs; i++) {
+		PM.start("section");
+		PM.stop ("section");
+	}
+	t2 = wtime();
+	printf("usec_per_pair= %.6f\n", (t2-t1)/(double)n_pairs*1.0e6);
+
+	PM.print(stdout, "", "", 0);
+	return 0;
+}
+
+//	run the child with PMLIB_HWPC_RDPMC=s_rdpmc and take the time and the read method
+bool run_child(const char* argv0, const char* s_rdpmc, double& usec, std::string& s_read)
+{
+	setenv("PMLIB_HWPC_RDPMC", s_rdpmc, 1);
+	std::string cmd = std::string("\"") + argv0 + "\" -measure";
+	FILE* fp = popen(cmd.c_str(), "r");
+	if (fp == NULL) return false;
+
+	char line[1024];
+	usec = -1.0;
+	s_read = "unknown";
+	while (fgets(line, sizeof(line), fp) != NULL) {
+		sscanf(line, "usec_per_pair= %lf", &usec);
+		const char* p = strstr(line, "counter read: ");
+		if (p != NULL) {
+			s_read = p + strlen("counter read: ");
+			size_t n = s_read.rfind(')');
+			if (n != std::string::npos) s_read.erase(n);
+		}
+	}
+	return (pclose(fp) == 0) && (usec >= 0.0);
+}
+
+int main (int argc, char *argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "-measure") == 0) return measure();
+
+	setenv("PMLIB_HWPC_BACKEND", "perf", 0);
+	setenv("HWPC_CHOOSER", "CYCLE", 0);
+
+	double usec_rdpmc, usec_read;
+	std::string s_rdpmc, s_read;
+	if (!run_child(argv[0], "yes", usec_rdpmc, s_rdpmc) ||
+		!run_child(argv[0], "no",  usec_read,  s_read)) {
+		fprintf(stderr, "*** error. the measurement run failed.\n");
+		return 1;
+	}
+
+	printf("PMlib start/stop overhead: %d pairs, HWPC_CHOOSER=%s, PMLIB_HWPC_BACKEND=%s\n",
+		n_pairs, getenv("HWPC_CHOOSER"), getenv("PMLIB_HWPC_BACKEND"));
+	printf("\t PMLIB_HWPC_RDPMC=yes : %8.3f [usec/pair]  counter read: %s\n", usec_rdpmc, s_rdpmc.c_str());
+	printf("\t PMLIB_HWPC_RDPMC=no  : %8.3f [usec/pair]  counter read: %s\n", usec_read, s_read.c_str());
+	printf("\t difference           : %8.3f [usec/pair]\n", usec_read - usec_rdpmc);
+	return 0;
+}
@@ -0,0 +1,134 @@
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 RIKEN Center for Computational Science(R-CCS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+//	Check that "pmtrace json" converts the binary trace into the same events
+//	as the native JSON trace of PMLIB_TRACE=full.
+//	The program runs itself twice with PMLIB_TRACE_FORMAT=json and =binary,
+//	since the format is chosen when PMlib is initialized, and then compares
+//	the number of the events of each kind ("ph") of the two JSON files.
+//	$ ./example7 <path of pmtrace>
+
+#include <PerfMonitor.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <map>
+using namespace pm_lib;
+
+PerfMonitor PM;
+
+const int n_iterations = 1000;
+
+const char* s_native = "pmlib_trace_native.json";
+const char* s_binary = "pmlib_trace_binary.pmt";
+const char* s_converted = "pmlib_trace_converted.json";
+
+//	the child run : write the trace
+int measure()
+{
+	PM.initialize();
+	PM.setProperties("outer", PerfMonitor::CALC);
+	PM.setProperties("inner", PerfMonitor::CALC);
+
+	for (int i=0; i<n_iterations; i++) {
+		PM.start("outer");
+		PM.start("inner");
+		PM.stop ("inner", 1.0, 100);
+		PM.stop ("outer", 2.0, 100);
+		if (i % 100 == 0) {
+			PM.mark("step");
+			PM.counter("residual", 1.0/(double)(i+1));
+		}
+	}
+	PM.report(stdout);
+	return 0;
+}
+
+//	run the child with PMLIB_TRACE_FORMAT=s_format
+bool run_child(const char* argv0, const char* s_format, const char* s_file)
+{
+	setenv("PMLIB_TRACE_FORMAT", s_format, 1);
+	setenv("PMLIB_TRACE_FILE", s_file, 1);
+	remove(s_file);
+	std::string cmd = std::string("\"") + argv0 + "\" -measure > /dev/null";
+	return system(cmd.c_str()) == 0;
+}
+
+//	count the events of each kind, i.e. the value of "ph", in the JSON trace file
+bool count_events(const char* s_file, std::map<char, long>& counts)
+{
+	FILE* fp = fopen(s_file, "r");
+	if (fp == NULL) return false;
+	const char* key = "\"ph\":\"";
+	const int n_key = strlen(key);
+	int i_match = 0;
+	int c;
+	while ((c = fgetc(fp)) != EOF) {
+		if (i_match == n_key) {
+			counts[(char)c]++;
+			i_match = 0;
+		} else if (c == key[i_match]) {
+			i_match++;
+		} else {
+			i_match = (c == key[0]) ? 1 : 0;
+		}
+	}
+	fclose(fp);
+	return true;
+}
+
+int main (int argc, char *argv[])
+{
+	if (argc > 1 && strcmp(argv[1], "-measure") == 0) return measure();
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <path of pmtrace>\n", argv[0]);
+		return 1;
+	}
+
+	setenv("PMLIB_TRACE", "full", 1);
+	if (!run_child(argv[0], "json", s_native) ||
+		!run_child(argv[0], "binary", s_binary)) {
+		fprintf(stderr, "*** error. the trace run failed.\n");
+		return 1;
+	}
+	std::string cmd = std::string("\"") + argv[1] + "\" json " + s_binary + " " + s_converted;
+	remove(s_converted);
+	if (system(cmd.c_str()) != 0) {
+		fprintf(stderr, "*** error. %s failed.\n", cmd.c_str());
+		return 1;
+	}
+
+	std::map<char, long> n_native, n_converted;
+	if (!count_events(s_native, n_native) || !count_events(s_converted, n_converted)) {
+		fprintf(stderr, "*** error. can not read the trace files.\n");
+		return 1;
+	}
+	bool is_same = (n_native.size() == n_converted.size());
+	printf("PMlib trace events per ph: native JSON, pmtrace json of the binary trace\n");
+	for (std::map<char, long>::iterator it=n_native.begin(); it!=n_native.end(); ++it) {
+		long n = n_converted.count(it->first) ? n_converted[it->first] : -1;
+		printf("\t ph=%c : %8ld %8ld\n", it->first, it->second, n);
+		if (n != it->second) is_same = false;
+	}
+	if (!is_same || n_native.count('X') == 0) {
+		printf("the events differ\n");
+		return 1;
+	}
+	printf("the events are the same\n");
+	return 0;
+}
@@ -0,0 +1,66 @@
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 RIKEN Center for Computational Science(R-CCS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+//	Check the threads which join the team after initialize().
+//	PMlib is initialized by a team of 2 threads, and the team grows to 4 threads
+//	with omp_set_num_threads(). The threads 2 and 3 are bound by the first start().
+//	"work" is measured by all the threads, and "late" only by the threads 2 and 3.
+//	The report must show the calls of every thread, and must not hang
+//	in stopping the Root section with HWPC.
+//	$ PMLIB_REPORT=FULL ./example8
+
+#include <PerfMonitor.h>
+#include <omp.h>
+#include <stdio.h>
+using namespace pm_lib;
+
+extern PerfMonitor PM;
+#pragma omp threadprivate(PM)
+PerfMonitor PM;
+PerfReport PR;
+
+const int n_iterations = 10;
+
+int main (int argc, char *argv[])
+{
+	MPI_Init(&argc, &argv);
+
+	omp_set_num_threads(2);
+	#pragma omp parallel
+	{
+		PM.initialize();
+		PM.start("work");
+		PM.stop ("work");
+	}
+
+	omp_set_num_threads(4);
+	#pragma omp parallel
+	{
+		for (int i=0; i<n_iterations; i++) {
+			PM.start("work");
+			PM.stop ("work");
+		}
+		if (omp_get_thread_num() >= 2) {
+			PM.start("late");
+			PM.stop ("late");
+		}
+	}
+
+	PR.report(stdout);
+	MPI_Finalize();
+	return 0;
+}
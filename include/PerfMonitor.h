@@ -23,6 +23,7 @@
 #include <cstdio>
 #include <cstdlib>
 #include <map>
+#include <vector>
 #include <list>
 
 #ifdef DISABLE_MPI
@@ -94,11 +95,12 @@ namespace pm_lib {
     bool is_OTF_enabled;       ///< PMlibの対応動作可能フラグ:OTF tracing 出力
     bool is_Root_active;       ///< 背景区間(Root区間)の動作フラグ
     bool is_exclusive_construct; ///< 測定区間の重なり状態検出フラグ
+    bool is_late_thread;       ///< initialize()の後に並列チームに加わったスレッドか
 
     std::string parallel_mode; /*!< 並列動作モード
       // {Serial| OpenMP| FlatMPI| Hybrid} */
     std::string env_str_hwpc;  /*!< 環境変数 HWPC_CHOOSERの値
-      // {FLOPS| BANDWIDTH| VECTOR| CACHE| CYCLE| LOADSTORE| USER} */
+      // {FLOPS| BANDWIDTH| VECTOR| CACHE| CYCLE| LOADSTORE| TOPDOWN| TLB| CUSTOM| USER} or G1+G2+... */
     std::string env_str_report;  /*!< 環境変数 PMLIB_REPORTの値
       // {BASIC| DETAIL| FULL} */
 
@@ -111,10 +113,20 @@ namespace pm_lib {
 
     std::map<std::string, int > m_map_sections; /// map of section name and ID
 
+    std::vector<std::string> m_seriesKeys;  ///< mark(), counter() の区間ラベル + '\0' + 種類 + 名前 (全プロセスの和集合)
+    std::vector<double> m_seriesStats;      ///< m_seriesKeys ごとの 回数, 合計, 最小値, 最大値 (全スレッド、全プロセス)
+
+    std::vector<int> m_shared_ids;          ///< 測定区間ごとのプロセス内で共通の区間番号 (shared_map_sections)
+    std::vector<std::string> m_samplingKeys; ///< sampling profiler の区間ラベル (全プロセスの和集合)
+    std::vector<double> m_samplingStats;    ///< m_samplingKeys ごとの 呼び出し回数, 最も内側だった標本数, 実行中だった標本数
+    double m_samplingTicks;                 ///< sampling profiler の全標本数
+    double m_samplingThreads;               ///< sampling したスレッド数 (全プロセスの合計)
+
 
   public:
     /// コンストラクタ.
-    PerfMonitor() : my_rank(-1), m_watchArray(0) {
+    PerfMonitor() : my_rank(-1), is_PMlib_enabled(false), is_late_thread(false), m_watchArray(0),
+      m_samplingTicks(0.0), m_samplingThreads(0.0) {
 		#ifdef DEBUG_PRINT_MONITOR
 		//	if (my_rank == 0) {
 		fprintf(stderr, "<PerfMonitor> constructor \n");
@@ -204,6 +216,22 @@ namespace pm_lib {
     void setPowerKnob(int knob, int value);
 
 
+    /// HWPC_CHOOSERで多重化したグループのうち計測するグループを切り替える
+    ///
+    ///   @param[in] name : グループ名、または'+'で連結したグループ名。
+    ///		"ALL"または""を指定すると多重化した全グループの計測に戻る。
+    ///
+    ///   @note 例えば HWPC_CHOOSER=FLOPS+CACHE の場合、setCounterGroup("CACHE")
+    ///		以降はCACHEのイベントだけをカウンタに割り当てて計測する。
+    ///		それまでのカウント値は保持され、計測中の測定区間は各グループが
+    ///		計測されていた間のカウント値と時間を積算する。各グループの速度は
+    ///		そのグループが計測されていた時間あたりの値となり、区間内で一度も
+    ///		計測されなかったグループはその区間では0と出力される。
+    ///		HWPC_CHOOSERに含まれないグループを指定した場合は無視される。
+    ///
+    void setCounterGroup(const std::string& name);
+
+
     /// 測定区間スタート
     ///
     ///   @param[in] label ラベル文字列。測定区間を識別するために用いる。
@@ -215,13 +243,29 @@ namespace pm_lib {
     void start (const std::string& label);
 
 
+    /// 自動生成される測定区間のスタート (OMPTツールから呼び出される)
+    ///
+    ///   @param[in] label ラベル文字列。
+    ///   @return 区間を開始したか
+    ///
+    ///   @note 区間が未定義の場合は非排他的区間(inclusive)として登録する。
+    ///		逐次領域のHWPC計測は並列構文を伴うため、OpenMPランタイムの
+    ///		コールバックからは開始せずfalseを返す。
+    ///
+    bool startAutoSection (const std::string& label);
+
+
     /// 測定区間ストップ
     ///
     ///   @param[in] label ラベル文字列。測定区間を識別するために用いる。
     ///   @param[in] flopPerTask 測定区間の計算量(演算量Flopまたは通信量Byte) :省略値0
     ///   @param[in] iterationCount  計算量の乗数（反復回数）:省略値1
+    ///   @param[in] bytePerTask 測定区間のメモリ転送量(Byte) :省略値0
     ///
     ///   @note  第２、第３引数はユーザ申告モードの場合にのみ利用される。 \n
+    ///   @note  ルーフラインレポート(PMLIB_ROOFLINE)では、HWPCで計測されない演算量と
+    ///          メモリ転送量に、計算区間のflopPerTask*iterationCount と
+    ///          bytePerTask*iterationCount がモードによらず利用される。 \n
     ///   @note  測定区間の計算量は次のように算出される。 \n
     ///          (A) ユーザ申告モードの場合は １区間１回あたりで flopPerTask*iterationCount \n
     ///          (B) HWPCによる自動算出モードの場合は引数とは関係なくHWPC内部値を利用\n
@@ -238,12 +282,47 @@ namespace pm_lib {
       - ユーザ申告モードで 計算量の引数が省略された場合は時間のみレポート出力する。
     (B) HWPCによる自動算出モード
       - HWPC/PAPIが利用可能なプラットフォームで利用できる
-      - 環境変数HWPC_CHOOSERの値により測定情報を選択する。(FLOPS| BANDWIDTH| VECTOR| CACHE| CYCLE| LOADSTORE)
+      - 環境変数HWPC_CHOOSERの値により測定情報を選択する。(FLOPS| BANDWIDTH| VECTOR| CACHE| CYCLE| LOADSTORE| TOPDOWN| TLB| CUSTOM:EV1,EV2,...)
+        FLOPS+BANDWIDTH+CACHE のように'+'で連結した複数グループは時分割(多重化)で測定される。
         環境変数HWPC_CHOOSERが指定された場合（USER以外の値を指定した場合）は自動的にHWPCが利用される。
      **/
     ///   @endverbatim
     ///
-    void stop(const std::string& label, double flopPerTask=0.0, unsigned iterationCount=1);
+    void stop(const std::string& label, double flopPerTask=0.0, unsigned iterationCount=1, double bytePerTask=0.0);
+
+
+    /// 事象の記録. trace出力では現在時刻のinstant eventになり、
+    /// 基本統計レポートには実行中の最も内側の区間ごとの回数が出力される
+    ///
+    ///   @param[in] label 事象の名前
+    ///
+    ///   @note スレッドごとに記録され、並列領域の中から呼び出せる。
+    ///         実行中の区間が無い時は Root 区間の事象になる
+    ///
+    void mark (const std::string& label);
+
+
+    /// 値の記録. trace出力では counter track になり、基本統計レポートには
+    /// 実行中の最も内側の区間ごとの回数、最小値、平均値、最大値が出力される
+    ///
+    ///   @param[in] name   counterの名前
+    ///   @param[in] value  値
+    ///
+    ///   @note 値は時系列としてスレッドごとに PMLIB_SERIES_MAX 個
+    ///         (省略値100000) まで保持され、getCounterSeries() で取得できる。
+    ///         統計値は保持数によらず全ての値から計算される
+    ///
+    void counter (const std::string& name, double value);
+
+
+    /// 自プロセスが記録した counter の時系列を時刻順に取得する
+    ///
+    ///   @param[in]  name   counterの名前
+    ///   @param[out] time   PerfWatch::getTime() の時刻 [sec]
+    ///   @param[out] value  値
+    ///   @return PMLIB_SERIES_MAX を超えて保持されなかった値の数 (全counterの合計)
+    ///
+    long getCounterSeries (const std::string& name, std::vector<double>& time, std::vector<double>& value);
 
 
     /// 測定区間のリセット
@@ -431,6 +510,14 @@ namespace pm_lib {
     void postTrace(void);
 
 
+    /// flight recorder (PMLIB_TRACE=flight:<秒>) が保持している直近の記録を
+    /// 自プロセスのtraceファイルに書き出す
+    ///
+    /// @note 各プロセスが独立に何回でも呼び出せる. flight recorder 以外では何もしない
+    ///
+    void dumpTrace(void);
+
+
     /// 旧バージョンとの互換維持用(並列モードを設定)。
     /// 利用者は通常このAPIを呼び出す必要はない。
     ///
@@ -465,6 +552,14 @@ namespace pm_lib {
 
   private:
 
+    /// initialize()の後に並列チームに加わったスレッドのthreadprivateなインスタンスを準備する
+    ///
+    /// @note MPI通信、環境変数の解析、HWPCやtraceの初期化は行わず、
+    ///       initialize()を呼び出したスレッドの設定を引き継ぐ。
+    ///       start(), mark(), counter()から呼び出される。
+    ///
+    void bindLateThread (void);
+
     /// 測定区間のラベルに対応する区間番号を追加作成する
     /// Add a new entry in the section map (section name, section ID)
     ///
@@ -592,6 +687,60 @@ namespace pm_lib {
 	void printBasicPower(FILE* fp, int maxLabelLen, int op_sort=0);
 
 
+	/// Report the BASIC thread CPU utilization and context switches of the sections
+	///
+	///   @param[in] fp         report file pointer
+	///   @param[in] maxLabelLen    maximum label field string length
+	///   @param[in] op_sort     sorting option (0:sorted by seconds, 1:listed order)
+	///
+	///		@note	the values are the sums of all threads and all processes
+	///
+	void printBasicCPU(FILE* fp, int maxLabelLen, int op_sort=0);
+
+
+	/// Report the roofline position of the sections, and write it to the plot file
+	///
+	///   @param[in] fp         report file pointer
+	///   @param[in] maxLabelLen    maximum label field string length
+	///   @param[in] op_sort     sorting option (0:sorted by seconds, 1:listed order)
+	///
+	///		@note	the values are per process, averaged over the processes
+	///
+	void printBasicRoofline(FILE* fp, int maxLabelLen, int op_sort=0);
+
+
+	/// Report the marks and the counters of the sections
+	///
+	///   @param[in] fp         report file pointer
+	///   @param[in] maxLabelLen    maximum label field string length
+	///   @param[in] op_sort     sorting option (0:sorted by seconds, 1:listed order)
+	///
+	void printBasicSeries(FILE* fp, int maxLabelLen, int op_sort=0);
+
+
+	/// record a mark or a value of a counter of the calling thread
+	void recordSeries (const std::string& name, int kind, double value);
+
+
+	/// gather the statistics of the marks and the counters of all threads and all processes
+	/// to m_seriesKeys and m_seriesStats
+	void gatherSeries (void);
+
+
+	/// Report the time of the sections estimated by the sampling profiler
+	///
+	///   @param[in] fp         report file pointer
+	///   @param[in] maxLabelLen    maximum label field string length
+	///   @param[in] op_sort     sorting option (0:sorted by the estimated time, 1:listed order)
+	///
+	void printBasicSampling(FILE* fp, int maxLabelLen, int op_sort=0);
+
+
+	/// gather the samples of the sampling profiler of all threads and all processes
+	/// to m_samplingKeys and m_samplingStats
+	void gatherSampling (void);
+
+
     /// PerfMonitorクラス用エラーメッセージ出力
     ///
     ///   @param[in] func  関数名
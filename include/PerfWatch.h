@@ -35,8 +35,10 @@
 #endif
 
 #include "pmlib_papi.h"
+#include "pmlib_hwpc.h"
 #include "pmlib_power.h"
 #include "pmlib_otf.h"
+#include "pmlib_trace.h"
 
 #ifndef _WIN32
 #include <sys/time.h>
@@ -52,6 +54,12 @@ namespace pm_lib {
 //	Do not exit when an error occurs.
 //	((void)printf("exit at %s:%u\n", __FILE__, __LINE__), exit((x)))
 
+  /// 入れ子の並列領域を通して一意なOpenMPスレッド番号. OpenMPを使わない場合は0
+  ///
+  ///   @note 入れ子でなければ omp_get_thread_num() と同じ
+  ///
+  int flat_thread_num(void);
+
 
 
   /**
@@ -86,6 +94,21 @@ namespace pm_lib {
     double m_flop_sd;    ///< 浮動小数点演算量or通信量の標準偏差
     double m_time_comm;  ///< 通信部分の最大値
 
+    // スレッド間の負荷バランス統計量(並列領域内の測定区間のみ)
+    double m_thread_tmin;  ///< スレッド時間の最小値(全プロセス中)
+    double m_thread_tav;   ///< スレッド時間の平均値(全プロセスの平均値)
+    double m_thread_tmax;  ///< スレッド時間の最大値(全プロセス中)
+    int m_thread_slowest;  ///< 最も遅いスレッドの番号(全プロセス中)
+    int m_rank_slowest;    ///< 最も遅いスレッドを含むプロセスのランク番号
+
+    // スレッドCPU時間の統計量(全スレッド・全プロセスの合計値)
+    int level_CPU;         ///< CPU時間の測定間隔 0(no), N(各区間のN回のstart/stop毎に測定)
+    double m_cpu_stats[Max_cpu_stats]; ///< CPU時間, 測定した呼び出しの経過時間, 自発的・非自発的コンテキストスイッチ
+    double m_cpu_time_all; ///< 全ての呼び出しの経過時間の合計(コンテキストスイッチ数の外挿用)
+
+    // ルーフライン用のユーザ申告値(全プロセスの平均値)
+    double m_roof[Max_roof_stats]; ///< 演算量(計算区間のみ), メモリ転送量(バイト)
+
     int level_POWER;	///< 電力情報レベル 0(no), 1(NODE), 2(NUMA), 3(PARTS)
     double m_power_av;    ///< average value of power consumption meter reading
     int level_OTF;	     ///< OTF tracing 出力レベル 0(no), 1(yes), 2(full)
@@ -94,6 +117,7 @@ namespace pm_lib {
                         //	definition	: otf_filename + .mdID + .def
                         //	event		: otf_filename + .mdID + .events
                         //	marker		: otf_filename + .mdID + .marker
+    int m_trace_id;      ///< 組み込みtrace出力での区間番号 (-1: 未登録, -2: filterで除外)
 
 	struct pmlib_papi_chooser my_papi;
 
@@ -103,10 +127,23 @@ namespace pm_lib {
     /// OpenMP並列時のスレッド数と自スレッド番号
     int num_threads;
     int my_thread;
+    int m_team_size;     ///< 測定区間を実際に実行したスレッドチームの大きさ(最大値)
+                         //	nested parallel regionでは全レベルのチームの積となる
+    double m_th_time[3];  ///< プロセス内のスレッド時間の最小値・平均値・最大値
+    int m_th_slowest;     ///< プロセス内で最も遅いスレッドの番号
 
     // 測定時の補助変数
     double m_startTime;  ///< 測定区間の測定開始時刻
     double m_stopTime;   ///< 測定区間の測定終了時刻
+    double m_cpuStart[Max_cpu_stats];  ///< 測定開始時のCPU時間とコンテキストスイッチ数
+    bool m_cpu_sampled;  ///< 今回のstart/stopでCPU時間を測定しているか
+    int m_placeStart[2]; ///< 測定開始時のCPU番号とNUMAノード番号
+    long long m_traceStart[Max_chooser_events]; ///< trace出力時の測定開始時のHWPC積算値
+    double m_groupStart[Max_hwpc_output_group]; ///< 測定開始時の各グループの計測時間の時計
+    double m_groupTime[Max_hwpc_output_group];  ///< m_time のうち各グループが計測されていた時間
+    std::vector<int> m_traceMetrics;  ///< trace出力する値 (-1: rate, -2: ユーザ申告の計算量, 0以上: HWPCのsorted番号)
+    bool m_traceMetricsSet;  ///< m_traceMetrics を PMLIB_TRACE_METRICS から選択済みか
+    int m_traceGroup;        ///< m_traceMetrics のHWPC値を含むグループ (-1: 複数のグループ)
 
     // 測定値集計時の補助変数
     double* m_timeArray;         ///< 「時間」集計用配列
@@ -126,10 +163,17 @@ namespace pm_lib {
 
   public:
     /// コンストラクタ.
-    PerfWatch() : m_time(0.0), m_flop(0.0), m_count(0), m_started(false),
-      my_rank(-1), m_timeArray(0), m_flopArray(0), m_countArray(0),
-      m_sortedArrayHWPC(0), m_is_set(false), m_is_healthy(true),
-      m_in_parallel(false) {
+    PerfWatch() : m_in_parallel(false), my_rank(-1), m_count(0), m_time(0.0), m_flop(0.0),
+      m_thread_tmin(0.0), m_thread_tav(0.0), m_thread_tmax(0.0),
+      m_thread_slowest(0), m_rank_slowest(0),
+      level_CPU(0), m_cpu_time_all(0.0), m_trace_id(-1),
+      m_team_size(0), m_th_slowest(0), m_cpu_sampled(false), m_traceMetricsSet(false), m_traceGroup(-1),
+      m_timeArray(0), m_flopArray(0), m_countArray(0), m_sortedArrayHWPC(0),
+      m_is_set(false), m_is_healthy(true), m_started(false) {
+      m_th_time[0] = m_th_time[1] = m_th_time[2] = 0.0;
+      for (int i=0; i<Max_cpu_stats; i++) { m_cpu_stats[i] = m_cpuStart[i] = 0.0; }
+      for (int i=0; i<Max_roof_stats; i++) { m_roof[i] = 0.0; }
+      for (int i=0; i<Max_hwpc_output_group; i++) { m_groupStart[i] = m_groupTime[i] = 0.0; }
 	#ifdef DEBUG_PRINT_WATCH
 		int i_thread_constractor;
 		#ifdef _OPENMP
@@ -160,6 +204,37 @@ namespace pm_lib {
     /// 測定モードを返す
     int get_typeCalc(void) { return m_typeCalc; }
 
+    /// ルーフラインレポートの演算量とメモリ転送量(全プロセスの平均値)を返す
+    ///
+    ///   @param[out] d_flop  浮動小数点演算量
+    ///   @param[out] d_byte  メモリ転送量(バイト)
+    ///   @param[out] c_flop  演算量の出典 'F':HWPC, 'f':ユーザ申告, '-':なし
+    ///   @param[out] c_byte  転送量の出典 'B':HWPC, 'b':ユーザ申告, '-':なし
+    ///
+    void getRooflineValues(double& d_flop, double& d_byte, char& c_flop, char& c_byte);
+
+    /// 測定区間を実際に実行したスレッド数を返す
+    ///
+    /// @note omp_set_num_threads() やnested parallel regionにより
+    ///       initialize()時のスレッド数と異なる場合がある。
+    ///       スレッド別配列の大きさ Max_nthreads を超えることはない。
+    ///
+    int get_team_size(void) {
+      int n = (m_team_size > 0) ? m_team_size : num_threads;
+      return (n < Max_nthreads) ? n : Max_nthreads;
+    }
+
+    /// 他のスレッドが測定区間を実行したチームの大きさを反映する
+    ///
+    ///   @param[in] n_team  チームの大きさ
+    ///
+    /// @note マスタースレッドが実行しなかった区間や、initialize()の後に
+    ///       大きくなったチームの区間をmergeThreads()で集約するために用いる
+    ///
+    void extend_team_size(int n_team) {
+      if (n_team > m_team_size) m_team_size = n_team;
+    }
+
     /// 測定区間にプロパティを設定.
     ///
     ///   @param[in] label     ラベル
@@ -179,6 +254,12 @@ namespace pm_lib {
     ///
     void cleanupHWPC(void);
 
+    /// HWPC_CHOOSERで多重化したグループのうち計測するグループを切り替える
+    ///
+    ///   @param[in] s_name グループ名、または'+'で連結したグループ名. "ALL"は全グループ
+    ///
+    void switchCounterGroup(const std::string& s_name);
+
     /// set the Power API reporting level for the Root section
     ///
     void setRootPowerLevel(int num, int level);
@@ -188,6 +269,10 @@ namespace pm_lib {
     ///
     void initializeOTF(void);
 
+    /// 組み込みtrace出力(Chrome Trace Event形式)の初期化
+    ///
+    void initializeTrace(void);
+
     /// 測定スタート.
     ///
     void start();
@@ -196,14 +281,17 @@ namespace pm_lib {
     ///
     ///   @param[in] flopPerTask     測定区間の計算量(演算量Flopまたは通信量Byte)
     ///   @param[in] iterationCount  計算量の乗数（反復回数）
+    ///   @param[in] bytePerTask  メモリ転送量(バイト) :省略値0
     ///
     ///   @note  引数はユーザ申告モードの場合にのみ利用され、計算量を
     ///          １区間１回あたりでflopPerTask*iterationCount として算出する。\n
     ///          HWPCによる自動算出モードでは引数は無視され、
     ///          内部で自動計測するHWPC統計情報から計算量を決定決定する。\n
     ///          レポート出力する情報の選択方法はPerfMonitor::stop()の規則による。\n
+    ///   @note  ルーフラインレポート(PMLIB_ROOFLINE)用に、計算区間のflopPerTask*iterationCount
+    ///          とbytePerTask*iterationCountはモードによらず別途積算される。\n
     ///
-    void stop(double flopPerTask, unsigned iterationCount);
+    void stop(double flopPerTask, unsigned iterationCount, double bytePerTask=0.0);
 
     /// 測定のリセット
     ///
@@ -290,6 +378,14 @@ namespace pm_lib {
     ///
     void finalizeOTF(void);
 
+    /// 組み込みtrace出力のファイルを書き出して終了する
+    ///
+    void finalizeTrace(void);
+
+    /// flight recorder の直近の記録を自プロセスのファイルに書き出す
+    ///
+    void dumpTrace(void);
+
     /// MPIランク別測定結果を出力. 非排他測定区間も出力
     ///
     ///   @param[in] fp 出力ファイルポインタ
@@ -379,6 +475,31 @@ namespace pm_lib {
     ///
     void read_cpu_clock_freq();
 
+    ///   ピーク演算性能とメモリバンド幅を実測、または較正ファイルから読み込む。
+    ///
+    void calibratePeak();
+
+    /// 呼び出したスレッド、またはプロセスの全スレッドのCPU時間とコンテキストスイッチ数を取得
+    ///
+    ///   @param[out] v  CPU時間[秒], 未使用, 自発的・非自発的コンテキストスイッチ数
+    ///   @param[in] all_threads  プロセスの全スレッドの合計値を得るか
+    ///
+    void readThreadCPU(double v[], bool all_threads);
+
+    /// 呼び出したスレッドが実行中のCPU番号とNUMAノード番号を取得
+    ///
+    ///   @param[out] cpu   CPU番号. 取得できない場合は-1
+    ///   @param[out] node  NUMAノード番号. 取得できない場合は-1
+    ///
+    void readThreadPlace(int& cpu, int& node);
+
+    /// ノードおよびソケットを共有するプロセス数を検出してhwpc_groupに保存する
+    ///
+    ///   @note  MPI_Comm_split_type(MPI_COMM_TYPE_SHARED)による。全プロセスで呼び出す集団操作.
+    ///          PerfMonitor::initialize() のマスタースレッドが1回だけ呼び出す
+    ///
+    void detectNodeLayout();
+
     ///	copy in HWPC values from master thread to shared "papi" struct
     ///
     void mergeMasterThread(void);
@@ -408,11 +529,29 @@ namespace pm_lib {
     ///	stop() calls following internal functions
     void stopSectionSerial(double flopPerTask, unsigned iterationCount);
     void stopSectionParallel(double flopPerTask, unsigned iterationCount);
+    ///	the rate of the section written to the traces
+    double traceRate(double flopPerTask, unsigned iterationCount, double* v_sorted = NULL);
+    ///	the values of the section written to the built-in trace
+    int traceValues(double flopPerTask, unsigned iterationCount, double* v);
+    void selectTraceMetrics(void);
+    ///	the name of the counter track of the traces
+    std::string traceCounterName(void);
+    ///	the clock offset to rank 0 for the traces
+    void syncTraceClock(double& t_local, double& offset, double& error);
+    void sumThreadAccumu(long long* v);
+    void readMuxCoverage(int i_thread, bool is_stop);
+    void readGroupClock(double t, double* clock);
+    double groupTime(int i_group);
 
 	/// HWPC related internal functions
+	void bindHWPCthread (void);
+	void reprogramHWPCthread (void);
 	void identifyARMplatform (void);
+	void readCpuModel (std::string& s_model, std::string& s_vendor);
 	void createPapiCounterList (void);
-	void sortPapiCounterList (void);
+	void sortPapiCounterList (int i_group = -1);
+	int  appendMuxScaled (int i_group, int js, int jp);
+	int  sortTableCounters (int i_group, int jp);
 	void outputPapiCounterHeader (FILE* fp, std::string s_label);
 	void outputPapiCounterList (FILE* fp);
 	void outputPapiCounterLegend (FILE* fp);
@@ -43,6 +43,8 @@ namespace pm_lib {
 
 #define MPI_SUCCESS true
 #define MPI_SUM (MPI_Op)(0x58000003)
+#define MPI_MAX (MPI_Op)(0x58000001)
+#define MPI_MIN (MPI_Op)(0x58000002)
 
 
   inline bool MPI_Init(int* argc, char*** argv) { return true; }
@@ -92,6 +94,13 @@ namespace pm_lib {
   }
 
 
+  inline int MPI_Bcast(void *buffer, int count, MPI_Datatype datatype,
+                  int root, MPI_Comm comm)
+  {
+    return 0;
+  }
+
+
   inline int MPI_Barrier(MPI_Comm comm)
   {
     return 0;
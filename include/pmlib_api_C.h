@@ -5,6 +5,7 @@ extern void C_pm_initialize (int init_nWatch);
 extern void C_pm_start (char* fc);
 extern void C_pm_stop (char* fc);
 extern void C_pm_stop_usermode (char* fc, double fpt, unsigned tic);
+extern void C_pm_stop_roofline (char* fc, double fpt, unsigned tic, double bpt);
 extern void C_pm_report (char* fc);
 extern void C_pm_select_report (char* fc);
 extern void C_pm_print (char* fc, char* fh, char* fcmt, int fp_sort);
@@ -13,6 +14,9 @@ extern void C_pm_printthreads (char* fc, int rank_ID, int fp_sort);
 extern void C_pm_printlegend (char* fc);
 extern void C_pm_printprogress (char* fc, char* comments, int fp_sort);
 extern void C_pm_posttrace (void);
+extern void C_pm_dumptrace (void);
+extern void C_pm_mark (char* fc);
+extern void C_pm_counter (char* fc, double value);
 extern void C_pm_reset (char* fc);
 extern void C_pm_resetall (void);
 extern void C_pm_setproperties (char* fc, int f_type, int f_exclusive);
@@ -23,6 +27,7 @@ extern void C_pm_stop_Root (void);
 extern void C_pm_mergethreads (int id);
 extern void C_pm_getpowerknob (int knob, int* value);
 extern void C_pm_setpowerknob (int knob, int value);
+extern void C_pm_setcountergroup (char* fc);
 #if defined  (MORE_MPI_MEMBERS)
 extern void C_pm_printgroup (char* fc, MPI_Group p_group, MPI_Comm p_comm, int* pp_ranks, int group, int legend, int fp_sort);
 extern void C_pm_printcomm (char* fc, MPI_Comm new_comm, int icolor, int key, int legend, int fp_sort);
@@ -0,0 +1,156 @@
+#ifndef _PM_HWPC_H_
+#define _PM_HWPC_H_
+
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 RIKEN Center for Computational Science(R-CCS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+/// PMlib HWPC counter backend interface
+///
+/// PerfWatch accesses the hardware performance counters only through
+/// the function table below. The following backends are provided.
+///	papi   : PAPI library via the my_papi_* C functions (USE_PAPI)
+///	perf   : Linux perf_event_open(2) system call (USE_PERF_EVENT)
+///	replay : deterministic counter values for testing
+/// The backend is chosen by the environment variable PMLIB_HWPC_BACKEND.
+///
+/// @file pmlib_hwpc.h
+/// @brief Header block for PMlib - HWPC backend interface
+///
+
+#if defined(USE_PAPI) || defined(USE_PERF_EVENT)
+
+namespace pm_lib {
+
+/// return code of the backend functions. Same value as PAPI_OK
+const int PM_HWPC_OK = 0;
+
+/// event code which is not counted. Same value as PAPI_NULL
+const int PM_HWPC_NO_EVENT = -1;
+
+/// HWPC counter backend function table
+///
+/// @note	add_events, start, read, stop and thread_free act on the
+///	event set of the calling thread. The values are cumulative counts
+///	since the last start() or stop().
+///	set_multiplex is called before add_events when HWPC_CHOOSER lists
+///	several groups. The multiplexed counts are scaled to the enabled time.
+///	coverage gives the enabled time and the running time, i.e. the time
+///	actually counted, of each event of the calling thread as of the last
+///	read(). They are cumulative like the counts, so that the sections take
+///	their differences between start and stop.
+///	The events given as PM_HWPC_NO_EVENT are not counted and read as 0.
+///
+struct pmlib_hwpc_backend {
+	const char* name;		///< backend name shown in the report
+	int  (*library_init)(void);	///< process wide initialization, called once by the master thread
+	int  (*name_to_code)(const char* c_event, int* i_event);	///< event name to backend event code
+	int  (*add_events)(int* events, int num_events);	///< create the event set of the calling thread
+	int  (*start)(long long* values, int num_events);	///< reset and start counting
+	int  (*read)(long long* values, int num_events);	///< read the counts without stopping
+	int  (*stop)(long long* values, int num_events);	///< read the counts, then reset and restart
+	void (*thread_free)(void);	///< release the event set of the calling thread
+	const char* (*read_path)(void);	///< how the counters have been read, shown in the report
+	int  (*set_multiplex)(void);	///< allow more events than counters. NULL if not needed
+	int  (*coverage)(double* enabled, double* running, int num_events);	///< enabled and running time of each event. NULL if unknown
+};
+
+/// Choose the backend according to PMLIB_HWPC_BACKEND = papi | perf | replay
+///
+///   @return  backend function table. papi is the default if available, otherwise perf.
+///
+const pmlib_hwpc_backend* hwpc_select_backend (void);
+
+/// The backend selected by hwpc_select_backend()
+extern const pmlib_hwpc_backend* hwpc_backend;
+
+/// Counts of the calling thread taken over from the event sets before
+/// hwpc_reprogram(). NULL until the thread is reprogrammed.
+extern long long* hwpc_read_offset;
+#ifdef _OPENMP
+#pragma omp threadprivate(hwpc_read_offset)
+#endif
+
+/// Enabled and running time of the calling thread taken over from the event
+/// sets before hwpc_reprogram(), [2*i] enabled and [2*i+1] running.
+/// NULL until the thread is reprogrammed.
+extern double* hwpc_coverage_offset;
+#ifdef _OPENMP
+#pragma omp threadprivate(hwpc_coverage_offset)
+#endif
+
+/// Read the counts of the calling thread, continuous across hwpc_reprogram()
+///
+///   @param[out] values  counts since the event set was bound to the thread
+///   @param[in]  num_events  number of events
+///
+inline int hwpc_read (long long* values, int num_events)
+{
+	int i_ret = hwpc_backend->read (values, num_events);
+	if (hwpc_read_offset != NULL) {
+		for (int i=0; i<num_events; i++) values[i] += hwpc_read_offset[i];
+	}
+	return i_ret;
+}
+
+/// Enabled and running time of the calling thread as of the last hwpc_read(),
+/// continuous across hwpc_reprogram()
+///
+///   @param[out] enabled  enabled time of each event
+///   @param[out] running  time each event has been actually counted
+///   @param[in]  num_events  number of events
+///   @return  PM_HWPC_OK, or -1 if the backend does not know the times
+///
+inline int hwpc_coverage (double* enabled, double* running, int num_events)
+{
+	if (hwpc_backend->coverage == NULL) return -1;
+	int i_ret = hwpc_backend->coverage (enabled, running, num_events);
+	if (hwpc_coverage_offset != NULL) {
+		for (int i=0; i<num_events; i++) {
+			enabled[i] += hwpc_coverage_offset[2*i];
+			running[i] += hwpc_coverage_offset[2*i+1];
+		}
+	}
+	return i_ret;
+}
+
+/// Replace the event set of the calling thread.
+/// The counts read so far are kept in hwpc_read_offset, so the running
+/// sections see the counts of the old events frozen and those of the new
+/// events continue.
+///
+///   @param[in]  events  event codes. PM_HWPC_NO_EVENT is not counted
+///   @param[in]  num_events  number of events. Same as the current event set
+///
+int hwpc_reprogram (int* events, int num_events);
+
+/// Release the event set and the offsets of the calling thread
+void hwpc_thread_free (void);
+
+/// Convert the event name to the event code of the selected backend
+///
+///   @param[in]  c_event  event name, PAPI preset name, or native event name
+///   @param[out] i_event  event code. PM_HWPC_NO_EVENT if the backend does not know the name
+///
+/// @note  The first unknown name is warned. The event is not counted.
+///
+void hwpc_name_to_code (const char* c_event, int* i_event);
+
+} /* namespace pm_lib */
+
+#endif // USE_PAPI || USE_PERF_EVENT
+
+#endif // _PM_HWPC_H_
@@ -0,0 +1,125 @@
+#ifndef _PM_HWPC_TABLE_H_
+#define _PM_HWPC_TABLE_H_
+
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 RIKEN Center for Computational Science(R-CCS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+/// PMlib HWPC event table
+///
+/// The HWPC_CHOOSER groups of a platform can be given as a text table
+/// instead of the built-in code in createPapiCounterList() and
+/// sortPapiCounterList(). Each group lists its events and the derived
+/// metrics computed from the accumulated counts at report time.
+///	@verbatim
+///	# comment
+///	platform <name> <model substring> [| <model substring> ...]
+///	peak <floating point operations per cycle per core>
+///	group <FLOPS|BANDWIDTH|VECTOR|CACHE|CYCLE|LOADSTORE|TOPDOWN|TLB>
+///	event <label> <event name> [<backend>=<event name> ...] [scope=core|socket|node]
+///	metric <label> = <expression>
+///	@endverbatim
+/// The expression consists of numbers, + - * / ( ), the event labels,
+/// the labels of the preceding metrics of the group, and the variables
+/// time (section time [sec]), peak (peak flops per core) and ghz.
+/// Division by zero gives 0.
+/// The events with scope=socket or scope=node, e.g. uncore and memory
+/// controller events, count the whole socket or node. Each process takes
+/// the count once and its share among the processes on the socket or node.
+///
+/// The table given by PMLIB_HWPC_TABLE=<file> is searched first, and
+/// overrides the built-in code of the groups it defines. The shipped table
+/// is used for the processors which the built-in code does not support.
+///
+/// @file pmlib_hwpc_table.h
+/// @brief Header block for PMlib - HWPC event table
+///
+
+#if defined(USE_PAPI) || defined(USE_PERF_EVENT)
+
+#include <string>
+#include <vector>
+
+namespace pm_lib {
+
+const int Max_table_events = 16;	///< events per group
+const int Max_table_metrics = 4;	///< derived metrics per group
+
+/// an operation of the compiled expression in reverse polish order
+struct hwpc_expr_op {
+	char op;		///< 'n' number, 'v' operand value, '~' negation, or one of + - * /
+	double value;	///< the number if op=='n'
+	int ref;		///< the operand index if op=='v'
+};
+
+/// events and derived metrics of a HWPC_CHOOSER group
+struct hwpc_table_group {
+	int n_events;
+	std::string label[Max_table_events];	///< reported symbol, also used in the expressions
+	std::string name[Max_table_events];		///< event name for any backend
+	std::string backend_name[Max_table_events];	///< "backend=name ..." for specific backends
+	int scope[Max_table_events];	///< hwpc_event_scope
+	int n_metrics;
+	std::string m_label[Max_table_metrics];
+	std::string m_text[Max_table_metrics];	///< expression as written, shown in the legend
+	std::vector<hwpc_expr_op> m_expr[Max_table_metrics];
+};
+
+/// Select the table platform for the processor
+///
+///   @param[in] s_model  CPU model name
+///   @param[in] s_vendor CPU vendor name
+///   @param[in] builtin  true if the built-in code supports the processor
+///   @param[in] verbose  print the table errors
+///   @return  platform name, or empty if no table platform matches
+///
+/// @note  the ARM processors are also matched by "ARM <implementer>:<part>",
+///	e.g. "ARM 0x41:0xd0c" for Neoverse N1, since they have no model name.
+///
+std::string hwpc_table_select (const std::string& s_model, const std::string& s_vendor, bool builtin, bool verbose);
+
+/// peak floating point operations per cycle of the selected platform. 0 if not given
+double hwpc_table_peak (void);
+
+/// where the selected platform has been read from, i.e. PMLIB_HWPC_TABLE or "shipped"
+std::string hwpc_table_source (void);
+
+/// The group of the selected platform, or NULL if the group is not in the table
+///
+///   @param[in] i_group  hwpc_output_group
+///
+const hwpc_table_group* hwpc_table_group_of (int i_group);
+
+/// Event name of the i-th event of the group for the backend. Empty if not available
+std::string hwpc_table_event_name (const hwpc_table_group* g, int i, const char* c_backend);
+
+/// Evaluate the metrics of the group
+///
+///   @param[in]  g       table group
+///   @param[in]  counts  accumulated counts of the events
+///   @param[in]  time    section time [sec]
+///   @param[in]  peak    peak floating point operations per second
+///   @param[in]  ghz     core clock frequency
+///   @param[out] metrics values of the metrics
+///
+void hwpc_table_eval (const hwpc_table_group* g, const double* counts,
+		double time, double peak, double ghz, double* metrics);
+
+} /* namespace pm_lib */
+
+#endif // USE_PAPI || USE_PERF_EVENT
+
+#endif // _PM_HWPC_TABLE_H_
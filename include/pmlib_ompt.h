@@ -0,0 +1,52 @@
+#ifndef _PM_OMPT_H_
+#define _PM_OMPT_H_
+
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+/// PMlib PerfMonitor クラスから OMPT ツールへのインタフェイス関数
+/// included in PerfMonitor.cpp
+///
+/// OMPT ツールは環境変数 PMLIB_OMPT が指定された時だけOpenMPランタイムに登録され、
+/// 並列領域、ワークシェアリング構文、同期待ちの測定区間を自動生成する。
+///
+/// @file pmlib_ompt.h
+/// @brief Header block for PMlib - OMPT tool interface
+///
+
+namespace pm_lib {
+
+  class PerfMonitor;
+
+#if defined(USE_OMPT) && defined(_OPENMP)
+  /// 呼び出したスレッドのPerfMonitorインスタンスをOMPTツールに登録し、自動計測を開始する
+  void pm_ompt_attach (PerfMonitor* pm);
+
+  /// 全スレッドの自動計測を終了する。レポート処理中の並列構文は計測しない
+  void pm_ompt_detach (void);
+
+  /// OMPTツールがOpenMPランタイムに登録されているか
+  bool pm_ompt_is_active (void);
+
+  /// PMlib内部の並列構文の開始と終了. この間に開始した並列領域は計測しない
+  void pm_ompt_enter_internal (void);
+  void pm_ompt_leave_internal (void);
+#endif
+
+} // end of namespace
+
+#endif // _PM_OMPT_H_
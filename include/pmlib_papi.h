@@ -23,12 +23,20 @@
 /// extern "C" int my_papi_bind_stop  ( long long *, int );
 /// extern "C" int my_papi_add_events ( int *, int);
 /// extern "C" void my_papi_name_to_code ( const char *, int *);
+/// extern "C" int my_papi_set_multiplex ( void );
 ///
 /// @file pmlib_papi.h
 /// @brief Header block for PMlib - PAPI interface class
 ///
 /// PMlib supports PAPI 5.3 and upper
 
+/// HWPC計測機能はPAPIまたはLinux perf_eventのいずれかで有効になる
+#if defined(USE_PAPI) || defined(USE_PERF_EVENT)
+#define USE_HWPC
+#endif
+
+#include <string>
+
 #ifdef USE_PAPI
 #include "papi.h"
 extern "C" int my_papi_bind_start ( long long *, int );
@@ -38,8 +46,42 @@ extern "C" int my_papi_add_events ( int *, int);
 
 extern "C" void my_papi_name_to_code ( const char *, int *);
 extern "C" void my_papi_internal_free ( void );
+extern "C" int my_papi_set_multiplex ( void );
 #endif
 
+/// HWPC_CHOOSER=G1+G2+... の多重化指定を検査する
+///
+///   @param[in]  s_chooser  HWPC_CHOOSER の値
+///   @param[out] s_groups   重複を除いて連結したグループ名 "G1+G2+..."
+///   @return  グループ数. 多重化できないグループ名を含む場合は0
+///
+/// @note 多重化できるのは FLOPS, BANDWIDTH, VECTOR, CACHE, CYCLE, LOADSTORE, TOPDOWN, TLB
+///
+inline int hwpc_parse_multiplex (const std::string& s_chooser, std::string& s_groups)
+{
+	const char* c_names[] = { "FLOPS", "BANDWIDTH", "VECTOR", "CACHE", "CYCLE", "LOADSTORE", "TOPDOWN", "TLB" };
+	int n_groups = 0;
+	s_groups.clear();
+	size_t i_begin = 0;
+	while (i_begin <= s_chooser.size()) {
+		size_t i_end = s_chooser.find('+', i_begin);
+		if (i_end == std::string::npos) i_end = s_chooser.size();
+		std::string s_name = s_chooser.substr(i_begin, i_end-i_begin);
+		i_begin = i_end + 1;
+
+		bool known = false;
+		for (int i=0; i<8; i++) {
+			if (s_name == c_names[i]) known = true;
+		}
+		if (!known) return 0;
+		if (("+" + s_groups + "+").find("+" + s_name + "+") != std::string::npos) continue;
+		if (n_groups > 0) s_groups += "+";
+		s_groups += s_name;
+		n_groups++;
+	}
+	return n_groups;
+}
+
 /// HWPC counter情報の記憶配列
 /// struct hwpc_group_chooser{}
 /// struct pmlib_papi_chooser{}
@@ -52,9 +94,28 @@ enum hwpc_output_group {
 	I_cache,
 	I_cycle,
 	I_loadstore,
+	I_custom,
+	I_topdown,
+	I_tlb,
 	Max_hwpc_output_group,
 };
 
+/// the hardware shared by the event counts. The events outside the core,
+/// e.g. uncore and memory controller, count the same value on all the
+/// threads and processes sharing the socket or the node.
+enum hwpc_event_scope {
+	I_scope_core= 0,
+	I_scope_socket,
+	I_scope_node,
+};
+
+const int Max_chooser_events=32;	// enough for the events and the derived values of multiplexed groups
+const int Max_custom_events=8;		// CUSTOM reports the counts and their rates
+const int Max_nthreads=48;
+const int Max_cpu_stats=4;
+const int Max_place_stats=7;
+const int Max_roof_stats=2;
+
 struct hwpc_group_chooser {
 	int number[Max_hwpc_output_group];
 	int index[Max_hwpc_output_group];
@@ -70,24 +131,38 @@ struct hwpc_group_chooser {
 		// 99:processor is not supported
 	std::string platform;	// "Xeon", "SPARC64", "ARM", "unsupported_hardware"
 	std::string env_str_hwpc;
-		// USER or one of FLOPS, BANDWIDTH, VECTOR, CACHE, CYCLE, LOADSTORE
+		// USER or one of FLOPS, BANDWIDTH, VECTOR, CACHE, CYCLE, LOADSTORE, TOPDOWN, TLB, CUSTOM
+		// or the multiplexed groups joined by '+', e.g. FLOPS+BANDWIDTH+CACHE
+	int n_multiplex;	// number of the multiplexed groups. 1 if not multiplexed
+	bool active[Max_hwpc_output_group];	// the group is being counted. changed by PerfMonitor::setCounterGroup()
+	double active_time[Max_hwpc_output_group];	// time the group had been counted until it was deactivated last [sec]
+	double active_since[Max_hwpc_output_group];	// the time the group was activated last
+	std::string custom_events;	// comma separated event list of HWPC_CHOOSER=CUSTOM:EV1,EV2,...
 	double coreGHz;
-	double corePERF;
+	double corePERF;	// peak floating point performance per core [Flop/s]
+	double measuredPERF;	// measured peak performance per core by PMLIB_CALIBRATE. 0 if not measured
+	double measuredBW;	// measured memory bandwidth per process [Byte/s]. 0 if not measured
+	std::string calibration;	// "measured" or the calibration file name. empty if not calibrated
+	std::string model_string;	// detected CPU model name. empty if HWPC is not initialized
+	int n_nodes;		// number of the nodes of the job, detected by PerfWatch::detectNodeLayout()
+	int np_node;		// number of the processes sharing the node of this process
+	int rank_on_node;	// local rank number of this process on the node
+	int np_socket;		// number of the processes sharing the socket of this process
 };
 
-const int Max_chooser_events=12;
-const int Max_nthreads=48;
-
 struct pmlib_papi_chooser {
 	int num_events;				// number of PAPI events
 	int events[Max_chooser_events];		// PAPI events array
 	long long values[Max_chooser_events];	// incremental HW counter values
 	long long accumu[Max_chooser_events];	// accumulated HW counter values
 	std::string s_name[Max_chooser_events];	// event symbol name
+	int scope[Max_chooser_events];		// hwpc_event_scope of the event
 
 	int num_sorted;			// number of sorted events to report
 	double v_sorted[Max_chooser_events];		// sorted event values
 	std::string s_sorted[Max_chooser_events];	// sorted event symbols
+	int sorted_index[Max_hwpc_output_group];	// the first sorted value of each group
+	int sorted_number[Max_hwpc_output_group];	// number of sorted values of each group
 
 	// Arrays for exchanging thread private values across threads
 	// These keep  m_count, m_time, m_flop until sortPapiCounterList() is called.
@@ -101,6 +176,39 @@ struct pmlib_papi_chooser {
 	double th_v_sorted[Max_nthreads][Max_chooser_events];	// sorted values per thread
 	// Note 1. Exchanged dimension [Max_chooser_events] <-> [Max_nthreads]
 	// Note 2. Shall we change the name from th_v_sorted[][] to th_user[][] ? To be checked.
+
+	// Thread CPU time statistics of the sampled calls, accumulated per thread
+	//	th_cpu[my_thread][0] = CPU time (user+system) [sec]
+	//	th_cpu[my_thread][1] = elapsed time of the sampled calls [sec]
+	//	th_cpu[my_thread][2] = voluntary context switches
+	//	th_cpu[my_thread][3] = involuntary context switches
+	double th_cpu[Max_nthreads][Max_cpu_stats];
+
+	// Multiplexing coverage of the section, accumulated per thread when the groups are multiplexed
+	//	th_mux[my_thread][2*i]   = enabled time of the i-th event
+	//	th_mux[my_thread][2*i+1] = running time of the i-th event, i.e. the time actually counted
+	// th_mux_start[][] keeps the values read at start
+	double th_mux[Max_nthreads][2*Max_chooser_events];
+	double th_mux_start[Max_nthreads][2*Max_chooser_events];
+
+	// Time the section ran while each group was counted, accumulated per thread when the groups are multiplexed
+	//	th_group_time[my_thread][i_group] = the part of m_time of the thread [sec]
+	double th_group_time[Max_nthreads][Max_hwpc_output_group];
+
+	// Thread placement observed at the sampled start/stop, recorded per thread
+	//	th_place[my_thread][0] = number of samples
+	//	th_place[my_thread][1] = CPU at the last stop
+	//	th_place[my_thread][2] = smallest CPU number seen
+	//	th_place[my_thread][3] = largest CPU number seen
+	//	th_place[my_thread][4] = migrations across CPUs between start and stop
+	//	th_place[my_thread][5] = NUMA node at the last stop
+	//	th_place[my_thread][6] = migrations across NUMA nodes between start and stop
+	int th_place[Max_nthreads][Max_place_stats];
+
+	// User provided operations for the roofline report, accumulated per thread in any mode
+	//	th_roof[my_thread][0] = floating point operations of the calculation sections
+	//	th_roof[my_thread][1] = memory traffic [Bytes] given by the bytePerTask argument
+	double th_roof[Max_nthreads][Max_roof_stats];
 };
 
 #endif // _PM_PAPI_H_
@@ -0,0 +1,81 @@
+#ifndef _PM_SAMPLING_H_
+#define _PM_SAMPLING_H_
+
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+/// PMlib PerfMonitor クラスから sampling profiler へのインタフェイス関数
+///
+/// 環境変数 PMLIB_SAMPLING が指定された時、測定区間のstart/stopは時間を測らずに
+/// スレッドごとの区間スタックへの区間番号のpush/popだけを行う。
+/// 各スレッドの timer (timer_create, SIGEV_THREAD_ID) が一定周期でsignalを送り、
+/// signal handler がそのスレッドで実行中の最も内側の区間の標本数を数える。
+/// 区間の時間は標本数と周期から推定される。
+///
+/// @file pmlib_sampling.h
+/// @brief Header block for PMlib - sampling profiler
+///
+
+#include <vector>
+
+namespace pm_lib {
+
+  /// 標本を区間ごとに数える区間数の上限
+  static const int Max_sampled_sections = 1024;
+
+  /// sampling の周期 [sec]. 0 の時は sampling しない
+  extern double pm_sampling_period;
+
+  /// PMLIB_SAMPLING=(off|on|<Hz>) を読み、呼び出したスレッドの sampling を開始する.
+  /// PMLIB_SAMPLING の解釈はプロセス内で最初の呼び出しだけが行う
+  ///
+  ///   @param[in] my_rank  自ランク番号 (警告の出力用)
+  ///
+  void pm_sampling_initialize (int my_rank);
+
+  /// 区間スタックへのpush. スレッドの最初の呼び出しでそのスレッドの sampling を開始する
+  ///
+  ///   @param[in] id  プロセス内で共通の区間番号 (0 はRoot区間)
+  ///
+  void pm_sampling_push (int id);
+
+  /// 区間スタックからのpop. 区間が入れ子になっていなくても該当する区間を取り除く
+  ///
+  ///   @param[in] id  プロセス内で共通の区間番号
+  ///
+  void pm_sampling_pop (int id);
+
+  /// 全スレッドの sampling を終了する. 2回目以降の呼び出しは何もしない
+  void pm_sampling_stop (void);
+
+  /// 全スレッドの標本数の合計
+  ///
+  ///   @param[out] exclusive  区間番号ごとの、最も内側の区間だった標本数
+  ///   @param[out] inclusive  区間番号ごとの、区間が実行中だった標本数
+  ///   @param[out] calls      区間番号ごとの push の回数
+  ///   @param[out] n_threads  sampling したスレッド数
+  ///   @return 全標本数
+  ///
+  ///   @note 区間番号が Max_sampled_sections 以上の区間は数えられず、
+  ///         その標本はどの区間にも含まれない
+  ///
+  long pm_sampling_collect (std::vector<long>& exclusive, std::vector<long>& inclusive,
+    std::vector<long>& calls, int& n_threads);
+
+} // end of namespace
+
+#endif // _PM_SAMPLING_H_
@@ -0,0 +1,140 @@
+#ifndef _PM_TRACE_H_
+#define _PM_TRACE_H_
+
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+/// PMlib PerfWatch クラスから組み込みtrace出力へのインタフェイス関数
+/// included in PerfWatch.h
+///
+/// 環境変数 PMLIB_TRACE が指定された時、測定区間のstart/stopとHWPC rateを
+/// Chrome Trace Event形式(JSON)のファイルに出力する。外部ライブラリは不要で、
+/// 出力ファイルは Perfetto UI または chrome://tracing でそのまま表示できる。
+/// MPIランクはprocess、OpenMPスレッドはthreadのtrackとして表示される。
+/// 各スレッドは自分のring bufferにlockなしで記録し、background writer thread が
+/// プロセスのspoolファイルにまとめて書き出す。
+/// PMLIB_TRACE=flight:<秒> の時はflight recorderとして直近の記録だけをメモリに保持し、
+/// pm_trace_dump()、シグナル、閾値を越えた区間、または pm_trace_finalize() の時に書き出す。
+/// PMLIB_TRACE_FORMAT=binary の時は pmlib_trace_format.h の binary 形式で出力し、
+/// pmtrace コマンドでJSONやCSVに変換する。
+///
+/// @file pmlib_trace.h
+/// @brief Header block for PMlib - native trace writer
+///
+
+#include <string>
+#include <vector>
+
+namespace pm_lib {
+
+  /// trace 出力レベル 0(no), 1(yes: 時間情報のみ), 2(full: HWPC rateのcounter trackも出力)
+  extern int pm_trace_level;
+
+  /// trace の初期化. プロセス内で最初の呼び出しだけが有効
+  ///
+  ///   @param[in] num_process  プロセス数
+  ///   @param[in] my_rank      自ランク番号
+  ///   @param[in] baseT        時刻の基準値 [sec]
+  ///   @param[in] s_counter    counter track の名前 (HWPC rateの単位など)
+  ///
+  ///   @note  環境変数 PMLIB_TRACE, PMLIB_TRACE_FILE, PMLIB_TRACE_FORMAT, PMLIB_TRACE_COMPRESS,
+  ///          PMLIB_TRACE_BUFFER, PMLIB_TRACE_POLICY を読み、background writer thread を開始する.
+  ///          flight recorder では PMLIB_TRACE_TRIGGER, PMLIB_TRACE_SIGNAL も読む.
+  ///          filter として PMLIB_TRACE_SECTIONS, PMLIB_TRACE_EXCLUDE, PMLIB_TRACE_RANKS,
+  ///          PMLIB_TRACE_WINDOW, PMLIB_TRACE_ITERATIONS, PMLIB_TRACE_MIN_DURATION を読む
+  ///
+  void pm_trace_initialize (int num_process, int my_rank, double baseT, const std::string& s_counter);
+
+  /// ランク0の時計とのずれを登録する. initialize時とfinalize時の2回まで有効で、
+  /// 記録の時刻はその間を線形補間したずれで補正される
+  ///
+  ///   @param[in] t_local  測定した時の自プロセスの時刻 [sec]
+  ///   @param[in] offset   ランク0の時刻 - 自プロセスの時刻 [sec]
+  ///   @param[in] error    offset の誤差の上限 (往復時間の1/2) [sec]
+  ///
+  ///   @note  pm_trace_initialize() の baseT はランク0の時刻で与える
+  ///
+  void pm_trace_clock (double t_local, double offset, double error);
+
+  /// trace 内の名前の種類
+  enum pm_trace_kind {
+    I_trace_section = 0,	///< 測定区間
+    I_trace_mark,		///< mark() の事象
+    I_trace_counter,		///< counter() の値
+  };
+
+  /// 測定区間のラベルを登録し、trace内の区間番号を返す.
+  /// PMLIB_TRACE_SECTIONS, PMLIB_TRACE_EXCLUDE, PMLIB_TRACE_RANKS で除外された区間は
+  /// 登録せずに -2 を返す
+  int pm_trace_section (const std::string& label);
+
+  /// 測定区間の counter track に出力する値の名前を登録する. 区間ごとに最初の登録が有効
+  ///
+  ///   @param[in] id     pm_trace_section() が返した区間番号
+  ///   @param[in] names  pm_trace_record() の values[] の各要素の名前
+  ///
+  void pm_trace_metrics (int id, const std::vector<std::string>& names);
+
+  /// 測定区間の1回のstart/stopを記録する. 時間窓、反復範囲、最短時間の filter は
+  /// ここで判定し、除外された記録はring bufferに入れない
+  ///
+  ///   @param[in] i_thread  スレッド番号
+  ///   @param[in] id        pm_trace_section() が返した区間番号
+  ///   @param[in] t_start   開始時刻 [sec]
+  ///   @param[in] t_stop    終了時刻 [sec]
+  ///   @param[in] values    counter track に倍精度のまま出力する値 (レベル2のみ)
+  ///   @param[in] n_values  values[] の要素数
+  ///
+  void pm_trace_record (int i_thread, int id, double t_start, double t_stop, const double* values, int n_values);
+
+  /// mark() または counter() の名前を登録し、trace内の番号を返す.
+  /// 区間の filter のうち PMLIB_TRACE_RANKS だけが適用され、除外されたプロセスでは -2 を返す
+  ///
+  ///   @param[in] name  名前
+  ///   @param[in] kind  I_trace_mark または I_trace_counter
+  ///
+  int pm_trace_name (const std::string& name, int kind);
+
+  /// mark() または counter() の1回の事象を記録する. 時間窓と反復範囲の filter は適用されるが、
+  /// 最短時間と PMLIB_TRACE_TRIGGER の判定には使われない
+  ///
+  ///   @param[in] i_thread  スレッド番号
+  ///   @param[in] id        pm_trace_name() が返した番号
+  ///   @param[in] t         時刻 [sec]
+  ///   @param[in] value     counter の値へのポインタ. mark では NULL
+  ///
+  void pm_trace_instant (int i_thread, int id, double t, const double* value);
+
+  /// 全プロセスの記録を1つのファイルに出力して終了する. 全プロセスが呼び出す
+  ///
+  ///   @param[in] s_counter  counter track の名前 (HWPC rateの単位など)
+  ///
+  void pm_trace_finalize (const std::string& s_counter);
+
+  /// flight recorder が保持している直近の記録を自プロセスのファイルに書き出す.
+  /// flight recorder 以外では何もしない. 各プロセスが独立に呼び出せる
+  ///
+  ///   @param[in] reason  書き出しの理由. ファイルの otherData に記録される
+  ///
+  void pm_trace_dump (const std::string& reason);
+
+  /// ring buffer が一杯で捨てられた記録の数 (全プロセスの合計. pm_trace_finalize() 以降に有効)
+  long pm_trace_dropped (void);
+
+} // end of namespace
+
+#endif // _PM_TRACE_H_
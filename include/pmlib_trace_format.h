@@ -0,0 +1,222 @@
+#ifndef _PM_TRACE_FORMAT_H_
+#define _PM_TRACE_FORMAT_H_
+
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+/// PMlib binary trace (PMLIB_TRACE_FORMAT=binary) の形式と符号化関数.
+/// 組み込みtrace出力 (PerfTrace.cpp) と pmtrace コマンドの両方から使われる
+///
+/// ファイルは magic "PMLIBTRC" と形式の版 (varint) に続くblockの列である.
+/// 各blockは種類 (1 byte)、payloadのbyte数 (varint)、payload からなる.
+///   - 'I' ファイル情報: trace出力レベル
+///   - 'P' プロセス: rank, baseT, tickの秒数, 時計補正のsample, 区間ラベル, 値の名前, counter名,
+///         ラベルの種類 (区間/mark/counter. 無ければ全て区間)
+///   - 'E' イベント: thread, イベント数, 圧縮方式, 展開後のbyte数, イベント列.
+///         各イベントは 区間番号, 開始時刻と前のイベントの開始時刻の差 (zigzag),
+///         区間の時間, 値の数 (以上varint), 値 (倍精度 8 bytes) からなる.
+///         時刻はbaseTからの自プロセスの時計のtick数で、差分はblockの先頭で0から始まる
+///   - 'S' PMLIB_TRACE_MIN_DURATION より短く記録されなかった区間の数と時間
+///   - 'Z' 終端: プロセス数, node, rank, 捨てられた記録の数, 時計補正の誤差, 理由, counter名
+/// プロセスのblockは独立に復号できるので、プロセスごとのblock列を連結したものも正しいファイルになる.
+/// varintは7 bitずつのLEB128、倍精度はIEEE 754のbit列のlittle endianで機種によらない.
+///
+/// @file pmlib_trace_format.h
+/// @brief Header block for PMlib - binary trace format
+///
+
+#include <string>
+#include <vector>
+#include <cstring>
+
+namespace pm_lib {
+
+  static const char pmt_magic[8] = {'P','M','L','I','B','T','R','C'};
+  static const unsigned long pmt_version = 1;
+  static const double pmt_tick = 1.0e-9;		///< 時刻のtick [sec]
+
+  /// block の種類
+  enum pmt_block_type {
+    pmt_info = 'I',
+    pmt_process = 'P',
+    pmt_events = 'E',
+    pmt_short = 'S',
+    pmt_footer = 'Z',
+  };
+
+  /// イベント列の圧縮方式
+  enum pmt_codec {
+    pmt_raw = 0,
+    pmt_lz = 1,
+  };
+
+
+  inline void pmt_put_varint (std::string& s, unsigned long long v)
+  {
+    while (v >= 0x80) {
+      s += (char)((v & 0x7f) | 0x80);
+      v >>= 7;
+    }
+    s += (char)v;
+  }
+
+  inline void pmt_put_zigzag (std::string& s, long long v)
+  {
+    pmt_put_varint(s, ((unsigned long long)v << 1) ^ (unsigned long long)(v >> 63));
+  }
+
+  inline void pmt_put_double (std::string& s, double d)
+  {
+    unsigned long long u;
+    memcpy(&u, &d, sizeof(u));
+    for (int i=0; i<8; i++) s += (char)((u >> (8*i)) & 0xff);
+  }
+
+  inline void pmt_put_string (std::string& s, const std::string& v)
+  {
+    pmt_put_varint(s, v.size());
+    s += v;
+  }
+
+  /// block を追加する
+  inline void pmt_put_block (std::string& s, char type, const std::string& payload)
+  {
+    s += type;
+    pmt_put_varint(s, payload.size());
+    s += payload;
+  }
+
+
+  /// 符号化されたbyte列の読み出し. 範囲外の読み出しは ok を false にする
+  ///
+  struct pmt_reader {
+    const unsigned char* p;
+    const unsigned char* end;
+    bool ok;
+
+    pmt_reader (const char* buf, size_t n)
+      : p((const unsigned char*)buf), end((const unsigned char*)buf + n), ok(true) {}
+
+    bool done (void) const { return p >= end; }
+
+    unsigned long long varint (void)
+    {
+      unsigned long long v = 0;
+      for (int shift=0; shift<64; shift+=7) {
+        if (p >= end) { ok = false; return 0; }
+        unsigned char c = *p++;
+        v |= (unsigned long long)(c & 0x7f) << shift;
+        if ((c & 0x80) == 0) return v;
+      }
+      ok = false;
+      return 0;
+    }
+
+    long long zigzag (void)
+    {
+      unsigned long long u = varint();
+      return (long long)(u >> 1) ^ -(long long)(u & 1);
+    }
+
+    double real (void)
+    {
+      if (end - p < 8) { ok = false; p = end; return 0.0; }
+      unsigned long long u = 0;
+      for (int i=0; i<8; i++) u |= (unsigned long long)p[i] << (8*i);
+      p += 8;
+      double d;
+      memcpy(&d, &u, sizeof(d));
+      return d;
+    }
+
+    std::string string (void)
+    {
+      unsigned long long n = varint();
+      if (n > (unsigned long long)(end - p)) { ok = false; p = end; return ""; }
+      std::string s((const char*)p, n);
+      p += n;
+      return s;
+    }
+  };
+
+
+  /// LZ77形式の圧縮. (literalの長さ, literal, 一致の長さ, 一致の距離) の列で、
+  /// 最後の組は一致の長さが0で距離を持たない. 長さと距離はvarint
+  ///
+  inline void pmt_lz_compress (const std::string& in, std::string& out)
+  {
+    const int n_hash = 1 << 14;
+    const size_t min_match = 4;
+    const size_t max_distance = 1 << 20;
+    std::vector<long> table(n_hash, -1);
+    const unsigned char* s = (const unsigned char*)in.data();
+    const size_t n = in.size();
+    size_t i = 0, lit = 0;
+
+    out.clear();
+    while (i + min_match <= n) {
+      unsigned int h = ((unsigned int)s[i] | (unsigned int)s[i+1] << 8 |
+                        (unsigned int)s[i+2] << 16 | (unsigned int)s[i+3] << 24) * 2654435761u >> 18;
+      long cand = table[h];
+      table[h] = (long)i;
+      if (cand >= 0 && i - cand <= max_distance && memcmp(s + cand, s + i, min_match) == 0) {
+        size_t m = min_match;
+        while (i + m < n && s[cand + m] == s[i + m]) m++;
+        pmt_put_varint(out, i - lit);
+        out.append(in, lit, i - lit);
+        pmt_put_varint(out, m);
+        pmt_put_varint(out, i - cand);
+        i += m;
+        lit = i;
+      } else {
+        i++;
+      }
+    }
+    pmt_put_varint(out, n - lit);
+    out.append(in, lit, n - lit);
+    pmt_put_varint(out, 0);
+  }
+
+  /// pmt_lz_compress() の逆. 壊れた入力には false を返す
+  ///
+  inline bool pmt_lz_decompress (const char* buf, size_t n, size_t n_out, std::string& out)
+  {
+    pmt_reader r(buf, n);
+    out.clear();
+    out.reserve(n_out);
+    while (r.ok) {
+      unsigned long long n_lit = r.varint();
+      if (!r.ok || n_lit > (unsigned long long)(r.end - r.p) || out.size() + n_lit > n_out) return false;
+      out.append((const char*)r.p, n_lit);
+      r.p += n_lit;
+      unsigned long long m = r.varint();
+      if (!r.ok) return false;
+      if (m == 0) return (out.size() == n_out);
+      unsigned long long d = r.varint();
+      if (!r.ok || d == 0 || d > out.size() || out.size() + m > n_out) return false;
+      size_t from = out.size() - d;
+      for (unsigned long long k=0; k<m; k++) {
+        char c = out[from + k];
+        out += c;
+      }
+    }
+    return false;
+  }
+
+} // end of namespace
+
+#endif // _PM_TRACE_FORMAT_H_
@@ -0,0 +1,248 @@
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 RIKEN Center for Computational Science(R-CCS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+//! @file   PerfCalibrate.cpp
+//! @brief  measured peak floating point performance and memory bandwidth
+
+#include <string>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+
+#ifdef DISABLE_MPI
+#include "mpi_stubs.h"
+#else
+#include <mpi.h>
+#endif
+#include "PerfWatch.h"
+#include "pmlib_ompt.h"
+
+namespace pm_lib {
+
+  extern struct hwpc_group_chooser hwpc_group;
+
+// The flops kernel updates enough independent FMA chains to hide the
+// latency of the FMA units with the widest SIMD registers.
+static const int  n_fma_chains = 64;
+static const long n_fma_loops = 200000;		// 25.6 Mflop per run
+// The triad arrays of the process must be much larger than the last level cache.
+static const long n_triad_process = 8*1024*1024;	// elements of each array per process
+static const long n_triad_thread = 256*1024;	// minimum elements per thread
+static const int  n_calibrate_runs = 5;	// the best run is taken
+
+
+  /// x[i] = x[i]*a + b. 2*n_fma_chains*n_loops floating point operations
+  ///
+static double calibrate_fma (double* x, long n_loops)
+{
+	const double a = 0.999999, b = 1.0e-6;
+	for (long j=0; j<n_loops; j++) {
+		for (int i=0; i<n_fma_chains; i++) {
+			x[i] = x[i] * a + b;
+		}
+	}
+	double sum = 0.0;
+	for (int i=0; i<n_fma_chains; i++) sum += x[i];
+	return sum;
+}
+
+
+  /// STREAM triad a[i] = b[i] + s*c[i]. 24*n Bytes of memory traffic
+  ///
+static double calibrate_triad (double* a, const double* b, const double* c, long n)
+{
+	const double s = 3.0;
+	for (long i=0; i<n; i++) {
+		a[i] = b[i] + s * c[i];
+	}
+	return a[n/2];
+}
+
+
+  /// Read the calibration file written by writeCalibration()
+  ///
+  ///   @return  true if the file matches the processor and the number of threads
+  ///
+static bool read_calibration (const std::string& s_file, const std::string& s_model, int n_threads,
+		double& d_flops, double& d_bw)
+{
+	FILE* fp = fopen(s_file.c_str(), "r");
+	if (fp == NULL) return false;
+
+	char buffer[1024];
+	char value[1024];
+	std::string s_read_model;
+	int n_read_threads = 0;
+	d_flops = d_bw = 0.0;
+	while (fgets(buffer, 1024, fp) != NULL) {
+		if (buffer[0] == '#') continue;
+		if (!strncmp(buffer, "model ", 6)) {
+			if (sscanf(buffer, "model %[^\n]", value) == 1) s_read_model = value;
+		} else if (!strncmp(buffer, "threads ", 8)) {
+			sscanf(buffer, "threads %d", &n_read_threads);
+		} else if (!strncmp(buffer, "flops ", 6)) {
+			sscanf(buffer, "flops %lf", &d_flops);
+		} else if (!strncmp(buffer, "bandwidth ", 10)) {
+			sscanf(buffer, "bandwidth %lf", &d_bw);
+		}
+	}
+	fclose(fp);
+
+	if (d_flops <= 0.0 || d_bw <= 0.0) return false;
+	if (n_read_threads != n_threads) return false;
+	if (!s_model.empty() && !s_read_model.empty() && s_model != s_read_model) return false;
+	return true;
+}
+
+
+  /// Measure the peak performance, or read it from the calibration file
+  ///
+  /// @note  PMLIB_CALIBRATE=YES measures the floating point performance
+  ///	per core and the memory bandwidth of the process by the FMA
+  ///	and STREAM triad kernels run by all threads at initialize().
+  ///	PMLIB_CALIBRATE=<file> reads the values from the file, or
+  ///	measures them and writes the file if it does not match.
+  ///	The kernels are compiled with the PMlib build options, so PMlib should
+  ///	be built with the SIMD options of the application, e.g. -march=native.
+  ///
+void PerfWatch::calibratePeak ()
+{
+	hwpc_group.measuredPERF = 0.0;
+	hwpc_group.measuredBW = 0.0;
+	hwpc_group.calibration.clear();
+
+	char* cp_env = std::getenv("PMLIB_CALIBRATE");
+	if (cp_env == NULL) return;
+	std::string s_env = cp_env;
+	if (s_env.empty() || s_env == "NO" || s_env == "no" || s_env == "OFF" || s_env == "off") return;
+	bool is_file = !(s_env == "YES" || s_env == "yes" || s_env == "ON" || s_env == "on");
+
+	std::string s_model, s_vendor;
+	readCpuModel (s_model, s_vendor);
+
+	int n_threads = 1;
+	#ifdef _OPENMP
+	if (!omp_in_parallel()) n_threads = omp_get_max_threads();
+	#endif
+
+	double d_flops, d_bw;
+	if (is_file && read_calibration (s_env, s_model, n_threads, d_flops, d_bw)) {
+		hwpc_group.measuredPERF = d_flops;
+		hwpc_group.measuredBW = d_bw;
+		hwpc_group.calibration = s_env;
+		hwpc_group.corePERF = hwpc_group.measuredPERF;
+		return;
+	}
+
+	// run the kernels by all threads at once
+	double t_fma[Max_nthreads];
+	double t_triad = 0.0;
+	long n_triad = n_triad_process / n_threads;
+	if (n_triad < n_triad_thread) n_triad = n_triad_thread;
+	bool is_alloc = true;
+	double d_check = 0.0;
+
+	#if defined(USE_OMPT) && defined(_OPENMP)
+	pm_ompt_enter_internal();
+	#endif
+	#pragma omp parallel num_threads(n_threads) reduction(+:d_check)
+	{
+	int i_thread = 0;
+	#ifdef _OPENMP
+	i_thread = omp_get_thread_num();
+	#endif
+	double x[n_fma_chains];
+	for (int i=0; i<n_fma_chains; i++) x[i] = 1.0 + 1.0e-3 * i;
+	d_check += calibrate_fma (x, n_fma_loops / 10);	// warm up
+	double t_best = 1.0e+30;
+	for (int k=0; k<n_calibrate_runs; k++) {
+		double t0 = getTime();
+		d_check += calibrate_fma (x, n_fma_loops);
+		double t1 = getTime() - t0;
+		if (t1 < t_best) t_best = t1;
+	}
+	if (i_thread < Max_nthreads) t_fma[i_thread] = t_best;
+
+	// the arrays are first touched by the thread which uses them
+	double* a = (double*)malloc(3 * n_triad * sizeof(double));
+	if (a == NULL) {
+		#pragma omp atomic write
+		is_alloc = false;
+	} else {
+		double* b = a + n_triad;
+		double* c = b + n_triad;
+		for (long i=0; i<n_triad; i++) { a[i] = 0.0; b[i] = 1.0; c[i] = 2.0; }
+	}
+	#pragma omp barrier
+	for (int k=0; k<n_calibrate_runs && is_alloc; k++) {
+		double t0 = getTime();
+		d_check += calibrate_triad (a, a + n_triad, a + 2*n_triad, n_triad);
+		#pragma omp barrier
+		#pragma omp master
+		{
+		double t1 = getTime() - t0;
+		if (k == 0 || t1 < t_triad) t_triad = t1;
+		}
+		#pragma omp barrier
+	}
+	free(a);
+	} // end of #pragma omp parallel
+	#if defined(USE_OMPT) && defined(_OPENMP)
+	pm_ompt_leave_internal();
+	#endif
+
+	if (d_check == 0.0 || !is_alloc) {
+		fprintf(stderr, "*** PMlib warning. <calibratePeak> the calibration kernels failed. PMLIB_CALIBRATE is ignored.\n");
+		return;
+	}
+
+	// the peak per core is the average of the threads
+	d_flops = 0.0;
+	int n_fma = (n_threads < Max_nthreads) ? n_threads : Max_nthreads;
+	for (int i=0; i<n_fma; i++) {
+		d_flops += 2.0 * n_fma_chains * n_fma_loops / t_fma[i];
+	}
+	d_flops /= (double)n_fma;
+	d_bw = 3.0 * sizeof(double) * n_triad * n_threads / t_triad;
+
+	hwpc_group.measuredPERF = d_flops;
+	hwpc_group.measuredBW = d_bw;
+	hwpc_group.calibration = "measured";
+	hwpc_group.corePERF = hwpc_group.measuredPERF;
+
+	// write to a temporary file and rename it, so that the other processes
+	// do not read the file being written
+	if (is_file && my_rank == 0) {
+		std::string s_tmp = s_env + ".tmp";
+		FILE* fp = fopen(s_tmp.c_str(), "w");
+		if (fp == NULL) {
+			fprintf(stderr, "*** PMlib warning. <calibratePeak> can not write the calibration file %s\n", s_env.c_str());
+			return;
+		}
+		fprintf(fp, "# PMlib peak calibration. flops: per core [Flop/s], bandwidth: per process [Byte/s]\n");
+		fprintf(fp, "model %s\n", s_model.c_str());
+		fprintf(fp, "threads %d\n", n_threads);
+		fprintf(fp, "flops %e\n", d_flops);
+		fprintf(fp, "bandwidth %e\n", d_bw);
+		fclose(fp);
+		if (rename(s_tmp.c_str(), s_env.c_str()) != 0) {
+			fprintf(stderr, "*** PMlib warning. <calibratePeak> can not write the calibration file %s\n", s_env.c_str());
+		}
+	}
+}
+
+} /* namespace pm_lib */
@@ -18,7 +18,7 @@
 //@file   PerfCpuType.cpp
 //@brief  PMlib - PAPI interface class
 
-// if USE_PAPI is defined, compile this file with openmp option
+// if USE_HWPC is defined, compile this file with openmp option
 
 #include <iostream>
 #include <string>
@@ -32,12 +32,79 @@
 #endif
 #include <cmath>
 #include "PerfWatch.h"
+#include "pmlib_ompt.h"
+#include "pmlib_hwpc_table.h"
 
 namespace pm_lib {
 
   extern struct pmlib_papi_chooser papi;
   extern struct hwpc_group_chooser hwpc_group;
 
+#ifdef USE_HWPC
+  /// HWPC event set is bound to the calling thread or not (thread private flag)
+  static int papi_thread_bound = 0;
+  #ifdef _OPENMP
+  #pragma omp threadprivate(papi_thread_bound)
+  #endif
+
+
+  /// HWPC_CHOOSER で指定されたグループ名を含むか. 多重化指定 "G1+G2+..." にも対応する
+  static bool hwpc_group_chosen (const char* c_group)
+  {
+	std::string s_list = "+" + hwpc_group.env_str_hwpc + "+";
+	return s_list.find(std::string("+") + c_group + "+") != std::string::npos;
+  }
+
+  /// add the events of the group defined by the HWPC event table
+  static void hwpc_table_add_events (int i_group, int& ip)
+  {
+	const hwpc_table_group* g = hwpc_table_group_of(i_group);
+	hwpc_group.index[i_group] = ip;
+	hwpc_group.number[i_group] = 0;
+	for (int i=0; i<g->n_events; i++) {
+		if (ip >= Max_chooser_events) {
+			fprintf(stderr, "*** PMlib warning. too many HWPC events. The event table event [%s] and the rest are ignored.\n",
+				g->label[i].c_str());
+			break;
+		}
+		std::string s_event = hwpc_table_event_name(g, i, hwpc_backend->name);
+		papi.events[ip] = PM_HWPC_NO_EVENT;
+		if (!s_event.empty()) hwpc_name_to_code( s_event.c_str(), &papi.events[ip]);
+		papi.s_name[ip] = g->label[i];
+		papi.scope[ip] = g->scope[i];
+		hwpc_group.number[i_group]++;
+		ip++;
+	}
+  }
+
+  /// change the active groups, and keep the time each group has been counted
+  static void hwpc_set_active (const bool* active, double t)
+  {
+	for (int i=0; i<Max_hwpc_output_group; i++) {
+		if (hwpc_group.active[i] && !active[i]) {
+			hwpc_group.active_time[i] += t - hwpc_group.active_since[i];
+		} else if (!hwpc_group.active[i] && active[i]) {
+			hwpc_group.active_since[i] = t;
+		}
+		hwpc_group.active[i] = active[i];
+	}
+  }
+
+  /// event codes of the calling thread. The events of the inactive groups are not counted
+  static void hwpc_active_events (int* events)
+  {
+	for (int i=0; i<papi.num_events; i++) {
+		events[i] = papi.events[i];
+	}
+	for (int ig=0; ig<Max_hwpc_output_group; ig++) {
+		if (hwpc_group.active[ig]) continue;
+		for (int i=0; i<hwpc_group.number[ig]; i++) {
+			events[hwpc_group.index[ig]+i] = PM_HWPC_NO_EVENT;
+		}
+	}
+  }
+#endif
+
 
   /// HWPC interface initialization
   ///
@@ -81,11 +148,15 @@ void PerfWatch::initializeHWPC ()
 	for (int i=0; i<Max_hwpc_output_group; i++) {
 		hwpc_group.number[i] = 0;
 		hwpc_group.index[i] = -999999;
+		hwpc_group.active[i] = true;
+		hwpc_group.active_time[i] = 0.0;
+		hwpc_group.active_since[i] = 0.0;
 		}
 
 	papi.num_events = 0;
 	for (int i=0; i<Max_chooser_events; i++){
 		papi.events[i] = 0;
+		papi.scope[i] = I_scope_core;
 		papi.values[i] = 0;
 		papi.accumu[i] = 0;
 		papi.v_sorted[i] = 0;
@@ -96,6 +167,22 @@ void PerfWatch::initializeHWPC ()
 			papi.th_accumu[j][i] = 0;
 			papi.th_v_sorted[j][i] = 0;
 		}
+	for (int i=0; i<Max_cpu_stats; i++){
+			papi.th_cpu[j][i] = 0.0;
+		}
+	for (int i=0; i<2*Max_chooser_events; i++){
+			papi.th_mux[j][i] = 0.0;
+			papi.th_mux_start[j][i] = 0.0;
+		}
+	for (int i=0; i<Max_hwpc_output_group; i++){
+			papi.th_group_time[j][i] = 0.0;
+		}
+	for (int i=0; i<Max_place_stats; i++){
+			papi.th_place[j][i] = 0;
+		}
+	for (int i=0; i<Max_roof_stats; i++){
+			papi.th_roof[j][i] = 0.0;
+		}
 		}
 	}
 
@@ -113,39 +200,68 @@ void PerfWatch::initializeHWPC ()
 			s_chooser == "CACHE" ||
 			s_chooser == "CYCLE" ||
 			s_chooser == "LOADSTORE" ||
+			s_chooser == "TOPDOWN" ||
+			s_chooser == "TLB" ||
 			s_chooser == "USER" ) {
 			;
+		} else if (s_chooser.compare(0, 7, "CUSTOM:") == 0) {
+			hwpc_group.custom_events = s_chooser.substr(7);
+			s_chooser = "CUSTOM";
+		} else if (s_chooser.find('+') != std::string::npos) {
+			// multiplexed groups, e.g. HWPC_CHOOSER=FLOPS+BANDWIDTH+CACHE
+			std::string s_groups;
+			if (hwpc_parse_multiplex(s_chooser, s_groups) > 0) {
+				s_chooser = s_groups;
+			} else {
+				s_chooser = s_default;
+			}
 		} else {
 			s_chooser = s_default;
 		}
 	}
 	hwpc_group.env_str_hwpc = s_chooser;
+	hwpc_group.n_multiplex = 1;
+	if (s_chooser.find('+') != std::string::npos) {
+		std::string s_groups;
+		hwpc_group.n_multiplex = hwpc_parse_multiplex(s_chooser, s_groups);
+	}
 
 	read_cpu_clock_freq(); /// API for reading processor clock frequency.
 
+	// the measured peak performance replaces the nominal one. PMLIB_CALIBRATE
+	if (root_thread == 0) calibratePeak();
+
+#ifdef USE_HWPC
+	// The counter backend is chosen by PMLIB_HWPC_BACKEND = papi | perf | replay
+	if (hwpc_backend == NULL) hwpc_backend = hwpc_select_backend();
+#endif
+
 	if (hwpc_group.env_str_hwpc == "USER" ) return;	// Is this a correct return?
 
-#ifdef USE_PAPI
+#ifdef USE_HWPC
 	int i_papi;
 	if (root_thread == 0)
 	{
-	i_papi = PAPI_library_init( PAPI_VER_CURRENT );
-	if (i_papi != PAPI_VER_CURRENT ) {
-		fprintf (stderr, "*** error. <PAPI_library_init> code: %d\n", i_papi);
-		fprintf (stderr, "\t Check if correct version of PAPI library is linked.");
-		PM_Exit(0);
-		//	return;
-		}
-
-	i_papi = PAPI_thread_init( (unsigned long (*)(void)) (omp_get_thread_num) );
-	if (i_papi != PAPI_OK ) {
-		fprintf (stderr, "*** error. <PAPI_thread_init> failed. code=%d, root_thread=%d\n", i_papi, root_thread);
+	i_papi = hwpc_backend->library_init();
+	if (i_papi != PM_HWPC_OK ) {
+		fprintf (stderr, "*** error. <initializeHWPC> %s backend initialization failed. code=%d\n",
+			hwpc_backend->name, i_papi);
 		PM_Exit(0);
 		//	return;
 		}
 
 	createPapiCounterList ();
 
+	// the multiplexed groups share the counters by time slicing
+	if (hwpc_group.n_multiplex > 1 && hwpc_backend->set_multiplex != NULL) {
+		i_papi = hwpc_backend->set_multiplex();
+		if (i_papi != PM_HWPC_OK ) {
+			fprintf (stderr, "*** error. <initializeHWPC> %s backend can not multiplex the events. code=%d\n",
+				hwpc_backend->name, i_papi);
+			PM_Exit(0);
+			}
+		}
+
 	#ifdef DEBUG_PRINT_PAPI
 	if (my_rank == 0 && root_thread == 0) {
 		fprintf(stderr, "<initializeHWPC> created struct papi: papi.num_events=%d, address=%p\n",
@@ -158,74 +274,223 @@ void PerfWatch::initializeHWPC ()
 	#pragma omp barrier
 	// In general the arguments to <my_papi_*> should be thread private.
 	// For APIs whose arguments do not change,  we use shared object.
+	// The threads which are created later, i.e. larger team or nested team,
+	// are bound lazily by startSectionSerial() and startSectionParallel().
 
 	if (root_in_parallel) {
-	int t_papi;
-	t_papi = my_papi_add_events (papi.events, papi.num_events);
-	if ( t_papi != PAPI_OK ) {
-		fprintf(stderr, "*** error. <initializeHWPC> <my_papi_add_events> code: %d\n"
-			"\n\t most likely un-supported HWPC PAPI combination.\n", t_papi);
-		papi.num_events = 0;
-		PM_Exit(0);
-		}
-	t_papi = my_papi_bind_start (papi.values, papi.num_events);
-	if ( t_papi != PAPI_OK ) {
-		fprintf(stderr, "*** error. <initializeHWPC> <my_papi_bind_start> code: %d\n", t_papi);
-		PM_Exit(0);
-		}
-
+		bindHWPCthread();
 	} else {
 	#pragma omp parallel
 	{
+		bindHWPCthread();
+	} // end of #pragma omp parallel
+	} // end of if (root_in_parallel)
+
+#endif // USE_HWPC
+}
+
+
+  /// Bind the HWPC event set to the calling thread, if it has not been bound yet
+  ///
+  /// @note  this routine is called by initializeHWPC() for the initial team,
+  ///	and lazily by start() for the threads which join the later teams,
+  ///	i.e. after omp_set_num_threads() with larger value or in nested regions.
+  ///
+void PerfWatch::bindHWPCthread ()
+{
+#ifdef USE_HWPC
+	if (papi_thread_bound) return;
+	if (papi.num_events == 0) return;
+
 	int t_papi;
-	t_papi = my_papi_add_events (papi.events, papi.num_events);
-	if ( t_papi != PAPI_OK ) {
-		fprintf(stderr, "*** error. <initializeHWPC> <my_papi_add_events> code: %d\n"
-			"\n\t most likely un-supported HWPC PAPI combination.\n", t_papi);
+	int events[Max_chooser_events];
+	hwpc_active_events (events);
+	t_papi = hwpc_backend->add_events (events, papi.num_events);
+	if ( t_papi != PM_HWPC_OK ) {
+		fprintf(stderr, "*** error. <bindHWPCthread> <%s add_events> code: %d\n"
+			"\n\t most likely un-supported HWPC event combination.\n", hwpc_backend->name, t_papi);
 		papi.num_events = 0;
 		PM_Exit(0);
+		return;
 		}
-	t_papi = my_papi_bind_start (papi.values, papi.num_events);
-	if ( t_papi != PAPI_OK ) {
-		fprintf(stderr, "*** error. <initializeHWPC> <my_papi_bind_start> code: %d\n", t_papi);
+	t_papi = hwpc_backend->start (papi.values, papi.num_events);
+	if ( t_papi != PM_HWPC_OK ) {
+		fprintf(stderr, "*** error. <bindHWPCthread> <%s start> code: %d\n", hwpc_backend->name, t_papi);
 		PM_Exit(0);
+		return;
 		}
-	} // end of #pragma omp parallel
-	} // end of if (root_in_parallel)
-
-#endif // USE_PAPI
+	papi_thread_bound = 1;
+#endif // USE_HWPC
 }
 
 
   /// cleanup and free HWPC memory space for papi HighLevelInfo struct
   /// @note  this routine is called by PerfMonitor::stopRoot()
+  /// @note  Inside a parallel region each thread frees only its own context,
+  ///        so no barrier is used here. The threads joining the team after
+  ///        initialize() do not stop the Root section and call this routine
+  ///        only for themselves. A barrier would leave the team unbalanced.
   ///
 void PerfWatch::cleanupHWPC ()
 {
 
 #ifdef _OPENMP
-#ifdef USE_PAPI
+#ifdef USE_HWPC
 	bool root_in_parallel;
+	if (hwpc_backend == NULL) return;
 
-	#pragma omp barrier
 	root_in_parallel = omp_in_parallel();
 
 	if (root_in_parallel) {
-		my_papi_internal_free();
+		if (papi_thread_bound) hwpc_thread_free();
+		papi_thread_bound = 0;
 
 	} else {
 	#pragma omp parallel
 		{
-		my_papi_internal_free();
+		if (papi_thread_bound) hwpc_thread_free();
+		papi_thread_bound = 0;
 		} // end of #pragma omp parallel
 
 	} // end of if (root_in_parallel)
 
-#endif // USE_PAPI
+#endif // USE_HWPC
+#endif
+}
+
+
+  /// Switch the counted groups among those multiplexed by HWPC_CHOOSER
+  ///
+  ///   @param[in] s_name  group name or the groups joined by '+'. "ALL" or "" counts all the groups
+  ///
+  /// @note  the counts read so far are kept, and every thread bound to
+  ///	the event set is reprogrammed. The running sections accumulate the
+  ///	counts and the time of each group only while the group is active,
+  ///	see readGroupClock().
+  ///	This routine is called by PerfMonitor::setCounterGroup() in a serial
+  ///	context, or by all the threads of the parallel region.
+  ///
+void PerfWatch::switchCounterGroup (const std::string& s_name)
+{
+#ifdef USE_HWPC
+	if (hwpc_backend == NULL || papi.num_events == 0) return;
+	if (hwpc_group.n_multiplex <= 1) {
+		if (my_rank == 0) {
+		fprintf(stderr, "*** PMlib warning. setCounterGroup(%s) needs HWPC_CHOOSER with multiple groups, e.g. FLOPS+CACHE. ignored.\n",
+			s_name.c_str());
+		}
+		return;
+	}
+
+	std::string s_groups = s_name;
+	if (s_name.empty() || s_name == "ALL") {
+		s_groups = hwpc_group.env_str_hwpc;
+	} else {
+		std::string s_list;
+		if (hwpc_parse_multiplex(s_name, s_list) == 0) s_list = "";
+		std::string s_chosen = "+" + hwpc_group.env_str_hwpc + "+";
+		size_t i_begin = 0;
+		while (!s_list.empty() && i_begin <= s_list.size()) {
+			size_t i_end = s_list.find('+', i_begin);
+			if (i_end == std::string::npos) i_end = s_list.size();
+			if (s_chosen.find("+" + s_list.substr(i_begin, i_end-i_begin) + "+") == std::string::npos) s_list = "";
+			i_begin = i_end + 1;
+		}
+		if (s_list.empty()) {
+			if (my_rank == 0) {
+			fprintf(stderr, "*** PMlib warning. setCounterGroup(%s) is not among HWPC_CHOOSER=%s. ignored.\n",
+				s_name.c_str(), hwpc_group.env_str_hwpc.c_str());
+			}
+			return;
+		}
+		s_groups = s_list;
+	}
+
+	bool active[Max_hwpc_output_group];
+	const char* c_names[] = { "FLOPS", "VECTOR", "BANDWIDTH", "CACHE", "CYCLE", "LOADSTORE", "TOPDOWN", "TLB" };
+	const int i_names[] = { I_flops, I_vector, I_bandwidth, I_cache, I_cycle, I_loadstore, I_topdown, I_tlb };
+	for (int i=0; i<Max_hwpc_output_group; i++) active[i] = true;
+	for (int i=0; i<8; i++) {
+		active[i_names[i]] = ("+" + s_groups + "+").find(std::string("+") + c_names[i] + "+") != std::string::npos;
+	}
+
+#ifdef _OPENMP
+	bool root_in_parallel = omp_in_parallel();
+	if (root_in_parallel) {
+		#pragma omp barrier
+		#pragma omp master
+		hwpc_set_active (active, getTime());
+		#pragma omp barrier
+		reprogramHWPCthread();
+		#pragma omp barrier
+	} else {
+		hwpc_set_active (active, getTime());
+		#if defined(USE_OMPT) && defined(_OPENMP)
+		pm_ompt_enter_internal();
+		#endif
+		#pragma omp parallel
+		{
+		reprogramHWPCthread();
+		} // end of #pragma omp parallel
+		#if defined(USE_OMPT) && defined(_OPENMP)
+		pm_ompt_leave_internal();
+		#endif
+	}
+#else
+	hwpc_set_active (active, getTime());
+	reprogramHWPCthread();
 #endif
+
+#endif // USE_HWPC
 }
 
 
+  /// Read the clock of each group, which advances only while the group is active
+  ///
+  ///   @param[in]  t  current time by getTime()
+  ///   @param[out] clock  time each group has been counted until t
+  ///
+void PerfWatch::readGroupClock (double t, double* clock)
+{
+#ifdef USE_HWPC
+	for (int i=0; i<Max_hwpc_output_group; i++) {
+		clock[i] = hwpc_group.active_time[i];
+		if (hwpc_group.active[i]) clock[i] += t - hwpc_group.active_since[i];
+	}
+#endif // USE_HWPC
+}
+
+
+  /// The part of m_time while the group was counted. m_time if not multiplexed
+  ///
+  ///   @param[in] i_group  hwpc_output_group of the group
+  ///
+double PerfWatch::groupTime (int i_group)
+{
+#ifdef USE_HWPC
+	if (hwpc_group.n_multiplex > 1) return m_groupTime[i_group];
+#endif // USE_HWPC
+	return m_time;
+}
+
+
+  /// Replace the event set of the calling thread with the active groups
+  ///
+void PerfWatch::reprogramHWPCthread ()
+{
+#ifdef USE_HWPC
+	if (!papi_thread_bound) return;
+
+	int events[Max_chooser_events];
+	hwpc_active_events (events);
+	int t_papi = hwpc_reprogram (events, papi.num_events);
+	if ( t_papi != PM_HWPC_OK ) {
+		fprintf(stderr, "*** error. <reprogramHWPCthread> <%s> code: %d\n", hwpc_backend->name, t_papi);
+		PM_Exit(0);
+		}
+#endif // USE_HWPC
+}
+
 
   /// Construct the available list of PAPI counters for the targer processor
   /// @note  this routine needs the processor hardware information
@@ -234,10 +499,9 @@ void PerfWatch::cleanupHWPC ()
   ///
 void PerfWatch::createPapiCounterList ()
 {
-#ifdef USE_PAPI
+#ifdef USE_HWPC
 // Set PAPI counter events. The events are CPU hardware dependent
 
-	const PAPI_hw_info_t *hwinfo = NULL;
 	using namespace std;
 	std::string s_model_string;
 	std::string s_vendor_string;
@@ -258,6 +522,9 @@ void PerfWatch::createPapiCounterList ()
 	// water:	: Intel(R) Xeon(R) Gold 6148 CPU @ 2.40GHz	# Skylake
 	// fugaku:	: Fujitsu A64FX based on ARM SVE edition @ 2.0 GHz base frequency
 
+#ifdef USE_PAPI
+	if (std::string(hwpc_backend->name) == "papi") {
+	const PAPI_hw_info_t *hwinfo = NULL;
 	hwinfo = PAPI_get_hardware_info();
 	if (hwinfo == NULL) {
 		if (my_rank == 0) {
@@ -278,6 +545,13 @@ void PerfWatch::createPapiCounterList ()
 //	with Linux, s_model_string is usually taken from "model name" in /proc/cpuinfo
 	s_model_string = hwinfo->model_string;
 	s_vendor_string = hwinfo->vendor_string;
+	} else
+#endif
+	{
+	// the other backends read /proc/cpuinfo directly
+	readCpuModel (s_model_string, s_vendor_string);
+	}
+	hwpc_group.model_string = s_model_string;
 
 	// Intel Xeon processors
     if (s_model_string.find( "Intel" ) != string::npos) {
@@ -330,7 +604,10 @@ void PerfWatch::createPapiCounterList ()
 		int loc_ATmark, loc_GHz, nchars;
 		loc_ATmark = s_model_string.find_first_of(s_separator);
 		loc_GHz    = s_model_string.find(s_terminator, loc_ATmark);
-		hwpc_group.coreGHz = stod ( s_model_string.substr(loc_ATmark+1, loc_GHz-loc_ATmark-1) );
+		hwpc_group.coreGHz = 0.0;
+		if (loc_ATmark != (int)string::npos && loc_GHz != (int)string::npos) {
+		hwpc_group.coreGHz = atof ( s_model_string.substr(loc_ATmark+1, loc_GHz-loc_ATmark-1).c_str() );
+		}
 		if ( hwpc_group.coreGHz <= 1.0 ||  hwpc_group.coreGHz >= 10.0 ) {
 			hwpc_group.coreGHz = 1.000;
 		}
@@ -402,6 +679,32 @@ void PerfWatch::createPapiCounterList ()
 	}
 
 
+// 1a. The HWPC event table overrides the built-in code of the groups it defines.
+//	The shipped table is used for the processors which are not supported above.
+	bool is_builtin = (hwpc_group.i_platform > 0 && hwpc_group.i_platform < 90);
+	std::string s_table = hwpc_table_select (hwpc_group.model_string, s_vendor_string, is_builtin, my_rank == 0);
+	if (!s_table.empty()) {
+		if (hwpc_group.platform.empty() || hwpc_group.platform == "unsupported_hardware") {
+			hwpc_group.platform = s_table;
+			hwpc_group.i_platform = 90;	// event table only
+		}
+		if (hwpc_group.model_string.empty()) {
+			hwpc_group.model_string = s_table;	// ARM processors have no model name
+		}
+		if (hwpc_table_peak() > 0.0) {
+			if ( hwpc_group.coreGHz <= 1.0 ||  hwpc_group.coreGHz >= 10.0 ) {
+				hwpc_group.coreGHz = 1.000;
+			}
+			hwpc_group.corePERF = hwpc_group.coreGHz * 1.0e9 * hwpc_table_peak();
+		}
+	}
+
+// 1b. The peak performance measured by calibratePeak() replaces the nominal one
+	if (hwpc_group.measuredPERF > 0.0) {
+		hwpc_group.corePERF = hwpc_group.measuredPERF;
+	}
+
+
 // 2. Parse the Environment Variable HWPC_CHOOSER
 //	the parsing has been done in initializeHWPC() routine
 
@@ -411,7 +714,10 @@ void PerfWatch::createPapiCounterList ()
 
 
 // if (FLOPS)
-	if ( hwpc_group.env_str_hwpc == "FLOPS" ) {
+	if ( hwpc_group_chosen("FLOPS") && hwpc_table_group_of(I_flops) != NULL ) {
+		hwpc_table_add_events (I_flops, ip);
+	} else
+	if ( hwpc_group_chosen("FLOPS") ) {
 		hwpc_group.index[I_flops] = ip;
 		hwpc_group.number[I_flops] = 0;
 
@@ -421,8 +727,8 @@ void PerfWatch::createPapiCounterList ()
 				hwpc_group.i_platform == 4 ||
 				hwpc_group.i_platform == 5 ) {
 				hwpc_group.number[I_flops] += 2;
-				papi.s_name[ip] = "SP_OPS"; papi.events[ip] = PAPI_SP_OPS; ip++;
-				papi.s_name[ip] = "DP_OPS"; papi.events[ip] = PAPI_DP_OPS; ip++;
+				papi.s_name[ip] = "SP_OPS"; hwpc_name_to_code( "PAPI_SP_OPS", &papi.events[ip]); ip++;
+				papi.s_name[ip] = "DP_OPS"; hwpc_name_to_code( "PAPI_DP_OPS", &papi.events[ip]); ip++;
 			} else {
 				;	// hwpc_group.i_platform = 3;	// Haswell does not support FLOPS events
 			}
@@ -432,7 +738,7 @@ void PerfWatch::createPapiCounterList ()
 				hwpc_group.i_platform == 9 ||
 				hwpc_group.i_platform == 11 ) {
 				hwpc_group.number[I_flops] += 1;
-				papi.s_name[ip] = "FP_OPS"; papi.events[ip] = PAPI_FP_OPS; ip++;
+				papi.s_name[ip] = "FP_OPS"; hwpc_name_to_code( "PAPI_FP_OPS", &papi.events[ip]); ip++;
 				//	single precision count is not supported on FX100
 			}
 		} else
@@ -440,15 +746,17 @@ void PerfWatch::createPapiCounterList ()
 		if (hwpc_group.platform == "A64FX" ) {
 			if (hwpc_group.i_platform == 21 ) {
 				hwpc_group.number[I_flops] += 2;
-				papi.s_name[ip] = "SP_OPS"; papi.events[ip] = PAPI_SP_OPS; ip++;
-				papi.s_name[ip] = "DP_OPS"; papi.events[ip] = PAPI_DP_OPS; ip++;
+				papi.s_name[ip] = "SP_OPS"; hwpc_name_to_code( "PAPI_SP_OPS", &papi.events[ip]); ip++;
+				papi.s_name[ip] = "DP_OPS"; hwpc_name_to_code( "PAPI_DP_OPS", &papi.events[ip]); ip++;
 			}
 		}
 	}
 
-	else
 // if (BANDWIDTH)
-	if ( hwpc_group.env_str_hwpc == "BANDWIDTH" ) {
+	if ( hwpc_group_chosen("BANDWIDTH") && hwpc_table_group_of(I_bandwidth) != NULL ) {
+		hwpc_table_add_events (I_bandwidth, ip);
+	} else
+	if ( hwpc_group_chosen("BANDWIDTH") ) {
 		hwpc_group.index[I_bandwidth] = ip;
 		hwpc_group.number[I_bandwidth] = 0;
 
@@ -463,61 +771,61 @@ void PerfWatch::createPapiCounterList ()
 			if (hwpc_group.i_platform >= 2 ) {
 				hwpc_group.number[I_bandwidth] += 2;
 				papi.s_name[ip] = "L2_RQSTS:DEMAND_DATA_RD_HIT";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L2_RD_HIT"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L2_RD_HIT"; ip++;
 				papi.s_name[ip] = "L2_RQSTS:PF_HIT";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L2_PF_HIT"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L2_PF_HIT"; ip++;
 			}
 
 			// data feed from L3 cache and from memory
 			if (hwpc_group.i_platform == 2 ) {
 				hwpc_group.number[I_bandwidth] += 2;
 				papi.s_name[ip] = "OFFCORE_RESPONSE_0:ANY_DATA:LLC_HITMESF";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L3_HIT"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L3_HIT"; ip++;
 				papi.s_name[ip] = "OFFCORE_RESPONSE_0:ANY_DATA:L3_MISS";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L3_MISS"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L3_MISS"; ip++;
 			} else
 			if (hwpc_group.i_platform == 3 ) {
 				hwpc_group.number[I_bandwidth] += 2;
 				papi.s_name[ip] = "OFFCORE_RESPONSE_0:ANY_DATA:L3_HIT";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L3_HIT"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L3_HIT"; ip++;
 				papi.s_name[ip] = "OFFCORE_RESPONSE_0:ANY_DATA:L3_MISS";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L3_MISS"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L3_MISS"; ip++;
 			} else
 			if (hwpc_group.i_platform == 4 ) {
 				hwpc_group.number[I_bandwidth] += 2;
 				papi.s_name[ip] = "OFFCORE_RESPONSE_0:ANY_DATA:SPL_HIT";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L3_HIT"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L3_HIT"; ip++;
 				papi.s_name[ip] = "OFFCORE_RESPONSE_0:ANY_DATA:L3_MISS";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L3_MISS"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L3_MISS"; ip++;
 			} else
 			if (hwpc_group.i_platform == 5 ) {
 				hwpc_group.number[I_bandwidth] += 2;
 				papi.s_name[ip] = "OFFCORE_RESPONSE_0:ANY_DATA:L3_HIT";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L3_HIT"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L3_HIT"; ip++;
 				papi.s_name[ip] = "OFFCORE_RESPONSE_0:ANY_DATA:L3_MISS";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L3_MISS"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L3_MISS"; ip++;
 			}
 
 		} else
 		if (hwpc_group.platform == "SPARC64" ) {
 			hwpc_group.number[I_bandwidth] += 6;
 			papi.s_name[ip] = "L2_READ_DM";
-				my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); ip++;
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); ip++;
 			papi.s_name[ip] = "L2_READ_PF";
-				my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); ip++;
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); ip++;
 
 			//	SPARC64 event PAPI_L2_TCM == (L2_MISS_DM + L2_MISS_PF)
 			papi.s_name[ip] = "L2_MISS_DM";
-				my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); ip++;
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); ip++;
 			papi.s_name[ip] = "L2_MISS_PF";
-				my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); ip++;
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); ip++;
 
 			// The following two events are not shown from papi_avail -d command.
 			// They show up from papi_event_chooser NATIVE L2_WB_DM (or L2_WB_PF) command.
 			papi.s_name[ip] = "L2_WB_DM";
-				my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); ip++;
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); ip++;
 			papi.s_name[ip] = "L2_WB_PF";
-				my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); ip++;
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); ip++;
 
 		} else
 		if (hwpc_group.platform == "A64FX" ) {
@@ -525,18 +833,20 @@ void PerfWatch::createPapiCounterList ()
 			// On A64FX, we use native events BUS_READ_TOTAL_MEM and BUS_WRITE_TOTAL_MEM
 			hwpc_group.number[I_bandwidth] += 2;
 			papi.s_name[ip] = "BUS_READ_TOTAL_MEM";
-			my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "CMG_bus_RD"; ip++;
+			hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "CMG_bus_RD"; ip++;
 			papi.s_name[ip] = "BUS_WRITE_TOTAL_MEM";
-			my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "CMG_bus_WR"; ip++;
+			hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "CMG_bus_WR"; ip++;
 
 			}
 		}
 
 	}
 
-	else
 // if (VECTOR)
-	if ( hwpc_group.env_str_hwpc == "VECTOR" ) {
+	if ( hwpc_group_chosen("VECTOR") && hwpc_table_group_of(I_vector) != NULL ) {
+		hwpc_table_add_events (I_vector, ip);
+	} else
+	if ( hwpc_group_chosen("VECTOR") ) {
 		hwpc_group.index[I_vector] = ip;
 		hwpc_group.number[I_vector] = 0;
 
@@ -546,61 +856,61 @@ void PerfWatch::createPapiCounterList ()
 			if (hwpc_group.i_platform == 1 ) {
 				// Basic support for two types only
 				hwpc_group.number[I_vector] += 2;
-				papi.s_name[ip] = "SP_OPS"; papi.events[ip] = PAPI_SP_OPS; ip++;
-				papi.s_name[ip] = "DP_OPS"; papi.events[ip] = PAPI_DP_OPS; ip++;
+				papi.s_name[ip] = "SP_OPS"; hwpc_name_to_code( "PAPI_SP_OPS", &papi.events[ip]); ip++;
+				papi.s_name[ip] = "DP_OPS"; hwpc_name_to_code( "PAPI_DP_OPS", &papi.events[ip]); ip++;
 					//	PAPI_FP_OPS (=PAPI_FP_INS) is not useful on Xeon. un-packed operations only.
 			} else
 			if ( hwpc_group.i_platform == 2 ) {
 				// Sandybridge v2 and alike platform
 				hwpc_group.number[I_vector] += 6;
 				papi.s_name[ip] = "FP_COMP_OPS_EXE:SSE_FP_SCALAR_SINGLE";		// scalar
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_SINGLE"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_SINGLE"; ip++;
 				papi.s_name[ip] = "FP_COMP_OPS_EXE:SSE_PACKED_SINGLE";		// 4 SIMD
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_SSE"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_SSE"; ip++;
 				papi.s_name[ip] = "SIMD_FP_256:PACKED_SINGLE";				// 8 SIMD
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_AVX"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_AVX"; ip++;
 				papi.s_name[ip] = "FP_COMP_OPS_EXE:SSE_SCALAR_DOUBLE";		// scalar
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_SINGLE"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_SINGLE"; ip++;
 				papi.s_name[ip] = "FP_COMP_OPS_EXE:SSE_FP_PACKED_DOUBLE";	// 2 SIMD
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_SSE"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_SSE"; ip++;
 				papi.s_name[ip] = "SIMD_FP_256:PACKED_DOUBLE";				// 4 SIMD
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_AVX"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_AVX"; ip++;
 			} else
 			if ( hwpc_group.i_platform == 4 ) {
 				// Broadwell
 				hwpc_group.number[I_vector] += 6;
 				papi.s_name[ip] = "FP_ARITH:SCALAR_SINGLE";			//	scalar
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_SINGLE"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_SINGLE"; ip++;
 				papi.s_name[ip] = "FP_ARITH:128B_PACKED_SINGLE";	//	4 SIMD
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_SSE"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_SSE"; ip++;
 				papi.s_name[ip] = "FP_ARITH:256B_PACKED_SINGLE";	//	8 SIMD
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_AVX"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_AVX"; ip++;
 				papi.s_name[ip] = "FP_ARITH:SCALAR_DOUBLE";			//	scalar
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_SINGLE"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_SINGLE"; ip++;
 				papi.s_name[ip] = "FP_ARITH:128B_PACKED_DOUBLE";	//	2 SIMD
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_SSE"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_SSE"; ip++;
 				papi.s_name[ip] = "FP_ARITH:256B_PACKED_DOUBLE";	//	4 SIMD
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_AVX"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_AVX"; ip++;
 			} else
 			if ( hwpc_group.i_platform == 5 ) {
 				// Skylake and alike platform
 				hwpc_group.number[I_vector] += 8;
 				papi.s_name[ip] = "FP_ARITH:SCALAR_SINGLE";			//	scalar
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_SINGLE"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_SINGLE"; ip++;
 				papi.s_name[ip] = "FP_ARITH:128B_PACKED_SINGLE";	//	4 SIMD
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_SSE"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_SSE"; ip++;
 				papi.s_name[ip] = "FP_ARITH:256B_PACKED_SINGLE";	//	8 SIMD
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_AVX"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_AVX"; ip++;
 				papi.s_name[ip] = "FP_ARITH:512B_PACKED_SINGLE";	//	16 SIMD
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_AVXW"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_AVXW"; ip++;
 				papi.s_name[ip] = "FP_ARITH:SCALAR_DOUBLE";			//	scalar
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_SINGLE"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_SINGLE"; ip++;
 				papi.s_name[ip] = "FP_ARITH:128B_PACKED_DOUBLE";	//	2 SIMD
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_SSE"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_SSE"; ip++;
 				papi.s_name[ip] = "FP_ARITH:256B_PACKED_DOUBLE";	//	4 SIMD
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_AVX"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_AVX"; ip++;
 				papi.s_name[ip] = "FP_ARITH:512B_PACKED_DOUBLE";	//	8 SIMD
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_AVXW"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_AVXW"; ip++;
 			} else {
 				;	// no VECTOR support
 				// hwpc_group.i_platform = 3;	// Haswell does not support VECTOR events
@@ -614,13 +924,13 @@ void PerfWatch::createPapiCounterList ()
 			//		4 native events are supported for F.P.ops.
 				hwpc_group.number[I_vector] += 4;
 				papi.s_name[ip] = "FLOATING_INSTRUCTIONS";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "FP_INS"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "FP_INS"; ip++;
 				papi.s_name[ip] = "FMA_INSTRUCTIONS";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "FMA_INS"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "FMA_INS"; ip++;
 				papi.s_name[ip] = "SIMD_FLOATING_INSTRUCTIONS";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SIMD_FP"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SIMD_FP"; ip++;
 				papi.s_name[ip] = "SIMD_FMA_INSTRUCTIONS";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SIMD_FMA"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SIMD_FMA"; ip++;
 			}
 			else if (hwpc_group.i_platform == 11 ) {
 			//	[FX100]
@@ -628,15 +938,15 @@ void PerfWatch::createPapiCounterList ()
 			//		It is not quite clear if they are precise for both double precision and single precision
 				hwpc_group.number[I_vector] += 5;
 				papi.s_name[ip] = "1FLOPS_INSTRUCTIONS";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "1FP_INS"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "1FP_INS"; ip++;
 				papi.s_name[ip] = "2FLOPS_INSTRUCTIONS";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "2FP_INS"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "2FP_INS"; ip++;
 				papi.s_name[ip] = "4FLOPS_INSTRUCTIONS";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "4FP_INS"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "4FP_INS"; ip++;
 				papi.s_name[ip] = "8FLOPS_INSTRUCTIONS";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "8FP_INS"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "8FP_INS"; ip++;
 				papi.s_name[ip] = "16FLOPS_INSTRUCTIONS";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "16FP_INS"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "16FP_INS"; ip++;
 			/*
 			The other combination might be
 				FLOATING_INSTRUCTIONS
@@ -657,13 +967,13 @@ void PerfWatch::createPapiCounterList ()
 
 				hwpc_group.number[I_vector] += 4;
 				papi.s_name[ip] = "FP_DP_SCALE_OPS_SPEC";
-				my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_SVE_op"; ip++;
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_SVE_op"; ip++;
 				papi.s_name[ip] = "FP_DP_FIXED_OPS_SPEC";
-				my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_FIX_op"; ip++;
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "DP_FIX_op"; ip++;
 				papi.s_name[ip] = "FP_SP_SCALE_OPS_SPEC";
-				my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_SVE_op"; ip++;
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_SVE_op"; ip++;
 				papi.s_name[ip] = "FP_SP_FIXED_OPS_SPEC";
-				my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_FIX_op"; ip++;
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SP_FIX_op"; ip++;
 		
 			}
 		}
@@ -671,26 +981,27 @@ void PerfWatch::createPapiCounterList ()
 	}
 
 
-	else
 // if (CACHE)
-
-	if ( hwpc_group.env_str_hwpc == "CACHE" ) {
+	if ( hwpc_group_chosen("CACHE") && hwpc_table_group_of(I_cache) != NULL ) {
+		hwpc_table_add_events (I_cache, ip);
+	} else
+	if ( hwpc_group_chosen("CACHE") ) {
 		hwpc_group.index[I_cache] = ip;
 		hwpc_group.number[I_cache] = 0;
 
 		if (hwpc_group.platform == "Xeon" ) {
 			hwpc_group.number[I_cache] += 6;
-			papi.s_name[ip] = "LOAD_INS"; papi.events[ip] = PAPI_LD_INS; ip++;
-			papi.s_name[ip] = "STORE_INS"; papi.events[ip] = PAPI_SR_INS; ip++;
+			papi.s_name[ip] = "LOAD_INS"; hwpc_name_to_code( "PAPI_LD_INS", &papi.events[ip]); ip++;
+			papi.s_name[ip] = "STORE_INS"; hwpc_name_to_code( "PAPI_SR_INS", &papi.events[ip]); ip++;
 			papi.s_name[ip] = "MEM_LOAD_UOPS_RETIRED:L1_HIT";
-				my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L1_HIT"; ip++;
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L1_HIT"; ip++;
 			papi.s_name[ip] = "MEM_LOAD_UOPS_RETIRED:HIT_LFB";
-				my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "LFB_HIT"; ip++;
-			papi.s_name[ip] = "L1_TCM"; papi.events[ip] = PAPI_L1_TCM; ip++;
-			papi.s_name[ip] = "L2_TCM"; papi.events[ip] = PAPI_L2_TCM; ip++;
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "LFB_HIT"; ip++;
+			papi.s_name[ip] = "L1_TCM"; hwpc_name_to_code( "PAPI_L1_TCM", &papi.events[ip]); ip++;
+			papi.s_name[ip] = "L2_TCM"; hwpc_name_to_code( "PAPI_L2_TCM", &papi.events[ip]); ip++;
 			//	"L2_RQSTS:DEMAND_DATA_RD_HIT" and "L2_RQSTS:PF_HIT" maybe more precise for cache hit/miss rate???
 			//	We skip showing L3 here
-			//	papi.s_name[ip] = "L3_TCM"; papi.events[ip] = PAPI_L3_TCM; ip++;
+			//	papi.s_name[ip] = "L3_TCM"; hwpc_name_to_code( "PAPI_L3_TCM", &papi.events[ip]); ip++;
 		} else
 
 		if (hwpc_group.platform == "SPARC64" ) {
@@ -698,46 +1009,48 @@ void PerfWatch::createPapiCounterList ()
 			if (hwpc_group.i_platform == 8 || hwpc_group.i_platform == 9 ) {
 				hwpc_group.number[I_cache] += 2;
 				papi.s_name[ip] = "LOAD_STORE_INSTRUCTIONS";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "LD+ST"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "LD+ST"; ip++;
 				papi.s_name[ip] = "SIMD_LOAD_STORE_INSTRUCTIONS";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SIMD_LDST"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SIMD_LDST"; ip++;
 			}
 			else if (hwpc_group.i_platform == 11 ) {
 				hwpc_group.number[I_cache] += 3;
 				papi.s_name[ip] = "LOAD_STORE_INSTRUCTIONS";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "LD+ST"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "LD+ST"; ip++;
 				papi.s_name[ip] = "SIMD_LOAD_STORE_INSTRUCTIONS";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "2SIMD_LDST"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "2SIMD_LDST"; ip++;
 				papi.s_name[ip] = "4SIMD_LOAD_STORE_INSTRUCTIONS";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "4SIMD_LDST"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "4SIMD_LDST"; ip++;
 			}
 			hwpc_group.number[I_cache] += 2;
-			papi.s_name[ip] = "L1_TCM"; papi.events[ip] = PAPI_L1_TCM; ip++;
-			papi.s_name[ip] = "L2_TCM"; papi.events[ip] = PAPI_L2_TCM; ip++;
+			papi.s_name[ip] = "L1_TCM"; hwpc_name_to_code( "PAPI_L1_TCM", &papi.events[ip]); ip++;
+			papi.s_name[ip] = "L2_TCM"; hwpc_name_to_code( "PAPI_L2_TCM", &papi.events[ip]); ip++;
 		} else
 
 		if (hwpc_group.platform == "A64FX" ) {
 			if (hwpc_group.i_platform == 21 ) {
 			hwpc_group.number[I_cache] += 5;
-			papi.s_name[ip] = "LOAD_INS"; papi.events[ip] = PAPI_LD_INS; ip++;	// == "LD_SPEC";
-			papi.s_name[ip] = "STORE_INS"; papi.events[ip] = PAPI_SR_INS; ip++;	// == "ST_SPEC";
+			papi.s_name[ip] = "LOAD_INS"; hwpc_name_to_code( "PAPI_LD_INS", &papi.events[ip]); ip++;	// == "LD_SPEC";
+			papi.s_name[ip] = "STORE_INS"; hwpc_name_to_code( "PAPI_SR_INS", &papi.events[ip]); ip++;	// == "ST_SPEC";
 			papi.s_name[ip] = "PAPI_L1_DCH";
-				my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L1_HIT"; ip++;
-			papi.s_name[ip] = "L1_TCM"; papi.events[ip] = PAPI_L1_TCM; ip++;
-			papi.s_name[ip] = "L2_TCM"; papi.events[ip] = PAPI_L2_TCM; ip++;
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "L1_HIT"; ip++;
+			papi.s_name[ip] = "L1_TCM"; hwpc_name_to_code( "PAPI_L1_TCM", &papi.events[ip]); ip++;
+			papi.s_name[ip] = "L2_TCM"; hwpc_name_to_code( "PAPI_L2_TCM", &papi.events[ip]); ip++;
 			}
 		}
 	}
 
-	else
 // if (CYCLE)
-	if ( hwpc_group.env_str_hwpc == "CYCLE" ) {
+	if ( hwpc_group_chosen("CYCLE") && hwpc_table_group_of(I_cycle) != NULL ) {
+		hwpc_table_add_events (I_cycle, ip);
+	} else
+	if ( hwpc_group_chosen("CYCLE") ) {
 		hwpc_group.index[I_cycle] = ip;
 		hwpc_group.number[I_cycle] = 0;
 
 		hwpc_group.number[I_cycle] += 2;
-		papi.s_name[ip] = "TOT_CYC"; papi.events[ip] = PAPI_TOT_CYC; ip++;
-		papi.s_name[ip] = "TOT_INS"; papi.events[ip] = PAPI_TOT_INS; ip++;
+		papi.s_name[ip] = "TOT_CYC"; hwpc_name_to_code( "PAPI_TOT_CYC", &papi.events[ip]); ip++;
+		papi.s_name[ip] = "TOT_INS"; hwpc_name_to_code( "PAPI_TOT_INS", &papi.events[ip]); ip++;
 
 		if (hwpc_group.platform == "Xeon" ) {
 			;
@@ -749,31 +1062,33 @@ void PerfWatch::createPapiCounterList ()
 			if (hwpc_group.i_platform == 21 ) {
 				hwpc_group.number[I_cycle] += 2;
 				papi.s_name[ip] = "PAPI_FP_INS";
-				my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "FP_inst"; ip++;
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "FP_inst"; ip++;
 				papi.s_name[ip] = "PAPI_FMA_INS";
-				my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "FMA_inst"; ip++;
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "FMA_inst"; ip++;
 			}
 		}
 	}
 
-	else
 // if (LOADSTORE)
-	if ( hwpc_group.env_str_hwpc == "LOADSTORE" ) {
+	if ( hwpc_group_chosen("LOADSTORE") && hwpc_table_group_of(I_loadstore) != NULL ) {
+		hwpc_table_add_events (I_loadstore, ip);
+	} else
+	if ( hwpc_group_chosen("LOADSTORE") ) {
 		hwpc_group.index[I_loadstore] = ip;
 		hwpc_group.number[I_loadstore] = 0;
 
 		if (hwpc_group.platform == "Xeon" ) {
 			hwpc_group.number[I_loadstore] = +2;
-			papi.s_name[ip] = "LOAD_INS"; papi.events[ip] = PAPI_LD_INS; ip++;
-			papi.s_name[ip] = "STORE_INS"; papi.events[ip] = PAPI_SR_INS; ip++;
+			papi.s_name[ip] = "LOAD_INS"; hwpc_name_to_code( "PAPI_LD_INS", &papi.events[ip]); ip++;
+			papi.s_name[ip] = "STORE_INS"; hwpc_name_to_code( "PAPI_SR_INS", &papi.events[ip]); ip++;
 
 			if (hwpc_group.i_platform >= 2 && hwpc_group.i_platform <= 4 ) {
 				// memory write operation via writeback and streaming-store for Sandybridge and Ivybridge
 				hwpc_group.number[I_loadstore] += 2;
 				papi.s_name[ip] = "OFFCORE_RESPONSE_0:WB:ANY_RESPONSE";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "WBACK_MEM"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "WBACK_MEM"; ip++;
 				papi.s_name[ip] = "OFFCORE_RESPONSE_0:STRM_ST:L3_MISS:SNP_ANY";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "STRMS_MEM"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "STRMS_MEM"; ip++;
 			} else {
 				// The writeback and streaming-store events (WB and STRMS) are deleted on Skylake, somehow...
 			}
@@ -783,18 +1098,18 @@ void PerfWatch::createPapiCounterList ()
 			if (hwpc_group.i_platform == 8 || hwpc_group.i_platform == 9 ) {
 				hwpc_group.number[I_loadstore] += 2;
 				papi.s_name[ip] = "LOAD_STORE_INSTRUCTIONS";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "LD+ST"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "LD+ST"; ip++;
 				papi.s_name[ip] = "SIMD_LOAD_STORE_INSTRUCTIONS";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SIMDLD+ST"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SIMDLD+ST"; ip++;
 			}
 			else if (hwpc_group.i_platform == 11 ) {
 				hwpc_group.number[I_loadstore] += 3;
 				papi.s_name[ip] = "LOAD_STORE_INSTRUCTIONS";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "LD+ST"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "LD+ST"; ip++;
 				papi.s_name[ip] = "SIMD_LOAD_STORE_INSTRUCTIONS";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "2SIMD_LDST"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "2SIMD_LDST"; ip++;
 				papi.s_name[ip] = "4SIMD_LOAD_STORE_INSTRUCTIONS";
-					my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "4SIMD_LDST"; ip++;
+					hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "4SIMD_LDST"; ip++;
 			}
 		} else
 
@@ -802,24 +1117,146 @@ void PerfWatch::createPapiCounterList ()
 		if (hwpc_group.platform == "A64FX" ) {
 			if (hwpc_group.i_platform == 21 ) {
 			hwpc_group.number[I_loadstore] += 8;
-			papi.s_name[ip] = "LOAD_INS"; papi.events[ip] = PAPI_LD_INS; ip++;
-			papi.s_name[ip] = "STORE_INS"; papi.events[ip] = PAPI_SR_INS; ip++;
+			papi.s_name[ip] = "LOAD_INS"; hwpc_name_to_code( "PAPI_LD_INS", &papi.events[ip]); ip++;
+			papi.s_name[ip] = "STORE_INS"; hwpc_name_to_code( "PAPI_SR_INS", &papi.events[ip]); ip++;
 			papi.s_name[ip] = "ASE_SVE_LD_SPEC";
-			my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SVE_LOAD"; ip++;
+			hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SVE_LOAD"; ip++;
 			papi.s_name[ip] = "ASE_SVE_ST_SPEC";
-			my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SVE_STORE"; ip++;
+			hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SVE_STORE"; ip++;
 			papi.s_name[ip] = "ASE_SVE_LD_MULTI_SPEC";
-			my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SVE_SMV_LD"; ip++;
+			hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SVE_SMV_LD"; ip++;
 			papi.s_name[ip] = "ASE_SVE_ST_MULTI_SPEC";
-			my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SVE_SMV_ST"; ip++;
+			hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SVE_SMV_ST"; ip++;
 			papi.s_name[ip] = "SVE_LD_GATHER_SPEC";
-			my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "GATHER_LD"; ip++;
+			hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "GATHER_LD"; ip++;
 			papi.s_name[ip] = "SVE_ST_SCATTER_SPEC";
-			my_papi_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SCATTER_ST"; ip++;
+			hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "SCATTER_ST"; ip++;
 			}
 		}
 	}
 
+// if (TOPDOWN)
+	if ( hwpc_group_chosen("TOPDOWN") && hwpc_table_group_of(I_topdown) != NULL ) {
+		hwpc_table_add_events (I_topdown, ip);
+	} else
+	if ( hwpc_group_chosen("TOPDOWN") ) {
+		hwpc_group.index[I_topdown] = ip;
+		hwpc_group.number[I_topdown] = 0;
+
+		// top-down level 1 of Haswell, Broadwell and Skylake. 4 issue slots per cycle
+		if (hwpc_group.platform == "Xeon" && hwpc_group.i_platform >= 3 && hwpc_group.i_platform <= 5 ) {
+			hwpc_group.number[I_topdown] += 5;
+			papi.s_name[ip] = "TOT_CYC"; hwpc_name_to_code( "PAPI_TOT_CYC", &papi.events[ip]); ip++;
+			papi.s_name[ip] = "IDQ_UOPS_NOT_DELIVERED:CORE";
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "NOT_DLVD"; ip++;
+			papi.s_name[ip] = "UOPS_ISSUED:ANY";
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "UOPS_ISSUE"; ip++;
+			papi.s_name[ip] = "UOPS_RETIRED:RETIRE_SLOTS";
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "RET_SLOTS"; ip++;
+			papi.s_name[ip] = "INT_MISC:RECOVERY_CYCLES";
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "RECOV_CYC"; ip++;
+		}
+		if (hwpc_group.number[I_topdown] == 0 && my_rank == 0) {
+			fprintf(stderr, "*** PMlib warning. HWPC_CHOOSER=TOPDOWN is not supported on this CPU. Define it with PMLIB_HWPC_TABLE.\n");
+		}
+	}
+
+// if (TLB)
+	if ( hwpc_group_chosen("TLB") && hwpc_table_group_of(I_tlb) != NULL ) {
+		hwpc_table_add_events (I_tlb, ip);
+	} else
+	if ( hwpc_group_chosen("TLB") ) {
+		hwpc_group.index[I_tlb] = ip;
+		hwpc_group.number[I_tlb] = 0;
+
+		if (hwpc_group.platform == "Xeon" && hwpc_group.i_platform >= 3 && hwpc_group.i_platform <= 5 ) {
+			hwpc_group.number[I_tlb] += 5;
+			papi.s_name[ip] = "TOT_INS"; hwpc_name_to_code( "PAPI_TOT_INS", &papi.events[ip]); ip++;
+			papi.s_name[ip] = "DTLB_LOAD_MISSES:MISS_CAUSES_A_WALK";
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "LD_WALK"; ip++;
+			papi.s_name[ip] = "DTLB_STORE_MISSES:MISS_CAUSES_A_WALK";
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "ST_WALK"; ip++;
+			// the page walk cycles are WALK_DURATION on Haswell and Broadwell, WALK_ACTIVE on Skylake
+			if (hwpc_group.i_platform == 5 ) {
+			papi.s_name[ip] = "DTLB_LOAD_MISSES:WALK_ACTIVE";
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "LD_WALK_C"; ip++;
+			papi.s_name[ip] = "DTLB_STORE_MISSES:WALK_ACTIVE";
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "ST_WALK_C"; ip++;
+			} else {
+			papi.s_name[ip] = "DTLB_LOAD_MISSES:WALK_DURATION";
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "LD_WALK_C"; ip++;
+			papi.s_name[ip] = "DTLB_STORE_MISSES:WALK_DURATION";
+				hwpc_name_to_code( papi.s_name[ip].c_str(), &papi.events[ip]); papi.s_name[ip] = "ST_WALK_C"; ip++;
+			}
+		}
+		if (hwpc_group.number[I_tlb] == 0 && my_rank == 0) {
+			fprintf(stderr, "*** PMlib warning. HWPC_CHOOSER=TLB is not supported on this CPU. Define it with PMLIB_HWPC_TABLE.\n");
+		}
+	}
+
+// if (CUSTOM)
+	if ( hwpc_group.env_str_hwpc == "CUSTOM" ) {
+		hwpc_group.index[I_custom] = ip;
+		hwpc_group.number[I_custom] = 0;
+
+		// HWPC_CHOOSER=CUSTOM:EV1,EV2,... PAPI preset, native or perf raw (r<hex>) event names
+		std::string s_list = hwpc_group.custom_events;
+		size_t i_begin = 0;
+		while (i_begin <= s_list.size()) {
+			size_t i_end = s_list.find(',', i_begin);
+			if (i_end == string::npos) i_end = s_list.size();
+			std::string s_event = s_list.substr(i_begin, i_end-i_begin);
+			i_begin = i_end + 1;
+			s_event.erase(0, s_event.find_first_not_of(" \t"));
+			s_event.erase(s_event.find_last_not_of(" \t")+1);
+			if (s_event.empty()) continue;
+
+			if (hwpc_group.number[I_custom] >= Max_custom_events) {
+				if (my_rank == 0) {
+				fprintf(stderr, "*** PMlib warning. HWPC_CHOOSER=CUSTOM accepts up to %d events. [%s] and the rest are ignored.\n",
+					Max_custom_events, s_event.c_str());
+				}
+				break;
+			}
+			int i_code = PM_HWPC_NO_EVENT;
+			hwpc_name_to_code( s_event.c_str(), &i_code);
+			// the unknown event has been warned by hwpc_name_to_code() and is left out
+			if (i_code == PM_HWPC_NO_EVENT) continue;
+			if (s_event.compare(0, 5, "PAPI_") == 0) s_event = s_event.substr(5);
+			papi.s_name[ip] = s_event; papi.events[ip] = i_code; ip++;
+			hwpc_group.number[I_custom]++;
+		}
+		if (hwpc_group.number[I_custom] == 0 && my_rank == 0) {
+			fprintf(stderr, "*** PMlib warning. HWPC_CHOOSER=CUSTOM has no valid event. HWPC is not reported.\n");
+		}
+	}
+
+
+// the multiplexed groups which do not fit in the arrays are dropped from the tail.
+//	Each group reports its events, up to 4 derived values and the [%scaled] column.
+	if (hwpc_group.n_multiplex > 1) {
+		int n_sorted = 0;
+		for (int i=0; i<ip; ) {
+			int i_group = -1;
+			for (int j=0; j<Max_hwpc_output_group; j++) {
+				if (hwpc_group.number[j] > 0 && hwpc_group.index[j] == i) i_group = j;
+			}
+			if (i_group < 0) break;
+			n_sorted += hwpc_group.number[i_group] + 5;
+			if (n_sorted > Max_chooser_events) {
+				if (my_rank == 0) {
+				fprintf(stderr, "*** PMlib warning. HWPC_CHOOSER=%s has too many events to multiplex. The groups from the event [%s] are dropped.\n",
+					hwpc_group.env_str_hwpc.c_str(), papi.s_name[i].c_str());
+				}
+				for (int j=0; j<Max_hwpc_output_group; j++) {
+					if (hwpc_group.number[j] > 0 && hwpc_group.index[j] >= i) hwpc_group.number[j] = 0;
+				}
+				ip = i;
+				break;
+			}
+			i += hwpc_group.number[i_group];
+		}
+	}
 
 // total number of traced events by PMlib
 	papi.num_events = ip;
@@ -851,7 +1288,14 @@ void PerfWatch::createPapiCounterList ()
 		}
 	}
 	#endif
-#endif // USE_PAPI
+#endif // USE_HWPC
+}
+
+
+  /// whether the group is evaluated by sortPapiCounterList(i_only)
+static inline bool is_sorted_group (int i_group, int i_only)
+{
+	return (i_only < 0 || i_group == i_only);
 }
 
 
@@ -866,17 +1310,20 @@ void PerfWatch::createPapiCounterList ()
   /// PerfMonitor::postTrace() -> ditto
 
   ///   PerfWatch::printDetailThreads() -> gatherHWPC() -> sortPapiCounterList()
-  ///   PerfWatch::stop() -> sortPapiCounterList()	// special case when using OTF (#ifdef USE_OTF)
+  ///   PerfWatch::stop() -> traceRate() -> sortPapiCounterList(i_group)	// OTF and PMLIB_TRACE=full
+  ///
+  ///   @param[in] i_group  hwpc_output_group to be sorted alone, or -1 (default) for all the groups.
+  ///	Only the group is evaluated in its place if the groups have been sorted once,
+  ///	and the sorted values of the other groups are left as they are.
   ///
 
-void PerfWatch::sortPapiCounterList (void)
+void PerfWatch::sortPapiCounterList (int i_group)
 {
-#ifdef USE_PAPI
+#ifdef USE_HWPC
 
-	int ip, jp, kp;
+	int ip, jp, js, kp;
 	double counts;
-	double perf_rate=0.0;
-	if ( m_time > 0.0 ) { perf_rate = 1.0/m_time; }
+	double perf_rate=0.0;	// per the time the group was counted
 
 #ifdef DEBUG_PRINT_PAPI
 //	#pragma omp barrier
@@ -893,12 +1340,30 @@ void PerfWatch::sortPapiCounterList (void)
 //	}
 #endif
 
+	// The groups are sorted one after another when multiplexed.
+	// js is the first sorted position of the group being processed.
+	int i_only = -1;
+	if (i_group >= 0 && i_group < Max_hwpc_output_group && my_papi.sorted_number[i_group] > 0) {
+		i_only = i_group;
+		jp = my_papi.sorted_index[i_group];
+	} else {
+	jp=0;
+	for (int i=0; i<Max_hwpc_output_group; i++) {
+		my_papi.sorted_index[i] = 0;
+		my_papi.sorted_number[i] = 0;
+	}
+	}
+
 // if (FLOPS)
-	if ( hwpc_group.number[I_flops] > 0 ) {
+	if ( is_sorted_group(I_flops, i_only) && hwpc_group.number[I_flops] > 0 && hwpc_table_group_of(I_flops) != NULL ) {
+		jp = sortTableCounters(I_flops, jp);
+	} else
+	if ( is_sorted_group(I_flops, i_only) && hwpc_group.number[I_flops] > 0 ) {
+		perf_rate = (groupTime(I_flops) > 0.0) ? 1.0/groupTime(I_flops) : 0.0;
 		double d_flops, d_peak_normal, d_peak_ratio;
 		counts=0.0;
 		ip = hwpc_group.index[I_flops];
-		jp=0;
+		js=jp;
 
 		for(int i=0; i<hwpc_group.number[I_flops]; i++)
 		{
@@ -919,11 +1384,15 @@ void PerfWatch::sortPapiCounterList (void)
 		my_papi.s_sorted[jp] = "[%Peak] ";
 		my_papi.v_sorted[jp] = d_peak_ratio * 100.0; 	//	percentage
 		jp++;
+		jp = appendMuxScaled(I_flops, js, jp);
 	}
 
-	else
 // if (BANDWIDTH)
-	if ( hwpc_group.number[I_bandwidth] > 0 ) {
+	if ( is_sorted_group(I_bandwidth, i_only) && hwpc_group.number[I_bandwidth] > 0 && hwpc_table_group_of(I_bandwidth) != NULL ) {
+		jp = sortTableCounters(I_bandwidth, jp);
+	} else
+	if ( is_sorted_group(I_bandwidth, i_only) && hwpc_group.number[I_bandwidth] > 0 ) {
+		perf_rate = (groupTime(I_bandwidth) > 0.0) ? 1.0/groupTime(I_bandwidth) : 0.0;
 		double d_load_ins, d_store_ins;
 		double d_load_store, d_simd_load_store, d_xsimd_load_store;
 		double d_hit_L2, d_miss_L2;
@@ -935,7 +1404,7 @@ void PerfWatch::sortPapiCounterList (void)
 
 		counts = 0.0;
 		ip = hwpc_group.index[I_bandwidth];
-		jp=0;
+		js=jp;
 		for(int i=0; i<hwpc_group.number[I_bandwidth]; i++)
 		{
 			my_papi.s_sorted[jp] = my_papi.s_name[ip] ;
@@ -1047,11 +1516,14 @@ void PerfWatch::sortPapiCounterList (void)
 			}
 		}
 
+		jp = appendMuxScaled(I_bandwidth, js, jp);
 	}
 
-	else
 // if (VECTOR)
-	if ( hwpc_group.number[I_vector] > 0 ) {
+	if ( is_sorted_group(I_vector, i_only) && hwpc_group.number[I_vector] > 0 && hwpc_table_group_of(I_vector) != NULL ) {
+		jp = sortTableCounters(I_vector, jp);
+	} else
+	if ( is_sorted_group(I_vector, i_only) && hwpc_group.number[I_vector] > 0 ) {
 		double fp_sp1, fp_sp2, fp_sp4, fp_sp8, fp_sp16;
 		double fp_dp1, fp_dp2, fp_dp4, fp_dp8, fp_dp16;
 		double fp_total, fp_vector;
@@ -1063,7 +1535,7 @@ void PerfWatch::sortPapiCounterList (void)
 		fp_total = 1.0;
 		counts = 0.0;
 		ip = hwpc_group.index[I_vector];
-		jp=0;
+		js=jp;
 		for(int i=0; i<hwpc_group.number[I_vector]; i++)
 		{
 			my_papi.s_sorted[jp] = my_papi.s_name[ip] ;
@@ -1198,8 +1670,8 @@ void PerfWatch::sortPapiCounterList (void)
 				fp_total  = fp_dp1 + fp_sp1 + fp_dpv + fp_spv ;
 
 			// correction of v_sorted values
-				my_papi.v_sorted[ip] = fp_dpv;
-				my_papi.v_sorted[ip+2] = fp_spv;
+				my_papi.v_sorted[js] = fp_dpv;
+				my_papi.v_sorted[js+2] = fp_spv;
 
 			}
 			// calculate vector_percent for both of exclusive and inclusive sections
@@ -1219,18 +1691,21 @@ void PerfWatch::sortPapiCounterList (void)
 		my_papi.v_sorted[jp] = vector_percent * 100.0;
 		jp++;
 
+		jp = appendMuxScaled(I_vector, js, jp);
 	}
 
-	else
 // if (CACHE)
-	if ( hwpc_group.number[I_cache] > 0 ) {
+	if ( is_sorted_group(I_cache, i_only) && hwpc_group.number[I_cache] > 0 && hwpc_table_group_of(I_cache) != NULL ) {
+		jp = sortTableCounters(I_cache, jp);
+	} else
+	if ( is_sorted_group(I_cache, i_only) && hwpc_group.number[I_cache] > 0 ) {
 		double d_load_ins, d_store_ins;
 		double d_load_store, d_simd_load_store, d_xsimd_load_store;
 		double d_hit_LFB, d_hit_L1, d_miss_L1, d_miss_L2, d_miss_L3;
 		double d_L1_ratio, d_L2_ratio, d_cache_transaction;
 
 		ip = hwpc_group.index[I_cache];
-		jp=0;
+		js=jp;
 		for(int i=0; i<hwpc_group.number[I_cache]; i++)
 		{
 			my_papi.s_sorted[jp] = my_papi.s_name[ip] ;
@@ -1338,15 +1813,18 @@ void PerfWatch::sortPapiCounterList (void)
 		my_papi.v_sorted[jp] = (d_L1_ratio + d_L2_ratio) * 100.0;
 		jp++;
 
+		jp = appendMuxScaled(I_cache, js, jp);
 	}
 
-	else
 // if (CYCLE)
-	if ( hwpc_group.number[I_cycle] > 0 ) {
+	if ( is_sorted_group(I_cycle, i_only) && hwpc_group.number[I_cycle] > 0 && hwpc_table_group_of(I_cycle) != NULL ) {
+		jp = sortTableCounters(I_cycle, jp);
+	} else
+	if ( is_sorted_group(I_cycle, i_only) && hwpc_group.number[I_cycle] > 0 ) {
 		double d_fp_ins, d_fma_ins, fma_percent;
 
 		ip = hwpc_group.index[I_cycle];
-		jp=0;
+		js=jp;
 		for(int i=0; i<hwpc_group.number[I_cycle] ; i++)
 		{
 			my_papi.s_sorted[jp] = my_papi.s_name[ip] ;
@@ -1375,18 +1853,21 @@ void PerfWatch::sortPapiCounterList (void)
 		//	events[0] = PAPI_TOT_CYC;
 		//	events[1] = PAPI_TOT_INS;
 		my_papi.s_sorted[jp] = "[Ins/cyc]" ;
-		if ( my_papi.v_sorted[ip] > 0.0 ) {
-			my_papi.v_sorted[jp] = my_papi.v_sorted[ip+1] / my_papi.v_sorted[ip];
+		if ( my_papi.v_sorted[js] > 0.0 ) {
+			my_papi.v_sorted[jp] = my_papi.v_sorted[js+1] / my_papi.v_sorted[js];
 		} else {
 			my_papi.v_sorted[jp] = 0.0;
 		}
 		jp++;
+		jp = appendMuxScaled(I_cycle, js, jp);
 	}
 
-	else
 // if (LOADSTORE)
-
-	if ( hwpc_group.number[I_loadstore] > 0 ) {
+	if ( is_sorted_group(I_loadstore, i_only) && hwpc_group.number[I_loadstore] > 0 && hwpc_table_group_of(I_loadstore) != NULL ) {
+		jp = sortTableCounters(I_loadstore, jp);
+	} else
+	if ( is_sorted_group(I_loadstore, i_only) && hwpc_group.number[I_loadstore] > 0 ) {
+		perf_rate = (groupTime(I_loadstore) > 0.0) ? 1.0/groupTime(I_loadstore) : 0.0;
 		double d_load_ins, d_store_ins, d_load_store_ins, d_simd_load_store_ins;
 		double d_writeback_MEM, d_streaming_MEM;
 		double bandwidth;
@@ -1394,7 +1875,7 @@ void PerfWatch::sortPapiCounterList (void)
 		double vector_percent;
 		counts = 0.0;
 		ip = hwpc_group.index[I_loadstore];
-		jp=0;
+		js=jp;
 		for(int i=0; i<hwpc_group.number[I_loadstore]; i++)
 		{
 			my_papi.s_sorted[jp] = my_papi.s_name[ip] ;
@@ -1446,10 +1927,106 @@ void PerfWatch::sortPapiCounterList (void)
 		my_papi.s_sorted[jp] = "[Vector %]" ;
 		my_papi.v_sorted[jp] = vector_percent * 100.0;
 		jp++;
+		jp = appendMuxScaled(I_loadstore, js, jp);
+	}
+
+// if (TOPDOWN)
+	if ( is_sorted_group(I_topdown, i_only) && hwpc_group.number[I_topdown] > 0 && hwpc_table_group_of(I_topdown) != NULL ) {
+		jp = sortTableCounters(I_topdown, jp);
+	} else
+	if ( is_sorted_group(I_topdown, i_only) && hwpc_group.number[I_topdown] > 0 ) {
+		double d_slots, d_not_delivered, d_issued, d_retired, d_recovery;
+		double d_frontend, d_badspec, d_retiring;
+		ip = hwpc_group.index[I_topdown];
+		js=jp;
+		for(int i=0; i<hwpc_group.number[I_topdown]; i++)
+		{
+			my_papi.s_sorted[jp] = my_papi.s_name[ip] ;
+			my_papi.v_sorted[jp] = my_papi.accumu[ip] ;
+			ip++;jp++;
+		}
+		ip = hwpc_group.index[I_topdown];
+
+		//	the fractions of the issue slots, 4 slots per cycle
+		d_slots         = 4.0 * my_papi.accumu[ip] ;	//	PAPI_TOT_CYC
+		d_not_delivered = my_papi.accumu[ip+1] ;	//	IDQ_UOPS_NOT_DELIVERED:CORE
+		d_issued        = my_papi.accumu[ip+2] ;	//	UOPS_ISSUED:ANY
+		d_retired       = my_papi.accumu[ip+3] ;	//	UOPS_RETIRED:RETIRE_SLOTS
+		d_recovery      = my_papi.accumu[ip+4] ;	//	INT_MISC:RECOVERY_CYCLES
+		if ( d_slots > 0.0 ) {
+			d_frontend = d_not_delivered / d_slots;
+			d_badspec  = (d_issued - d_retired + 4.0 * d_recovery) / d_slots;
+			d_retiring = d_retired / d_slots;
+		} else {
+			d_frontend = d_badspec = d_retiring = 0.0;
+		}
+		my_papi.s_sorted[jp] = "[Front%]" ;
+		my_papi.v_sorted[jp] = d_frontend * 100.0;
+		jp++;
+		my_papi.s_sorted[jp] = "[BadSpec%]" ;
+		my_papi.v_sorted[jp] = d_badspec * 100.0;
+		jp++;
+		my_papi.s_sorted[jp] = "[Retire%]" ;
+		my_papi.v_sorted[jp] = d_retiring * 100.0;
+		jp++;
+		my_papi.s_sorted[jp] = "[Backend%]" ;
+		my_papi.v_sorted[jp] = (d_slots > 0.0) ? (1.0 - d_frontend - d_badspec - d_retiring) * 100.0 : 0.0;
+		jp++;
+		jp = appendMuxScaled(I_topdown, js, jp);
+	}
+
+// if (TLB)
+	if ( is_sorted_group(I_tlb, i_only) && hwpc_group.number[I_tlb] > 0 && hwpc_table_group_of(I_tlb) != NULL ) {
+		jp = sortTableCounters(I_tlb, jp);
+	} else
+	if ( is_sorted_group(I_tlb, i_only) && hwpc_group.number[I_tlb] > 0 ) {
+		double d_kilo_ins, d_walks, d_walk_cycles;
+		ip = hwpc_group.index[I_tlb];
+		js=jp;
+		for(int i=0; i<hwpc_group.number[I_tlb]; i++)
+		{
+			my_papi.s_sorted[jp] = my_papi.s_name[ip] ;
+			my_papi.v_sorted[jp] = my_papi.accumu[ip] ;
+			ip++;jp++;
+		}
+		ip = hwpc_group.index[I_tlb];
+
+		//	per kilo instructions
+		d_kilo_ins    = my_papi.accumu[ip] / 1000.0 ;	//	PAPI_TOT_INS
+		d_walks       = my_papi.accumu[ip+1] + my_papi.accumu[ip+2] ;	//	load and store misses causing a walk
+		d_walk_cycles = my_papi.accumu[ip+3] + my_papi.accumu[ip+4] ;	//	load and store page walk cycles
+		my_papi.s_sorted[jp] = "[Miss/KI]" ;
+		my_papi.v_sorted[jp] = (d_kilo_ins > 0.0) ? d_walks / d_kilo_ins : 0.0;
+		jp++;
+		my_papi.s_sorted[jp] = "[WalkC/KI]" ;
+		my_papi.v_sorted[jp] = (d_kilo_ins > 0.0) ? d_walk_cycles / d_kilo_ins : 0.0;
+		jp++;
+		jp = appendMuxScaled(I_tlb, js, jp);
+	}
+
+// if (CUSTOM)
+	if ( is_sorted_group(I_custom, i_only) && hwpc_group.number[I_custom] > 0 ) {
+		perf_rate = (groupTime(I_custom) > 0.0) ? 1.0/groupTime(I_custom) : 0.0;
+		// the raw counts followed by their rates per second
+		ip = hwpc_group.index[I_custom];
+		js=jp;
+		for(int i=0; i<hwpc_group.number[I_custom]; i++)
+		{
+			my_papi.s_sorted[jp] = my_papi.s_name[ip] ;
+			my_papi.v_sorted[jp] = my_papi.accumu[ip] ;
+			ip++;jp++;
+		}
+		for(int i=0; i<hwpc_group.number[I_custom]; i++)
+		{
+			my_papi.s_sorted[jp] = "[/sec]" ;
+			my_papi.v_sorted[jp] = my_papi.v_sorted[js+i] * perf_rate ;
+			jp++;
+		}
+		jp = appendMuxScaled(I_custom, js, jp);
 	}
     	
 // count the number of reported events and derived matrices
-	my_papi.num_sorted = jp;
+	if (i_only < 0) my_papi.num_sorted = jp;
 
 #ifdef DEBUG_PRINT_PAPI_THREADS
 	#pragma omp barrier
@@ -1466,7 +2043,90 @@ void PerfWatch::sortPapiCounterList (void)
 	}
 #endif
 
-#endif // USE_PAPI
+#endif // USE_HWPC
+}
+
+
+
+  /// Sort the events of the group defined by the HWPC event table, and evaluate its metrics
+  ///
+  ///   @param[in] i_group  hwpc_output_group of the group
+  ///   @param[in] jp  first sorted position of the group
+  ///   @return  next sorted position
+  ///
+  /// @note  the metrics are computed from the accumulated counts and the time the group was counted
+  ///
+int PerfWatch::sortTableCounters (int i_group, int jp)
+{
+#ifdef USE_HWPC
+	const hwpc_table_group* g = hwpc_table_group_of(i_group);
+	double counts[Max_table_events];
+	double metrics[Max_table_metrics];
+	int ip = hwpc_group.index[i_group];
+	int js = jp;
+
+	for (int i=0; i<Max_table_events; i++) counts[i] = 0.0;
+	for (int i=0; i<hwpc_group.number[i_group]; i++)
+	{
+		my_papi.s_sorted[jp] = my_papi.s_name[ip] ;
+		counts[i] = my_papi.v_sorted[jp] = my_papi.accumu[ip] ;
+		ip++;jp++;
+	}
+
+	hwpc_table_eval (g, counts, groupTime(i_group), hwpc_group.corePERF, hwpc_group.coreGHz, metrics);
+	for (int i=0; i<g->n_metrics; i++)
+	{
+		my_papi.s_sorted[jp] = g->m_label[i] ;
+		my_papi.v_sorted[jp] = metrics[i] ;
+		jp++;
+	}
+	jp = appendMuxScaled(i_group, js, jp);
+#endif // USE_HWPC
+	return jp;
+}
+
+
+
+  /// Record the sorted range of the group, and append its scaling uncertainty if multiplexed
+  ///
+  ///   @param[in] i_group  hwpc_output_group of the group
+  ///   @param[in] js  first sorted position of the group
+  ///   @param[in] jp  next sorted position
+  ///   @return  next sorted position
+  ///
+  /// @note  [%scaled] is the percentage of the group counts which has been
+  ///	extrapolated from the counted time to the enabled time, i.e. 100*(1-r)
+  ///	with r the smallest running/enabled ratio among the events of the group.
+  ///	The times are those accumulated by the section, see readMuxCoverage().
+  ///	It is reported only if the backend knows the times, i.e. not with papi.
+  ///
+int PerfWatch::appendMuxScaled (int i_group, int js, int jp)
+{
+#ifdef USE_HWPC
+	my_papi.sorted_index[i_group] = js;
+	my_papi.sorted_number[i_group] = jp - js;
+
+	if (hwpc_group.n_multiplex <= 1 || hwpc_backend->coverage == NULL) return jp;
+
+	// the section values of the calling thread if inside of parallel region, otherwise of all the threads
+	int j0 = m_in_parallel ? my_thread : 0;
+	int j1 = m_in_parallel ? my_thread+1 : Max_nthreads;
+	double r = 1.0;
+	int ip = hwpc_group.index[i_group];
+	for (int i=ip; i<ip+hwpc_group.number[i_group]; i++) {
+		double enabled = 0.0;
+		double running = 0.0;
+		for (int j=j0; j<j1; j++) {
+			enabled += my_papi.th_mux[j][2*i];
+			running += my_papi.th_mux[j][2*i+1];
+		}
+		if (enabled > 0.0 && running / enabled < r) r = running / enabled;
+	}
+	my_papi.s_sorted[jp] = "[%scaled]";
+	my_papi.v_sorted[jp] = (1.0 - r) * 100.0;
+	jp++;
+#endif // USE_HWPC
+	return jp;
 }
 
 
@@ -1478,7 +2138,7 @@ void PerfWatch::sortPapiCounterList (void)
   ///
 void PerfWatch::outputPapiCounterHeader (FILE* fp, std::string s_label)
 {
-#ifdef USE_PAPI
+#ifdef USE_HWPC
 
 	fprintf(fp, "Section : %s%s%s\n", s_label.c_str(), m_exclusive? "":" (*)" , m_in_parallel? " (+)":"" );
 
@@ -1496,7 +2156,7 @@ void PerfWatch::outputPapiCounterHeader (FILE* fp, std::string s_label)
 		fprintf (fp, " %10.10s", s.c_str() );
 	} fprintf (fp, "\n");
 
-#endif // USE_PAPI
+#endif // USE_HWPC
 }
 
 
@@ -1507,7 +2167,7 @@ void PerfWatch::outputPapiCounterHeader (FILE* fp, std::string s_label)
   ///
 void PerfWatch::outputPapiCounterList (FILE* fp)
 {
-#ifdef USE_PAPI
+#ifdef USE_HWPC
 	int iret;
 	if (my_rank == 0) {
 	// print the HWPC event values and their derived values
@@ -1520,7 +2180,7 @@ void PerfWatch::outputPapiCounterList (FILE* fp)
 	}
 	}
 
-#endif // USE_PAPI
+#endif // USE_HWPC
 }
 
 
@@ -1532,7 +2192,7 @@ void PerfWatch::outputPapiCounterList (FILE* fp)
   ///
 void PerfWatch::outputPapiCounterGroup (FILE* fp, MPI_Group p_group, int* pp_ranks)
 {
-#ifdef USE_PAPI
+#ifdef USE_HWPC
 	int iret, g_np, ip;
 	iret =
 	MPI_Group_size(p_group, &g_np);
@@ -1551,7 +2211,7 @@ void PerfWatch::outputPapiCounterGroup (FILE* fp, MPI_Group p_group, int* pp_ran
 		fprintf (fp, "\n");
 	}
 	}
-#endif // USE_PAPI
+#endif // USE_HWPC
 }
 
 
@@ -1564,7 +2224,6 @@ void PerfWatch::outputPapiCounterLegend (FILE* fp)
 
 // TODO: We should simplify these too many fprintf() calls into one fprintf() call. sometime...
 
-	const PAPI_hw_info_t *hwinfo = NULL;
 	std::string s_model_string;
 	std::string s_vendor_string;
 	using namespace std;
@@ -1595,25 +2254,28 @@ void PerfWatch::outputPapiCounterLegend (FILE* fp)
 	fprintf(fp, "\t       For this type of parallel construct, the execution time must be interpreted carefully\n");
 	fprintf(fp, "\t       based on the inclusive section stats for that parallel region, and on the thread report.\n");
 	fprintf(fp, "\t       The section without (+) is defined in serial region. It can start parallel region inside.\n");
+	fprintf(fp, "\t       For (+) sections the thread load balance columns show the minimum, average and maximum\n");
+	fprintf(fp, "\t       time among the threads, the imbalance factor max/avg-1, and the slowest thread number\n");
+	fprintf(fp, "\t       (as rank:thread for MPI jobs).\n");
 	fprintf(fp, "\t The sections without any annotation symbols, i.e. exclusive and in serial region,\n");
 	fprintf(fp, "\t are suited to simply nested loop kernels often seen in HPC applications.\n");
 	fprintf(fp, "\n");
 
 
-#ifdef USE_PAPI
+#ifdef USE_HWPC
 	fprintf(fp, "\n    Symbols in PMlib hardware performance counter (HWPC) report:\n" );
-	hwinfo = PAPI_get_hardware_info();
-	if (hwinfo == NULL) {
-		//	fprintf (fp, "\n\t<PAPI_get_hardware_info> failed. \n" );
+	if (hwpc_group.model_string.empty()) {
+		//	the CPU model is detected by createPapiCounterList()
 		fprintf(fp, "\n\t HWPC was not initialized, so automatic CPU detection and HWPC legend was disabled.\n");
 		fprintf(fp, "\t In order to enable HWPC feature, HWPC_CHOOSER env. var. must be set for the job as:\n");
-		fprintf(fp, "\t $ export HWPC_CHOOSER=FLOPS # [FLOPS|BANDWIDTH|VECTOR|CACHE|CYCLE|LOADSTORE]\n\n");
+		fprintf(fp, "\t $ export HWPC_CHOOSER=FLOPS # [FLOPS|BANDWIDTH|VECTOR|CACHE|CYCLE|LOADSTORE|TOPDOWN|TLB|CUSTOM:EV1,EV2,...|G1+G2+...]\n\n");
 		return;
 	}
 
-	s_model_string = hwinfo->model_string;
+	s_model_string = hwpc_group.model_string;
 
 	fprintf(fp, "\t Detected CPU architecture: %s \n", s_model_string.c_str());
+	fprintf(fp, "\t HWPC counter backend: %s \n", hwpc_backend->name);
 	fprintf(fp, "\t The available HWPC_CHOOSER values and their HWPC events for this CPU are shown below.\n");
 	fprintf(fp, "\n");
 
@@ -1642,6 +2304,10 @@ void PerfWatch::outputPapiCounterLegend (FILE* fp)
 	fprintf(fp, "\t\t Total_FP:  total floating point operations\n");
 	fprintf(fp, "\t\t [Flops]:   floating point operations per second \n");
 	fprintf(fp, "\t\t [%%Peak]:   sustained performance over peak performance\n");
+	if (hwpc_group.measuredPERF > 0.0) {
+	fprintf(fp, "\t\t            the peak performance %.2f GFlops per core is given by PMLIB_CALIBRATE\n",
+		hwpc_group.corePERF * 1.0e-9);
+	}
 
 // BANDWIDTH
 	fprintf(fp, "\t HWPC_CHOOSER=BANDWIDTH:\n");
@@ -1815,6 +2481,71 @@ void PerfWatch::outputPapiCounterLegend (FILE* fp)
 	}
 	fprintf(fp, "\t\t [Ins/cyc]: performed instructions per machine clock cycle\n");
 
+// TOPDOWN
+	fprintf(fp, "\t HWPC_CHOOSER=TOPDOWN:\n");
+	if (hwpc_group.platform == "Xeon" && hwpc_group.i_platform >= 3 && hwpc_group.i_platform <= 5 ) {
+	fprintf(fp, "\t\t TOT_CYC:    total cycles. The pipeline has 4 issue slots per cycle\n");
+	fprintf(fp, "\t\t NOT_DLVD:   slots not filled by the frontend while the backend is not stalled\n");
+	fprintf(fp, "\t\t UOPS_ISSUE: micro operations issued to the backend\n");
+	fprintf(fp, "\t\t RET_SLOTS:  slots of the retired micro operations\n");
+	fprintf(fp, "\t\t RECOV_CYC:  cycles recovering from mispredicted branches and machine clears\n");
+	fprintf(fp, "\t\t [Front%%]:   frontend bound. slots not filled by the frontend (%%)\n");
+	fprintf(fp, "\t\t [BadSpec%%]: bad speculation. slots wasted by the canceled operations and the recovery (%%)\n");
+	fprintf(fp, "\t\t [Retire%%]:  retiring. slots of useful work (%%)\n");
+	fprintf(fp, "\t\t [Backend%%]: backend bound. the rest of the slots, stalled by the execution units and memory (%%)\n");
+	} else {
+	fprintf(fp, "\t\t not supported on this CPU unless the HWPC event table defines it.\n");
+	}
+
+// TLB
+	fprintf(fp, "\t HWPC_CHOOSER=TLB:\n");
+	if (hwpc_group.platform == "Xeon" && hwpc_group.i_platform >= 3 && hwpc_group.i_platform <= 5 ) {
+	fprintf(fp, "\t\t TOT_INS:    total instructions\n");
+	fprintf(fp, "\t\t LD_WALK:    data TLB load misses causing a page walk\n");
+	fprintf(fp, "\t\t ST_WALK:    data TLB store misses causing a page walk\n");
+	fprintf(fp, "\t\t LD_WALK_C:  cycles of the page walks by the load misses\n");
+	fprintf(fp, "\t\t ST_WALK_C:  cycles of the page walks by the store misses\n");
+	fprintf(fp, "\t\t [Miss/KI]:  data TLB misses per 1000 instructions\n");
+	fprintf(fp, "\t\t [WalkC/KI]: page walk cycles per 1000 instructions\n");
+	} else {
+	fprintf(fp, "\t\t not supported on this CPU unless the HWPC event table defines it.\n");
+	}
+
+// CUSTOM
+	fprintf(fp, "\t HWPC_CHOOSER=CUSTOM:EV1,EV2,...\n");
+	fprintf(fp, "\t\t Up to %d user specified events, i.e. PAPI preset, native or perf raw (r<hex>) events.\n", Max_custom_events);
+	fprintf(fp, "\t\t EV1 ... EVn: the counted events\n");
+	fprintf(fp, "\t\t [/sec]:     the rates of EV1 ... EVn per second, in the same order\n");
+
+// multiplexed groups
+	fprintf(fp, "\t HWPC_CHOOSER=FLOPS+BANDWIDTH+CACHE (any of the groups above except CUSTOM, joined by '+')\n");
+	fprintf(fp, "\t\t The event groups are time sliced on the counters, and each group is reported in the order above.\n");
+	fprintf(fp, "\t\t The counts are scaled up by the enabled time / the time actually counted.\n");
+	fprintf(fp, "\t\t The Basic Report shows the first group of BANDWIDTH, FLOPS, VECTOR, CACHE, CYCLE, LOADSTORE, TOPDOWN, TLB.\n");
+	fprintf(fp, "\t\t [%%scaled]: percentage of the group counts of the section estimated by the scaling, as the scaling uncertainty.\n");
+	fprintf(fp, "\t\t            0 means the group was always counted. Not supported with the papi backend, which does\n");
+	fprintf(fp, "\t\t            not tell the counted time, and the column is not reported then.\n");
+	fprintf(fp, "\t\t setCounterGroup(\"CACHE\") counts only the named groups until setCounterGroup(\"ALL\").\n");
+	fprintf(fp, "\t\t The groups count only while they are active, and their rates are per the time they were active\n");
+	fprintf(fp, "\t\t in the section. A group which was not active in a section reports 0 for the section.\n");
+
+// event table
+	const char* c_table_groups[] = { "FLOPS", "BANDWIDTH", "VECTOR", "CACHE", "CYCLE", "LOADSTORE", "TOPDOWN", "TLB" };
+	const int i_table_groups[] = { I_flops, I_bandwidth, I_vector, I_cache, I_cycle, I_loadstore, I_topdown, I_tlb };
+	for (int k=0; k<8; k++) {
+		const hwpc_table_group* g = hwpc_table_group_of(i_table_groups[k]);
+		if (g == NULL) continue;
+	fprintf(fp, "\t HWPC_CHOOSER=%s: defined by the HWPC event table (%s), instead of the above.\n",
+		c_table_groups[k], hwpc_table_source().c_str());
+		for (int i=0; i<g->n_events; i++) {
+	fprintf(fp, "\t\t %-10s %s%s\n", g->label[i].c_str(), hwpc_table_event_name(g, i, hwpc_backend->name).c_str(),
+		(g->scope[i] == I_scope_node) ? " (node shared)" : (g->scope[i] == I_scope_socket) ? " (socket shared)" : "");
+		}
+		for (int i=0; i<g->n_metrics; i++) {
+	fprintf(fp, "\t\t %-10s = %s\n", g->m_label[i].c_str(), g->m_text[i].c_str());
+		}
+	}
+
 // USER
 	fprintf(fp, "\t HWPC_CHOOSER=USER:\n");
 	fprintf(fp, "\t\t User provided argument values (Arithmetic Workload) are accumulated and reported.\n");
@@ -1857,7 +2588,7 @@ void PerfWatch::outputPapiCounterLegend (FILE* fp)
 	fprintf(fp, "\t\t Basic Report and Process Report statistics both show the measured value.\n");
 	}
 
-#endif // USE_PAPI
+#endif // USE_HWPC
 	fflush(fp);
 }
 
@@ -1866,7 +2597,7 @@ void PerfWatch::outputPapiCounterLegend (FILE* fp)
 
 void PerfWatch::identifyARMplatform (void)
 {
-#ifdef USE_PAPI
+#ifdef USE_HWPC
 	// on ARM, PAPI_get_hardware_info() does not provide so useful information.
 	// so we use /proc/cpuinfo information instead
 
@@ -1942,7 +2673,48 @@ void PerfWatch::identifyARMplatform (void)
 	}
 	#endif
 	return;
-#endif // USE_PAPI
+#endif // USE_HWPC
+}
+
+
+  /// Read the CPU model name and vendor from /proc/cpuinfo
+  /// @note  used instead of PAPI_get_hardware_info() by the non-PAPI backends
+  ///
+void PerfWatch::readCpuModel (std::string& s_model, std::string& s_vendor)
+{
+#ifdef USE_HWPC
+	FILE *fp;
+	char buffer[1024];
+	char value[1024];
+
+	s_model.clear();
+	s_vendor.clear();
+	fp = fopen("/proc/cpuinfo","r");
+	if (fp == NULL) {
+		fprintf(stderr, "*** Error <readCpuModel> can not open /proc/cpuinfo \n");
+		return;
+	}
+	while (fgets(buffer, 1024, fp) != NULL) {
+		if (s_model.empty() && !strncmp(buffer, "model name",10)) {
+			if (sscanf(buffer, "model name\t: %[^\n]", value) == 1) s_model = value;
+			continue;
+		}
+		if (s_vendor.empty() && !strncmp(buffer, "vendor_id",9)) {
+			if (sscanf(buffer, "vendor_id\t: %[^\n]", value) == 1) s_vendor = value;
+			continue;
+		}
+		if (s_vendor.empty() && !strncmp(buffer, "CPU implementer",15)) {
+			s_vendor = "ARM";	// same as PAPI_get_hardware_info() on ARM
+			continue;
+		}
+	}
+	fclose(fp);
+	#ifdef DEBUG_PRINT_PAPI
+	if (my_rank == 0) {
+		fprintf(stderr, "<readCpuModel> model=%s, vendor=%s\n", s_model.c_str(), s_vendor.c_str());
+	}
+	#endif
+#endif // USE_HWPC
 }
 
 
@@ -0,0 +1,936 @@
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 RIKEN Center for Computational Science(R-CCS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+//@file   PerfHwpcBackend.cpp
+//@brief  PMlib - HWPC counter backends (PAPI, Linux perf_event, replay)
+
+// if USE_HWPC is defined, compile this file with openmp option
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+
+#ifdef _OPENMP
+	#include <omp.h>
+#endif
+
+#include "pmlib_papi.h"
+#include "pmlib_hwpc.h"
+
+#ifdef USE_PAPI
+#include <pthread.h>
+#endif
+
+#ifdef USE_PERF_EVENT
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#endif
+
+#ifdef USE_HWPC
+
+namespace pm_lib {
+
+  const pmlib_hwpc_backend* hwpc_backend = NULL;
+
+  long long* hwpc_read_offset = NULL;
+#ifdef _OPENMP
+#pragma omp threadprivate(hwpc_read_offset)
+#endif
+
+  double* hwpc_coverage_offset = NULL;
+#ifdef _OPENMP
+#pragma omp threadprivate(hwpc_coverage_offset)
+#endif
+
+
+#ifdef USE_PAPI
+// ----------------------------------------------------------------------
+// papi backend : adaptor to the my_papi_* functions in src_papi_ext
+// ----------------------------------------------------------------------
+
+static int papi_library_init (void)
+{
+	int i_papi;
+	i_papi = PAPI_library_init( PAPI_VER_CURRENT );
+	if (i_papi != PAPI_VER_CURRENT ) {
+		fprintf (stderr, "*** error. <PAPI_library_init> code: %d\n", i_papi);
+		fprintf (stderr, "\t Check if correct version of PAPI library is linked.");
+		return i_papi;
+		}
+
+	// pthread_self() identifies the threads of the nested teams as well,
+	// while omp_get_thread_num() gives the same number to the threads of different teams.
+	i_papi = PAPI_thread_init( (unsigned long (*)(void)) (pthread_self) );
+	if (i_papi != PAPI_OK ) {
+		fprintf (stderr, "*** error. <PAPI_thread_init> failed. code=%d\n", i_papi);
+		return i_papi;
+		}
+	return PM_HWPC_OK;
+}
+
+static int papi_name_to_code (const char* c_event, int* i_event)
+{
+	// i_event stays PAPI_NULL, i.e. not counted, if the event is not known to PAPI
+	*i_event = PAPI_NULL;
+	my_papi_name_to_code (c_event, i_event);
+	return PM_HWPC_OK;
+}
+
+static const char* papi_read_path (void)
+{
+	return "PAPI_read";
+}
+
+  /// PAPI event set holds only the counted events, i.e. except PM_HWPC_NO_EVENT.
+  /// papi_index[k] is the position of the k-th PAPI event in the PMlib events.
+struct papi_thread_map {
+	int n_counted;
+	int papi_index[Max_chooser_events];
+};
+
+static papi_thread_map* papi_map = NULL;
+#ifdef _OPENMP
+#pragma omp threadprivate(papi_map)
+#endif
+
+static int papi_add_events (int* events, int num_events)
+{
+	int counted[Max_chooser_events];
+	if (papi_map == NULL) papi_map = new papi_thread_map;
+	papi_map->n_counted = 0;
+	for (int i=0; i<num_events; i++) {
+		if (events[i] == PM_HWPC_NO_EVENT) continue;	// same value as PAPI_NULL
+		counted[papi_map->n_counted] = events[i];
+		papi_map->papi_index[papi_map->n_counted] = i;
+		papi_map->n_counted++;
+	}
+	return my_papi_add_events (counted, papi_map->n_counted);
+}
+
+  /// scatter the PAPI values to the PMlib event positions
+static void papi_expand (long long* papi_values, long long* values, int num_events)
+{
+	for (int i=0; i<num_events; i++) values[i] = 0;
+	for (int k=0; k<papi_map->n_counted; k++) {
+		values[papi_map->papi_index[k]] = papi_values[k];
+	}
+}
+
+static int papi_start (long long* values, int num_events)
+{
+	long long papi_values[Max_chooser_events];
+	if (papi_map == NULL) return -1;
+	int i_papi = my_papi_bind_start (papi_values, papi_map->n_counted);
+	for (int i=0; i<num_events; i++) values[i] = 0;
+	return i_papi;
+}
+
+static int papi_read (long long* values, int num_events)
+{
+	long long papi_values[Max_chooser_events];
+	if (papi_map == NULL) return -1;
+	int i_papi = my_papi_bind_read (papi_values, papi_map->n_counted);
+	papi_expand (papi_values, values, num_events);
+	return i_papi;
+}
+
+static int papi_stop (long long* values, int num_events)
+{
+	long long papi_values[Max_chooser_events];
+	if (papi_map == NULL) return -1;
+	int i_papi = my_papi_bind_stop (papi_values, papi_map->n_counted);
+	papi_expand (papi_values, values, num_events);
+	return i_papi;
+}
+
+static void papi_thread_free (void)
+{
+	my_papi_internal_free ();
+	delete papi_map;
+	papi_map = NULL;
+}
+
+static const pmlib_hwpc_backend papi_backend = {
+	"papi",
+	papi_library_init,
+	papi_name_to_code,
+	papi_add_events,
+	papi_start,
+	papi_read,
+	papi_stop,
+	papi_thread_free,
+	papi_read_path,
+	my_papi_set_multiplex,
+	NULL	// PAPI does not tell the multiplexed time of each event
+};
+#endif // USE_PAPI
+
+
+#ifdef USE_PERF_EVENT
+// ----------------------------------------------------------------------
+// perf backend : Linux perf_event_open(2)
+// ----------------------------------------------------------------------
+//	A logical event is the weighted sum of up to Max_perf_terms kernel events,
+//	so that PAPI_DP_OPS like derived events can be counted without PAPI.
+//	The raw event codes are those of Intel Sandybridge ... Skylake (umask<<8 | event).
+
+const int Max_perf_terms = 4;
+const int Max_perf_fds = Max_chooser_events * Max_perf_terms;
+const int Max_perf_group = 4;	///< fds per group. Kept below the number of general purpose counters
+
+struct perf_term {
+	unsigned int type;
+	unsigned long long config;
+	int weight;
+};
+
+struct perf_event_def {
+	std::string name;
+	int n_terms;
+	perf_term term[Max_perf_terms];
+};
+
+#define PM_HW(x)	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_##x, 1 }
+#define PM_SW(x)	{ PERF_TYPE_SOFTWARE, PERF_COUNT_SW_##x, 1 }
+#define PM_RAW(x,w)	{ PERF_TYPE_RAW, x, w }
+#define PM_L1D_READ_MISS	{ PERF_TYPE_HW_CACHE, \
+	PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ<<8) | (PERF_COUNT_HW_CACHE_RESULT_MISS<<16), 1 }
+
+static std::vector<perf_event_def> perf_events;
+
+static void perf_define (const char* name, int n_terms, const perf_term* term)
+{
+	perf_event_def e;
+	e.name = name;
+	e.n_terms = n_terms;
+	for (int i=0; i<n_terms; i++) e.term[i] = term[i];
+	perf_events.push_back(e);
+}
+
+  /// the raw event codes of the table are those of Intel Core and Xeon, i.e. family 6
+  ///
+static bool perf_is_intel_family6 (void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	unsigned int eax, ebx, ecx, edx;
+	if (__get_cpuid(0, &eax, &ebx, &ecx, &edx) == 0) return false;
+	// "GenuineIntel" in ebx, edx, ecx
+	if (ebx != 0x756e6547 || edx != 0x49656e69 || ecx != 0x6c65746e) return false;
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) == 0) return false;
+	return ((eax >> 8) & 0xf) == 6;
+#else
+	return false;
+#endif
+}
+
+static void perf_create_event_table (void)
+{
+	if (!perf_events.empty()) return;
+
+	// generic events known to the kernel
+	{ perf_term t[] = { PM_HW(CPU_CYCLES) };			perf_define("PAPI_TOT_CYC", 1, t); }
+	{ perf_term t[] = { PM_HW(INSTRUCTIONS) };			perf_define("PAPI_TOT_INS", 1, t); }
+	{ perf_term t[] = { PM_HW(REF_CPU_CYCLES) };		perf_define("PAPI_REF_CYC", 1, t); }
+	{ perf_term t[] = { PM_HW(BRANCH_INSTRUCTIONS) };	perf_define("PAPI_BR_INS", 1, t); }
+	{ perf_term t[] = { PM_HW(BRANCH_MISSES) };			perf_define("PAPI_BR_MSP", 1, t); }
+	{ perf_term t[] = { PM_L1D_READ_MISS };				perf_define("PAPI_L1_TCM", 1, t); }
+	{ perf_term t[] = { PM_HW(CACHE_MISSES) };			perf_define("PAPI_L3_TCM", 1, t); }
+
+	// the same events by the names of perf(1), e.g. HWPC_CHOOSER=CUSTOM:cycles,instructions
+	{ perf_term t[] = { PM_HW(CPU_CYCLES) };			perf_define("cycles", 1, t); }
+	{ perf_term t[] = { PM_HW(CPU_CYCLES) };			perf_define("cpu-cycles", 1, t); }
+	{ perf_term t[] = { PM_HW(INSTRUCTIONS) };			perf_define("instructions", 1, t); }
+	{ perf_term t[] = { PM_HW(REF_CPU_CYCLES) };		perf_define("ref-cycles", 1, t); }
+	{ perf_term t[] = { PM_HW(BUS_CYCLES) };			perf_define("bus-cycles", 1, t); }
+	{ perf_term t[] = { PM_HW(CACHE_REFERENCES) };		perf_define("cache-references", 1, t); }
+	{ perf_term t[] = { PM_HW(CACHE_MISSES) };			perf_define("cache-misses", 1, t); }
+	{ perf_term t[] = { PM_HW(BRANCH_INSTRUCTIONS) };	perf_define("branches", 1, t); }
+	{ perf_term t[] = { PM_HW(BRANCH_INSTRUCTIONS) };	perf_define("branch-instructions", 1, t); }
+	{ perf_term t[] = { PM_HW(BRANCH_MISSES) };			perf_define("branch-misses", 1, t); }
+	{ perf_term t[] = { PM_HW(STALLED_CYCLES_FRONTEND) };	perf_define("stalled-cycles-frontend", 1, t); }
+	{ perf_term t[] = { PM_HW(STALLED_CYCLES_BACKEND) };	perf_define("stalled-cycles-backend", 1, t); }
+	{ perf_term t[] = { PM_L1D_READ_MISS };				perf_define("L1-dcache-load-misses", 1, t); }
+
+	// software events. available also on virtual machines without PMU
+	{ perf_term t[] = { PM_SW(TASK_CLOCK) };		perf_define("task-clock", 1, t); }
+	{ perf_term t[] = { PM_SW(CPU_CLOCK) };			perf_define("cpu-clock", 1, t); }
+	{ perf_term t[] = { PM_SW(PAGE_FAULTS) };		perf_define("page-faults", 1, t); }
+	{ perf_term t[] = { PM_SW(PAGE_FAULTS_MIN) };	perf_define("minor-faults", 1, t); }
+	{ perf_term t[] = { PM_SW(PAGE_FAULTS_MAJ) };	perf_define("major-faults", 1, t); }
+	{ perf_term t[] = { PM_SW(CONTEXT_SWITCHES) };	perf_define("context-switches", 1, t); }
+	{ perf_term t[] = { PM_SW(CPU_MIGRATIONS) };	perf_define("cpu-migrations", 1, t); }
+
+	// The raw codes below are model specific. The other CPUs, e.g. AMD and ARM,
+	// report these events as not supported rather than counting unrelated events.
+	if (!perf_is_intel_family6()) return;
+
+	{ perf_term t[] = { PM_RAW(0x3f24,1) };				perf_define("PAPI_L2_TCM", 1, t); }	// L2_RQSTS:MISS
+	{ perf_term t[] = { PM_RAW(0x81d0,1) };				perf_define("PAPI_LD_INS", 1, t); }	// MEM_UOPS_RETIRED:ALL_LOADS
+	{ perf_term t[] = { PM_RAW(0x82d0,1) };				perf_define("PAPI_SR_INS", 1, t); }	// MEM_UOPS_RETIRED:ALL_STORES
+
+	// floating point operations. FP_ARITH_INST_RETIRED (Broadwell and later)
+	{ perf_term t[] = { PM_RAW(0x01c7,1), PM_RAW(0x04c7,2), PM_RAW(0x10c7,4), PM_RAW(0x40c7,8) };
+		perf_define("PAPI_DP_OPS", 4, t); }
+	{ perf_term t[] = { PM_RAW(0x02c7,1), PM_RAW(0x08c7,4), PM_RAW(0x20c7,8), PM_RAW(0x80c7,16) };
+		perf_define("PAPI_SP_OPS", 4, t); }
+	{ perf_term t[] = { PM_RAW(0x01c7,1) };		perf_define("FP_ARITH:SCALAR_DOUBLE", 1, t); }
+	{ perf_term t[] = { PM_RAW(0x02c7,1) };		perf_define("FP_ARITH:SCALAR_SINGLE", 1, t); }
+	{ perf_term t[] = { PM_RAW(0x04c7,1) };		perf_define("FP_ARITH:128B_PACKED_DOUBLE", 1, t); }
+	{ perf_term t[] = { PM_RAW(0x08c7,1) };		perf_define("FP_ARITH:128B_PACKED_SINGLE", 1, t); }
+	{ perf_term t[] = { PM_RAW(0x10c7,1) };		perf_define("FP_ARITH:256B_PACKED_DOUBLE", 1, t); }
+	{ perf_term t[] = { PM_RAW(0x20c7,1) };		perf_define("FP_ARITH:256B_PACKED_SINGLE", 1, t); }
+	{ perf_term t[] = { PM_RAW(0x40c7,1) };		perf_define("FP_ARITH:512B_PACKED_DOUBLE", 1, t); }
+	{ perf_term t[] = { PM_RAW(0x80c7,1) };		perf_define("FP_ARITH:512B_PACKED_SINGLE", 1, t); }
+
+	// Sandybridge and Ivybridge
+	{ perf_term t[] = { PM_RAW(0x2010,1) };		perf_define("FP_COMP_OPS_EXE:SSE_FP_SCALAR_SINGLE", 1, t); }
+	{ perf_term t[] = { PM_RAW(0x4010,1) };		perf_define("FP_COMP_OPS_EXE:SSE_PACKED_SINGLE", 1, t); }
+	{ perf_term t[] = { PM_RAW(0x8010,1) };		perf_define("FP_COMP_OPS_EXE:SSE_SCALAR_DOUBLE", 1, t); }
+	{ perf_term t[] = { PM_RAW(0x1010,1) };		perf_define("FP_COMP_OPS_EXE:SSE_FP_PACKED_DOUBLE", 1, t); }
+	{ perf_term t[] = { PM_RAW(0x0111,1) };		perf_define("SIMD_FP_256:PACKED_SINGLE", 1, t); }
+	{ perf_term t[] = { PM_RAW(0x0211,1) };		perf_define("SIMD_FP_256:PACKED_DOUBLE", 1, t); }
+
+	// cache and load/store
+	{ perf_term t[] = { PM_RAW(0x01d1,1) };		perf_define("MEM_LOAD_UOPS_RETIRED:L1_HIT", 1, t); }
+	{ perf_term t[] = { PM_RAW(0x40d1,1) };		perf_define("MEM_LOAD_UOPS_RETIRED:HIT_LFB", 1, t); }
+	{ perf_term t[] = { PM_RAW(0x4124,1) };		perf_define("L2_RQSTS:DEMAND_DATA_RD_HIT", 1, t); }
+	{ perf_term t[] = { PM_RAW(0xd824,1) };		perf_define("L2_RQSTS:PF_HIT", 1, t); }
+
+	// top-down level 1 (4 issue slots per cycle). The counter mask is given in bits 24-31
+	{ perf_term t[] = { PM_RAW(0x019c,1) };		perf_define("IDQ_UOPS_NOT_DELIVERED:CORE", 1, t); }
+	{ perf_term t[] = { PM_RAW(0x010e,1) };		perf_define("UOPS_ISSUED:ANY", 1, t); }
+	{ perf_term t[] = { PM_RAW(0x02c2,1) };		perf_define("UOPS_RETIRED:RETIRE_SLOTS", 1, t); }
+	{ perf_term t[] = { PM_RAW(0x100030d,1) };	perf_define("INT_MISC:RECOVERY_CYCLES", 1, t); }
+
+	// data TLB misses which cause a page walk, and the cycles of the page walks.
+	// WALK_DURATION (Haswell, Broadwell) counts the cycles the page miss handler is busy,
+	// same as libpfm4. WALK_ACTIVE (Skylake) counts the cycles with a walk, i.e. cmask=1.
+	{ perf_term t[] = { PM_RAW(0x0108,1) };		perf_define("DTLB_LOAD_MISSES:MISS_CAUSES_A_WALK", 1, t); }
+	{ perf_term t[] = { PM_RAW(0x0149,1) };		perf_define("DTLB_STORE_MISSES:MISS_CAUSES_A_WALK", 1, t); }
+	{ perf_term t[] = { PM_RAW(0x1008,1) };		perf_define("DTLB_LOAD_MISSES:WALK_DURATION", 1, t); }
+	{ perf_term t[] = { PM_RAW(0x1049,1) };		perf_define("DTLB_STORE_MISSES:WALK_DURATION", 1, t); }
+	{ perf_term t[] = { PM_RAW(0x1001008,1) };	perf_define("DTLB_LOAD_MISSES:WALK_ACTIVE", 1, t); }
+	{ perf_term t[] = { PM_RAW(0x1001049,1) };	perf_define("DTLB_STORE_MISSES:WALK_ACTIVE", 1, t); }
+}
+
+
+  /// perf_event file descriptors of the calling thread.
+  /// The fds are packed into groups of at most Max_perf_group, and each group
+  /// is read by a single read(2) with PERF_FORMAT_GROUP.
+  /// If the kernel allows, the counters are read in user space with rdpmc
+  /// through the mmap page of each fd, and read(2) is used as the fallback.
+  ///
+struct perf_thread_state {
+	int n_fds;
+	int fd[Max_perf_fds];
+	struct perf_event_mmap_page* fd_page[Max_perf_fds];	// NULL if mmap failed
+	int fd_event[Max_perf_fds];		// index of the logical event in papi.events[]
+	int fd_weight[Max_perf_fds];
+	long long fd_base[Max_perf_fds];	// raw count at the last start/stop
+	long long fd_last[Max_perf_fds];
+
+	int n_groups;
+	int group_leader[Max_perf_fds];		// index of the leader fd
+	int group_size[Max_perf_fds];
+	long long group_base_enabled[Max_perf_fds];
+	long long group_base_running[Max_perf_fds];
+	long long group_enabled[Max_perf_fds];
+	long long group_running[Max_perf_fds];
+};
+
+static perf_thread_state* perf_state = NULL;
+#ifdef _OPENMP
+#pragma omp threadprivate(perf_state)
+#endif
+
+static bool perf_warned_open = false;
+static bool perf_use_rdpmc = true;		// PMLIB_HWPC_RDPMC
+static bool perf_rdpmc_used = false;	// at least one group was read by rdpmc
+static long perf_page_size = 4096;
+
+
+static int perf_library_init (void)
+{
+	perf_create_event_table();
+
+	// user space counter read with rdpmc is enabled unless PMLIB_HWPC_RDPMC=no
+	std::string s_rdpmc;
+	char* cp_env = std::getenv("PMLIB_HWPC_RDPMC");
+	if (cp_env != NULL) {
+		s_rdpmc = cp_env;
+		if (s_rdpmc == "no" || s_rdpmc == "off" || s_rdpmc == "0") perf_use_rdpmc = false;
+	}
+	perf_page_size = sysconf(_SC_PAGESIZE);
+	return PM_HWPC_OK;
+}
+
+static int perf_name_to_code (const char* c_event, int* i_event)
+{
+	perf_create_event_table();
+
+	for (int i=0; i<(int)perf_events.size(); i++) {
+		if (perf_events[i].name == c_event) { *i_event = i; return PM_HWPC_OK; }
+	}
+
+	// raw event given as "r<hex>", same notation as perf(1)
+	if (c_event[0] == 'r' && c_event[1] != '\0') {
+		char* p_end;
+		unsigned long long config = strtoull(c_event+1, &p_end, 16);
+		if (*p_end == '\0') {
+			perf_term t[] = { PM_RAW(config,1) };
+			perf_define(c_event, 1, t);
+			*i_event = perf_events.size() - 1;
+			return PM_HWPC_OK;
+		}
+	}
+
+	// not known. hwpc_name_to_code() gives the warning
+	*i_event = PM_HWPC_NO_EVENT;
+	return PM_HWPC_OK;
+}
+
+static int perf_open (perf_term& t, int group_fd)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = t.type;
+	attr.config = t.config;
+	attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	// the software events, e.g. context-switches, happen in the kernel and
+	// are excluded only if perf_event_paranoid does not allow the kernel
+	attr.exclude_kernel = (t.type == PERF_TYPE_SOFTWARE) ? 0 : 1;
+	attr.exclude_hv = 1;
+	attr.disabled = (group_fd == -1) ? 1 : 0;
+	// pid=0, cpu=-1 : the calling thread on any CPU
+	int fd = syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+	if (fd == -1 && !attr.exclude_kernel && (errno == EACCES || errno == EPERM)) {
+		attr.exclude_kernel = 1;
+		fd = syscall(__NR_perf_event_open, &attr, 0, -1, group_fd, 0);
+	}
+	return fd;
+}
+
+static void perf_thread_free (void)
+{
+	if (perf_state == NULL) return;
+	for (int i=0; i<perf_state->n_fds; i++) {
+		if (perf_state->fd_page[i] != NULL) munmap(perf_state->fd_page[i], perf_page_size);
+		close(perf_state->fd[i]);
+	}
+	delete perf_state;
+	perf_state = NULL;
+}
+
+static int perf_add_events (int* events, int num_events)
+{
+	perf_thread_free();
+	perf_state = new perf_thread_state;
+	perf_thread_state& s = *perf_state;
+	s.n_fds = 0;
+	s.n_groups = 0;
+
+	for (int ie=0; ie<num_events; ie++) {
+		if (events[ie] < 0 || events[ie] >= (int)perf_events.size()) continue;
+		perf_event_def& e = perf_events[events[ie]];
+
+		for (int k=0; k<e.n_terms; k++) {
+			bool new_group = (s.n_groups == 0 || s.group_size[s.n_groups-1] >= Max_perf_group);
+			int group_fd = new_group ? -1 : s.fd[s.group_leader[s.n_groups-1]];
+			int fd = perf_open(e.term[k], group_fd);
+			if (fd == -1) {
+				if (errno == EACCES || errno == EPERM) {
+					fprintf(stderr, "*** PMlib error. <perf_add_events> perf_event_open() is not permitted: %s\n", strerror(errno));
+					fprintf(stderr, "\t check /proc/sys/kernel/perf_event_paranoid .\n");
+					return -errno;
+				}
+				int i_errno = errno;
+				#pragma omp critical (pm_perf_warning)
+				if (!perf_warned_open) {
+					fprintf(stderr, "*** PMlib warning. <perf_add_events> event [%s] can not be counted on this system: %s\n",
+						e.name.c_str(), strerror(i_errno));
+					fprintf(stderr, "\t Its count is reported as 0. Further warnings are suppressed.\n");
+					perf_warned_open = true;
+				}
+				continue;
+			}
+			if (new_group) {
+				s.group_leader[s.n_groups] = s.n_fds;
+				s.group_size[s.n_groups] = 0;
+				s.n_groups++;
+			}
+			s.group_size[s.n_groups-1]++;
+			s.fd[s.n_fds] = fd;
+			s.fd_page[s.n_fds] = NULL;
+			if (perf_use_rdpmc) {
+				// only the control page is mapped. No sampling buffer.
+				void* p = mmap(NULL, perf_page_size, PROT_READ, MAP_SHARED, fd, 0);
+				if (p != MAP_FAILED) s.fd_page[s.n_fds] = (struct perf_event_mmap_page*)p;
+			}
+			s.fd_event[s.n_fds] = ie;
+			s.fd_weight[s.n_fds] = e.term[k].weight;
+			s.n_fds++;
+		}
+	}
+
+	for (int g=0; g<s.n_groups; g++) {
+		ioctl(s.fd[s.group_leader[g]], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+	return PM_HWPC_OK;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+static inline unsigned long long perf_rdpmc (unsigned int counter)
+{
+	unsigned int low, high;
+	__asm__ volatile("rdpmc" : "=a" (low), "=d" (high) : "c" (counter));
+	return (unsigned long long)low | ((unsigned long long)high << 32);
+}
+
+static inline unsigned long long perf_rdtsc (void)
+{
+	unsigned int low, high;
+	__asm__ volatile("rdtsc" : "=a" (low), "=d" (high));
+	return (unsigned long long)low | ((unsigned long long)high << 32);
+}
+#endif
+
+  /// read the group g in user space with rdpmc, following the seqlock protocol
+  /// described in linux/perf_event.h
+  ///
+  /// @return  false if any counter of the group is not on the PMU right now,
+  ///	e.g. software events or multiplexed out. The caller falls back to read(2).
+  ///
+static bool perf_read_group_user (perf_thread_state& s, int g)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	int leader = s.group_leader[g];
+	for (int j=0; j<s.group_size[g]; j++) {
+		struct perf_event_mmap_page* pc = s.fd_page[leader+j];
+		if (pc == NULL) return false;
+
+		unsigned int seq, idx;
+		long long count;
+		unsigned long long enabled, running;
+		do {
+			seq = pc->lock;
+			__asm__ volatile("" ::: "memory");
+			idx = pc->index;
+			if (!pc->cap_user_rdpmc || idx == 0) return false;
+			if (j == 0 && !pc->cap_user_time) return false;
+			enabled = pc->time_enabled;
+			running = pc->time_running;
+			if (j == 0) {
+				// extend the times up to now
+				unsigned long long cyc = perf_rdtsc();
+				unsigned short shift = pc->time_shift;
+				unsigned long long quot = cyc >> shift;
+				unsigned long long rem = cyc & (((unsigned long long)1 << shift) - 1);
+				unsigned long long delta = pc->time_offset + quot * pc->time_mult
+					+ ((rem * pc->time_mult) >> shift);
+				enabled += delta;
+				running += delta;
+			}
+			long long pmc = perf_rdpmc(idx - 1);
+			int width = pc->pmc_width;
+			pmc = (long long)((unsigned long long)pmc << (64 - width)) >> (64 - width);
+			count = pc->offset + pmc;
+			__asm__ volatile("" ::: "memory");
+		} while (pc->lock != seq);
+
+		s.fd_last[leader+j] = count;
+		if (j == 0) {
+			s.group_enabled[g] = enabled;
+			s.group_running[g] = running;
+		}
+	}
+	perf_rdpmc_used = true;
+	return true;
+#else
+	return false;
+#endif
+}
+
+  /// read all the groups. rdpmc if possible, otherwise one read(2) per group
+static int perf_read_groups (perf_thread_state& s)
+{
+	long long buf[3 + Max_perf_group];
+	for (int g=0; g<s.n_groups; g++) {
+		if (perf_use_rdpmc && perf_read_group_user(s, g)) continue;
+		int leader = s.group_leader[g];
+		ssize_t n = read(s.fd[leader], buf, sizeof(buf));
+		if (n < (ssize_t)(3*sizeof(long long))) return -1;
+		s.group_enabled[g] = buf[1];
+		s.group_running[g] = buf[2];
+		for (int j=0; j<s.group_size[g] && j<buf[0]; j++) {
+			s.fd_last[leader+j] = buf[3+j];
+		}
+	}
+	return PM_HWPC_OK;
+}
+
+static void perf_set_baseline (perf_thread_state& s)
+{
+	for (int i=0; i<s.n_fds; i++) s.fd_base[i] = s.fd_last[i];
+	for (int g=0; g<s.n_groups; g++) {
+		s.group_base_enabled[g] = s.group_enabled[g];
+		s.group_base_running[g] = s.group_running[g];
+	}
+}
+
+  /// counts since the baseline, scaled by enabled/running time when multiplexed
+static void perf_values (perf_thread_state& s, long long* values, int num_events)
+{
+	for (int i=0; i<num_events; i++) values[i] = 0;
+	for (int g=0; g<s.n_groups; g++) {
+		double d_enabled = (double)(s.group_enabled[g] - s.group_base_enabled[g]);
+		double d_running = (double)(s.group_running[g] - s.group_base_running[g]);
+		double scale = 1.0;
+		if (d_running <= 0.0) {
+			scale = 0.0;
+		} else if (d_running < d_enabled) {
+			scale = d_enabled / d_running;
+		}
+		int leader = s.group_leader[g];
+		for (int j=0; j<s.group_size[g]; j++) {
+			int i = leader + j;
+			double d_count = (double)(s.fd_last[i] - s.fd_base[i]) * scale;
+			values[s.fd_event[i]] += (long long)(d_count * s.fd_weight[i]);
+		}
+	}
+}
+
+  /// start() takes the baseline snapshot instead of PERF_EVENT_IOC_RESET,
+  /// since the reset does not clear the enabled/running times.
+static int perf_start (long long* values, int num_events)
+{
+	if (num_events == 0) return PM_HWPC_OK;
+	if (perf_state == NULL) return -1;
+	if (perf_read_groups(*perf_state) != PM_HWPC_OK) return -1;
+	perf_set_baseline(*perf_state);
+	for (int i=0; i<num_events; i++) values[i] = 0;
+	return PM_HWPC_OK;
+}
+
+static int perf_read (long long* values, int num_events)
+{
+	if (num_events == 0) return PM_HWPC_OK;
+	if (perf_state == NULL) return -1;
+	if (perf_read_groups(*perf_state) != PM_HWPC_OK) return -1;
+	perf_values(*perf_state, values, num_events);
+	return PM_HWPC_OK;
+}
+
+static int perf_stop (long long* values, int num_events)
+{
+	if (num_events == 0) return PM_HWPC_OK;
+	if (perf_read(values, num_events) != PM_HWPC_OK) return -1;
+	perf_set_baseline(*perf_state);
+	return PM_HWPC_OK;
+}
+
+static const char* perf_read_path (void)
+{
+	if (perf_rdpmc_used) return "rdpmc in user space, read(2) as fallback";
+	if (perf_use_rdpmc) return "read(2). rdpmc was not available";
+	return "read(2). rdpmc is disabled by PMLIB_HWPC_RDPMC";
+}
+
+  /// enabled/running time since add_events as of the last read. The kernel multiplexes
+  /// the groups by itself when they outnumber the counters, so no set_multiplex is needed.
+  /// The times of an event counted by several groups are summed over the groups.
+static int perf_coverage (double* enabled, double* running, int num_events)
+{
+	for (int i=0; i<num_events; i++) enabled[i] = running[i] = 0.0;
+	if (num_events == 0) return PM_HWPC_OK;
+	if (perf_state == NULL) return -1;
+	perf_thread_state& s = *perf_state;
+	for (int g=0; g<s.n_groups; g++) {
+		double d_enabled = (double)(s.group_enabled[g] - s.group_base_enabled[g]);
+		double d_running = (double)(s.group_running[g] - s.group_base_running[g]);
+		for (int j=0; j<s.group_size[g]; j++) {
+			int i = s.fd_event[s.group_leader[g] + j];
+			enabled[i] += d_enabled;
+			running[i] += d_running;
+		}
+	}
+	return PM_HWPC_OK;
+}
+
+static const pmlib_hwpc_backend perf_backend = {
+	"perf",
+	perf_library_init,
+	perf_name_to_code,
+	perf_add_events,
+	perf_start,
+	perf_read,
+	perf_stop,
+	perf_thread_free,
+	perf_read_path,
+	NULL,
+	perf_coverage
+};
+
+#undef PM_HW
+#undef PM_SW
+#undef PM_RAW
+#undef PM_L1D_READ_MISS
+#endif // USE_PERF_EVENT
+
+
+// ----------------------------------------------------------------------
+// replay backend : deterministic counts for testing the report logic
+// ----------------------------------------------------------------------
+//	Each read advances the count of the i-th event by (i+1)*1000, or by the
+//	values of the next row of the file given by PMLIB_HWPC_REPLAY.
+//	The rows are used cyclically. Lines starting with '#' are comments.
+
+static std::vector<std::string> replay_names;
+static std::vector< std::vector<long long> > replay_rows;
+
+struct replay_thread_state {
+	long long n_reads;
+	int events[Max_chooser_events];
+	long long counts[Max_chooser_events];
+	long long base[Max_chooser_events];
+};
+
+static replay_thread_state* replay_state = NULL;
+#ifdef _OPENMP
+#pragma omp threadprivate(replay_state)
+#endif
+
+static int replay_library_init (void)
+{
+	char* cp_env = std::getenv("PMLIB_HWPC_REPLAY");
+	if (cp_env == NULL || !replay_rows.empty()) return PM_HWPC_OK;
+
+	FILE* fp = fopen(cp_env, "r");
+	if (fp == NULL) {
+		fprintf(stderr, "*** PMlib error. <replay_library_init> can not open PMLIB_HWPC_REPLAY=%s\n", cp_env);
+		return -1;
+	}
+	char buffer[1024];
+	while (fgets(buffer, 1024, fp) != NULL) {
+		if (buffer[0] == '#') continue;
+		std::vector<long long> row;
+		char* p = buffer;
+		char* p_end;
+		for (long long v = strtoll(p, &p_end, 10); p_end != p; v = strtoll(p, &p_end, 10)) {
+			row.push_back(v);
+			p = p_end;
+		}
+		if (!row.empty()) replay_rows.push_back(row);
+	}
+	fclose(fp);
+	return PM_HWPC_OK;
+}
+
+static int replay_name_to_code (const char* c_event, int* i_event)
+{
+	for (int i=0; i<(int)replay_names.size(); i++) {
+		if (replay_names[i] == c_event) { *i_event = i; return PM_HWPC_OK; }
+	}
+	replay_names.push_back(c_event);
+	*i_event = replay_names.size() - 1;
+	return PM_HWPC_OK;
+}
+
+static void replay_thread_free (void)
+{
+	delete replay_state;
+	replay_state = NULL;
+}
+
+static int replay_add_events (int* events, int num_events)
+{
+	replay_thread_free();
+	replay_state = new replay_thread_state;
+	replay_state->n_reads = 0;
+	for (int i=0; i<Max_chooser_events; i++) {
+		replay_state->counts[i] = replay_state->base[i] = 0;
+		replay_state->events[i] = (i < num_events) ? events[i] : PM_HWPC_NO_EVENT;
+	}
+	return PM_HWPC_OK;
+}
+
+static int replay_read (long long* values, int num_events)
+{
+	if (num_events == 0) return PM_HWPC_OK;
+	if (replay_state == NULL) return -1;
+	replay_thread_state& s = *replay_state;
+	const std::vector<long long>* row = NULL;
+	if (!replay_rows.empty()) row = &replay_rows[s.n_reads % replay_rows.size()];
+	s.n_reads++;
+
+	for (int i=0; i<num_events; i++) {
+		if (s.events[i] == PM_HWPC_NO_EVENT) {
+			;
+		} else if (row == NULL) {
+			s.counts[i] += (i+1)*1000;
+		} else if (i < (int)row->size()) {
+			s.counts[i] += (*row)[i];
+		}
+		values[i] = s.counts[i] - s.base[i];
+	}
+	return PM_HWPC_OK;
+}
+
+static int replay_start (long long* values, int num_events)
+{
+	if (num_events == 0) return PM_HWPC_OK;
+	if (replay_state == NULL) return -1;
+	for (int i=0; i<num_events; i++) {
+		replay_state->base[i] = replay_state->counts[i];
+		values[i] = 0;
+	}
+	return PM_HWPC_OK;
+}
+
+static int replay_stop (long long* values, int num_events)
+{
+	if (num_events == 0) return PM_HWPC_OK;
+	if (replay_read(values, num_events) != PM_HWPC_OK) return -1;
+	for (int i=0; i<num_events; i++) {
+		replay_state->base[i] = replay_state->counts[i];
+	}
+	return PM_HWPC_OK;
+}
+
+static const char* replay_read_path (void)
+{
+	return "replay";
+}
+
+  /// the replayed counts are never scaled. Each read takes 1000 [ns] of enabled time
+static int replay_coverage (double* enabled, double* running, int num_events)
+{
+	if (replay_state == NULL) return -1;
+	for (int i=0; i<num_events; i++) {
+		enabled[i] = running[i] = (double)replay_state->n_reads * 1000.0;
+	}
+	return PM_HWPC_OK;
+}
+
+static const pmlib_hwpc_backend replay_backend = {
+	"replay",
+	replay_library_init,
+	replay_name_to_code,
+	replay_add_events,
+	replay_start,
+	replay_read,
+	replay_stop,
+	replay_thread_free,
+	replay_read_path,
+	NULL,
+	replay_coverage
+};
+
+
+const pmlib_hwpc_backend* hwpc_select_backend (void)
+{
+	const pmlib_hwpc_backend* p_default;
+#ifdef USE_PAPI
+	p_default = &papi_backend;
+#else
+	p_default = &perf_backend;
+#endif
+
+	std::string s_backend;
+	char* cp_env = std::getenv("PMLIB_HWPC_BACKEND");
+	if (cp_env == NULL) return p_default;
+	s_backend = cp_env;
+
+	if (s_backend == "replay") return &replay_backend;
+#ifdef USE_PAPI
+	if (s_backend == "papi") return &papi_backend;
+#endif
+#ifdef USE_PERF_EVENT
+	if (s_backend == "perf") return &perf_backend;
+#endif
+
+	fprintf(stderr, "*** PMlib warning. PMLIB_HWPC_BACKEND=%s is not available. %s backend is used.\n",
+		cp_env, p_default->name);
+	return p_default;
+}
+
+
+int hwpc_reprogram (int* events, int num_events)
+{
+	long long values[Max_chooser_events];
+	int i_ret = hwpc_read (values, num_events);
+	if (i_ret != PM_HWPC_OK) return i_ret;
+
+	if (hwpc_read_offset == NULL) hwpc_read_offset = new long long[Max_chooser_events];
+	for (int i=0; i<num_events; i++) hwpc_read_offset[i] = values[i];
+
+	double enabled[Max_chooser_events], running[Max_chooser_events];
+	if (hwpc_coverage (enabled, running, num_events) == PM_HWPC_OK) {
+		if (hwpc_coverage_offset == NULL) hwpc_coverage_offset = new double[2*Max_chooser_events];
+		for (int i=0; i<num_events; i++) {
+			hwpc_coverage_offset[2*i] = enabled[i];
+			hwpc_coverage_offset[2*i+1] = running[i];
+		}
+	}
+
+	hwpc_backend->thread_free();
+	i_ret = hwpc_backend->add_events (events, num_events);
+	if (i_ret != PM_HWPC_OK) return i_ret;
+	return hwpc_backend->start (values, num_events);
+}
+
+
+void hwpc_thread_free (void)
+{
+	hwpc_backend->thread_free();
+	delete [] hwpc_read_offset;
+	hwpc_read_offset = NULL;
+	delete [] hwpc_coverage_offset;
+	hwpc_coverage_offset = NULL;
+}
+
+
+// the unknown event names of all the backends are warned here, once per process
+static std::atomic<bool> hwpc_warned_unknown(false);
+
+void hwpc_name_to_code (const char* c_event, int* i_event)
+{
+	int i_ret = hwpc_backend->name_to_code (c_event, i_event);
+	if (i_ret != PM_HWPC_OK) {
+		fprintf(stderr, "*** error. <hwpc_name_to_code> backend=%s c_event=[%s], code=%d\n",
+			hwpc_backend->name, c_event, i_ret);
+	}
+	if (*i_event == PM_HWPC_NO_EVENT && !hwpc_warned_unknown.exchange(true)) {
+		fprintf(stderr, "*** PMlib warning. HWPC event [%s] is not available with %s backend and is not counted.\n",
+			c_event, hwpc_backend->name);
+		fprintf(stderr, "\t Further warnings of the unknown events are suppressed.\n");
+	}
+}
+
+} /* namespace pm_lib */
+
+#endif // USE_HWPC
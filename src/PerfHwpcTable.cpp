@@ -0,0 +1,696 @@
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 RIKEN Center for Computational Science(R-CCS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+//! @file   PerfHwpcTable.cpp
+//! @brief  HWPC event table and derived metric expressions
+
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+
+#include "pmlib_papi.h"
+#include "pmlib_hwpc.h"
+#include "pmlib_hwpc_table.h"
+
+#ifdef USE_HWPC
+
+namespace pm_lib {
+
+// ----------------------------------------------------------------------
+// shipped table : the processors which the built-in code does not support
+// ----------------------------------------------------------------------
+//	The events are given as PAPI (libpfm4) names, and as perf raw events
+//	for the perf backend. The metrics follow the order of the built-in
+//	groups, since the Basic Report takes the following values of the group.
+//	table_check_group() ignores the groups which do not have them.
+//	BANDWIDTH: the last [Bytes]
+//	FLOPS:     the last three Total_FP, [Flops], [%Peak]
+//	VECTOR:    the last three Total_FP, Vector_FP, [Vector %]
+//	CACHE:     the first two events load and store, and the last [L*$ hit%]
+//	CYCLE:     the first two events cycles and instructions
+//	LOADSTORE: the first two events load and store, and the last [Vector %]
+//	TOPDOWN:   the first event cycles, and the last four [Front%] [BadSpec%] [Retire%] [Backend%]
+//	TLB:       the first event instructions, and the last two [Miss/KI] [WalkC/KI]
+
+static const char* hwpc_table_shipped =
+	"# Intel processors after Skylake, e.g. Ice Lake and Sapphire Rapids,\n"
+	"# and the virtual machines which hide the model name\n"
+	"platform Intel Intel(R)\n"
+	"peak 32\n"
+	"group FLOPS\n"
+	"event SP_OPS PAPI_SP_OPS\n"
+	"event DP_OPS PAPI_DP_OPS\n"
+	"metric Total_FP = SP_OPS + DP_OPS\n"
+	"metric [Flops] = Total_FP / time\n"
+	"metric [%Peak] = Total_FP / time / peak * 100\n"
+	"group VECTOR\n"
+	"event SP_SINGLE FP_ARITH:SCALAR_SINGLE\n"
+	"event SP_SSE    FP_ARITH:128B_PACKED_SINGLE\n"
+	"event SP_AVX    FP_ARITH:256B_PACKED_SINGLE\n"
+	"event SP_AVXW   FP_ARITH:512B_PACKED_SINGLE\n"
+	"event DP_SINGLE FP_ARITH:SCALAR_DOUBLE\n"
+	"event DP_SSE    FP_ARITH:128B_PACKED_DOUBLE\n"
+	"event DP_AVX    FP_ARITH:256B_PACKED_DOUBLE\n"
+	"event DP_AVXW   FP_ARITH:512B_PACKED_DOUBLE\n"
+	"metric Total_FP = SP_SINGLE + 4*SP_SSE + 8*SP_AVX + 16*SP_AVXW + DP_SINGLE + 2*DP_SSE + 4*DP_AVX + 8*DP_AVXW\n"
+	"metric Vector_FP = Total_FP - SP_SINGLE - DP_SINGLE\n"
+	"metric [Vector %] = Vector_FP / Total_FP * 100\n"
+	"group BANDWIDTH\n"
+	"event L3_HIT  MEM_LOAD_RETIRED:L3_HIT perf=r04d1\n"
+	"event L3_MISS LONGEST_LAT_CACHE:MISS  perf=r412e\n"
+	"metric L3$ [B/s] = L3_HIT * 64 / time\n"
+	"metric Mem [B/s] = L3_MISS * 64 / time\n"
+	"metric [Bytes] = (L3_HIT + L3_MISS) * 64\n"
+	"group TOPDOWN\n"
+	"event TOT_CYC   PAPI_TOT_CYC\n"
+	"event SLOTS     TOPDOWN:SLOTS_P               perf=r01a4\n"
+	"event NOT_DLVD  IDQ_UOPS_NOT_DELIVERED:CORE   perf=r019c\n"
+	"event BE_SLOTS  TOPDOWN:BACKEND_BOUND_SLOTS   perf=r02a4\n"
+	"event RET_SLOTS UOPS_RETIRED:SLOTS            perf=r02c2\n"
+	"metric [Front%] = NOT_DLVD / SLOTS * 100\n"
+	"metric [BadSpec%] = (SLOTS - NOT_DLVD - BE_SLOTS - RET_SLOTS) / SLOTS * 100\n"
+	"metric [Retire%] = RET_SLOTS / SLOTS * 100\n"
+	"metric [Backend%] = BE_SLOTS / SLOTS * 100\n"
+	"group TLB\n"
+	"event TOT_INS   PAPI_TOT_INS\n"
+	"event LD_WALK   DTLB_LOAD_MISSES:WALK_COMPLETED  perf=r0e08\n"
+	"event ST_WALK   DTLB_STORE_MISSES:WALK_COMPLETED perf=r0e49\n"
+	"event LD_WALK_C DTLB_LOAD_MISSES:WALK_ACTIVE     perf=r1001008\n"
+	"event ST_WALK_C DTLB_STORE_MISSES:WALK_ACTIVE    perf=r1001049\n"
+	"metric [Miss/KI] = (LD_WALK + ST_WALK) / TOT_INS * 1000\n"
+	"metric [WalkC/KI] = (LD_WALK_C + ST_WALK_C) / TOT_INS * 1000\n"
+	"\n"
+	"# AMD Zen 2, 3 and 4. RETIRED_SSE_AVX_FLOPS counts the operations, FMA as 2\n"
+	"platform Zen AMD EPYC | AMD Ryzen\n"
+	"peak 16\n"
+	"group FLOPS\n"
+	"event FP_OPS RETIRED_SSE_AVX_FLOPS:ANY perf=rff03\n"
+	"metric Total_FP = FP_OPS\n"
+	"metric [Flops] = Total_FP / time\n"
+	"metric [%Peak] = Total_FP / time / peak * 100\n"
+	"group CACHE\n"
+	"event LOAD_INS  LS_DISPATCH:LD_DISPATCH    perf=r0129\n"
+	"event STORE_INS LS_DISPATCH:STORE_DISPATCH perf=r0229\n"
+	"event L1_TCM    PAPI_L1_DCM perf=PAPI_L1_TCM\n"
+	"event L2_TCM    PAPI_L2_DCM perf=r0864\n"
+	"metric [L1$ hit%] = (LOAD_INS + STORE_INS - L1_TCM) / (LOAD_INS + STORE_INS) * 100\n"
+	"metric [L2$ hit%] = (L1_TCM - L2_TCM) / (LOAD_INS + STORE_INS) * 100\n"
+	"metric [L*$ hit%] = (LOAD_INS + STORE_INS - L2_TCM) / (LOAD_INS + STORE_INS) * 100\n"
+	"\n"
+	"# Arm Neoverse V1. SVE operations are counted per 128 bits\n"
+	"platform Neoverse_V1 ARM 0x41:0xd40\n"
+	"peak 16\n"
+	"group FLOPS\n"
+	"event FIXED_OPS FP_FIXED_OPS_SPEC perf=r80c1\n"
+	"event SCALE_OPS FP_SCALE_OPS_SPEC perf=r80c0\n"
+	"metric Total_FP = FIXED_OPS + 2 * SCALE_OPS\n"
+	"metric [Flops] = Total_FP / time\n"
+	"metric [%Peak] = Total_FP / time / peak * 100\n"
+	"group CACHE\n"
+	"event LOAD_INS  LD_SPEC perf=r70\n"
+	"event STORE_INS ST_SPEC perf=r71\n"
+	"event L1_TCM    L1D_CACHE_REFILL perf=r3\n"
+	"event L2_TCM    L2D_CACHE_REFILL perf=r17\n"
+	"metric [L1$ hit%] = (LOAD_INS + STORE_INS - L1_TCM) / (LOAD_INS + STORE_INS) * 100\n"
+	"metric [L2$ hit%] = (L1_TCM - L2_TCM) / (LOAD_INS + STORE_INS) * 100\n"
+	"metric [L*$ hit%] = (LOAD_INS + STORE_INS - L2_TCM) / (LOAD_INS + STORE_INS) * 100\n"
+	"group BANDWIDTH\n"
+	"event L2_REFILL L2D_CACHE_REFILL perf=r17\n"
+	"event LLC_MISS  LL_CACHE_MISS_RD perf=r37\n"
+	"metric L3$ [B/s] = (L2_REFILL - LLC_MISS) * 64 / time\n"
+	"metric Mem [B/s] = LLC_MISS * 64 / time\n"
+	"metric [Bytes] = L2_REFILL * 64\n"
+	"\n"
+	"# Arm Neoverse N1, N2 and V2\n"
+	"platform Neoverse ARM 0x41:0xd0c | ARM 0x41:0xd49 | ARM 0x41:0xd4f\n"
+	"peak 8\n"
+	"group CACHE\n"
+	"event LOAD_INS  LD_SPEC perf=r70\n"
+	"event STORE_INS ST_SPEC perf=r71\n"
+	"event L1_TCM    L1D_CACHE_REFILL perf=r3\n"
+	"event L2_TCM    L2D_CACHE_REFILL perf=r17\n"
+	"metric [L1$ hit%] = (LOAD_INS + STORE_INS - L1_TCM) / (LOAD_INS + STORE_INS) * 100\n"
+	"metric [L2$ hit%] = (L1_TCM - L2_TCM) / (LOAD_INS + STORE_INS) * 100\n"
+	"metric [L*$ hit%] = (LOAD_INS + STORE_INS - L2_TCM) / (LOAD_INS + STORE_INS) * 100\n"
+	"group BANDWIDTH\n"
+	"event L2_REFILL L2D_CACHE_REFILL perf=r17\n"
+	"event LLC_MISS  LL_CACHE_MISS_RD perf=r37\n"
+	"metric L3$ [B/s] = (L2_REFILL - LLC_MISS) * 64 / time\n"
+	"metric Mem [B/s] = LLC_MISS * 64 / time\n"
+	"metric [Bytes] = L2_REFILL * 64\n"
+	;
+
+
+// operand index of the variables. The events and the metrics come first.
+const int I_time = Max_table_events + Max_table_metrics;
+const int I_peak = I_time + 1;
+const int I_ghz  = I_time + 2;
+const int Max_table_operands = I_time + 3;
+const int Max_expr_stack = 32;
+
+struct table_platform {
+	std::string name;
+	std::vector<std::string> match;
+	double peak;
+	bool defined[Max_hwpc_output_group];
+	hwpc_table_group group[Max_hwpc_output_group];
+};
+
+static std::vector<table_platform> user_platforms;
+static std::vector<table_platform> shipped_platforms;
+static const table_platform* table_selected = NULL;
+static std::string table_selected_source;
+static bool table_loaded = false;
+
+
+static std::string table_trim (const std::string& s)
+{
+	size_t i_begin = s.find_first_not_of(" \t\r\n");
+	if (i_begin == std::string::npos) return "";
+	size_t i_end = s.find_last_not_of(" \t\r\n");
+	return s.substr(i_begin, i_end-i_begin+1);
+}
+
+static bool table_identifier (const std::string& s)
+{
+	if (s.empty() || !(isalpha((unsigned char)s[0]) || s[0] == '_')) return false;
+	for (size_t i=1; i<s.size(); i++) {
+		if (!(isalnum((unsigned char)s[i]) || s[i] == '_')) return false;
+	}
+	return true;
+}
+
+static int table_group_index (const std::string& s)
+{
+	if (s == "FLOPS") return I_flops;
+	if (s == "BANDWIDTH") return I_bandwidth;
+	if (s == "VECTOR") return I_vector;
+	if (s == "CACHE") return I_cache;
+	if (s == "CYCLE") return I_cycle;
+	if (s == "LOADSTORE") return I_loadstore;
+	if (s == "TOPDOWN") return I_topdown;
+	if (s == "TLB") return I_tlb;
+	return -1;
+}
+
+  /// check the values which the reports take from the group by position,
+  /// see the comment of hwpc_table_shipped
+  ///
+  ///   @return  empty if the group has them, otherwise the reason
+  ///
+static std::string table_check_group (const hwpc_table_group& g, int i_group)
+{
+	int n_events = 0;
+	std::vector<std::string> last;
+	if (i_group == I_flops) {
+		last = { "Total_FP", "[Flops]", "[%Peak]" };
+	} else if (i_group == I_vector) {
+		last = { "Total_FP", "Vector_FP", "[Vector %]" };
+	} else if (i_group == I_bandwidth) {
+		last = { "[Bytes]" };
+	} else if (i_group == I_cache) {
+		n_events = 2;
+		last = { "[L*$ hit%]" };
+	} else if (i_group == I_cycle) {
+		n_events = 2;
+	} else if (i_group == I_loadstore) {
+		n_events = 2;
+		last = { "[Vector %]" };
+	} else if (i_group == I_topdown) {
+		n_events = 1;
+		last = { "[Front%]", "[BadSpec%]", "[Retire%]", "[Backend%]" };
+	} else if (i_group == I_tlb) {
+		n_events = 1;
+		last = { "[Miss/KI]", "[WalkC/KI]" };
+	}
+
+	if (g.n_events < n_events) {
+		return "the group needs at least " + std::to_string(n_events) + " events";
+	}
+	bool is_ok = (g.n_metrics >= (int)last.size());
+	for (size_t i=0; is_ok && i<last.size(); i++) {
+		if (g.m_label[g.n_metrics - last.size() + i] != last[i]) is_ok = false;
+	}
+	if (!is_ok) {
+		std::string s_last;
+		for (size_t i=0; i<last.size(); i++) s_last += " " + last[i];
+		return "the last metrics of the group must be" + s_last;
+	}
+	return "";
+}
+
+
+// ----------------------------------------------------------------------
+// expression compiler : recursive descent into reverse polish order
+// ----------------------------------------------------------------------
+
+struct expr_parser {
+	const char* p;
+	const hwpc_table_group* g;
+	int n_metrics;			// the metrics which can be referred
+	std::vector<hwpc_expr_op>* out;
+	int depth;
+	int max_depth;
+	std::string error;
+};
+
+static void expr_sum (expr_parser& ps);
+
+static void expr_skip (expr_parser& ps)
+{
+	while (*ps.p == ' ' || *ps.p == '\t') ps.p++;
+}
+
+static void expr_emit (expr_parser& ps, char op, double value, int ref)
+{
+	hwpc_expr_op e;
+	e.op = op; e.value = value; e.ref = ref;
+	ps.out->push_back(e);
+	if (op == 'n' || op == 'v') {
+		ps.depth++;
+		if (ps.depth > ps.max_depth) ps.max_depth = ps.depth;
+	} else if (op != '~') {
+		ps.depth--;
+	}
+}
+
+static void expr_primary (expr_parser& ps)
+{
+	expr_skip(ps);
+	if (!ps.error.empty()) return;
+
+	if (*ps.p == '(') {
+		ps.p++;
+		expr_sum(ps);
+		expr_skip(ps);
+		if (*ps.p != ')') { if (ps.error.empty()) ps.error = "missing )"; return; }
+		ps.p++;
+	} else
+	if (*ps.p == '-') {
+		ps.p++;
+		expr_primary(ps);
+		expr_emit(ps, '~', 0.0, 0);
+	} else
+	if (isdigit((unsigned char)*ps.p) || *ps.p == '.') {
+		char* p_end;
+		double v = strtod(ps.p, &p_end);
+		ps.p = p_end;
+		expr_emit(ps, 'n', v, 0);
+	} else
+	if (isalpha((unsigned char)*ps.p) || *ps.p == '_') {
+		const char* p_begin = ps.p;
+		while (isalnum((unsigned char)*ps.p) || *ps.p == '_') ps.p++;
+		std::string s_name(p_begin, ps.p-p_begin);
+		int ref = -1;
+		if (s_name == "time") ref = I_time;
+		else if (s_name == "peak") ref = I_peak;
+		else if (s_name == "ghz") ref = I_ghz;
+		for (int i=0; ref<0 && i<ps.g->n_events; i++) {
+			if (ps.g->label[i] == s_name) ref = i;
+		}
+		for (int i=0; ref<0 && i<ps.n_metrics; i++) {
+			if (ps.g->m_label[i] == s_name) ref = Max_table_events + i;
+		}
+		if (ref < 0) { ps.error = "unknown symbol " + s_name; return; }
+		expr_emit(ps, 'v', 0.0, ref);
+	} else {
+		ps.error = std::string("unexpected ") + (*ps.p ? std::string(1, *ps.p) : std::string("end of line"));
+	}
+}
+
+static void expr_product (expr_parser& ps)
+{
+	expr_primary(ps);
+	for (;;) {
+		expr_skip(ps);
+		if (!ps.error.empty()) return;
+		char op = *ps.p;
+		if (op != '*' && op != '/') return;
+		ps.p++;
+		expr_primary(ps);
+		expr_emit(ps, op, 0.0, 0);
+	}
+}
+
+static void expr_sum (expr_parser& ps)
+{
+	expr_product(ps);
+	for (;;) {
+		expr_skip(ps);
+		if (!ps.error.empty()) return;
+		char op = *ps.p;
+		if (op != '+' && op != '-') return;
+		ps.p++;
+		expr_product(ps);
+		expr_emit(ps, op, 0.0, 0);
+	}
+}
+
+static bool expr_compile (const std::string& s_expr, const hwpc_table_group& g, int n_metrics,
+		std::vector<hwpc_expr_op>& out, std::string& error)
+{
+	expr_parser ps;
+	ps.p = s_expr.c_str();
+	ps.g = &g;
+	ps.n_metrics = n_metrics;
+	ps.out = &out;
+	ps.depth = ps.max_depth = 0;
+	out.clear();
+
+	expr_sum(ps);
+	expr_skip(ps);
+	if (ps.error.empty() && *ps.p != '\0') ps.error = std::string("unexpected ") + *ps.p;
+	if (ps.error.empty() && ps.max_depth > Max_expr_stack) ps.error = "too complex";
+	error = ps.error;
+	return error.empty();
+}
+
+static double expr_eval (const std::vector<hwpc_expr_op>& expr, const double* operand)
+{
+	double stack[Max_expr_stack];
+	int n = 0;
+	for (size_t i=0; i<expr.size(); i++) {
+		const hwpc_expr_op& e = expr[i];
+		switch (e.op) {
+		case 'n': stack[n++] = e.value; break;
+		case 'v': stack[n++] = operand[e.ref]; break;
+		case '~': stack[n-1] = -stack[n-1]; break;
+		case '+': n--; stack[n-1] += stack[n]; break;
+		case '-': n--; stack[n-1] -= stack[n]; break;
+		case '*': n--; stack[n-1] *= stack[n]; break;
+		case '/': n--; stack[n-1] = (stack[n] != 0.0) ? stack[n-1] / stack[n] : 0.0; break;
+		}
+	}
+	return (n > 0) ? stack[n-1] : 0.0;
+}
+
+
+// ----------------------------------------------------------------------
+// table parser
+// ----------------------------------------------------------------------
+
+  /// the group which does not have the values taken by position is not used
+static void table_close_group (table_platform* tp, int i_group, int i_group_line,
+		const std::string& s_source, bool verbose)
+{
+	if (tp == NULL || i_group < 0 || !tp->defined[i_group]) return;
+	std::string error = table_check_group(tp->group[i_group], i_group);
+	if (error.empty()) return;
+	tp->defined[i_group] = false;
+	if (verbose) {
+		fprintf(stderr, "*** PMlib warning. HWPC event table %s line %d: %s. the group is ignored.\n",
+			s_source.c_str(), i_group_line, error.c_str());
+	}
+}
+
+static void table_parse (const std::string& s_text, const std::string& s_source,
+		std::vector<table_platform>& platforms, bool verbose)
+{
+	table_platform* tp = NULL;
+	int i_group = -1;
+	int i_group_line = 0;
+	int i_line = 0;
+	size_t i_begin = 0;
+
+	while (i_begin < s_text.size()) {
+		size_t i_end = s_text.find('\n', i_begin);
+		if (i_end == std::string::npos) i_end = s_text.size();
+		std::string s_line = s_text.substr(i_begin, i_end-i_begin);
+		i_begin = i_end + 1;
+		i_line++;
+
+		size_t i_comment = s_line.find('#');
+		if (i_comment != std::string::npos) s_line.erase(i_comment);
+		s_line = table_trim(s_line);
+		if (s_line.empty()) continue;
+
+		size_t i_space = s_line.find_first_of(" \t");
+		std::string s_key = s_line.substr(0, i_space);
+		std::string s_rest = (i_space == std::string::npos) ? "" : table_trim(s_line.substr(i_space));
+		std::string error;
+
+		if (s_key == "platform" || s_key == "group") table_close_group(tp, i_group, i_group_line, s_source, verbose);
+
+		if (s_key == "platform") {
+			table_platform p;
+			size_t i_name = s_rest.find_first_of(" \t");
+			p.name = s_rest.substr(0, i_name);
+			p.peak = 0.0;
+			for (int i=0; i<Max_hwpc_output_group; i++) p.defined[i] = false;
+			std::string s_match = (i_name == std::string::npos) ? "" : s_rest.substr(i_name);
+			size_t i_pos = 0;
+			while (i_pos <= s_match.size()) {
+				size_t i_bar = s_match.find('|', i_pos);
+				if (i_bar == std::string::npos) i_bar = s_match.size();
+				std::string s = table_trim(s_match.substr(i_pos, i_bar-i_pos));
+				if (!s.empty()) p.match.push_back(s);
+				i_pos = i_bar + 1;
+			}
+			if (p.name.empty() || p.match.empty()) {
+				error = "platform needs the name and the model substrings";
+				tp = NULL;
+			} else {
+				platforms.push_back(p);
+				tp = &platforms.back();
+			}
+			i_group = -1;
+
+		} else if (tp == NULL) {
+			error = "no platform line before " + s_key;
+
+		} else if (s_key == "peak") {
+			tp->peak = atof(s_rest.c_str());
+
+		} else if (s_key == "group") {
+			i_group = table_group_index(s_rest);
+			i_group_line = i_line;
+			if (i_group < 0) {
+				error = "unknown group " + s_rest;
+			} else {
+				tp->defined[i_group] = true;
+				tp->group[i_group].n_events = 0;
+				tp->group[i_group].n_metrics = 0;
+			}
+
+		} else if (i_group < 0) {
+			error = "no group line before " + s_key;
+
+		} else if (s_key == "event") {
+			hwpc_table_group& g = tp->group[i_group];
+			size_t i_label = s_rest.find_first_of(" \t");
+			std::string s_label = s_rest.substr(0, i_label);
+			std::string s_names = (i_label == std::string::npos) ? "" : table_trim(s_rest.substr(i_label));
+			if (!table_identifier(s_label)) {
+				error = "event label must be an identifier: " + s_label;
+			} else if (s_names.empty()) {
+				error = "event " + s_label + " has no event name";
+			} else if (g.n_events >= Max_table_events || g.n_metrics > 0) {
+				error = "too many events, or event after metric";
+			} else {
+				int i = g.n_events++;
+				g.label[i] = s_label;
+				g.name[i].clear();
+				g.backend_name[i].clear();
+				g.scope[i] = I_scope_core;
+				// "name" for any backend, "backend=name" for a specific backend
+				size_t i_pos = 0;
+				while (i_pos < s_names.size()) {
+					size_t i_next = s_names.find_first_of(" \t", i_pos);
+					if (i_next == std::string::npos) i_next = s_names.size();
+					std::string s = s_names.substr(i_pos, i_next-i_pos);
+					i_pos = s_names.find_first_not_of(" \t", i_next);
+					if (i_pos == std::string::npos) i_pos = s_names.size();
+					if (s.compare(0, 5, "papi=") == 0 || s.compare(0, 5, "perf=") == 0 || s.compare(0, 7, "replay=") == 0) {
+						g.backend_name[i] += s + " ";
+					} else if (s.compare(0, 6, "scope=") == 0) {
+						if (s == "scope=core") {
+							g.scope[i] = I_scope_core;
+						} else if (s == "scope=socket") {
+							g.scope[i] = I_scope_socket;
+						} else if (s == "scope=node") {
+							g.scope[i] = I_scope_node;
+						} else {
+							error = "unknown " + s;
+						}
+					} else {
+						g.name[i] = s;
+					}
+				}
+			}
+
+		} else if (s_key == "metric") {
+			hwpc_table_group& g = tp->group[i_group];
+			size_t i_equal = s_rest.find('=');
+			if (i_equal == std::string::npos) {
+				error = "metric needs <label> = <expression>";
+			} else if (g.n_metrics >= Max_table_metrics) {
+				error = "too many metrics";
+			} else {
+				int i = g.n_metrics;
+				g.m_label[i] = table_trim(s_rest.substr(0, i_equal));
+				g.m_text[i] = table_trim(s_rest.substr(i_equal+1));
+				if (expr_compile(g.m_text[i], g, i, g.m_expr[i], error)) {
+					g.n_metrics++;
+				} else {
+					error = "metric " + g.m_label[i] + ": " + error;
+				}
+			}
+
+		} else {
+			error = "unknown keyword " + s_key;
+		}
+
+		if (!error.empty() && verbose) {
+			fprintf(stderr, "*** PMlib warning. HWPC event table %s line %d: %s. ignored.\n",
+				s_source.c_str(), i_line, error.c_str());
+		}
+	}
+	table_close_group(tp, i_group, i_group_line, s_source, verbose);
+}
+
+
+  /// the string matched with the table platforms. The ARM processors have
+  /// no model name, so "ARM <implementer>:<part>" is added from /proc/cpuinfo
+static std::string table_cpu_id (const std::string& s_model, const std::string& s_vendor)
+{
+	std::string s_id = s_model + " " + s_vendor;
+
+	FILE* fp = fopen("/proc/cpuinfo", "r");
+	if (fp == NULL) return s_id;
+	char buffer[1024];
+	int cpu_implementer = -1;
+	int cpu_part = -1;
+	while (fgets(buffer, 1024, fp) != NULL) {
+		if (cpu_implementer < 0 && !strncmp(buffer, "CPU implementer", 15)) {
+			sscanf(buffer, "CPU implementer\t: %x", &cpu_implementer);
+		}
+		if (cpu_part < 0 && !strncmp(buffer, "CPU part", 8)) {
+			sscanf(buffer, "CPU part\t: %x", &cpu_part);
+		}
+	}
+	fclose(fp);
+	if (cpu_implementer >= 0 && cpu_part >= 0) {
+		snprintf(buffer, 1024, " ARM 0x%02x:0x%03x", cpu_implementer, cpu_part);
+		s_id += buffer;
+	}
+	return s_id;
+}
+
+static const table_platform* table_match (const std::vector<table_platform>& platforms, const std::string& s_id)
+{
+	for (size_t i=0; i<platforms.size(); i++) {
+		for (size_t j=0; j<platforms[i].match.size(); j++) {
+			if (s_id.find(platforms[i].match[j]) != std::string::npos) return &platforms[i];
+		}
+	}
+	return NULL;
+}
+
+
+std::string hwpc_table_select (const std::string& s_model, const std::string& s_vendor, bool builtin, bool verbose)
+{
+	char* cp_env = std::getenv("PMLIB_HWPC_TABLE");
+	if (!table_loaded) {
+		table_loaded = true;
+		if (cp_env != NULL && cp_env[0] != '\0') {
+			FILE* fp = fopen(cp_env, "r");
+			if (fp == NULL) {
+				if (verbose) {
+				fprintf(stderr, "*** PMlib warning. can not open PMLIB_HWPC_TABLE=%s. ignored.\n", cp_env);
+				}
+			} else {
+				std::string s_text;
+				char buffer[1024];
+				while (fgets(buffer, 1024, fp) != NULL) s_text += buffer;
+				fclose(fp);
+				table_parse(s_text, cp_env, user_platforms, verbose);
+			}
+		}
+		table_parse(hwpc_table_shipped, "shipped", shipped_platforms, verbose);
+	}
+
+	std::string s_id = table_cpu_id(s_model, s_vendor);
+	table_selected = table_match(user_platforms, s_id);
+	if (table_selected != NULL) {
+		table_selected_source = cp_env;
+	} else if (!builtin) {
+		table_selected = table_match(shipped_platforms, s_id);
+		table_selected_source = "shipped";
+	}
+	return (table_selected != NULL) ? table_selected->name : "";
+}
+
+
+double hwpc_table_peak (void)
+{
+	return (table_selected != NULL) ? table_selected->peak : 0.0;
+}
+
+
+std::string hwpc_table_source (void)
+{
+	return (table_selected != NULL) ? table_selected_source : "";
+}
+
+
+const hwpc_table_group* hwpc_table_group_of (int i_group)
+{
+	if (table_selected == NULL || i_group < 0 || i_group >= Max_hwpc_output_group) return NULL;
+	if (!table_selected->defined[i_group]) return NULL;
+	return &table_selected->group[i_group];
+}
+
+
+std::string hwpc_table_event_name (const hwpc_table_group* g, int i, const char* c_backend)
+{
+	std::string s_key = std::string(c_backend) + "=";
+	const std::string& s_list = g->backend_name[i];
+	size_t i_pos = 0;
+	while (i_pos < s_list.size()) {
+		size_t i_next = s_list.find(' ', i_pos);
+		if (i_next == std::string::npos) i_next = s_list.size();
+		if (s_list.compare(i_pos, s_key.size(), s_key) == 0) {
+			return s_list.substr(i_pos + s_key.size(), i_next - i_pos - s_key.size());
+		}
+		i_pos = i_next + 1;
+	}
+	return g->name[i];
+}
+
+
+void hwpc_table_eval (const hwpc_table_group* g, const double* counts,
+		double time, double peak, double ghz, double* metrics)
+{
+	double operand[Max_table_operands];
+	for (int i=0; i<Max_table_operands; i++) operand[i] = 0.0;
+	for (int i=0; i<g->n_events; i++) operand[i] = counts[i];
+	operand[I_time] = time;
+	operand[I_peak] = peak;
+	operand[I_ghz] = ghz;
+
+	for (int i=0; i<g->n_metrics; i++) {
+		metrics[i] = expr_eval(g->m_expr[i], operand);
+		operand[Max_table_events + i] = metrics[i];
+	}
+}
+
+} /* namespace pm_lib */
+
+#endif // USE_HWPC
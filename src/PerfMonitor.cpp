@@ -24,13 +24,117 @@
 #include <time.h>
 #include <unistd.h> // for gethostname() of FX10/K
 #include <cmath>
+#include <algorithm>
+#include <atomic>
 #include "power_obj_menu.h"
+#include "pmlib_ompt.h"
+#include "pmlib_sampling.h"
 
 namespace pm_lib {
 
+  extern struct hwpc_group_chooser hwpc_group;
+
     /// shared map of section name and ID
     std::map<std::string, int > shared_map_sections;
 
+    /// the largest team which ran the section being merged by mergeThreads()
+    static int pm_merge_team_size = 0;
+
+    /// the settings made by initialize(), which are taken over by the threads
+    /// joining a team after initialize(). See PerfMonitor::bindLateThread()
+    struct pm_initial_setup {
+      bool is_PMlib_enabled;
+      int my_rank;
+      int num_process;
+      int num_threads;
+      int init_nWatch;
+      std::string parallel_mode;
+      std::string env_str_hwpc;
+      std::string env_str_report;
+    };
+    static pm_initial_setup pm_setup;
+    static std::atomic<bool> pm_setup_done(false);
+
+    /// the stack of the active sections of each thread. mark() and counter()
+    /// are attributed to the innermost section
+    static const int Max_section_depth = 64;
+    struct pm_section_stack {
+      int depth;
+      int id[Max_section_depth];
+    };
+    static pm_section_stack pm_stacks[Max_nthreads];
+
+    /// the statistics of a mark or a counter in a section
+    struct pm_series_stat {
+      long count;
+      double sum;
+      double min;
+      double max;
+    };
+
+    /// a sample of the time series. the key is the index of pm_series::keys
+    struct pm_series_sample {
+      double t;
+      int key;
+      double value;
+    };
+
+    /// the marks and the counters of a thread. Only the owner thread writes it
+    struct pm_series {
+      std::map<std::string, int> key_map;
+      std::vector<std::string> keys;	// section label + '\0' + kind + name
+      std::vector<pm_series_stat> stats;
+      std::vector<int> trace_ids;
+      std::vector<pm_series_sample> samples;
+      long n_dropped;
+      pm_series () : n_dropped(0) {}
+    };
+    static std::atomic<pm_series*> pm_series_store[Max_nthreads];
+    static std::atomic<long> pm_series_max(-1);	// PMLIB_SERIES_MAX
+
+    /// the slot of the calling thread, unique over the nested parallel regions.
+    /// Max_nthreads for the threads beyond the slots, which are not recorded
+    static int pm_thread_index (void)
+    {
+      return std::min(flat_thread_num(), Max_nthreads);
+    }
+
+    /// the union of the keys of all processes, sorted. Collective over MPI_COMM_WORLD
+    static void pm_union_keys (int num_process, std::vector<std::string>& keys)
+    {
+	#ifndef DISABLE_MPI
+      if (num_process > 1) {
+        // each key is sent as its length and its characters
+        std::string s_keys;
+        for (size_t k=0; k<keys.size(); k++) {
+          int n = keys[k].size();
+          s_keys.append((const char*)&n, sizeof(n));
+          s_keys += keys[k];
+        }
+        int n_chars = s_keys.size();
+        std::vector<int> counts(num_process), displs(num_process);
+        MPI_Allgather(&n_chars, 1, MPI_INT, &counts[0], 1, MPI_INT, MPI_COMM_WORLD);
+        int n_all = 0;
+        for (int i=0; i<num_process; i++) {
+          displs[i] = n_all;
+          n_all += counts[i];
+        }
+        std::vector<char> buf(n_all + 1);
+        MPI_Allgatherv((void*)s_keys.data(), n_chars, MPI_CHAR, &buf[0], &counts[0], &displs[0], MPI_CHAR, MPI_COMM_WORLD);
+        keys.clear();
+        for (size_t pos=0; pos + sizeof(int) <= (size_t)n_all; ) {
+          int n;
+          memcpy(&n, &buf[pos], sizeof(n));
+          pos += sizeof(n);
+          keys.push_back(std::string(&buf[pos], n));
+          pos += n;
+        }
+      }
+	#endif
+      std::sort(keys.begin(), keys.end());
+      keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+    }
+
 
 
   /// 初期化.
@@ -94,7 +198,7 @@ namespace pm_lib {
 	is_MPI_enabled = true;
 	#endif
 
-	#ifdef USE_PAPI
+	#ifdef USE_HWPC
 	is_PAPI_enabled = true;
 	#else
 	is_PAPI_enabled = false;
@@ -128,7 +232,8 @@ namespace pm_lib {
     }
 
 // Parse the Environment Variable HWPC_CHOOSER
-	// If given, the value should be one of {FLOPS| BANDWIDTH| VECTOR| CACHE| CYCLE| LOADSTORE| USER}
+	// If given, the value should be one of {FLOPS| BANDWIDTH| VECTOR| CACHE| CYCLE| LOADSTORE| TOPDOWN| TLB| CUSTOM:EV1,EV2,...| USER}
+	// or the multiplexed groups joined by '+', e.g. FLOPS+BANDWIDTH+CACHE
 	std::string s_chooser;
 	std::string s_default = "FLOPS";
 
@@ -144,8 +249,15 @@ namespace pm_lib {
 			s_chooser == "CACHE" ||
 			s_chooser == "CYCLE" ||
 			s_chooser == "LOADSTORE" ||
+			s_chooser == "TOPDOWN" ||
+			s_chooser == "TLB" ||
 			s_chooser == "USER" ) {
 			;
+		} else if (s_chooser.compare(0, 7, "CUSTOM:") == 0) {
+			s_chooser = "CUSTOM";
+		} else if (s_chooser.find('+') != std::string::npos &&
+			hwpc_parse_multiplex(std::string(cp_env), s_chooser) > 0) {
+			;	// multiplexed groups, e.g. FLOPS+BANDWIDTH+CACHE
 		} else {
 			printDiag("initialize()",  "unknown HWPC_CHOOSER value [%s]. the default value [%s] is set.\n", cp_env, s_default.c_str());
 			s_chooser = s_default;
@@ -173,6 +285,12 @@ namespace pm_lib {
     m_watchArray[0].num_process = num_process;
 
 // Note: HWPC, Power API,  and OTF are all initialized by a "Root Section" PerfWatch instance
+// The thread which joins a team after initialize() keeps the shared objects
+// prepared by the initial team. See bindLateThread().
+
+// the processes sharing the node and the socket. The detection is a collective operation
+// of the processes, so it is done once by the master thread before HWPC is initialized.
+    if (my_thread == 0) m_watchArray[0].detectNodeLayout();
 
 // initialize HWPC interface structure
     m_watchArray[0].initializeHWPC();
@@ -201,6 +319,7 @@ namespace pm_lib {
 //	increment the shared sections as well
     int id_shared;
     id_shared = add_shared_section(label);
+    m_shared_ids.assign(1, id_shared);
 
     //	m_watchArray[0].setRootPowerLevel (num_power, level_POWER);
 
@@ -209,11 +328,15 @@ namespace pm_lib {
 
 // initialize OTF manager
     m_watchArray[0].initializeOTF();
+    m_watchArray[0].initializeTrace();
 
 // start root section
     m_watchArray[0].start();
     is_Root_active = true;			// "Root Section" is now active
 
+// start the sampling profiler if PMLIB_SAMPLING is given
+    pm_sampling_initialize(my_rank);
+
 // start power measurement
 	#ifdef USE_POWER
     m_watchArray[0].power_start( pm_pacntxt, pm_extcntxt, pm_obj_array, pm_obj_ext);
@@ -240,6 +363,110 @@ namespace pm_lib {
 		}
 	}
 	env_str_report = s_chooser;
+
+// keep the settings for the threads which join a team later
+	#pragma omp critical (pm_setup)
+	{
+	if (!pm_setup_done.load()) {
+		pm_setup.is_PMlib_enabled = is_PMlib_enabled;
+		pm_setup.my_rank = my_rank;
+		pm_setup.num_process = num_process;
+		pm_setup.num_threads = num_threads;
+		pm_setup.init_nWatch = init_nWatch;
+		pm_setup.parallel_mode = parallel_mode;
+		pm_setup.env_str_hwpc = env_str_hwpc;
+		pm_setup.env_str_report = env_str_report;
+		pm_setup_done.store(true, std::memory_order_release);
+	}
+	}
+
+	#if defined(USE_OMPT) && defined(_OPENMP)
+	// OpenMP constructs executed by this thread are measured automatically
+	// if the OMPT tool has been activated by PMLIB_OMPT environment variable.
+	pm_ompt_attach(this);
+	#endif
+  }
+
+
+  /// initialize()の後に並列チームに加わったスレッドの準備.
+  /// omp_set_num_threads()やnum_threads()で大きくなったチーム、
+  /// nested parallel regionのスレッドのthreadprivateなインスタンスは
+  /// initialize()を経由しないので、最初のstart(), mark(), counter()で準備する
+  ///
+  /// @note 並列領域の内側から呼ばれるので、MPI通信や共有オブジェクト
+  ///       (HWPC, Power API, trace)の初期化は行わない。
+  ///       "Root Section"はinitialize()したスレッドが測定する
+  ///
+  void PerfMonitor::bindLateThread (void)
+  {
+    // initialize() has not been called by the process. The calls are ignored
+    if (!pm_setup_done.load(std::memory_order_acquire)) return;
+
+    is_late_thread = true;
+    is_PMlib_enabled = pm_setup.is_PMlib_enabled;
+    if (!is_PMlib_enabled) return;
+
+    my_rank = pm_setup.my_rank;
+    num_process = pm_setup.num_process;
+    num_threads = pm_setup.num_threads;
+    init_nWatch = pm_setup.init_nWatch;
+    parallel_mode = pm_setup.parallel_mode;
+    env_str_hwpc = pm_setup.env_str_hwpc;
+    env_str_report = pm_setup.env_str_report;
+
+	#ifdef _OPENMP
+    is_OpenMP_enabled = true;
+	// the thread of a nested team is numbered across the levels, as PerfWatch does
+	my_thread = std::min(flat_thread_num(), Max_nthreads-1);
+	#else
+    is_OpenMP_enabled = false;
+	my_thread = 0;
+	#endif
+	#ifdef DISABLE_MPI
+	is_MPI_enabled = false;
+	#else
+	is_MPI_enabled = true;
+	#endif
+	#ifdef USE_HWPC
+	is_PAPI_enabled = true;
+	#else
+	is_PAPI_enabled = false;
+	#endif
+	#ifdef USE_POWER
+	is_POWER_enabled = true;
+	#else
+	is_POWER_enabled = false;
+	#endif
+    #ifdef USE_OTF
+    is_OTF_enabled = true;
+    #else
+    is_OTF_enabled = false;
+    #endif
+	num_power = 0;
+	level_POWER = 0;
+
+    std::string label;
+    label="Root Section";
+
+    m_watchArray = new PerfWatch[init_nWatch];
+    m_nWatch = 0 ;
+    m_order = NULL;
+	reserved_nWatch = init_nWatch;
+
+    m_watchArray[0].my_rank = my_rank;
+    m_watchArray[0].num_process = num_process;
+
+    int id, id_shared;
+    id = add_section_object(label);
+    id_shared = add_shared_section(label);
+    m_shared_ids.assign(1, id_shared);
+    m_nWatch++;
+    m_watchArray[0].setProperties(label, id, CALC, num_process, my_rank, num_threads, false);
+	is_Root_active = false;		// "Root Section" is measured by the initial team
+
+	#if defined(USE_OMPT) && defined(_OPENMP)
+	pm_ompt_attach(this);
+	#endif
   }
 
 
@@ -280,6 +507,8 @@ namespace pm_lib {
 	if (id < 0) {
     	id = add_section_object(label);
    		id_shared = add_shared_section(label);
+   		if ((int)m_shared_ids.size() <= id) m_shared_ids.resize(id+1, 0);
+   		m_shared_ids[id] = id_shared;
 
     	#ifdef DEBUG_PRINT_MONITOR
 		fprintf(stderr, "<setProperties> [%s] NEW section created by my_rank=%d, my_thread=%d as [%d] \n", label.c_str(), my_rank, my_thread, id);
@@ -407,6 +636,30 @@ namespace pm_lib {
   }
 
 
+  /// HWPC_CHOOSERで多重化したグループのうち計測するグループを切り替える
+  ///
+  ///   @param[in] name : グループ名、または'+'で連結したグループ名。"ALL"は全グループ
+  ///
+  void PerfMonitor::setCounterGroup(const std::string& name)
+  {
+    if (!is_PMlib_enabled) return;
+
+    #ifdef DEBUG_PRINT_MONITOR
+    if (my_rank == 0) {
+      fprintf(stderr, "<PerfMonitor::setCounterGroup> is called. name=%s \n", name.c_str());
+    }
+    #endif
+
+	#ifdef USE_HWPC
+	m_watchArray[0].switchCounterGroup(name);
+	#else
+	if (my_rank == 0) {
+		fprintf(stderr, "*** Warning PMlib. HWPC is not included. <setCounterGroup> is ignored.\n");
+	}
+    #endif
+  }
+
+
 
   /// 測定区間スタート
   ///
@@ -415,6 +668,12 @@ namespace pm_lib {
   ///
   void PerfMonitor::start (const std::string& label)
   {
+    if (m_watchArray == NULL) {
+		// This threadprivate copy has not been initialized. The thread has joined
+		// a team after initialize(), i.e. the team has grown with omp_set_num_threads()
+		// or num_threads() clause, or a nested team has started. Bind it lazily.
+		bindLateThread();
+	}
     if (!is_PMlib_enabled) return;
 
     int id;
@@ -456,10 +715,22 @@ namespace pm_lib {
     }
     is_exclusive_construct = true;
 
-    m_watchArray[id].start();
+    if (pm_sampling_period > 0.0) {
+      // the sampling profiler estimates the time. The section is not timed
+      pm_sampling_push(m_shared_ids[id]);
+    } else {
+      m_watchArray[id].start();
 	#ifdef USE_POWER
-    m_watchArray[id].power_start( pm_pacntxt, pm_extcntxt, pm_obj_array, pm_obj_ext);
+      m_watchArray[id].power_start( pm_pacntxt, pm_extcntxt, pm_obj_array, pm_obj_ext);
 	#endif
+    }
+
+    int i_thread = pm_thread_index();
+    if (i_thread < Max_nthreads) {
+      pm_section_stack& st = pm_stacks[i_thread];
+      if (st.depth < Max_section_depth) st.id[st.depth] = id;
+      st.depth++;
+    }
 
     //	last_started_label = label;
     #ifdef DEBUG_PRINT_MONITOR
@@ -470,15 +741,37 @@ namespace pm_lib {
   }
 
 
+  /// 自動生成される測定区間のスタート (OMPTツールから呼び出される)
+  ///
+  ///   @param[in] label ラベル文字列。
+  ///   @return 区間を開始したか
+  ///
+  bool PerfMonitor::startAutoSection (const std::string& label)
+  {
+    if (!is_PMlib_enabled || m_watchArray == NULL) return false;
+
+	#ifdef _OPENMP
+    if (!omp_in_parallel() && m_watchArray[0].statsSwitch() >= 2) return false;
+	#endif
+
+    if (find_section_object(label) < 0) {
+      PerfMonitor::setProperties(label, CALC, false);
+    }
+    start(label);
+    return true;
+  }
+
+
   /// 測定区間ストップ
   ///
   ///   @param[in] label ラベル文字列。測定区間を識別するために用いる。
   ///   @param[in] flopPerTask 測定区間の計算量(演算量Flopまたは通信量Byte):省略値0
   ///   @param[in] iterationCount  計算量の乗数（反復回数）:省略値1
+  ///   @param[in] bytePerTask 測定区間のメモリ転送量(Byte):省略値0
   ///
   ///   @note  引数とレポート出力情報の関連は PerfMonitor.h に詳しく説明されている。
   ///
-  void PerfMonitor::stop(const std::string& label, double flopPerTask, unsigned iterationCount)
+  void PerfMonitor::stop(const std::string& label, double flopPerTask, unsigned iterationCount, double bytePerTask)
   {
     if (!is_PMlib_enabled) return;
 
@@ -493,16 +786,34 @@ namespace pm_lib {
 				label.c_str());
       return;
     }
-    m_watchArray[id].stop(flopPerTask, iterationCount);
+    if (pm_sampling_period > 0.0) {
+      pm_sampling_pop(m_shared_ids[id]);
+    } else {
+      m_watchArray[id].stop(flopPerTask, iterationCount, bytePerTask);
 	#ifdef USE_POWER
-    m_watchArray[id].power_stop( pm_pacntxt, pm_extcntxt, pm_obj_array, pm_obj_ext);
+      m_watchArray[id].power_stop( pm_pacntxt, pm_extcntxt, pm_obj_array, pm_obj_ext);
 	#endif
 
-    if (!is_exclusive_construct) {
-      m_watchArray[id].m_exclusive = false;
+      if (!is_exclusive_construct) {
+        m_watchArray[id].m_exclusive = false;
+      }
     }
     is_exclusive_construct = false;
 
+    // pop the section even if the sections are not properly nested
+    int i_thread = pm_thread_index();
+    if (i_thread < Max_nthreads) {
+      pm_section_stack& st = pm_stacks[i_thread];
+      int n = std::min(st.depth, Max_section_depth);
+      for (int k=n-1; k>=0; k--) {
+        if (st.id[k] != id) continue;
+        for (int j=k; j<n-1; j++) st.id[j] = st.id[j+1];
+        st.depth--;
+        break;
+      }
+      if (st.depth > Max_section_depth) st.depth--;
+    }
+
     #ifdef DEBUG_PRINT_MONITOR
     //	if (my_rank == 0) {
       fprintf(stderr, "<stop> [%s] id=%d\n", label.c_str(), id);
@@ -511,6 +822,144 @@ namespace pm_lib {
   }
 
 
+  /// mark() と counter() の記録
+  ///
+  ///   @param[in] name   名前
+  ///   @param[in] kind   I_trace_mark または I_trace_counter
+  ///   @param[in] value  counter の値 (mark では 1)
+  ///
+  void PerfMonitor::recordSeries (const std::string& name, int kind, double value)
+  {
+    if (m_watchArray == NULL) {
+		bindLateThread();
+	}
+    if (!is_PMlib_enabled) return;
+    if (name.empty()) {
+      printDiag(kind == I_trace_mark ? "mark()" : "counter()",  "name is blank. Ignored the call.\n");
+      return;
+    }
+    int i_thread = pm_thread_index();
+    if (i_thread >= Max_nthreads) return;
+
+    // the innermost active section of this thread, or the Root section
+    int id = 0;
+    const pm_section_stack& st = pm_stacks[i_thread];
+    if (st.depth > 0) {
+      int k = std::min(st.depth, Max_section_depth) - 1;
+      if (st.id[k] < m_nWatch) id = st.id[k];
+    }
+    double t = m_watchArray[0].getTime();
+
+    pm_series* ps = pm_series_store[i_thread].load(std::memory_order_acquire);
+    if (ps == NULL) {
+      ps = new pm_series;
+      pm_series_store[i_thread].store(ps, std::memory_order_release);
+    }
+    std::string key = m_watchArray[id].m_label;
+    key += '\0';
+    key += (char)('0' + kind);
+    key += name;
+    int i_key;
+    std::map<std::string, int>::iterator it = ps->key_map.find(key);
+    if (it == ps->key_map.end()) {
+      i_key = ps->keys.size();
+      ps->key_map.insert( std::make_pair(key, i_key) );
+      ps->keys.push_back(key);
+      pm_series_stat z = { 0, 0.0, value, value };
+      ps->stats.push_back(z);
+      ps->trace_ids.push_back(-1);
+    } else {
+      i_key = it->second;
+    }
+
+    pm_series_stat& c = ps->stats[i_key];
+    c.count++;
+    c.sum += value;
+    c.min = std::min(c.min, value);
+    c.max = std::max(c.max, value);
+
+    long n_max = pm_series_max.load();
+    if (n_max < 0) {
+      char* cp_env = std::getenv("PMLIB_SERIES_MAX");
+      n_max = (cp_env == NULL) ? 100000 : std::max(atol(cp_env), 0L);
+      pm_series_max.store(n_max);
+    }
+    if ((long)ps->samples.size() < n_max) {
+      pm_series_sample r = { t, i_key, value };
+      ps->samples.push_back(r);
+    } else {
+      ps->n_dropped++;
+    }
+
+    if (pm_trace_level != 0) {
+      if (ps->trace_ids[i_key] == -1) ps->trace_ids[i_key] = pm_trace_name(name, kind);
+      if (ps->trace_ids[i_key] >= 0) {
+        pm_trace_instant(i_thread, ps->trace_ids[i_key], t, (kind == I_trace_counter) ? &value : NULL);
+      }
+    }
+  }
+
+
+  /// 事象の記録
+  ///
+  ///   @param[in] label 事象の名前
+  ///
+  void PerfMonitor::mark (const std::string& label)
+  {
+    recordSeries(label, I_trace_mark, 1.0);
+  }
+
+
+  /// 値の記録
+  ///
+  ///   @param[in] name   counterの名前
+  ///   @param[in] value  値
+  ///
+  void PerfMonitor::counter (const std::string& name, double value)
+  {
+    recordSeries(name, I_trace_counter, value);
+  }
+
+
+  /// 自プロセスが記録した counter の時系列を取得する
+  ///
+  ///   @param[in]  name   counterの名前
+  ///   @param[out] time   時刻 [sec]
+  ///   @param[out] value  値
+  ///   @return 記録できずに捨てられた値の数
+  ///
+  long PerfMonitor::getCounterSeries (const std::string& name, std::vector<double>& time, std::vector<double>& value)
+  {
+    time.clear();
+    value.clear();
+    if (!is_PMlib_enabled) return 0;
+
+    std::vector< std::pair<double, double> > v;
+    long n_dropped = 0;
+    for (int i=0; i<Max_nthreads; i++) {
+      pm_series* ps = pm_series_store[i].load(std::memory_order_acquire);
+      if (ps == NULL) continue;
+      std::vector<bool> is_match(ps->keys.size());
+      for (size_t k=0; k<ps->keys.size(); k++) {
+        const std::string& key = ps->keys[k];
+        size_t pos = key.find('\0');
+        is_match[k] = (key[pos+1] == '0' + I_trace_counter && key.compare(pos+2, std::string::npos, name) == 0);
+      }
+      for (size_t j=0; j<ps->samples.size(); j++) {
+        const pm_series_sample& r = ps->samples[j];
+        if (is_match[r.key]) v.push_back( std::make_pair(r.t, r.value) );
+      }
+      n_dropped += ps->n_dropped;
+    }
+    std::sort(v.begin(), v.end());
+    for (size_t j=0; j<v.size(); j++) {
+      time.push_back(v[j].first);
+      value.push_back(v[j].second);
+    }
+    return n_dropped;
+  }
+
+
   /// 測定区間リセット
   ///
   ///   @param[in] label ラベル文字列。測定区間を識別するために用いる。
@@ -585,6 +1034,14 @@ namespace pm_lib {
     }
     #endif
 
+	#if defined(USE_OMPT) && defined(_OPENMP)
+	// the parallel constructs in the report phase are not measured by the OMPT tool
+	pm_ompt_detach();
+	#endif
+
+    // the report phase is not sampled
+    pm_sampling_stop();
+
     if (is_Root_active) {
     	m_watchArray[0].stop(0.0, 1);
 
@@ -594,6 +1051,9 @@ namespace pm_lib {
     	m_watchArray[0].cleanupHWPC();
 
     	is_Root_active = false;
+    } else if (is_late_thread) {
+    	// the thread joined the team after initialize() and has bound its own HWPC context
+    	m_watchArray[0].cleanupHWPC();
     }
   }
 
@@ -717,14 +1177,18 @@ namespace pm_lib {
   ///
   void PerfMonitor::mergeThreads (int id)
   {
-    if (!is_PMlib_enabled) return;
 #ifdef _OPENMP
 	int mid = -1;	// this has been a hidden bug.
 	bool in_parallel;
 	in_parallel = omp_in_parallel();
 	std::string s;
 
+	// A thread whose threadprivate copy has not been initialized must still pass the barriers below.
+	bool is_active = (m_watchArray != NULL) && is_PMlib_enabled;
+	if (!is_active && !in_parallel) return;
+
 	// identify the section label for id
+	if (is_active)
 	for (auto it=shared_map_sections.begin(); it != shared_map_sections.end(); ++it)
 	{
     	if (it->second == id) {
@@ -747,12 +1211,24 @@ namespace pm_lib {
 	}
 	#endif
 
+	// The threads joining the team after initialize() may have run the section
+	// in a team larger than the master thread has seen, or the master thread
+	// may not have run it at all. The master thread merges the largest team.
+	if ( mid>=0 ) {
+		int n_team = m_watchArray[mid].get_team_size();
+		#pragma omp critical (pm_merge_team)
+		if (n_team > pm_merge_team_size) pm_merge_team_size = n_team;
+	}
+
 	#pragma omp barrier
+	if ( mid>=0 ) m_watchArray[mid].extend_team_size(pm_merge_team_size);
 	if ( mid>=0 ) m_watchArray[mid].mergeMasterThread();
 	#pragma omp barrier
 	if ( mid>=0 ) m_watchArray[mid].mergeParallelThread();
 	#pragma omp barrier
 	if ( mid>=0 ) m_watchArray[mid].updateMergedThread();
+	#pragma omp master
+	pm_merge_team_size = 0;
 	#pragma omp barrier
 
 #endif
@@ -781,6 +1257,10 @@ namespace pm_lib {
 
     sort_m_order();
 
+    gatherSeries();
+
+    gatherSampling();
+
 	#ifdef DEBUG_PRINT_MONITOR
     if (my_rank == 0) { fprintf(stderr, "<PerfMonitor::gather> finishes\n"); }
 	#endif
@@ -826,6 +1306,120 @@ namespace pm_lib {
   }
 
 
+  /// mark() と counter() の統計を全スレッド、全プロセスで集約する
+  ///
+  ///   @note 区間と名前の組の和集合を全プロセスで作り、回数と合計は和、
+  ///         最小値と最大値はそれぞれの最小と最大をとる
+  ///
+  void PerfMonitor::gatherSeries(void)
+  {
+    std::map<std::string, pm_series_stat> m;
+    for (int i=0; i<Max_nthreads; i++) {
+      pm_series* ps = pm_series_store[i].load(std::memory_order_acquire);
+      if (ps == NULL) continue;
+      for (size_t k=0; k<ps->keys.size(); k++) {
+        const pm_series_stat& c = ps->stats[k];
+        std::map<std::string, pm_series_stat>::iterator it = m.find(ps->keys[k]);
+        if (it == m.end()) {
+          m.insert( std::make_pair(ps->keys[k], c) );
+        } else {
+          it->second.count += c.count;
+          it->second.sum += c.sum;
+          it->second.min = std::min(it->second.min, c.min);
+          it->second.max = std::max(it->second.max, c.max);
+        }
+      }
+    }
+
+    std::vector<std::string> keys;
+    for (std::map<std::string, pm_series_stat>::iterator it=m.begin(); it!=m.end(); ++it) {
+      keys.push_back(it->first);
+    }
+    pm_union_keys(num_process, keys);
+
+    int n = keys.size();
+    m_seriesKeys = keys;
+    m_seriesStats.assign(4*n, 0.0);
+    if (n == 0) return;
+    std::vector<double> v_sum(2*n, 0.0), v_min(n, HUGE_VAL), v_max(n, -HUGE_VAL);
+    int k;
+    for (k=0; k<n; k++) {
+      std::map<std::string, pm_series_stat>::iterator it = m.find(keys[k]);
+      if (it == m.end()) continue;
+      v_sum[2*k] = it->second.count;
+      v_sum[2*k+1] = it->second.sum;
+      v_min[k] = it->second.min;
+      v_max[k] = it->second.max;
+    }
+
+    if (num_process > 1) {
+      std::vector<double> r_sum(2*n), r_min(n), r_max(n);
+      MPI_Allreduce(&v_sum[0], &r_sum[0], 2*n, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+      MPI_Allreduce(&v_min[0], &r_min[0], n, MPI_DOUBLE, MPI_MIN, MPI_COMM_WORLD);
+      MPI_Allreduce(&v_max[0], &r_max[0], n, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+      v_sum.swap(r_sum);
+      v_min.swap(r_min);
+      v_max.swap(r_max);
+    }
+    for (k=0; k<n; k++) {
+      m_seriesStats[4*k] = v_sum[2*k];
+      m_seriesStats[4*k+1] = v_sum[2*k+1];
+      m_seriesStats[4*k+2] = v_min[k];
+      m_seriesStats[4*k+3] = v_max[k];
+    }
+  }
+
+
+  /// sampling profiler の標本数を全スレッド、全プロセスで集約する
+  ///
+  ///   @note 標本は区間のラベルで全プロセスの和集合に対応づけて合計する
+  ///
+  void PerfMonitor::gatherSampling(void)
+  {
+    m_samplingKeys.clear();
+    m_samplingStats.clear();
+    m_samplingTicks = 0.0;
+    m_samplingThreads = 0.0;
+    if (pm_sampling_period <= 0.0) return;
+
+    std::vector<long> v_excl, v_incl, v_calls;
+    int n_threads;
+    long n_ticks = pm_sampling_collect(v_excl, v_incl, v_calls, n_threads);
+
+    // the labels of the process wide section ids
+    std::map<std::string, int> m;
+    for (std::map<std::string, int>::const_iterator it=shared_map_sections.begin();
+        it!=shared_map_sections.end(); ++it) {
+      int i = it->second;
+      if (i < 0 || i >= Max_sampled_sections) continue;
+      if (v_calls[i] == 0 && v_incl[i] == 0) continue;
+      m.insert( std::make_pair(it->first, i) );
+      m_samplingKeys.push_back(it->first);
+    }
+    pm_union_keys(num_process, m_samplingKeys);
+
+    int n = m_samplingKeys.size();
+    std::vector<double> v(3*n + 2, 0.0);
+    for (int k=0; k<n; k++) {
+      std::map<std::string, int>::const_iterator it = m.find(m_samplingKeys[k]);
+      if (it == m.end()) continue;
+      v[3*k] = v_calls[it->second];
+      v[3*k+1] = v_excl[it->second];
+      v[3*k+2] = v_incl[it->second];
+    }
+    v[3*n] = n_ticks;
+    v[3*n+1] = n_threads;
+    if (num_process > 1) {
+      std::vector<double> r(v.size());
+      MPI_Allreduce(&v[0], &r[0], v.size(), MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+      v.swap(r);
+    }
+    m_samplingStats.assign(v.begin(), v.begin() + 3*n);
+    m_samplingTicks = v[3*n];
+    m_samplingThreads = v[3*n+1];
+  }
+
+
   /// 経過時間でソートした測定区間のリストm_order[m_nWatch] を作成する。
   /// Remark.
   /// 	Each process stores its own sorted list. Be careful when reporting from rank 0.
@@ -1000,6 +1594,9 @@ namespace pm_lib {
 	}
 	#endif
 
+	// write the trace file if postTrace() has not been called
+	m_watchArray[0].finalizeTrace();
+
 	// BASIC report is always generated.
 	PerfMonitor::print(fp, "", "", 0);
 
@@ -1101,6 +1698,14 @@ namespace pm_lib {
 
     PerfMonitor::printBasicPower (fp, maxLabelLen, op_sort);
 
+    PerfMonitor::printBasicCPU (fp, maxLabelLen, op_sort);
+
+    PerfMonitor::printBasicRoofline (fp, maxLabelLen, op_sort);
+
+    PerfMonitor::printBasicSeries (fp, maxLabelLen, op_sort);
+
+    PerfMonitor::printBasicSampling (fp, maxLabelLen, op_sort);
+
   }
 
 
@@ -1113,7 +1718,7 @@ namespace pm_lib {
 ///
 void PerfMonitor::printBasicHWPC (FILE* fp, int maxLabelLen, int op_sort)
 {
-#ifdef USE_PAPI
+#ifdef USE_HWPC
 	if (m_watchArray[0].my_papi.num_events == 0) return;
 	if (env_str_hwpc == "USER" ) return;
 
@@ -1231,20 +1836,14 @@ void PerfMonitor::printBasicPower(FILE* fp, int maxLabelLen, int op_sort)
 
 	double t_joule;
 	int nnodes;
-	int np_per_node;
 	int iret;
 
 // the combined power consumption for all the processes
 
-    char* cp_env;
-    cp_env = NULL;
-	cp_env = std::getenv("PJM_PROC_BY_NODE");	// Fugaku job manager holds this variable
-	if (cp_env == NULL) {
-		np_per_node = 1;
-	} else {
-		np_per_node = atoi(cp_env);;
-	}
-	nnodes=(num_process-1)/np_per_node+1;
+	// the power is measured per node, and all the processes on the node read the same value.
+	// The number of nodes is detected by PerfWatch::detectNodeLayout()
+	nnodes = hwpc_group.n_nodes;
+	if (nnodes < 1) nnodes = 1;
 
 	fprintf(fp, "\t The aggregate power consumption of %d processes on %d nodes =", num_process, nnodes);
 	// m_power_av is the average value of my_power.w_accumu[Max_power_stats-1]; for all processes
@@ -1340,6 +1939,337 @@ void PerfMonitor::printBasicPower(FILE* fp, int maxLabelLen, int op_sort)
 }
 
 
+/// Report the BASIC thread CPU utilization and context switches of the sections
+///
+///   @param[in] fp       	report file pointer
+///   @param[in] maxLabelLen    maximum label string field length
+///   @param[in] op_sort 	sorting option (0:sorted by seconds, 1:listed order)
+///
+///	  @note  CPU busy[%] is the CPU time divided by the elapsed time of the sampled calls.
+///	         The context switches are extrapolated from the sampled calls to all calls.
+///
+void PerfMonitor::printBasicCPU(FILE* fp, int maxLabelLen, int op_sort)
+{
+    if (!is_PMlib_enabled) return;
+	if (m_watchArray[0].level_CPU == 0) return;
+
+	fprintf(fp, "\n");
+	fprintf(fp, "# PMlib CPU utilization report of threads ---------------------------------------- #\n");
+	fprintf(fp, "\n");
+	fprintf(fp, "\tThread CPU time is sampled once every %d calls of each section (PMLIB_CPU_STATS).\n",
+		m_watchArray[0].level_CPU);
+	fprintf(fp, "\tThe values are the sums of all threads and all processes.\n");
+	fprintf(fp, "\tThe sections outside of the parallel regions include the threads of the parallel regions inside them,\n");
+	fprintf(fp, "\tso their busy[%%] can exceed 100 %%.\n");
+	fprintf(fp, "\t  busy[%%]  : CPU time / elapsed time. Low values suggest lock, I/O or communication waits.\n");
+	fprintf(fp, "\t  vol.csw  : voluntary context switches (blocking)\n");
+	fprintf(fp, "\t  invol.csw: involuntary context switches (preemption). High rates suggest oversubscription.\n");
+	fprintf(fp, "\t  csw/sec  : context switches per second of the thread elapsed time\n\n");
+
+	fprintf(fp, "Section"); for (int i=7; i< maxLabelLen; i++) { fputc(' ', fp); }
+	fprintf(fp, "|  busy[%%]   vol.csw invol.csw  csw/sec \n");
+    for (int i=0; i< maxLabelLen; i++) { fputc('-', fp); }
+	fprintf(fp, "+---------------------------------------------------\n");
+
+    for (int j=0; j<m_nWatch; j++)
+	{
+		int m;
+		if (op_sort == 0) {
+			m = m_order[j];
+		} else {
+			m = j;
+		}
+		if (m == 0) continue;
+		PerfWatch& w = m_watchArray[m];
+		if (w.m_count_sum == 0) continue;
+
+		double cpu  = w.m_cpu_stats[0];
+		double wall = w.m_cpu_stats[1];
+		if (wall <= 0.0) continue;
+		double busy = 100.0 * cpu / wall;
+		double scale = (w.m_cpu_time_all > wall) ? w.m_cpu_time_all / wall : 1.0;
+		double vcsw  = w.m_cpu_stats[2] * scale;
+		double ivcsw = w.m_cpu_stats[3] * scale;
+		double rate  = (w.m_cpu_stats[2] + w.m_cpu_stats[3]) / wall;
+
+		std::string p_label = w.m_label;
+		if (!w.m_exclusive) { p_label = p_label + " (*)"; }
+		if (w.m_in_parallel) { p_label = p_label + " (+)"; }
+
+		fprintf(fp, "%-*s: %7.1f  %9.3e %9.3e %8.1f", maxLabelLen, p_label.c_str(), busy, vcsw, ivcsw, rate);
+		// Low CPU time with mostly involuntary switches means that the runnable threads
+		// waited for a core, otherwise the threads were blocked.
+		if (busy < 50.0) {
+			if (w.m_cpu_stats[3] > w.m_cpu_stats[2]) {
+				fprintf(fp, "  oversubscribed");
+			} else {
+				fprintf(fp, "  idle");
+			}
+		}
+		fprintf(fp, "\n");
+	}
+
+    for (int i=0; i< maxLabelLen; i++) { fputc('-', fp); }
+	fprintf(fp, "+---------------------------------------------------\n");
+}
+
+
+/// Report the roofline position of the sections, and write it to the plot file
+///
+///   @param[in] fp       	report file pointer
+///   @param[in] maxLabelLen    maximum label string field length
+///   @param[in] op_sort 	sorting option (0:sorted by seconds, 1:listed order)
+///
+///	  @note  The floating point operations are taken from the FLOPS (or VECTOR) group
+///	         if it is counted, otherwise from the flopPerTask argument of the calculation
+///	         sections. The memory traffic is taken from the BANDWIDTH group if it is
+///	         counted, otherwise from the bytePerTask argument of stop().
+///	         The compute ceiling is the peak performance per core times the threads
+///	         of the section, and the memory ceiling is the bandwidth measured by
+///	         PMLIB_CALIBRATE.
+///
+void PerfMonitor::printBasicRoofline(FILE* fp, int maxLabelLen, int op_sort)
+{
+    if (!is_PMlib_enabled) return;
+
+	char* cp_env = std::getenv("PMLIB_ROOFLINE");
+	if (cp_env == NULL) return;
+	std::string s_file = cp_env;
+	if (s_file.empty() || s_file == "NO" || s_file == "no" || s_file == "OFF" || s_file == "off") return;
+	if (s_file == "YES" || s_file == "yes" || s_file == "ON" || s_file == "on") {
+		s_file = "pmlib_roofline.csv";
+	}
+
+	double core_peak = hwpc_group.corePERF;
+	double mem_bw = hwpc_group.measuredBW;
+
+	fprintf(fp, "\n");
+	fprintf(fp, "# PMlib roofline report of the sections ----------------------------------------- #\n");
+	fprintf(fp, "\n");
+	fprintf(fp, "\tThe values are per process, averaged over the processes.\n");
+	fprintf(fp, "\t  source   : F/f floating point operations by HWPC/user, B/b bytes by HWPC/user\n");
+	fprintf(fp, "\t  AI       : arithmetic intensity [Flop/Byte]\n");
+	fprintf(fp, "\t  %%roof    : performance over the attainable performance min(peak, AI*bandwidth)\n");
+	if (core_peak > 0.0) {
+	fprintf(fp, "\t  compute ceiling : %.2f GFlops per core x threads of the section\n", core_peak*1.0e-9);
+	} else {
+	fprintf(fp, "\t  compute ceiling : unknown. Set HWPC_CHOOSER or PMLIB_CALIBRATE.\n");
+	}
+	if (mem_bw > 0.0) {
+	fprintf(fp, "\t  memory ceiling  : %.2f GB/s per process (PMLIB_CALIBRATE)\n", mem_bw*1.0e-9);
+	} else {
+	fprintf(fp, "\t  memory ceiling  : unknown. Set PMLIB_CALIBRATE.\n");
+	}
+	fprintf(fp, "\t  The table is also written to %s\n\n", s_file.c_str());
+
+	FILE* fc = fopen(s_file.c_str(), "w");
+	if (fc == NULL) {
+		fprintf(fp, "\t*** PMlib warning. can not open %s\n", s_file.c_str());
+	} else {
+		fprintf(fc, "# PMlib roofline. per process values averaged over %d processes\n", num_process);
+		fprintf(fc, "# bandwidth_gbs=%.6e\n", mem_bw*1.0e-9);
+		fprintf(fc, "section,calls,time,flop,byte,flop_source,byte_source,intensity,gflops,gbs,peak_gflops,attainable_gflops,percent,bound\n");
+	}
+
+	fprintf(fp, "Section"); for (int i=7; i< maxLabelLen; i++) { fputc(' ', fp); }
+	fprintf(fp, "|source     Flop       Byte      AI[F/B]  GFlops     GB/s  %%roof  bound\n");
+    for (int i=0; i< maxLabelLen; i++) { fputc('-', fp); }
+	fprintf(fp, "+---------------------------------------------------------------------\n");
+
+    for (int j=0; j<m_nWatch; j++)
+	{
+		int m;
+		if (op_sort == 0) {
+			m = m_order[j];
+		} else {
+			m = j;
+		}
+		if (m == 0) continue;
+		PerfWatch& w = m_watchArray[m];
+		if (w.m_count_sum == 0) continue;
+
+		double d_flop, d_byte;
+		char c_flop, c_byte;
+		w.getRooflineValues(d_flop, d_byte, c_flop, c_byte);
+		if (d_flop <= 0.0 && d_byte <= 0.0) continue;
+
+		double t = w.m_time_av;
+		double perf = (t > 0.0) ? d_flop / t : 0.0;
+		double bw = (t > 0.0) ? d_byte / t : 0.0;
+		double ai = (d_byte > 0.0) ? d_flop / d_byte : 0.0;
+		double peak = core_peak * w.get_team_size();
+
+		// the attainable performance and the bound of the section
+		double attain = 0.0;
+		std::string s_bound = "-";
+		if (ai > 0.0 && peak > 0.0 && mem_bw > 0.0) {
+			attain = std::min(peak, ai * mem_bw);
+			s_bound = (ai * mem_bw < peak) ? "memory" : "compute";
+		} else if (peak > 0.0 && d_flop > 0.0) {
+			attain = peak;
+		}
+		double ratio = (attain > 0.0) ? 100.0 * perf / attain : 0.0;
+
+		std::string p_label = w.m_label;
+		if (!w.m_exclusive) { p_label = p_label + " (*)"; }
+		if (w.m_in_parallel) { p_label = p_label + " (+)"; }
+
+		fprintf(fp, "%-*s:  %c%c   %9.3e  %9.3e  %9.2e %8.3f %8.3f  %5.1f  %s\n",
+			maxLabelLen, p_label.c_str(), c_flop, c_byte, d_flop, d_byte,
+			ai, perf*1.0e-9, bw*1.0e-9, ratio, s_bound.c_str());
+
+		if (fc != NULL) {
+			std::string s_label;
+			for (size_t i=0; i<w.m_label.size(); i++) {
+				if (w.m_label[i] == '"') s_label += '"';
+				s_label += w.m_label[i];
+			}
+			fprintf(fc, "\"%s\",%ld,%.6e,%.6e,%.6e,%c,%c,%.6e,%.6e,%.6e,%.6e,%.6e,%.2f,%s\n",
+				s_label.c_str(), w.m_count_av, t, d_flop, d_byte, c_flop, c_byte,
+				ai, perf*1.0e-9, bw*1.0e-9, peak*1.0e-9, attain*1.0e-9, ratio, s_bound.c_str());
+		}
+	}
+
+    for (int i=0; i< maxLabelLen; i++) { fputc('-', fp); }
+	fprintf(fp, "+---------------------------------------------------------------------\n");
+	if (fc != NULL) fclose(fc);
+}
+
+
+/// Report the marks and the counters of the sections
+///
+///   @param[in] fp       	report file pointer
+///   @param[in] maxLabelLen    maximum label string field length
+///   @param[in] op_sort 	sorting option (0:sorted by seconds, 1:listed order)
+///
+///	  @note  The values are the sums of all threads and all processes.
+///	         mark() and counter() are attributed to the innermost section
+///	         active on the calling thread.
+///
+void PerfMonitor::printBasicSeries(FILE* fp, int maxLabelLen, int op_sort)
+{
+    if (!is_PMlib_enabled) return;
+	if (m_seriesKeys.empty()) return;
+
+	// the sections in the order of the report, then the sections unknown to this process
+	std::vector<std::string> v_label;
+	for (int j=0; j<m_nWatch; j++) {
+		int m = (op_sort == 0) ? m_order[j] : j;
+		v_label.push_back(m_watchArray[m].m_label);
+	}
+	for (size_t k=0; k<m_seriesKeys.size(); k++) {
+		std::string s_label = m_seriesKeys[k].substr(0, m_seriesKeys[k].find('\0'));
+		if (std::find(v_label.begin(), v_label.end(), s_label) == v_label.end()) {
+			v_label.push_back(s_label);
+		}
+	}
+	int maxNameLen = 4;
+	for (size_t k=0; k<m_seriesKeys.size(); k++) {
+		int len = m_seriesKeys[k].size() - m_seriesKeys[k].find('\0') - 2;
+		maxNameLen = std::max(maxNameLen, len);
+	}
+	maxNameLen++;
+
+	fprintf(fp, "\n");
+	fprintf(fp, "# PMlib marks and counters of the sections ----------------------------------------- #\n");
+	fprintf(fp, "\n");
+	fprintf(fp, "\tThe values are the sums of all threads and all processes.\n");
+	fprintf(fp, "\tmark() and counter() are attributed to the innermost active section of the thread.\n\n");
+
+	fprintf(fp, "Section"); for (int i=7; i< maxLabelLen; i++) { fputc(' ', fp); }
+	fprintf(fp, "| %-*s%-7s %7s  %11s  %11s  %11s\n", maxNameLen, "name", "kind", "count", "min", "avg", "max");
+    for (int i=0; i< maxLabelLen; i++) { fputc('-', fp); }
+	fprintf(fp, "+"); for (int i=0; i< maxNameLen + 56; i++) { fputc('-', fp); }
+	fprintf(fp, "\n");
+
+	for (size_t j=0; j<v_label.size(); j++) {
+		bool is_first = true;
+		for (size_t k=0; k<m_seriesKeys.size(); k++) {
+			const std::string& key = m_seriesKeys[k];
+			size_t pos = key.find('\0');
+			if (key.compare(0, pos, v_label[j]) != 0 || pos != v_label[j].size()) continue;
+			const double* c = &m_seriesStats[4*k];
+			fprintf(fp, "%-*s: %-*s", maxLabelLen, is_first ? v_label[j].c_str() : "", maxNameLen, key.c_str() + pos + 2);
+			is_first = false;
+			if (key[pos+1] == '0' + I_trace_mark) {
+				fprintf(fp, "mark  %9.0f\n", c[0]);
+			} else {
+				fprintf(fp, "counter %7.0f  %11.4e  %11.4e  %11.4e\n", c[0], c[2], (c[0] > 0.0) ? c[1] / c[0] : 0.0, c[3]);
+			}
+		}
+	}
+
+    for (int i=0; i< maxLabelLen; i++) { fputc('-', fp); }
+	fprintf(fp, "+"); for (int i=0; i< maxNameLen + 56; i++) { fputc('-', fp); }
+	fprintf(fp, "\n");
+}
+
+
+
+/// Report the time of the sections estimated by the sampling profiler (PMLIB_SAMPLING)
+///
+///   @param[in] fp       	report file pointer
+///   @param[in] maxLabelLen    maximum label string field length
+///   @param[in] op_sort 	sorting option (0:sorted by the estimated time, 1:listed order)
+///
+///	  @note  The sample count n of a section out of N samples is binomial, so the
+///	         95% confidence interval of the exclusive time is
+///	         period * (n +- 1.96 * sqrt(n * (1 - n/N))).
+///
+void PerfMonitor::printBasicSampling(FILE* fp, int maxLabelLen, int op_sort)
+{
+    if (!is_PMlib_enabled) return;
+	if (pm_sampling_period <= 0.0) return;
+
+	int n = m_samplingKeys.size();
+	double n_all = m_samplingTicks;
+	std::vector< std::pair<double, int> > v_order;
+	for (int k=0; k<n; k++) {
+		v_order.push_back( std::make_pair(-m_samplingStats[3*k+1], k) );
+	}
+	if (op_sort == 0) {
+		std::sort(v_order.begin(), v_order.end());
+	} else {
+		// the listed order of this process, then the sections unknown to this process
+		for (int k=0; k<n; k++) {
+			int i = find_section_object(m_samplingKeys[k]);
+			v_order[k].first = (i < 0) ? m_nWatch + k : i;
+		}
+		std::sort(v_order.begin(), v_order.end());
+	}
+
+	fprintf(fp, "\n");
+	fprintf(fp, "# PMlib sampling profile of the sections ------------------------------------------- #\n");
+	fprintf(fp, "\n");
+	fprintf(fp, "\tThe sections are sampled at %.0f Hz by %.0f threads of %d processes (PMLIB_SAMPLING).\n",
+		1.0 / pm_sampling_period, m_samplingThreads, num_process);
+	fprintf(fp, "\tThe start/stop of the sections are not timed. The times are estimated from %.0f samples,\n", n_all);
+	fprintf(fp, "\tand are the sums of all the sampled threads and all processes.\n");
+	fprintf(fp, "\t  excl.[s] : the section is the innermost active section of the thread. Root is outside of the sections.\n");
+	fprintf(fp, "\t  +-95%%    : 95%% confidence interval of excl.[s]\n");
+	fprintf(fp, "\t  incl.[s] : the section is active\n\n");
+
+	fprintf(fp, "Section"); for (int i=7; i< maxLabelLen; i++) { fputc(' ', fp); }
+	fprintf(fp, "|      call   samples    excl.[s]     +-95%%  excl.[%%]    incl.[s]\n");
+    for (int i=0; i< maxLabelLen; i++) { fputc('-', fp); }
+	fprintf(fp, "+-----------------------------------------------------------------\n");
+
+	for (int j=0; j<n; j++) {
+		int k = v_order[j].second;
+		double calls = m_samplingStats[3*k];
+		double n_excl = m_samplingStats[3*k+1];
+		double n_incl = m_samplingStats[3*k+2];
+		double p = (n_all > 0.0) ? n_excl / n_all : 0.0;
+		double ci = 1.96 * pm_sampling_period * sqrt(std::max(n_excl * (1.0 - p), 0.0));
+		fprintf(fp, "%-*s: %9.0f %9.0f  %10.4e  %9.2e  %7.2f  %10.4e\n", maxLabelLen, m_samplingKeys[k].c_str(),
+			calls, n_excl, n_excl * pm_sampling_period, ci, 100.0 * p, n_incl * pm_sampling_period);
+	}
+
+    for (int i=0; i< maxLabelLen; i++) { fputc('-', fp); }
+	fprintf(fp, "+-----------------------------------------------------------------\n");
+}
+
+
   /// MPIランク別詳細レポート、HWPC詳細レポートを出力。
   ///
   ///   @param[in] fp           出力ファイルポインタ
@@ -1395,7 +2325,7 @@ void PerfMonitor::printBasicPower(FILE* fp, int maxLabelLen, int op_sort)
       }
 
 
-#ifdef USE_PAPI
+#ifdef USE_HWPC
     //	II. HWPC/PAPIレポート：HWPC計測結果を出力
 	if (m_watchArray[0].my_papi.num_events == 0) return;
 	if (env_str_hwpc == "USER" ) return;
@@ -1543,7 +2473,7 @@ void PerfMonitor::printBasicPower(FILE* fp, int maxLabelLen, int op_sort)
       }
     }
 
-#ifdef USE_PAPI
+#ifdef USE_HWPC
     //	II. HWPC/PAPIレポート：HWPC計測結果を出力
 	if (m_watchArray[0].my_papi.num_events == 0) return;
     if (my_rank == 0) {
@@ -1659,7 +2589,8 @@ void PerfMonitor::printBasicPower(FILE* fp, int maxLabelLen, int op_sort)
 
   /// ポスト処理用traceファイルの出力と終了処理
   ///
-  /// @note current version supports OTF(Open Trace Format) v1.5
+  /// @note current version supports OTF(Open Trace Format) v1.5 and
+  ///       the built-in Chrome Trace Event format (PMLIB_TRACE)
   /// @note This API terminates producing post trace immediately, and may
   ///       produce non-pairwise start()/stop() records.
   ///
@@ -1689,6 +2620,7 @@ void PerfMonitor::printBasicPower(FILE* fp, int maxLabelLen, int op_sort)
       m_watchArray[0].finalizeOTF();
     }
 #endif
+    m_watchArray[0].finalizeTrace();
 
 	#ifdef DEBUG_PRINT_MONITOR
     if (my_rank == 0) {
@@ -1698,6 +2630,19 @@ void PerfMonitor::printBasicPower(FILE* fp, int maxLabelLen, int op_sort)
   }
 
 
+  /// flight recorder が保持している直近の記録の書き出し
+  ///
+  /// @note 他のプロセスとの同期は行わない. 出力ファイル名は
+  ///       PMLIB_TRACE_FILE=<stem>.json に対して <stem>.<rank>.<n>.json
+  ///
+  void PerfMonitor::dumpTrace(void)
+  {
+    if (!is_PMlib_enabled) return;
+    if (m_nWatch == 0) return;
+    m_watchArray[0].dumpTrace();
+  }
+
+
   /// 基本統計レポートのヘッダ部分を出力。
   ///
   ///   @param[in] fp       出力ファイルポインタ
@@ -1741,7 +2686,7 @@ void PerfMonitor::printBasicPower(FILE* fp, int maxLabelLen, int op_sort)
 #else
     fprintf(fp, ", no-OpenMP");
 #endif
-#ifdef USE_PAPI
+#ifdef USE_HWPC
     fprintf(fp, ", HWPC");
 #else
     fprintf(fp, ", no-HWPC");
@@ -1785,6 +2730,10 @@ void PerfMonitor::printBasicPower(FILE* fp, int maxLabelLen, int op_sort)
       fprintf(fp, "\n\tError : invalid Parallel mode \n");
       PM_Exit(0);
     }
+    if (is_MPI_enabled && num_process > 1) {
+      fprintf(fp, "\tNode layout:     %d nodes, %d processes on the node of rank 0, %d on its socket\n",
+          hwpc_group.n_nodes, hwpc_group.np_node, hwpc_group.np_socket);
+    }
 
     m_watchArray[0].printEnvVars(fp);
 
@@ -1838,44 +2787,64 @@ void PerfMonitor::printBasicPower(FILE* fp, int maxLabelLen, int op_sort)
 	fprintf(fp, "%-*s| number of| measured | weight| time per| std.dv of ", maxLabelLen, "Section");
 
 
+    // 並列領域内の測定区間があれば、スレッド間の負荷バランスの列を追加する
+    bool show_thread = false;
+    for (int i = 1; i < m_nWatch; i++) {
+      if (m_watchArray[i].m_in_parallel && m_watchArray[i].m_count_sum > 0) show_thread = true;
+    }
+
+    const char* s_head1 = "";
+    const char* s_head2 = "";
     if ( is_unit == 0 || is_unit == 1 ) {
-      fprintf(fp, "| user defined numerical performance\n");
+      s_head1 = "user defined numerical performance";
+      s_head2 = "operations  std.dv  performance";
     } else if ( is_unit == 2 ) {
-      fprintf(fp, "| hardware counted data access \n");
+      s_head1 = "hardware counted data access ";
+      s_head2 = "  Bytes    std.dv  Mem+LLC bandwidth";
     } else if ( is_unit == 3 ) {
-      fprintf(fp, "| hardware counted floating point ops.\n");
+      s_head1 = "hardware counted floating point ops.";
+      s_head2 = " f.p.ops    std.dv  performance";
     } else if ( is_unit == 4 ) {
-      fprintf(fp, "| hardware counted floating point ops.\n");
+      s_head1 = "hardware counted floating point ops.";
+      s_head2 = " f.p.ops    std.dv  vectorized%";
     } else if ( is_unit == 5 ) {
-      fprintf(fp, "| hardware counted cache utilization\n");
+      s_head1 = "hardware counted cache utilization";
+      s_head2 = "load+store  std.dv  L1+L2 hit%";
     } else if ( is_unit == 6 ) {
-      fprintf(fp, "| hardware counted total instructions\n");
+      s_head1 = "hardware counted total instructions";
+      s_head2 = "instructions std.dv performance";
     } else if ( is_unit == 7 ) {
-      fprintf(fp, "| memory load and store instruction type\n");
+      s_head1 = "memory load and store instruction type";
+      s_head2 = "load+store  std.dv  vectorized%";
+    } else if ( is_unit == 8 ) {
+      s_head1 = "hardware counted custom events";
+      s_head2 = "1st event  std.dv  rate";
+    } else if ( is_unit == 9 ) {
+      s_head1 = "top-down pipeline slot utilization";
+      s_head2 = "  cycles    std.dv  retiring%";
+    } else if ( is_unit == 10 ) {
+      s_head1 = "data TLB misses causing page walks";
+      s_head2 = "instructions std.dv misses/KI";
+    } else {
+      s_head2 = "*** internal bug. <printBasicSections> ***";
+		;	// should not reach here
+	}
+
+    if (show_thread) {
+      fprintf(fp, "| %-42s| thread load balance of (+) sections\n", s_head1);
+    } else {
+      fprintf(fp, "| %s\n", s_head1);
     }
 
 	//	fprintf(fp, "%-*s|   calls  |   total    [%%]   total/call     sdv    ", maxLabelLen, "Label");
 	//	fprintf(fp, "%-*s|   calls  |  time[sec]   [%%]   time[sec]  deviation", maxLabelLen, "Label");
 	fprintf(fp, "%-*s|   calls  | time[sec]   [%%]   call[sec]    time    ", maxLabelLen, "Label");
 
-    if ( is_unit == 0 || is_unit == 1 ) {
-      fprintf(fp, "| operations  std.dv  performance\n");
-    } else if ( is_unit == 2 ) {
-      fprintf(fp, "|   Bytes    std.dv  Mem+LLC bandwidth\n");
-    } else if ( is_unit == 3 ) {
-      fprintf(fp, "|  f.p.ops    std.dv  performance\n");
-    } else if ( is_unit == 4 ) {
-      fprintf(fp, "|  f.p.ops    std.dv  vectorized%%\n");
-    } else if ( is_unit == 5 ) {
-      fprintf(fp, "| load+store  std.dv  L1+L2 hit%%\n");
-    } else if ( is_unit == 6 ) {
-      fprintf(fp, "| instructions std.dv performance\n");
-    } else if ( is_unit == 7 ) {
-      fprintf(fp, "| load+store  std.dv  vectorized%%\n");
+    if (show_thread) {
+      fprintf(fp, "| %-42s|   min      avg      max    max/avg-1 slowest\n", s_head2);
     } else {
-      fprintf(fp, "| *** internal bug. <printBasicSections> ***\n");
-		;	// should not reach here
-	}
+      fprintf(fp, "| %s\n", s_head2);
+    }
 
 	for (int i = 0; i < maxLabelLen; i++) fputc('-', fp);
 	fprintf(fp,       "+----------+----------------------------------------+--------------------------------\n");
@@ -1942,16 +2911,19 @@ void PerfMonitor::printBasicPower(FILE* fp, int maxLabelLen, int op_sort)
 		// 5: CACHE     : HWPC measured cache hit/miss (%)
 		// 6: CYCLE     : HWPC measured cycles, instructions
 		// 7: LOADSTORE : HWPC measured load/store instructions type (%)
+		// 8: CUSTOM    : HWPC measured user specified events
+		// 9: TOPDOWN   : HWPC measured top-down pipeline slots (%)
+		//10: TLB       : HWPC measured data TLB misses per kilo instructions
       if (w.m_time_av == 0.0) {
         fops = 0.0;
       } else {
         if ( is_unit >= 0 && is_unit <= 1 ) {
           fops = (w.m_count_av==0) ? 0.0 : w.m_flop_av/w.m_time_av;
         } else
-        if ( (is_unit == 2) || (is_unit == 3) || (is_unit == 6) ) {
+        if ( (is_unit == 2) || (is_unit == 3) || (is_unit == 6) || (is_unit == 8) ) {
           fops = (w.m_count_av==0) ? 0.0 : w.m_flop_av/w.m_time_av;
         } else
-        if ( (is_unit == 4) || (is_unit == 5) || (is_unit == 7) ) {
+        if ( (is_unit == 4) || (is_unit == 5) || (is_unit == 7) || (is_unit == 9) || (is_unit == 10) ) {
           fops = w.m_percentage;
         }
       }
@@ -1961,12 +2933,28 @@ void PerfMonitor::printBasicPower(FILE* fp, int maxLabelLen, int op_sort)
       if (!w.m_exclusive)  { p_label = p_label + "(*)"; }
       if (w.m_in_parallel) { p_label = p_label + "(+)"; }
 
-      fprintf(fp, "    %8.3e  %8.2e %6.2f %s\n",
+      fprintf(fp, "    %8.3e  %8.2e %6.2f %s",
             w.m_flop_av,          // 測定区間の計算量(全プロセスの平均値)
             w.m_flop_sd,          // 計算量の標準偏差(全プロセスの平均値)
             uF,                   // 測定区間の計算速度(全プロセスの平均値)
             p_label.c_str());		// 計算速度の単位
 
+      // スレッド間の負荷バランス : スレッド時間の最小・平均・最大値、不均衡度、最も遅いスレッド
+      if (show_thread && w.m_in_parallel) {
+        double imbalance = (w.m_thread_tav > 0.0) ? w.m_thread_tmax/w.m_thread_tav - 1.0 : 0.0;
+        int n_pad = 15 - (int)p_label.size();
+        fprintf(fp, "%*s| %8.2e %8.2e %8.2e  %6.3f    ",
+              (n_pad > 0) ? n_pad : 0, "",
+              w.m_thread_tmin, w.m_thread_tav, w.m_thread_tmax, imbalance);
+        if (num_process > 1) {
+          fprintf(fp, "%d:%d\n", w.m_rank_slowest, w.m_thread_slowest);
+        } else {
+          fprintf(fp, "%d\n", w.m_thread_slowest);
+        }
+      } else {
+        fprintf(fp, "\n");
+      }
+
       if (w.m_exclusive) {
         if ( is_unit == 0 ) {
           sum_time_comm += w.m_time_av;
@@ -1976,12 +2964,12 @@ void PerfMonitor::printBasicPower(FILE* fp, int maxLabelLen, int op_sort)
           sum_time_flop += w.m_time_av;
           sum_flop += w.m_flop_av;
         } else
-        if ( (is_unit == 2) || (is_unit == 3) || (is_unit == 6) ) {
+        if ( (is_unit == 2) || (is_unit == 3) || (is_unit == 6) || (is_unit == 8) ) {
           sum_time_flop += w.m_time_av;
           sum_flop += w.m_flop_av;
 
         } else
-        if ( (is_unit == 4) || (is_unit == 5) || (is_unit == 7) ) {
+        if ( (is_unit == 4) || (is_unit == 5) || (is_unit == 7) || (is_unit == 9) || (is_unit == 10) ) {
           sum_time_flop += w.m_time_av;
           sum_flop += w.m_flop_av;
           sum_other += w.m_flop_av * uF;
@@ -2036,7 +3024,7 @@ void PerfMonitor::printBasicPower(FILE* fp, int maxLabelLen, int op_sort)
 	} else
     // For the stats of each section, use the value of its own, except for calculating the time %.
 	// In time % calculation, use the Root section elapsed time (tot) as the total time
-    if ( (is_unit == 2) || (is_unit == 3) || (is_unit == 6) ) {
+    if ( (is_unit == 2) || (is_unit == 3) || (is_unit == 6) || (is_unit == 8) ) {
       //	fprintf(fp, "%-*s %1s %9.3e", maxLabelLen+10, "aggregate active sections", "", tot);
       //	fprintf(fp, "%-*s  %9.3e", maxLabelLen+10, "aggregate exclusive sections", sum_time_flop);
       fprintf(fp, "%-*s   %9.3e %6.2f ", maxLabelLen+10, "Sum of exclusive sections", sum_time_flop, 100*sum_time_flop/tot);
@@ -2044,7 +3032,7 @@ void PerfMonitor::printBasicPower(FILE* fp, int maxLabelLen, int op_sort)
       fprintf(fp, "%22s  %8.3e          %7.2f %s\n", " ", sum_flop, flop_serial, unit.c_str());
 
 	} else
-    if ( (is_unit == 4) || (is_unit == 5) || (is_unit == 7) ) {
+    if ( (is_unit == 4) || (is_unit == 5) || (is_unit == 7) || (is_unit == 9) || (is_unit == 10) ) {
       fprintf(fp, "%-*s   %9.3e %6.2f ", maxLabelLen+10, "Sum of exclusive sections", sum_time_flop, 100*sum_time_flop/tot);
       double other_serial = PerfWatch::unitFlop(sum_other/sum_flop, unit, is_unit);
       fprintf(fp, "%22s  %8.3e          %7.2f %s\n", " ", sum_flop, other_serial, unit.c_str());
@@ -2068,7 +3056,7 @@ void PerfMonitor::printBasicPower(FILE* fp, int maxLabelLen, int op_sort)
       fprintf(fp, "%22s     %8.3e          %7.2f %s\n", "", sum_flop_job, flop_job, unit.c_str());
       }
 	} else
-    if ( (is_unit == 2) || (is_unit == 3) || (is_unit == 6) ) {
+    if ( (is_unit == 2) || (is_unit == 3) || (is_unit == 6) || (is_unit == 8) ) {
 
       double sum_flop_job = (double)num_process*sum_flop;
       double flop_job = PerfWatch::unitFlop(sum_flop_job/sum_time_flop, unit, is_unit);
@@ -2076,7 +3064,7 @@ void PerfMonitor::printBasicPower(FILE* fp, int maxLabelLen, int op_sort)
       fprintf(fp, "%22s     %8.3e          %7.2f %s\n", "", sum_flop_job, flop_job, unit.c_str());
 
 	} else
-    if ( (is_unit == 4) || (is_unit == 5) || (is_unit == 7) ) {
+    if ( (is_unit == 4) || (is_unit == 5) || (is_unit == 7) || (is_unit == 9) || (is_unit == 10) ) {
       double sum_flop_job = (double)num_process*sum_flop;
       double other_serial = PerfWatch::unitFlop(sum_other/sum_flop, unit, is_unit);
       double other_job = other_serial;
@@ -2531,6 +3519,9 @@ void PerfMonitor::check_all_section_object(void)
 int PerfMonitor::add_shared_section(std::string arg_st)
 {
    	int n_shared_sections;
+	#if defined(USE_OMPT) && defined(_OPENMP)
+	pm_ompt_enter_internal();	// the critical construct below is not measured
+	#endif
 	#ifdef _OPENMP
 	#pragma omp critical
 	#endif
@@ -2547,6 +3538,9 @@ int PerfMonitor::add_shared_section(std::string arg_st)
     	#endif
 	}
 	// remark. end critical does not exist for C++. its only for fortran !$omp.
+	#if defined(USE_OMPT) && defined(_OPENMP)
+	pm_ompt_leave_internal();
+	#endif
 	return n_shared_sections;
 }
 
@@ -0,0 +1,433 @@
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 Advanced Institute for Computational Science(AICS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+//! @file   PerfOmpt.cpp
+//! @brief  PMlib OMPT tool : automatic measurement of OpenMP constructs
+
+//	The OMPT tool is registered to the OpenMP runtime only if the environment
+//	variable PMLIB_OMPT is given. Otherwise ompt_start_tool() returns NULL and
+//	the runtime never calls back into PMlib.
+//	The OMPT interface is supported by LLVM/Intel/AMD/Fujitsu(clang mode) OpenMP
+//	runtimes. GNU libgomp does not call ompt_start_tool().
+
+#if defined(USE_OMPT) && defined(_OPENMP)
+
+#include <string>
+#include <cstdlib>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <pthread.h>
+#include <dlfcn.h>
+#include <omp.h>
+#include <omp-tools.h>
+
+#ifdef DISABLE_MPI
+#include "mpi_stubs.h"
+#else
+#include <mpi.h>
+#endif
+
+#include "PerfMonitor.h"
+#include "pmlib_ompt.h"
+
+
+namespace pm_lib {
+
+  /// 自動生成する測定区間の種類
+  enum ompt_section_kind {
+	ompt_kind_fork = 0,
+	ompt_kind_parallel,
+	ompt_kind_join,
+	ompt_kind_loop,
+	ompt_kind_sections,
+	ompt_kind_single,
+	ompt_kind_workshare,
+	ompt_kind_taskloop,
+	ompt_kind_barrier,
+	ompt_kind_taskwait,
+	ompt_kind_taskgroup,
+	ompt_kind_reduction,
+	ompt_kind_critical,
+	ompt_kind_lock,
+	ompt_kind_ordered,
+	Max_ompt_kind
+  };
+
+  static const char* ompt_kind_name[Max_ompt_kind] = {
+	"fork", "parallel", "join",
+	"loop", "sections", "single", "workshare", "taskloop",
+	"barrier wait", "taskwait wait", "taskgroup wait", "reduction wait",
+	"critical wait", "lock wait", "ordered wait"
+  };
+
+  const int Max_ompt_stack = 32;	///< スレッド毎の入れ子の深さの上限
+  const int Max_ompt_cache = 64;	///< スレッド毎のラベルキャッシュの大きさ
+
+  /// 開始した(または開始しなかった)自動測定区間のスタック要素
+  struct ompt_stack_entry {
+	int kind;
+	const std::string* label;	///< 開始した区間のラベル. 開始しなかった場合はNULL
+  };
+
+  /// codeptr とラベルの対応のキャッシュ要素
+  struct ompt_cache_entry {
+	const void* codeptr;
+	int kind;
+	const std::string* label;
+  };
+
+  /// 並列領域のラベルの組. parallel_data->ptr に保持する
+  struct ompt_region_labels {
+	const std::string* fork;
+	const std::string* parallel;
+	const std::string* join;
+  };
+
+  /// PMlib内部の並列領域を表す印. parallel_data->ptr に保持する
+  static ompt_region_labels ompt_internal_region = { NULL, NULL, NULL };
+
+  static volatile bool ompt_active = false;	///< ツールがランタイムに登録済みか
+  static volatile bool ompt_armed = false;	///< 自動計測中か
+
+  static ompt_set_callback_t ompt_set_callback_fn = NULL;
+
+  // 全スレッドで共有するラベル表. 登録された文字列は解放しない
+  static pthread_mutex_t ompt_label_lock = PTHREAD_MUTEX_INITIALIZER;
+  static std::map< std::pair<int, const void*>, std::string* > ompt_label_map;
+  static std::map< const void*, ompt_region_labels* > ompt_region_map;
+
+  // スレッド毎の状態
+  static PerfMonitor* ompt_pm = NULL;	///< このスレッドのPerfMonitorインスタンス
+  static int ompt_busy = 0;				///< PMlibの処理中か(この間の構文は計測しない)
+  static int ompt_sp = 0;				///< スタックの深さ
+  static struct ompt_stack_entry ompt_stack[Max_ompt_stack];
+  static struct ompt_cache_entry ompt_cache[Max_ompt_cache];
+  #pragma omp threadprivate(ompt_pm, ompt_busy, ompt_sp, ompt_stack, ompt_cache)
+
+
+  /// codeptrの位置を表す文字列 "@symbol+0xoffset" または "@object+0xoffset"
+  ///
+  ///	@note 実行ファイルのシンボルは -rdynamic で作成した場合だけ得られる。
+  ///		オブジェクト内のオフセットは addr2line -e object offset でソース行に変換できる。
+  ///
+  static std::string ompt_location (const void* codeptr)
+  {
+	char buf[512];
+	if (codeptr == NULL) return "";
+
+	Dl_info info;
+	if (dladdr(codeptr, &info) != 0) {
+		if (info.dli_sname != NULL && info.dli_saddr != NULL) {
+			snprintf(buf, sizeof(buf), " @%s+0x%lx", info.dli_sname,
+				(unsigned long)((const char*)codeptr - (const char*)info.dli_saddr));
+			return buf;
+		}
+		if (info.dli_fname != NULL && info.dli_fbase != NULL) {
+			const char* p = strrchr(info.dli_fname, '/');
+			snprintf(buf, sizeof(buf), " @%s+0x%lx", (p == NULL) ? info.dli_fname : p+1,
+				(unsigned long)((const char*)codeptr - (const char*)info.dli_fbase));
+			return buf;
+		}
+	}
+	snprintf(buf, sizeof(buf), " @%p", codeptr);
+	return buf;
+  }
+
+
+  /// 区間の種類とcodeptrに対応するラベル
+  ///
+  ///	@note 共有のラベル表は最初の1回だけ参照し、以降はスレッド毎のキャッシュを用いる
+  ///
+  static const std::string* ompt_label (int kind, const void* codeptr)
+  {
+	int ic = (int)((((unsigned long)codeptr >> 2) ^ (unsigned long)kind) % Max_ompt_cache);
+	ompt_cache_entry& c = ompt_cache[ic];
+	if (c.label != NULL && c.codeptr == codeptr && c.kind == kind) return c.label;
+
+	std::string* label;
+	pthread_mutex_lock(&ompt_label_lock);
+	std::map< std::pair<int, const void*>, std::string* >::iterator it;
+	it = ompt_label_map.find(std::make_pair(kind, codeptr));
+	if (it == ompt_label_map.end()) {
+		label = new std::string(std::string("OMPT ") + ompt_kind_name[kind] + ompt_location(codeptr));
+		ompt_label_map[std::make_pair(kind, codeptr)] = label;
+	} else {
+		label = it->second;
+	}
+	pthread_mutex_unlock(&ompt_label_lock);
+
+	c.codeptr = codeptr;
+	c.kind = kind;
+	c.label = label;
+	return label;
+  }
+
+
+  /// 並列領域のラベルの組
+  static ompt_region_labels* ompt_region (const void* codeptr)
+  {
+	ompt_region_labels* r = NULL;
+	std::map< const void*, ompt_region_labels* >::iterator it;
+	pthread_mutex_lock(&ompt_label_lock);
+	it = ompt_region_map.find(codeptr);
+	if (it != ompt_region_map.end()) r = it->second;
+	pthread_mutex_unlock(&ompt_label_lock);
+	if (r != NULL) return r;
+
+	r = new ompt_region_labels;
+	r->fork     = ompt_label(ompt_kind_fork, codeptr);
+	r->parallel = ompt_label(ompt_kind_parallel, codeptr);
+	r->join     = ompt_label(ompt_kind_join, codeptr);
+
+	pthread_mutex_lock(&ompt_label_lock);
+	it = ompt_region_map.find(codeptr);
+	if (it == ompt_region_map.end()) {
+		ompt_region_map[codeptr] = r;
+	} else {
+		delete r;
+		r = it->second;
+	}
+	pthread_mutex_unlock(&ompt_label_lock);
+	return r;
+  }
+
+
+  /// このスレッドで自動計測を行うか
+  static inline bool ompt_enabled (void)
+  {
+	return ompt_armed && (ompt_pm != NULL) && (ompt_busy == 0);
+  }
+
+
+  /// 自動測定区間の開始. 開始したかどうかをスタックに積む
+  static void ompt_begin (int kind, const std::string* label)
+  {
+	if (ompt_sp >= Max_ompt_stack) { ompt_sp++; return; }
+
+	// reserve the entry first. PMlib may raise nested events, e.g. critical.
+	ompt_stack_entry& e = ompt_stack[ompt_sp++];
+	e.kind = kind;
+	e.label = NULL;
+	if (label != NULL && ompt_enabled()) {
+		ompt_busy++;
+		if (ompt_pm->startAutoSection(*label)) e.label = label;
+		ompt_busy--;
+	}
+  }
+
+
+  /// 自動測定区間の終了. 対応する開始がスタックの先頭にある場合だけ終了する
+  static void ompt_end (int kind)
+  {
+	if (ompt_sp <= 0) return;
+	if (ompt_sp > Max_ompt_stack) { ompt_sp--; return; }
+	if (ompt_stack[ompt_sp-1].kind != kind) return;
+
+	ompt_sp--;
+	const std::string* label = ompt_stack[ompt_sp].label;
+	if (label != NULL && ompt_pm != NULL) {
+		ompt_busy++;
+		ompt_pm->stop(*label);
+		ompt_busy--;
+	}
+  }
+
+
+  // OMPT callbacks
+
+  static void on_parallel_begin (ompt_data_t* encountering_task_data,
+		const ompt_frame_t* encountering_task_frame, ompt_data_t* parallel_data,
+		unsigned int requested_parallelism, int flags, const void* codeptr_ra)
+  {
+	if (ompt_busy > 0) {
+		// PMlib internal region. All the threads in the team skip their events.
+		parallel_data->ptr = &ompt_internal_region;
+		ompt_begin(ompt_kind_fork, NULL);
+		return;
+	}
+	ompt_region_labels* r = ompt_region(codeptr_ra);
+	parallel_data->ptr = r;
+	ompt_begin(ompt_kind_fork, r->fork);
+  }
+
+  static void on_parallel_end (ompt_data_t* parallel_data,
+		ompt_data_t* encountering_task_data, int flags, const void* codeptr_ra)
+  {
+	ompt_end(ompt_kind_join);
+	ompt_end(ompt_kind_fork);	// in case the master implicit task was not reported
+  }
+
+  static void on_implicit_task (ompt_scope_endpoint_t endpoint,
+		ompt_data_t* parallel_data, ompt_data_t* task_data,
+		unsigned int actual_parallelism, unsigned int index, int flags)
+  {
+	if (flags & ompt_task_initial) return;
+
+	if (endpoint == ompt_scope_begin) {
+		ompt_region_labels* r = (parallel_data == NULL) ? NULL : (ompt_region_labels*)parallel_data->ptr;
+		task_data->ptr = r;
+		if (index == 0) ompt_end(ompt_kind_fork);
+		if (r == &ompt_internal_region) ompt_busy++;
+		ompt_begin(ompt_kind_parallel, (r == NULL) ? NULL : r->parallel);
+	} else {
+		ompt_region_labels* r = (ompt_region_labels*)task_data->ptr;
+		ompt_end(ompt_kind_parallel);
+		if (r == &ompt_internal_region) ompt_busy--;
+		if (index == 0) ompt_begin(ompt_kind_join, (r == NULL) ? NULL : r->join);
+	}
+  }
+
+  static void on_work (ompt_work_t wstype, ompt_scope_endpoint_t endpoint,
+		ompt_data_t* parallel_data, ompt_data_t* task_data,
+		uint64_t count, const void* codeptr_ra)
+  {
+	int kind;
+	switch (wstype) {
+	case ompt_work_loop:            kind = ompt_kind_loop; break;
+	case ompt_work_sections:        kind = ompt_kind_sections; break;
+	case ompt_work_single_executor: kind = ompt_kind_single; break;
+	case ompt_work_workshare:       kind = ompt_kind_workshare; break;
+	case ompt_work_taskloop:        kind = ompt_kind_taskloop; break;
+	default: return;
+	}
+	if (endpoint == ompt_scope_begin) {
+		ompt_begin(kind, ompt_label(kind, codeptr_ra));
+	} else {
+		ompt_end(kind);
+	}
+  }
+
+  static void on_sync_region_wait (ompt_sync_region_t kind_sync, ompt_scope_endpoint_t endpoint,
+		ompt_data_t* parallel_data, ompt_data_t* task_data, const void* codeptr_ra)
+  {
+	int kind;
+	switch (kind_sync) {
+	case ompt_sync_region_taskwait:  kind = ompt_kind_taskwait; break;
+	case ompt_sync_region_taskgroup: kind = ompt_kind_taskgroup; break;
+	case ompt_sync_region_reduction: kind = ompt_kind_reduction; break;
+	default:                         kind = ompt_kind_barrier; break;
+	}
+	if (endpoint == ompt_scope_begin) {
+		ompt_begin(kind, ompt_label(kind, codeptr_ra));
+	} else {
+		ompt_end(kind);
+	}
+  }
+
+  static int ompt_mutex_kind (ompt_mutex_t kind_mutex)
+  {
+	switch (kind_mutex) {
+	case ompt_mutex_critical: return ompt_kind_critical;
+	case ompt_mutex_lock:
+	case ompt_mutex_nest_lock: return ompt_kind_lock;
+	case ompt_mutex_ordered:  return ompt_kind_ordered;
+	default: return -1;		// atomic operations are not measured
+	}
+  }
+
+  static void on_mutex_acquire (ompt_mutex_t kind_mutex, unsigned int hint,
+		unsigned int impl, ompt_wait_id_t wait_id, const void* codeptr_ra)
+  {
+	int kind = ompt_mutex_kind(kind_mutex);
+	if (kind < 0) return;
+	ompt_begin(kind, ompt_label(kind, codeptr_ra));
+  }
+
+  static void on_mutex_acquired (ompt_mutex_t kind_mutex,
+		ompt_wait_id_t wait_id, const void* codeptr_ra)
+  {
+	int kind = ompt_mutex_kind(kind_mutex);
+	if (kind < 0) return;
+	ompt_end(kind);
+  }
+
+
+  static int ompt_tool_initialize (ompt_function_lookup_t lookup,
+		int initial_device_num, ompt_data_t* tool_data)
+  {
+	ompt_set_callback_fn = (ompt_set_callback_t) lookup("ompt_set_callback");
+	if (ompt_set_callback_fn == NULL) return 0;
+
+	ompt_set_callback_fn(ompt_callback_parallel_begin, (ompt_callback_t)on_parallel_begin);
+	ompt_set_callback_fn(ompt_callback_parallel_end,   (ompt_callback_t)on_parallel_end);
+	ompt_set_callback_fn(ompt_callback_implicit_task,  (ompt_callback_t)on_implicit_task);
+	ompt_set_callback_fn(ompt_callback_work,           (ompt_callback_t)on_work);
+	ompt_set_callback_fn(ompt_callback_sync_region_wait, (ompt_callback_t)on_sync_region_wait);
+	ompt_set_callback_fn(ompt_callback_mutex_acquire,  (ompt_callback_t)on_mutex_acquire);
+	ompt_set_callback_fn(ompt_callback_mutex_acquired, (ompt_callback_t)on_mutex_acquired);
+
+	ompt_active = true;
+	return 1;	// non-zero value keeps the tool active
+  }
+
+  static void ompt_tool_finalize (ompt_data_t* tool_data)
+  {
+	ompt_armed = false;
+	ompt_active = false;
+  }
+
+
+  void pm_ompt_attach (PerfMonitor* pm)
+  {
+	if (!ompt_active) return;
+	ompt_pm = pm;
+	ompt_armed = true;
+  }
+
+  void pm_ompt_detach (void)
+  {
+	ompt_armed = false;
+  }
+
+  bool pm_ompt_is_active (void)
+  {
+	return ompt_active;
+  }
+
+  void pm_ompt_enter_internal (void)
+  {
+	ompt_busy++;
+  }
+
+  void pm_ompt_leave_internal (void)
+  {
+	ompt_busy--;
+  }
+
+} // end of namespace
+
+
+/// OpenMPランタイムが初期化時に呼び出すOMPTツールの入口
+///
+///	@note 環境変数PMLIB_OMPTが与えられていない場合や "no" の場合はNULLを返し、
+///		ツールは登録されない。この場合PMlibへのコールバックは一切発生しない。
+///
+extern "C" ompt_start_tool_result_t* ompt_start_tool (unsigned int omp_version,
+		const char* runtime_version)
+{
+	static ompt_start_tool_result_t result = {
+		&pm_lib::ompt_tool_initialize, &pm_lib::ompt_tool_finalize, {0} };
+
+	char* cp_env = std::getenv("PMLIB_OMPT");
+	if (cp_env == NULL) return NULL;
+	std::string s_chooser = cp_env;
+	if (s_chooser == "no" || s_chooser == "NO" || s_chooser == "off" || s_chooser == "OFF") return NULL;
+	return &result;
+}
+
+#endif // defined(USE_OMPT) && defined(_OPENMP)
@@ -222,6 +222,30 @@ void C_pm_stop_usermode (char* fc, double fpt, unsigned tic)
 }
 
 
+/// PMlib C interface
+/// stop the measurement section, overload version with the memory traffic for the roofline report.
+///
+///   @param[in] label        the character label, i.e. name, of the measuring section
+///   @param[in] fpt          computing volume (FLOP) or moved data(Byte) in "USER" mode measurement
+///   @param[in] tic          the number of cycles in "USER" mode measurement
+///   @param[in] bpt          memory traffic (Byte) used by the roofline report (PMLIB_ROOFLINE)
+///
+///   @note  the roofline report takes fpt*tic and bpt*tic of the calculation sections
+///          in any mode, if they are not counted by HWPC.
+///
+void C_pm_stop_roofline (char* fc, double fpt, unsigned tic, double bpt)
+{
+	std::string s;
+	s = fc;
+
+#ifdef DEBUG_PRINT_MONITOR
+	fprintf(stderr, "<C_pm_stop_roofline> fc=%s, fpt=%8.0lf, tic=%d, bpt=%8.0lf \n", s.c_str(), fpt, tic, bpt);
+#endif
+	PM.stop(s, fpt, tic, bpt);
+	return;
+}
+
+
 /// PMlib C interface
 /// @attention
 ///	Users should not call this routine directly.
@@ -530,6 +554,56 @@ void C_pm_posttrace (void)
 }
 
 
+/// PMlib C interface
+/// write the last seconds kept by the trace flight recorder
+///
+void C_pm_dumptrace (void)
+{
+	PM.dumpTrace ();
+
+	return;
+}
+
+
+/// PMlib C interface
+/// record an event in the innermost active section
+///
+///   @param[in] label        the name of the event
+///
+void C_pm_mark (char* fc)
+{
+	std::string s;
+	s = fc;
+
+	if (s == "") {
+		fprintf(stderr, "<C_pm_mark> argument fc is empty(null)\n");
+		return;
+	}
+	PM.mark(s);
+	return;
+}
+
+
+/// PMlib C interface
+/// record a value of the counter in the innermost active section
+///
+///   @param[in] name         the name of the counter
+///   @param[in] value        the value
+///
+void C_pm_counter (char* fc, double value)
+{
+	std::string s;
+	s = fc;
+
+	if (s == "") {
+		fprintf(stderr, "<C_pm_counter> argument fc is empty(null)\n");
+		return;
+	}
+	PM.counter(s, value);
+	return;
+}
+
+
 /// PMlib C interface
 /// reset the measured stats of the section
 ///
@@ -734,6 +808,20 @@ void C_pm_setpowerknob (int knob, int value)
 }
 
 
+/// PMlib C interface
+/// @brief switch the HWPC groups counted among those of HWPC_CHOOSER
+///
+///   @param[in] fc  group name, or the groups joined by '+'. "ALL" counts all the groups
+///
+void C_pm_setcountergroup (char* fc)
+{
+	std::string s;
+	if (fc != NULL) s=fc;
+	PM.setCounterGroup (s);
+	return;
+}
+
+
 } // closing extern "C"
 
 
@@ -215,6 +215,29 @@ void f_pm_stop_usermode_ (char* fc, double& fpt, unsigned& tic, int fc_size)
 }
 
 
+/// PMlib Fortran interface
+/// stop the measurement section, overload version with the memory traffic for the roofline report.
+///
+///   @param[in] label        the character label, i.e. name, of the measuring section
+///   @param[in] fpt          computing volume (FLOP) or moved data(Byte) in "USER" mode measurement
+///   @param[in] tic          the number of cycles in "USER" mode measurement
+///   @param[in] bpt          memory traffic (Byte) used by the roofline report (PMLIB_ROOFLINE)
+///   @param[in] int fc_size  the length of the character label.
+///
+///   @note  the roofline report takes fpt*tic and bpt*tic of the calculation sections
+///          in any mode, if they are not counted by HWPC.
+///   @note  Fortran compilers automatically add an extra fc_size argument holding the size of character.
+///	         for example, call f_pm_stop_roofline ("myname", fpt, tic, bpt) is good enough.
+///
+void f_pm_stop_roofline_ (char* fc, double& fpt, unsigned& tic, double& bpt, int fc_size)
+{
+	std::string s=std::string(fc,fc_size);
+
+	PM.stop(s, fpt, tic, bpt);
+	return;
+}
+
+
 //> PMlib Fortran interface
 /// @attention
 /// Users should not call this routine directly.
@@ -545,6 +568,57 @@ void f_pm_posttrace_ (void)
 }
 
 
+/// PMlib Fortran インタフェイス
+/// trace flight recorder の直近の記録の出力
+///
+void f_pm_dumptrace_ (void)
+{
+
+	PM.dumpTrace ();
+
+	return;
+}
+
+
+/// PMlib Fortran インタフェイス
+/// 実行中の最も内側の区間での事象の記録
+///
+///   @param[in] label        事象の名前
+///   @param[in] int fc_size  the length of the character label.
+///
+void f_pm_mark_ (char* fc, int fc_size)
+{
+	std::string s=std::string(fc,fc_size);
+
+	if (s == "") {
+		fprintf(stderr, "<f_pm_mark_> argument fc is empty(null)\n");
+		return;
+	}
+	PM.mark(s);
+	return;
+}
+
+
+/// PMlib Fortran インタフェイス
+/// 実行中の最も内側の区間での値の記録
+///
+///   @param[in] name         counterの名前
+///   @param[in] value        値
+///   @param[in] int fc_size  the length of the character name.
+///
+void f_pm_counter_ (char* fc, double& value, int fc_size)
+{
+	std::string s=std::string(fc,fc_size);
+
+	if (s == "") {
+		fprintf(stderr, "<f_pm_counter_> argument fc is empty(null)\n");
+		return;
+	}
+	PM.counter(s, value);
+	return;
+}
+
+
 /// PMlib Fortran インタフェイス
 /// 測定区間リセット
 ///
@@ -751,6 +825,24 @@ void f_pm_setpowerknob_ (int& knob, int& value)
 }
 
 
+/// PMlib Fortran インタフェイス
+/// HWPC_CHOOSERで多重化したグループのうち計測するグループを切り替える
+///
+///   @param[in] fc グループ名、または'+'で連結したグループ名。"ALL"は全グループ
+///   @param[in] int fc_size  character文字列ラベルの長さ（文字数）
+///
+///   @note fc_sizeはFortranコンパイラが自動的に追加してしまう引数。
+///			ユーザがFortranプログラムから呼び出す場合に指定する必要はない。
+///
+void f_pm_setcountergroup_ (char* fc, int fc_size)
+{
+	std::string s=std::string(fc,fc_size);
+	s.erase(s.find_last_not_of(' ')+1);
+	PM.setCounterGroup (s);
+	return;
+}
+
+
 } // closing extern "C" // PMlib Fortran インタフェイス終了
 
 
@@ -0,0 +1,278 @@
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 RIKEN Center for Computational Science(R-CCS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+//! @file   PerfSampling.cpp
+//! @brief  PMlib sampling profiler (PMLIB_SAMPLING)
+//!
+//! The start/stop of a section only push and pop the section id on the stack
+//! of the calling thread. A POSIX timer per thread sends SIGPROF to the thread
+//! itself (SIGEV_THREAD_ID), and the signal handler counts the sample for the
+//! innermost section on the stack. The handler finds the sampler of the thread
+//! in the value of the signal, so it touches neither locks nor thread local storage.
+//! The stack is written only by its own thread, and the compiler fences order
+//! the writes against the handler which interrupts the same thread.
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <signal.h>
+#include <time.h>
+
+#if defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "pmlib_sampling.h"
+
+// older glibc does not name the thread id member of struct sigevent
+#if defined(__linux__) && !defined(sigev_notify_thread_id)
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+namespace pm_lib {
+
+double pm_sampling_period = 0.0;
+
+static const int Max_sampling_depth = 64;
+
+  /// the stack and the samples of a thread. Allocated by the thread and never freed,
+  /// since the timer may still deliver a signal with its address.
+  ///
+struct pm_sampler {
+	volatile int depth;					// can exceed Max_sampling_depth
+	int id[Max_sampling_depth];
+	volatile long n_ticks;
+	long exclusive[Max_sampled_sections];
+	long inclusive[Max_sampled_sections];
+	long calls[Max_sampled_sections];
+	timer_t timer;
+	bool is_armed;
+};
+
+static std::vector<pm_sampler*> samplers;		// guarded by critical (pm_sampling)
+static thread_local pm_sampler* sampling_thread = NULL;
+static std::atomic<int> sampling_state(0);	// 0: not initialized, 1: running, 2: stopped
+static int sampling_rank = 0;
+
+
+  /// SIGPROF handler. Only async-signal-safe operations are used
+  ///
+static void sampling_handler (int, siginfo_t* si, void*)
+{
+	if (si == NULL || si->si_code != SI_TIMER) return;	// e.g. setitimer() of gprof
+	pm_sampler* s = (pm_sampler*)si->si_value.sival_ptr;
+	if (s == NULL) return;
+
+	// the ticks elapsed while the signal was pending belong to the same stack
+	long w = 1 + ((si->si_overrun > 0) ? si->si_overrun : 0);
+	int n = s->depth;
+	std::atomic_signal_fence(std::memory_order_acquire);
+	if (n > Max_sampling_depth) n = Max_sampling_depth;
+
+	int i_top = (n > 0) ? s->id[n-1] : 0;
+	if (i_top >= 0 && i_top < Max_sampled_sections) s->exclusive[i_top] += w;
+	for (int k=0; k<n; k++) {
+		int i = s->id[k];
+		if (i < 0 || i >= Max_sampled_sections) continue;
+		bool is_counted = false;		// recursive sections are counted once
+		for (int j=0; j<k; j++) {
+			if (s->id[j] == i) { is_counted = true; break; }
+		}
+		if (!is_counted) s->inclusive[i] += w;
+	}
+	s->n_ticks = s->n_ticks + w;
+}
+
+
+  /// the sampler of the calling thread. The first call of a thread starts its timer
+  ///
+static pm_sampler* sampling_self (void)
+{
+	pm_sampler* s = sampling_thread;
+	if (s != NULL) return s;
+
+	s = new pm_sampler();
+	#pragma omp critical (pm_sampling)
+	{
+	samplers.push_back(s);
+	}
+	sampling_thread = s;
+	if (sampling_state.load() != 1) return s;
+
+	#if defined(__linux__)
+	struct sigevent sev;
+	memset(&sev, 0, sizeof(sev));
+	sev.sigev_notify = SIGEV_THREAD_ID;
+	sev.sigev_signo = SIGPROF;
+	sev.sigev_value.sival_ptr = s;
+	sev.sigev_notify_thread_id = syscall(SYS_gettid);
+	if (timer_create(CLOCK_MONOTONIC, &sev, &s->timer) == 0) {
+		struct itimerspec its;
+		long nsec = (long)(pm_sampling_period * 1.0e+9);
+		its.it_interval.tv_sec = nsec / 1000000000L;
+		its.it_interval.tv_nsec = nsec % 1000000000L;
+		its.it_value = its.it_interval;
+		s->is_armed = (timer_settime(s->timer, 0, &its, NULL) == 0);
+		if (!s->is_armed) timer_delete(s->timer);
+	}
+	if (!s->is_armed && sampling_rank == 0) {
+		fprintf(stderr, "*** PMlib warning. PMLIB_SAMPLING could not start the timer of a thread.\n");
+	}
+	#endif
+	return s;
+}
+
+
+void pm_sampling_initialize (int my_rank)
+{
+	int state = 0;
+	#pragma omp critical (pm_sampling)
+	{
+	state = sampling_state.load();
+	if (state == 0) {
+		sampling_state.store(2);
+		sampling_rank = my_rank;
+		// PMLIB_SAMPLING = off | on | <Hz>
+		char* cp_env = std::getenv("PMLIB_SAMPLING");
+		if (cp_env != NULL) {
+			std::string s = cp_env;
+			for (size_t i=0; i<s.size(); i++) s[i] = tolower(s[i]);
+			double hz = 0.0;
+			if (s == "on" || s == "yes") {
+				hz = 1000.0;
+			} else if (s != "off" && s != "no") {
+				hz = atof(s.c_str());
+				if (hz <= 0.0 || hz > 100000.0) {
+					if (my_rank == 0) fprintf(stderr, "*** PMlib warning. PMLIB_SAMPLING=%s is ignored.\n", cp_env);
+					hz = 0.0;
+				}
+			}
+			#if defined(__linux__)
+			if (hz > 0.0) {
+				// do not take SIGPROF from the application, e.g. the profilers
+				struct sigaction sa_old;
+				sigaction(SIGPROF, NULL, &sa_old);
+				bool is_taken = (sa_old.sa_flags & SA_SIGINFO) ? (sa_old.sa_sigaction != NULL) :
+					(sa_old.sa_handler != SIG_DFL && sa_old.sa_handler != SIG_IGN);
+				struct sigaction sa;
+				memset(&sa, 0, sizeof(sa));
+				sa.sa_sigaction = sampling_handler;
+				sigemptyset(&sa.sa_mask);
+				sa.sa_flags = SA_SIGINFO | SA_RESTART;
+				if (is_taken || sigaction(SIGPROF, &sa, NULL) != 0) {
+					if (my_rank == 0) fprintf(stderr, "*** PMlib warning. PMLIB_SAMPLING is ignored. SIGPROF is used by the application.\n");
+					hz = 0.0;
+				}
+			}
+			#else
+			if (hz > 0.0) {
+				if (my_rank == 0) fprintf(stderr, "*** PMlib warning. PMLIB_SAMPLING is supported only on Linux.\n");
+				hz = 0.0;
+			}
+			#endif
+			if (hz > 0.0) {
+				pm_sampling_period = 1.0 / hz;
+				sampling_state.store(1);
+			}
+		}
+		state = sampling_state.load();
+	}
+	}
+	if (state == 1) (void) sampling_self();
+}
+
+
+void pm_sampling_push (int id)
+{
+	pm_sampler* s = sampling_self();
+	int n = s->depth;
+	if (n < Max_sampling_depth) s->id[n] = id;
+	std::atomic_signal_fence(std::memory_order_release);
+	s->depth = n + 1;
+	if (id >= 0 && id < Max_sampled_sections) s->calls[id]++;
+}
+
+
+void pm_sampling_pop (int id)
+{
+	pm_sampler* s = sampling_thread;
+	if (s == NULL || s->depth == 0) return;
+	int n = s->depth;
+	int m = std::min(n, Max_sampling_depth);
+	for (int k=m-1; k>=0; k--) {
+		if (s->id[k] != id) continue;
+		// hide the entries above k while they are shifted
+		s->depth = k;
+		std::atomic_signal_fence(std::memory_order_release);
+		for (int j=k; j<m-1; j++) s->id[j] = s->id[j+1];
+		std::atomic_signal_fence(std::memory_order_release);
+		s->depth = n - 1;
+		return;
+	}
+	if (n > Max_sampling_depth) s->depth = n - 1;	// one of the entries beyond the stack
+}
+
+
+void pm_sampling_stop (void)
+{
+	int expected = 1;
+	if (!sampling_state.compare_exchange_strong(expected, 2)) return;
+	#pragma omp critical (pm_sampling)
+	{
+	for (size_t i=0; i<samplers.size(); i++) {
+		#if defined(__linux__)
+		if (samplers[i]->is_armed) timer_delete(samplers[i]->timer);
+		#endif
+		samplers[i]->is_armed = false;
+	}
+	}
+}
+
+
+long pm_sampling_collect (std::vector<long>& exclusive, std::vector<long>& inclusive,
+	std::vector<long>& calls, int& n_threads)
+{
+	exclusive.assign(Max_sampled_sections, 0);
+	inclusive.assign(Max_sampled_sections, 0);
+	calls.assign(Max_sampled_sections, 0);
+	n_threads = 0;
+	long n_ticks = 0;
+	#pragma omp critical (pm_sampling)
+	{
+	for (size_t i=0; i<samplers.size(); i++) {
+		const pm_sampler* s = samplers[i];
+		if (s->n_ticks > 0) n_threads++;
+		n_ticks += s->n_ticks;
+		for (int k=0; k<Max_sampled_sections; k++) {
+			exclusive[k] += s->exclusive[k];
+			inclusive[k] += s->inclusive[k];
+			calls[k] += s->calls[k];
+		}
+	}
+	}
+	inclusive[0] = n_ticks;		// the Root section is always active
+	return n_ticks;
+}
+
+} // end of namespace
@@ -0,0 +1,1579 @@
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 RIKEN Center for Computational Science(R-CCS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+//! @file   PerfTrace.cpp
+//! @brief  PMlib native trace writer in Chrome Trace Event format (JSON)
+//!
+//! The threads put the records into their own ring buffers without locks.
+//! A background writer thread drains the rings into a spool file of the process
+//! with large sequential writes, and the spool file is converted to the trace
+//! file at pm_trace_finalize().
+//!
+//! In the flight recorder mode (PMLIB_TRACE=flight:<seconds>) the rings are
+//! overwritten in place and nothing is written until a dump is requested by
+//! pm_trace_dump(), a signal, a latency trigger or pm_trace_finalize().
+//!
+//! With PMLIB_TRACE_AGGREGATE=node|mpiio the processes send their events to
+//! the leader of the node, so that the number of files and of the processes
+//! opening them does not grow with the number of the processes.
+
+#include <string>
+#include <vector>
+#include <map>
+#include <atomic>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <signal.h>
+
+#ifdef DISABLE_MPI
+#include "mpi_stubs.h"
+#else
+#include <mpi.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#include "pmlib_papi.h"
+#include "pmlib_trace.h"
+#include "pmlib_trace_format.h"
+#include "pmVersion.h"
+
+namespace pm_lib {
+
+int pm_trace_level = 0;
+
+// one record per start/stop pair of a section.
+// A record with more than one value is followed by the extension records
+// which hold 3 values each in t_start, t_stop and value, and have id = -1.
+struct trace_record {
+	double t_start;
+	double t_stop;
+	double value;
+	int id;
+	int n_values;
+};
+
+// ring buffer of a thread. The owner thread puts the records without locks.
+// The writer and the owner thread with a full ring take them under trace_spool_lock.
+struct trace_ring {
+	trace_record* rec;
+	unsigned long mask;				// capacity - 1. the capacity is a power of 2
+	std::atomic<unsigned long> head;	// next record to be put by the owner thread
+	std::atomic<unsigned long> tail;	// next record to be taken to the spool file
+	std::atomic<long> dropped;			// records dropped when the ring was full
+	std::vector<long> short_count;		// records shorter than PMLIB_TRACE_MIN_DURATION per section
+	std::vector<double> short_time;		// and their total time
+	double short_last;					// the last stop time of them
+};
+
+// pm_trace_section() of a label which is not traced
+static const int I_trace_excluded = -2;
+
+// what to do when the ring of a thread is full
+enum trace_full_policy {
+	I_trace_stall = 0,	// the thread writes its records to the spool file by itself
+	I_trace_drop,		// drop the record and count it
+};
+
+// how the processes write the trace file at pm_trace_finalize()
+enum trace_aggregate_mode {
+	I_trace_shared = 0,	// the processes append to one file in the order of rank
+	I_trace_node,		// the node leader writes one file per node
+	I_trace_mpiio,		// the node leaders write one file with MPI-IO
+};
+
+static bool trace_initialized = false;
+static int trace_rank = 0;
+static int trace_nprocs = 1;
+static double trace_baseT = 0.0;			// in the clock of rank 0 if the clocks are synchronized
+
+// samples of the clock offset to rank 0 taken at initialize and finalize.
+// The time of rank 0 = t + offset, which is interpolated linearly between the samples.
+static int trace_n_clock = 0;
+static double trace_clock_t[2];
+static double trace_clock_offset[2];
+static double trace_clock_error[2];
+static double trace_clock_max[2] = {-1.0, 0.0};	// uncertainty and |drift| of all the processes
+static const int trace_tag = 12;	// MPI tag of the token passed between the writers
+static std::string trace_filename;
+static std::vector<std::string> trace_labels;
+static std::vector< std::vector<std::string> > trace_metrics;	// names of the values of each section
+static std::vector<int> trace_kinds;		// I_trace_section, I_trace_mark or I_trace_counter
+static std::map<std::pair<int, std::string>, int> trace_map;
+
+static std::atomic<trace_ring*> trace_rings[Max_nthreads];
+static unsigned long trace_capacity = 0;	// records per ring
+static int trace_policy = I_trace_stall;
+static int trace_aggregate = I_trace_shared;
+static long trace_dropped_total = 0;		// all the processes. valid after pm_trace_finalize()
+
+static std::string trace_spool_name;
+static FILE* trace_spool = NULL;
+static const size_t trace_spool_buffer = 4*1024*1024;	// bytes per write of the spool file
+
+static std::string trace_counter;			// name of the counter track
+static bool trace_binary = false;			// PMLIB_TRACE_FORMAT=binary
+static bool trace_compress = false;			// PMLIB_TRACE_COMPRESS
+
+// flight recorder mode
+static bool trace_flight = false;
+static double trace_window = 0.0;			// seconds kept in the rings
+// filters applied when a record is put
+static std::vector<std::string> trace_include;	// PMLIB_TRACE_SECTIONS
+static std::vector<std::string> trace_exclude;	// PMLIB_TRACE_EXCLUDE
+static bool trace_rank_enabled = true;		// PMLIB_TRACE_RANKS
+static double trace_t_from = -1.0e+300;		// PMLIB_TRACE_WINDOW
+static double trace_t_to = 1.0e+300;
+static std::string trace_iter_label;		// PMLIB_TRACE_ITERATIONS
+static std::atomic<int> trace_iter_id(-1);
+static long trace_iter_first = 0;
+static long trace_iter_last = 0;
+static std::atomic<long> trace_iter_done(0);	// the stops of trace_iter_label
+static double trace_min_duration = 0.0;		// PMLIB_TRACE_MIN_DURATION
+
+static std::atomic<int> trace_trigger_id(-2);	// -2: no trigger, -1: all the sections
+static std::string trace_trigger_label;
+static double trace_trigger_sec = 0.0;		// latency threshold of the trigger
+static std::atomic<int> trace_signaled(0);	// set by the signal handler
+static std::atomic<bool> trace_dumping(false);
+static int trace_n_dumps = 0;
+static double trace_last_dump = 0.0;		// time of the last triggered dump
+static const int trace_max_dumps = 16;		// dumps per process
+static void trace_flight_dump (const char* reason, double t_now, bool holdoff);
+
+#ifdef _OPENMP
+static pthread_t trace_writer;
+static bool trace_writer_running = false;
+static std::atomic<bool> trace_writer_stop(false);
+static const int trace_flush_usec = 10000;	// interval of the writer
+static pthread_mutex_t trace_spool_lock = PTHREAD_MUTEX_INITIALIZER;	// the spool file and the tails
+#endif
+
+
+  /// The ring of the thread. created by the owner thread at its first record
+  ///
+static trace_ring* trace_thread_ring (int i_thread)
+{
+	trace_ring* ring = trace_rings[i_thread].load(std::memory_order_acquire);
+	if (ring != NULL) return ring;
+
+	ring = new trace_ring;
+	ring->rec = new trace_record[trace_capacity];
+	ring->mask = trace_capacity - 1;
+	ring->head.store(0);
+	ring->tail.store(0);
+	ring->dropped.store(0);
+	ring->short_last = 0.0;
+	trace_rings[i_thread].store(ring, std::memory_order_release);
+	return ring;
+}
+
+
+  /// Move the records of the ring to the spool file.
+  /// Called by the writer thread, or by the owner thread when its ring is full.
+  /// A block of the spool file is the thread number, the number of records and the records.
+  ///
+static void trace_drain_ring (int i_thread, trace_ring* ring)
+{
+	unsigned long tail = ring->tail.load(std::memory_order_relaxed);
+	unsigned long head = ring->head.load(std::memory_order_acquire);
+	if (head == tail) return;
+
+	if (trace_spool != NULL) {
+		int header[2];
+		header[0] = i_thread;
+		header[1] = (int)(head - tail);
+		fwrite(header, sizeof(int), 2, trace_spool);
+		unsigned long i0 = tail & ring->mask;
+		unsigned long n0 = std::min(head - tail, trace_capacity - i0);
+		fwrite(&ring->rec[i0], sizeof(trace_record), n0, trace_spool);
+		if (n0 < head - tail) {
+			fwrite(&ring->rec[0], sizeof(trace_record), head - tail - n0, trace_spool);
+		}
+	} else {
+		ring->dropped.fetch_add(head - tail);
+	}
+	ring->tail.store(head, std::memory_order_release);
+}
+
+
+static void trace_drain_all (void)
+{
+	for (int t=0; t<Max_nthreads; t++) {
+		trace_ring* ring = trace_rings[t].load(std::memory_order_acquire);
+		if (ring != NULL) trace_drain_ring(t, ring);
+	}
+}
+
+
+#ifdef _OPENMP
+static void* trace_writer_main (void*)
+{
+	while (!trace_writer_stop.load(std::memory_order_acquire)) {
+		pthread_mutex_lock(&trace_spool_lock);
+		trace_drain_all();
+		pthread_mutex_unlock(&trace_spool_lock);
+		usleep(trace_flush_usec);
+	}
+	return NULL;
+}
+#endif
+
+
+  /// The handler only raises the flag. The dump is written by the next record.
+  ///
+static void trace_signal_handler (int)
+{
+	trace_signaled.store(1);
+}
+
+
+  /// signal number of PMLIB_TRACE_SIGNAL = USR1 | USR2 | <number>
+  ///
+static int trace_signal_number (const char* cp_env)
+{
+	std::string s = cp_env;
+	for (size_t i=0; i<s.size(); i++) s[i] = toupper(s[i]);
+	if (s.compare(0, 3, "SIG") == 0) s = s.substr(3);
+	if (s == "USR1") return SIGUSR1;
+	if (s == "USR2") return SIGUSR2;
+	return atoi(s.c_str());
+}
+
+
+  /// shell style pattern with '*' and '?'
+  ///
+static bool trace_glob (const char* p, const char* s)
+{
+	for (; *p != '\0'; p++, s++) {
+		if (*p == '*') {
+			while (*(p+1) == '*') p++;
+			for (; ; s++) {
+				if (trace_glob(p+1, s)) return true;
+				if (*s == '\0') return false;
+			}
+		}
+		if (*s == '\0' || (*p != '?' && *p != *s)) return false;
+	}
+	return (*s == '\0');
+}
+
+
+  /// comma separated list of the environment variable
+  ///
+static std::vector<std::string> trace_env_list (const char* name)
+{
+	std::vector<std::string> v;
+	char* cp_env = std::getenv(name);
+	std::string s = (cp_env != NULL) ? cp_env : "";
+	size_t i0 = 0;
+	while (i0 < s.size()) {
+		size_t i1 = s.find(',', i0);
+		if (i1 == std::string::npos) i1 = s.size();
+		std::string s_item = s.substr(i0, i1 - i0);
+		s_item.erase(0, s_item.find_first_not_of(" "));
+		s_item.erase(s_item.find_last_not_of(" ") + 1);
+		if (!s_item.empty()) v.push_back(s_item);
+		i0 = i1 + 1;
+	}
+	return v;
+}
+
+
+  /// whether the rank is in the list of PMLIB_TRACE_RANKS, e.g. "0-15,1024"
+  ///
+static bool trace_rank_listed (int my_rank, const std::vector<std::string>& v_ranks)
+{
+	for (size_t i=0; i<v_ranks.size(); i++) {
+		int i_first, i_last;
+		int n = sscanf(v_ranks[i].c_str(), "%d-%d", &i_first, &i_last);
+		if (n == 1) i_last = i_first;
+		if (n >= 1 && i_first <= my_rank && my_rank <= i_last) return true;
+	}
+	return false;
+}
+
+
+  /// the temporary file of this process, <trace file>.<rank><suffix>.
+  /// It is put in PMLIB_TRACE_SPOOL_DIR, e.g. node local storage, if given.
+  /// Otherwise the aggregated traces put it in $TMPDIR or /tmp rather than
+  /// in the directory of the trace file, which is usually a shared file system.
+  ///
+static std::string trace_spool_path (const char* suffix)
+{
+	char c_rank[32];
+	snprintf(c_rank, sizeof(c_rank), ".%d", trace_rank);
+	std::string s_name = trace_filename + c_rank + suffix;
+
+	std::string s_dir;
+	char* cp_env = std::getenv("PMLIB_TRACE_SPOOL_DIR");
+	if (cp_env != NULL) s_dir = cp_env;
+	if (s_dir.empty() && trace_aggregate != I_trace_shared) {
+		cp_env = std::getenv("TMPDIR");
+		s_dir = (cp_env != NULL && cp_env[0] != '\0') ? cp_env : "/tmp";
+	}
+	if (!s_dir.empty()) {
+		size_t i_slash = s_name.rfind('/');
+		if (i_slash != std::string::npos) s_name.erase(0, i_slash+1);
+		s_name = s_dir + "/" + s_name;
+	}
+	return s_name;
+}
+
+
+void pm_trace_initialize (int num_process, int my_rank, double baseT, const std::string& s_counter)
+{
+	#pragma omp critical (pm_trace_init)
+	{
+	if (!trace_initialized) {
+		trace_initialized = true;
+		trace_rank = my_rank;
+		trace_nprocs = num_process;
+		trace_baseT = baseT;
+		trace_counter = s_counter;
+
+		// PMLIB_TRACE = off(default) | on | full | flight:<seconds>[:full]
+		int level = 0;
+		char* cp_env = std::getenv("PMLIB_TRACE");
+		std::string s = (cp_env != NULL) ? cp_env : "";
+		for (size_t i=0; i<s.size(); i++) s[i] = toupper(s[i]);
+		if (s.compare(0, 7, "FLIGHT:") == 0) {
+			trace_window = atof(s.c_str() + 7);
+			if (trace_window > 0.0) {
+				trace_flight = true;
+				level = (s.size() > 5 && s.compare(s.size()-5, 5, ":FULL") == 0) ? 2 : 1;
+			} else if (my_rank == 0) {
+				fprintf(stderr, "*** PMlib warning. PMLIB_TRACE=%s needs the window in seconds. The trace is disabled.\n", cp_env);
+			}
+		} else if ((s == "ON") || (s == "YES")) {
+			level = 1;
+		} else if (s == "FULL") {
+			level = 2;
+		} else if (!s.empty() && s != "OFF" && s != "NO" && my_rank == 0) {
+			fprintf(stderr, "*** PMlib warning. unknown PMLIB_TRACE value [%s] is ignored.\n", cp_env);
+		}
+
+		// PMLIB_TRACE_FORMAT = json(default) | binary, PMLIB_TRACE_COMPRESS = no(default) | yes
+		cp_env = std::getenv("PMLIB_TRACE_FORMAT");
+		if (cp_env != NULL) {
+			s = cp_env;
+			for (size_t i=0; i<s.size(); i++) s[i] = toupper(s[i]);
+			if (s == "BINARY" || s == "PMT") {
+				trace_binary = true;
+			} else if (s != "JSON" && my_rank == 0) {
+				fprintf(stderr, "*** PMlib warning. unknown PMLIB_TRACE_FORMAT value [%s] is ignored.\n", cp_env);
+			}
+		}
+		cp_env = std::getenv("PMLIB_TRACE_COMPRESS");
+		if (cp_env != NULL) {
+			s = cp_env;
+			for (size_t i=0; i<s.size(); i++) s[i] = toupper(s[i]);
+			trace_compress = (s == "YES" || s == "ON");
+		}
+
+		trace_filename = trace_binary ? "pmlib_trace.pmt" : "pmlib_trace.json";
+		cp_env = std::getenv("PMLIB_TRACE_FILE");
+		if (cp_env != NULL && cp_env[0] != '\0') trace_filename = cp_env;
+
+		// PMLIB_TRACE_BUFFER = memory of the rings of the process in MB (default 16)
+		double d_mbytes = 16.0;
+		cp_env = std::getenv("PMLIB_TRACE_BUFFER");
+		if (cp_env != NULL && atof(cp_env) > 0.0) d_mbytes = atof(cp_env);
+		int n_threads = 1;
+		#ifdef _OPENMP
+		n_threads = omp_in_parallel() ? omp_get_num_threads() : omp_get_max_threads();
+		#endif
+		if (n_threads > Max_nthreads) n_threads = Max_nthreads;
+		double d_records = d_mbytes * 1024.0 * 1024.0 / sizeof(trace_record) / n_threads;
+		trace_capacity = 256;
+		while ((double)(trace_capacity * 2) <= d_records) trace_capacity *= 2;
+
+		// PMLIB_TRACE_POLICY = stall(default) | drop
+		trace_policy = I_trace_stall;
+		cp_env = std::getenv("PMLIB_TRACE_POLICY");
+		if (cp_env != NULL) {
+			s = cp_env;
+			for (size_t i=0; i<s.size(); i++) s[i] = toupper(s[i]);
+			if (s == "DROP") {
+				trace_policy = I_trace_drop;
+			} else if (s != "STALL" && my_rank == 0) {
+				fprintf(stderr, "*** PMlib warning. unknown PMLIB_TRACE_POLICY value [%s] is ignored.\n", cp_env);
+			}
+		}
+
+		// PMLIB_TRACE_AGGREGATE = off(default) | node | mpiio
+		trace_aggregate = I_trace_shared;
+		cp_env = std::getenv("PMLIB_TRACE_AGGREGATE");
+		if (cp_env != NULL) {
+			s = cp_env;
+			for (size_t i=0; i<s.size(); i++) s[i] = toupper(s[i]);
+			if (s == "NODE") {
+				trace_aggregate = I_trace_node;
+			} else if (s == "MPIIO") {
+				trace_aggregate = I_trace_mpiio;
+			} else if (s != "OFF" && my_rank == 0) {
+				fprintf(stderr, "*** PMlib warning. unknown PMLIB_TRACE_AGGREGATE value [%s] is ignored.\n", cp_env);
+			}
+		}
+#ifdef DISABLE_MPI
+		trace_aggregate = I_trace_shared;
+#endif
+
+		// the filters
+		trace_include = trace_env_list("PMLIB_TRACE_SECTIONS");
+		trace_exclude = trace_env_list("PMLIB_TRACE_EXCLUDE");
+		std::vector<std::string> v_ranks = trace_env_list("PMLIB_TRACE_RANKS");
+		trace_rank_enabled = v_ranks.empty() || trace_rank_listed(my_rank, v_ranks);
+		cp_env = std::getenv("PMLIB_TRACE_WINDOW");
+		if (cp_env != NULL && cp_env[0] != '\0') {
+			// PMLIB_TRACE_WINDOW = [from]:[to] in seconds after initialize()
+			s = cp_env;
+			size_t i_colon = s.find(':');
+			std::string s_from = s.substr(0, i_colon);
+			std::string s_to = (i_colon == std::string::npos) ? "" : s.substr(i_colon+1);
+			if (!s_from.empty()) trace_t_from = baseT + atof(s_from.c_str());
+			if (!s_to.empty()) trace_t_to = baseT + atof(s_to.c_str());
+		}
+		cp_env = std::getenv("PMLIB_TRACE_ITERATIONS");
+		if (cp_env != NULL && cp_env[0] != '\0') {
+			// PMLIB_TRACE_ITERATIONS = label:first:last
+			s = cp_env;
+			size_t i_last = s.rfind(':');
+			size_t i_first = (i_last == std::string::npos || i_last == 0) ? std::string::npos : s.rfind(':', i_last-1);
+			if (i_first == std::string::npos) {
+				if (my_rank == 0) fprintf(stderr, "*** PMlib warning. PMLIB_TRACE_ITERATIONS=%s is ignored. label:first:last is expected.\n", cp_env);
+			} else {
+				trace_iter_label = s.substr(0, i_first);
+				trace_iter_first = atol(s.c_str() + i_first + 1);
+				trace_iter_last = atol(s.c_str() + i_last + 1);
+			}
+		}
+		cp_env = std::getenv("PMLIB_TRACE_MIN_DURATION");
+		if (cp_env != NULL) trace_min_duration = atof(cp_env);
+
+		if (level > 0 && trace_flight) {
+			// PMLIB_TRACE_TRIGGER = [label:]seconds
+			cp_env = std::getenv("PMLIB_TRACE_TRIGGER");
+			if (cp_env != NULL && cp_env[0] != '\0') {
+				s = cp_env;
+				size_t i_colon = s.rfind(':');
+				trace_trigger_sec = atof(s.c_str() + ((i_colon == std::string::npos) ? 0 : i_colon+1));
+				if (i_colon != std::string::npos) trace_trigger_label = s.substr(0, i_colon);
+				if (trace_trigger_sec <= 0.0) {
+					if (my_rank == 0) fprintf(stderr, "*** PMlib warning. PMLIB_TRACE_TRIGGER=%s is ignored.\n", cp_env);
+				} else if (trace_trigger_label.empty()) {
+					trace_trigger_id.store(-1);
+				}
+			}
+			// PMLIB_TRACE_SIGNAL = USR1 | USR2 | <number>
+			cp_env = std::getenv("PMLIB_TRACE_SIGNAL");
+			if (cp_env != NULL && cp_env[0] != '\0') {
+				struct sigaction sa;
+				memset(&sa, 0, sizeof(sa));
+				sa.sa_handler = trace_signal_handler;
+				sigemptyset(&sa.sa_mask);
+				sa.sa_flags = SA_RESTART;
+				int i_sig = trace_signal_number(cp_env);
+				if (i_sig <= 0 || sigaction(i_sig, &sa, NULL) != 0) {
+					if (my_rank == 0) fprintf(stderr, "*** PMlib warning. PMLIB_TRACE_SIGNAL=%s is ignored.\n", cp_env);
+				}
+			}
+		} else if (level > 0) {
+			trace_spool_name = trace_spool_path(".spool");
+			trace_spool = fopen(trace_spool_name.c_str(), "w+b");
+			if (trace_spool == NULL) {
+				fprintf(stderr, "*** PMlib warning. <pm_trace_initialize> can not write %s. The trace events are dropped.\n",
+					trace_spool_name.c_str());
+			} else {
+				setvbuf(trace_spool, NULL, _IOFBF, trace_spool_buffer);
+			}
+			#ifdef _OPENMP
+			trace_writer_stop.store(false);
+			trace_writer_running = (trace_spool != NULL) &&
+				(pthread_create(&trace_writer, NULL, trace_writer_main, NULL) == 0);
+			#endif
+		}
+		pm_trace_level = level;
+	}
+	}
+}
+
+
+  /// register the label of the kind
+  ///
+static int trace_register (const std::string& label, int kind)
+{
+	int id;
+	#pragma omp critical (pm_trace_label)
+	{
+	std::map<std::pair<int, std::string>, int>::iterator it = trace_map.find(std::make_pair(kind, label));
+	if (it == trace_map.end()) {
+		id = trace_labels.size();
+		trace_labels.push_back(label);
+		trace_kinds.push_back(kind);
+		trace_map.insert( std::make_pair(std::make_pair(kind, label), id) );
+		if (kind == I_trace_section && trace_trigger_sec > 0.0 && label == trace_trigger_label) {
+			trace_trigger_id.store(id);
+		}
+		if (kind == I_trace_section && !trace_iter_label.empty() && label == trace_iter_label) {
+			trace_iter_id.store(id);
+		}
+	} else {
+		id = it->second;
+	}
+	}
+	return id;
+}
+
+
+int pm_trace_section (const std::string& label)
+{
+	if (!trace_rank_enabled) return I_trace_excluded;
+	if (label != trace_iter_label) {
+		bool is_included = trace_include.empty();
+		for (size_t i=0; i<trace_include.size() && !is_included; i++) {
+			is_included = trace_glob(trace_include[i].c_str(), label.c_str());
+		}
+		for (size_t i=0; i<trace_exclude.size() && is_included; i++) {
+			is_included = !trace_glob(trace_exclude[i].c_str(), label.c_str());
+		}
+		if (!is_included) return I_trace_excluded;
+	}
+	return trace_register(label, I_trace_section);
+}
+
+
+int pm_trace_name (const std::string& name, int kind)
+{
+	if (!trace_rank_enabled) return I_trace_excluded;
+	return trace_register(name, kind);
+}
+
+
+void pm_trace_metrics (int id, const std::vector<std::string>& names)
+{
+	#pragma omp critical (pm_trace_label)
+	{
+	if (id >= (int)trace_metrics.size()) trace_metrics.resize(id+1);
+	if (trace_metrics[id].empty()) trace_metrics[id] = names;
+	}
+}
+
+
+  /// the value of an extension record
+  ///
+static inline double trace_ext_value (const trace_record& e, int j)
+{
+	return (j == 0) ? e.t_start : ((j == 1) ? e.t_stop : e.value);
+}
+
+
+  /// put the record and its extension records at head of the ring
+  ///
+static void trace_put (trace_ring* ring, unsigned long head, int id, double t_start, double t_stop,
+	const double* values, int n_values)
+{
+	trace_record& r = ring->rec[head & ring->mask];
+	r.t_start = t_start;
+	r.t_stop = t_stop;
+	r.value = (n_values > 0) ? values[0] : 0.0;
+	r.id = id;
+	r.n_values = n_values;
+	for (int k=1; k<n_values; k+=3) {
+		trace_record& e = ring->rec[(++head) & ring->mask];
+		e.t_start = values[k];
+		e.t_stop = (k+1 < n_values) ? values[k+1] : 0.0;
+		e.value = (k+2 < n_values) ? values[k+2] : 0.0;
+		e.id = -1;
+		e.n_values = 0;
+	}
+}
+
+
+  /// put a record of a section, or an instant record of mark() or counter() with t_start == t_stop.
+  /// The instant records are not subject to PMLIB_TRACE_MIN_DURATION nor to PMLIB_TRACE_TRIGGER.
+  ///
+static void trace_record_event (int i_thread, int id, double t_start, double t_stop,
+	const double* values, int n_values, bool is_section)
+{
+	if (i_thread < 0 || i_thread >= Max_nthreads || id < 0) return;
+
+	// the filters. The records are traced from the first to the last iteration of trace_iter_label
+	if (!trace_iter_label.empty()) {
+		long n_done = (id == trace_iter_id.load(std::memory_order_relaxed))
+			? trace_iter_done.fetch_add(1) : trace_iter_done.load(std::memory_order_relaxed);
+		if (n_done < trace_iter_first - 1 || n_done >= trace_iter_last) return;
+	}
+	if (t_stop < trace_t_from || t_start > trace_t_to) return;
+	trace_ring* ring = trace_thread_ring(i_thread);
+	if (is_section && t_stop - t_start < trace_min_duration) {
+		if (id >= (int)ring->short_count.size()) {
+			ring->short_count.resize(id+1, 0);
+			ring->short_time.resize(id+1, 0.0);
+		}
+		ring->short_count[id]++;
+		ring->short_time[id] += t_stop - t_start;
+		ring->short_last = t_stop;
+		return;
+	}
+	if (n_values < 0) n_values = 0;
+	unsigned long n_slots = 1 + (n_values + 1) / 3;
+	if (n_slots > trace_capacity) {
+		n_values = 1 + 3 * (trace_capacity - 1);
+		n_slots = trace_capacity;
+	}
+
+	unsigned long head = ring->head.load(std::memory_order_relaxed);
+	if (trace_flight) {
+		// the oldest records are overwritten
+		trace_put(ring, head, id, t_start, t_stop, values, n_values);
+		ring->head.store(head + n_slots, std::memory_order_release);
+
+		int i_trigger = trace_trigger_id.load(std::memory_order_relaxed);
+		if (is_section && i_trigger != -2 && (i_trigger == -1 || i_trigger == id) &&
+			t_stop - t_start > trace_trigger_sec) {
+			trace_flight_dump("latency", t_stop, true);
+		}
+		if (trace_signaled.load(std::memory_order_relaxed) != 0 && trace_signaled.exchange(0) != 0) {
+			trace_flight_dump("signal", t_stop, false);
+		}
+		return;
+	}
+	if (head + n_slots - ring->tail.load(std::memory_order_acquire) > trace_capacity) {
+	#ifdef _OPENMP
+		if (trace_writer_running && trace_policy == I_trace_drop) {
+			ring->dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+		// stall: the thread writes its own records instead of waiting for the writer
+		pthread_mutex_lock(&trace_spool_lock);
+		trace_drain_ring(i_thread, ring);
+		pthread_mutex_unlock(&trace_spool_lock);
+	#else
+		trace_drain_ring(i_thread, ring);
+	#endif
+	}
+
+	trace_put(ring, head, id, t_start, t_stop, values, n_values);
+	ring->head.store(head + n_slots, std::memory_order_release);
+}
+
+
+void pm_trace_record (int i_thread, int id, double t_start, double t_stop, const double* values, int n_values)
+{
+	trace_record_event(i_thread, id, t_start, t_stop, values, n_values, true);
+}
+
+
+void pm_trace_instant (int i_thread, int id, double t, const double* value)
+{
+	trace_record_event(i_thread, id, t, t, value, (value != NULL) ? 1 : 0, false);
+}
+
+
+long pm_trace_dropped (void)
+{
+	return trace_dropped_total;
+}
+
+
+  /// JSON string with the escape sequences
+  ///
+static void write_json_string (FILE* fp, const std::string& s)
+{
+	fputc('"', fp);
+	for (size_t i=0; i<s.size(); i++) {
+		unsigned char c = s[i];
+		if (c == '"' || c == '\\') {
+			fputc('\\', fp); fputc(c, fp);
+		} else if (c < 0x20) {
+			fprintf(fp, "\\u%04x", c);
+		} else {
+			fputc(c, fp);
+		}
+	}
+	fputc('"', fp);
+}
+
+
+  /// time stamp of the trace in micro seconds from the base time
+  ///
+static inline double trace_us (double t)
+{
+	double offset = 0.0;
+	if (trace_n_clock == 1) {
+		offset = trace_clock_offset[0];
+	} else if (trace_n_clock == 2) {
+		offset = trace_clock_offset[0] + (trace_clock_offset[1] - trace_clock_offset[0])
+			* (t - trace_clock_t[0]) / (trace_clock_t[1] - trace_clock_t[0]);
+	}
+	return (t + offset - trace_baseT) * 1.0e+6;
+}
+
+
+  /// the residual uncertainty of the corrected time stamps [sec]. -1 if not synchronized
+  ///
+static double trace_clock_uncertainty (void)
+{
+	double err = -1.0;
+	for (int i=0; i<trace_n_clock; i++) err = std::max(err, trace_clock_error[i]);
+	return err;
+}
+
+
+  /// the drift of the clock to rank 0 [sec/sec]
+  ///
+static double trace_clock_drift (void)
+{
+	if (trace_n_clock < 2) return 0.0;
+	return (trace_clock_offset[1] - trace_clock_offset[0]) / (trace_clock_t[1] - trace_clock_t[0]);
+}
+
+
+void pm_trace_clock (double t_local, double offset, double error)
+{
+	if (!trace_initialized || trace_n_clock >= 2) return;
+	if (trace_n_clock == 1 && t_local <= trace_clock_t[0]) return;
+	trace_clock_t[trace_n_clock] = t_local;
+	trace_clock_offset[trace_n_clock] = offset;
+	trace_clock_error[trace_n_clock] = error;
+	trace_n_clock++;
+}
+
+
+  /// the separator of the events of the processes
+  ///
+static const char* trace_separator (void)
+{
+	return trace_binary ? "" : ",\n";
+}
+
+
+  /// one 'E' block of the binary trace
+  ///
+static void write_event_block (FILE* fp, int t, size_t n_events, const std::string& s_events)
+{
+	std::string s_block, s_lz;
+	pmt_put_varint(s_block, t);
+	pmt_put_varint(s_block, n_events);
+	if (trace_compress) pmt_lz_compress(s_events, s_lz);
+	if (trace_compress && s_lz.size() < s_events.size()) {
+		s_block += (char)pmt_lz;
+		pmt_put_varint(s_block, s_events.size());
+		s_block += s_lz;
+	} else {
+		s_block += (char)pmt_raw;
+		pmt_put_varint(s_block, s_events.size());
+		s_block += s_events;
+	}
+	std::string s;
+	pmt_put_block(s, pmt_events, s_block);
+	fwrite(s.data(), 1, s.size(), fp);
+}
+
+
+  /// write the events of a thread to the binary trace. The start times are
+  /// the ticks from the base time in the local clock, delta encoded in each block.
+  ///
+static void write_thread_blocks (FILE* fp, int t, const trace_record* recs, size_t n,
+	size_t n_labels, double t_from)
+{
+	const size_t max_events = 65536;	// events per block
+	std::string s_events;
+	size_t n_events = 0;
+	long long tick_prev = 0;
+
+	for (size_t i=0; i<n; i++) {
+		const trace_record& r = recs[i];
+		if (r.id < 0) continue;		// extension records whose head has been overwritten
+		size_t n_ext = (r.n_values + 1) / 3;
+		if (i + n_ext >= n) break;
+		i += n_ext;
+		if (r.t_stop < t_from || r.id >= (int)n_labels) continue;
+
+		long long tick = llround((r.t_start - trace_baseT) / pmt_tick);
+		long long duration = llround((r.t_stop - r.t_start) / pmt_tick);
+		pmt_put_varint(s_events, r.id);
+		pmt_put_zigzag(s_events, tick - tick_prev);
+		pmt_put_varint(s_events, (duration > 0) ? duration : 0);
+		pmt_put_varint(s_events, r.n_values);
+		if (r.n_values > 0) pmt_put_double(s_events, r.value);
+		for (int k=1; k<r.n_values; k++) {
+			pmt_put_double(s_events, trace_ext_value(recs[i - n_ext + 1 + (k-1)/3], (k-1)%3));
+		}
+		tick_prev = tick;
+		if (++n_events == max_events) {
+			write_event_block(fp, t, n_events, s_events);
+			s_events.clear();
+			n_events = 0;
+			tick_prev = 0;
+		}
+	}
+	if (n_events > 0) write_event_block(fp, t, n_events, s_events);
+}
+
+
+  /// write the events of a thread. The records stopped before t_from are skipped.
+  ///
+static void write_thread_events (FILE* fp, int level, int t, const trace_record* recs, size_t n,
+	const std::vector<std::string>& labels, const std::vector< std::vector<std::string> >& metrics,
+	const std::vector<int>& kinds, bool* named, double t_from)
+{
+	if (trace_binary) {
+		write_thread_blocks(fp, t, recs, n, labels.size(), t_from);
+		return;
+	}
+	const int pid = trace_rank;
+	char c_thread[32];
+	snprintf(c_thread, sizeof(c_thread), " thread %d", t);
+	std::vector<double> v;
+
+	for (size_t i=0; i<n; i++) {
+		const trace_record& r = recs[i];
+		if (r.id < 0) continue;		// extension records whose head has been overwritten
+		size_t n_ext = (r.n_values + 1) / 3;
+		if (i + n_ext >= n) break;
+		i += n_ext;
+		if (r.t_stop < t_from || r.id >= (int)labels.size()) continue;
+		if (!named[t]) {
+			named[t] = true;
+			fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}", pid, t, t);
+		}
+		const std::string& label = labels[r.id];
+		double ts = trace_us(r.t_start);
+		double te = trace_us(r.t_stop);
+		int kind = (r.id < (int)kinds.size()) ? kinds[r.id] : I_trace_section;
+		if (kind == I_trace_mark) {
+			fprintf(fp, ",\n{\"name\":");
+			write_json_string(fp, label);
+			fprintf(fp, ",\"cat\":\"PMlib mark\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f}", pid, t, ts);
+			continue;
+		}
+		if (kind == I_trace_counter) {
+			// a counter track of the process per name
+			fprintf(fp, ",\n{\"name\":");
+			write_json_string(fp, label);
+			fprintf(fp, ",\"cat\":\"PMlib counter\",\"ph\":\"C\",\"pid\":%d,\"ts\":%.3f,\"args\":{\"value\":%.17g}}",
+				pid, ts, (r.n_values > 0) ? r.value : 0.0);
+			continue;
+		}
+		fprintf(fp, ",\n{\"name\":");
+		write_json_string(fp, label);
+		fprintf(fp, ",\"cat\":\"PMlib\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+			pid, t, ts, te - ts);
+		if (level < 2) continue;
+
+		v.resize(r.n_values);
+		if (r.n_values > 0) v[0] = r.value;
+		for (int k=1; k<r.n_values; k++) {
+			v[k] = trace_ext_value(recs[i - n_ext + 1 + (k-1)/3], (k-1)%3);
+		}
+		static const std::vector<std::string> no_names;
+		const std::vector<std::string>& names = (r.id < (int)metrics.size()) ? metrics[r.id] : no_names;
+
+		// a counter track per metric and thread holds the value while the section is active
+		for (int m=0; m<r.n_values; m++) {
+			std::string s_track;
+			if (m < (int)names.size()) {
+				s_track = names[m];
+			} else {
+				char c_value[32];
+				snprintf(c_value, sizeof(c_value), "value %d", m);
+				s_track = (m == 0) ? trace_counter : c_value;
+			}
+			s_track += c_thread;
+			for (int k=0; k<2; k++) {
+				fprintf(fp, ",\n{\"name\":");
+				write_json_string(fp, s_track);
+				fprintf(fp, ",\"ph\":\"C\",\"pid\":%d,\"ts\":%.3f,\"args\":{", pid, (k == 0) ? ts : te);
+				write_json_string(fp, label);
+				fprintf(fp, ":%.17g}}", (k == 0) ? v[m] : 0.0);
+			}
+		}
+	}
+}
+
+
+  /// the metadata events of this process. The first event of rank 0 has no separator.
+  ///
+static void write_rank_header (FILE* fp, bool first)
+{
+	if (trace_binary) {
+		std::vector<std::string> labels;
+		std::vector< std::vector<std::string> > metrics;
+		std::vector<int> kinds;
+		#pragma omp critical (pm_trace_label)
+		{
+		labels = trace_labels;
+		metrics = trace_metrics;
+		kinds = trace_kinds;
+		}
+		std::string s_block;
+		pmt_put_varint(s_block, trace_rank);
+		pmt_put_double(s_block, trace_baseT);
+		pmt_put_double(s_block, pmt_tick);
+		pmt_put_varint(s_block, trace_n_clock);
+		for (int i=0; i<trace_n_clock; i++) {
+			pmt_put_double(s_block, trace_clock_t[i] - trace_baseT);
+			pmt_put_double(s_block, trace_clock_offset[i]);
+			pmt_put_double(s_block, trace_clock_error[i]);
+		}
+		pmt_put_varint(s_block, labels.size());
+		for (size_t i=0; i<labels.size(); i++) {
+			pmt_put_string(s_block, labels[i]);
+			size_t n_names = (i < metrics.size()) ? metrics[i].size() : 0;
+			pmt_put_varint(s_block, n_names);
+			for (size_t m=0; m<n_names; m++) pmt_put_string(s_block, metrics[i][m]);
+		}
+		pmt_put_string(s_block, trace_counter);
+		pmt_put_varint(s_block, kinds.size());
+		for (size_t i=0; i<kinds.size(); i++) pmt_put_varint(s_block, kinds[i]);
+		std::string s;
+		pmt_put_block(s, pmt_process, s_block);
+		fwrite(s.data(), 1, s.size(), fp);
+		return;
+	}
+	const int pid = trace_rank;
+	if (!first) fputs(trace_separator(), fp);
+	fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"rank %d\"}}", pid, pid);
+	fprintf(fp, ",\n{\"name\":\"process_sort_index\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"sort_index\":%d}}", pid, pid);
+	if (trace_n_clock > 0) {
+		fprintf(fp, ",\n{\"name\":\"process_labels\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"labels\":\"clock offset %.3f us, drift %.3f ppm, uncertainty %.3f us\"}}",
+			pid, trace_clock_offset[trace_n_clock-1] * 1.0e+6, trace_clock_drift() * 1.0e+6, trace_clock_uncertainty() * 1.0e+6);
+	}
+}
+
+
+  /// write the events of this process read from the spool file.
+  ///
+static void write_spool_events (FILE* fp, int level)
+{
+	if (trace_spool == NULL) return;
+
+	bool named[Max_nthreads];
+	for (int t=0; t<Max_nthreads; t++) named[t] = false;
+	std::vector<trace_record> buf;
+	int header[2];
+
+	rewind(trace_spool);
+	while (fread(header, sizeof(int), 2, trace_spool) == 2) {
+		int t = header[0];
+		if (t < 0 || t >= Max_nthreads || header[1] <= 0) break;
+		buf.resize(header[1]);
+		if (fread(&buf[0], sizeof(trace_record), header[1], trace_spool) != (size_t)header[1]) break;
+		write_thread_events(fp, level, t, &buf[0], buf.size(), trace_labels, trace_metrics, trace_kinds, named, -1.0e+300);
+	}
+}
+
+
+  /// the suffix of the trace files, ".json" or ".pmt"
+  ///
+static std::string trace_file_suffix (void)
+{
+	return trace_binary ? ".pmt" : ".json";
+}
+
+
+  /// the trace file name without the suffix
+  ///
+static std::string trace_file_stem (void)
+{
+	std::string s_file = trace_filename;
+	std::string s_suffix = trace_file_suffix();
+	size_t n = s_suffix.size();
+	if (s_file.size() > n && s_file.compare(s_file.size()-n, n, s_suffix) == 0) {
+		s_file.erase(s_file.size()-n);
+	}
+	return s_file;
+}
+
+
+  /// the beginning of the trace file
+  ///
+static std::string trace_file_head (int level)
+{
+	if (!trace_binary) return "{\"traceEvents\":[\n";
+	std::string s(pmt_magic, sizeof(pmt_magic));
+	pmt_put_varint(s, pmt_version);
+	std::string s_block;
+	pmt_put_varint(s_block, level);
+	pmt_put_double(s_block, trace_flight ? trace_window : 0.0);
+	pmt_put_block(s, pmt_info, s_block);
+	return s;
+}
+
+
+  /// the end of the binary trace file, i.e. the 'Z' block
+  ///
+static void write_binary_footer (FILE* fp, int n_procs, int i_node, int i_rank, long n_dropped,
+	double uncertainty, double drift, const char* reason)
+{
+	std::string s_block;
+	pmt_put_varint(s_block, n_procs);
+	pmt_put_zigzag(s_block, i_node);
+	pmt_put_zigzag(s_block, i_rank);
+	pmt_put_varint(s_block, n_dropped);
+	pmt_put_double(s_block, uncertainty);
+	pmt_put_double(s_block, drift);
+	pmt_put_string(s_block, reason);
+	pmt_put_string(s_block, trace_counter);
+	pmt_put_string(s_block, std::string("PMlib ") + PM_VERSION);
+	std::string s;
+	pmt_put_block(s, pmt_footer, s_block);
+	fwrite(s.data(), 1, s.size(), fp);
+}
+
+
+  /// the clock correction in otherData
+  ///
+static void write_trace_clock (FILE* fp, double uncertainty, double drift)
+{
+	if (uncertainty < 0.0) {
+		fprintf(fp, "\"clock\":{\"reference\":\"none\"},");
+	} else {
+		fprintf(fp, "\"clock\":{\"reference\":\"rank 0\",\"uncertainty_us\":%.3f,\"max_drift_ppm\":%.3f},",
+			uncertainty * 1.0e+6, drift * 1.0e+6);
+	}
+}
+
+
+  /// copy the records of a ring in the flight recorder mode, the oldest first.
+  /// The owner thread keeps putting the records during the copy, so the records
+  /// which may have been overwritten meanwhile are discarded.
+  ///
+static void trace_flight_snapshot (trace_ring* ring, std::vector<trace_record>& buf)
+{
+	unsigned long h1 = ring->head.load(std::memory_order_acquire);
+	unsigned long n = std::min(h1, trace_capacity);
+	unsigned long first = h1 - n;
+	buf.resize(n);
+	for (unsigned long k=0; k<n; k++) {
+		buf[k] = ring->rec[(first + k) & ring->mask];
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+	unsigned long h2 = ring->head.load(std::memory_order_relaxed);
+
+	// the slot of record h2 may be under writing, i.e. the records older than h2+1-capacity are lost
+	unsigned long lo = (h2 + 1 > trace_capacity) ? h2 + 1 - trace_capacity : 0;
+	if (lo > first) {
+		buf.erase(buf.begin(), buf.begin() + std::min(lo - first, n));
+	}
+}
+
+
+  /// write the records of the last trace_window seconds held in the rings.
+  ///
+  ///   @param[in] t_now  end of the window. The latest record when t_now <= 0
+  ///
+static void write_flight_events (FILE* fp, int level, double t_now)
+{
+	std::vector<trace_record> bufs[Max_nthreads];
+	for (int t=0; t<Max_nthreads; t++) {
+		trace_ring* ring = trace_rings[t].load(std::memory_order_acquire);
+		if (ring != NULL) trace_flight_snapshot(ring, bufs[t]);
+	}
+	if (t_now <= 0.0) {
+		for (int t=0; t<Max_nthreads; t++) {
+			for (size_t i=0; i<bufs[t].size(); i++) {
+				if (bufs[t][i].id >= 0) t_now = std::max(t_now, bufs[t][i].t_stop);
+			}
+		}
+	}
+	// the labels registered after the snapshot are not referred
+	std::vector<std::string> labels;
+	std::vector< std::vector<std::string> > metrics;
+	std::vector<int> kinds;
+	#pragma omp critical (pm_trace_label)
+	{
+	labels = trace_labels;
+	metrics = trace_metrics;
+	kinds = trace_kinds;
+	}
+
+	bool named[Max_nthreads];
+	for (int t=0; t<Max_nthreads; t++) named[t] = false;
+	for (int t=0; t<Max_nthreads; t++) {
+		if (bufs[t].empty()) continue;
+		write_thread_events(fp, level, t, &bufs[t][0], bufs[t].size(), labels, metrics, kinds, named, t_now - trace_window);
+	}
+}
+
+
+  /// write the flight recorder of this process to its own file.
+  /// <stem>.<rank>.<n>.json (or .pmt) is written for PMLIB_TRACE_FILE=<stem>.json
+  ///
+  ///   @param[in] reason    reason of the dump written to otherData
+  ///   @param[in] t_now     end of the window. The latest record when t_now <= 0
+  ///   @param[in] holdoff   skip the dump if the last one was written within the window
+  ///
+static void trace_flight_dump (const char* reason, double t_now, bool holdoff)
+{
+	if (trace_dumping.exchange(true)) return;	// another thread is dumping
+
+	if (trace_n_dumps >= trace_max_dumps) {
+		if (trace_n_dumps++ == trace_max_dumps) {
+			fprintf(stderr, "*** PMlib warning. <pm_trace_dump> rank %d reached %d dumps. The rest are ignored.\n",
+				trace_rank, trace_max_dumps);
+		}
+	} else if (!(holdoff && trace_n_dumps > 0 && t_now < trace_last_dump + trace_window)) {
+		if (holdoff) trace_last_dump = t_now;
+		std::string s_file = trace_file_stem();
+		char c_suffix[64];
+		snprintf(c_suffix, sizeof(c_suffix), ".%d.%d", trace_rank, trace_n_dumps++);
+		s_file += c_suffix + trace_file_suffix();
+
+		FILE* fp = fopen(s_file.c_str(), "wb");
+		if (fp == NULL) {
+			fprintf(stderr, "*** PMlib warning. <pm_trace_dump> can not write the trace file %s\n", s_file.c_str());
+		} else if (trace_binary) {
+			std::string s_head = trace_file_head(pm_trace_level);
+			fwrite(s_head.data(), 1, s_head.size(), fp);
+			write_rank_header(fp, true);
+			write_flight_events(fp, pm_trace_level, t_now);
+			long n_dropped = 0;
+			for (int t=0; t<Max_nthreads; t++) {
+				trace_ring* ring = trace_rings[t].load(std::memory_order_acquire);
+				if (ring != NULL) n_dropped += ring->dropped.load();
+			}
+			write_binary_footer(fp, 1, -1, trace_rank, n_dropped, trace_clock_uncertainty(), fabs(trace_clock_drift()), reason);
+			fclose(fp);
+			fprintf(stderr, "*** PMlib flight recorder. rank %d wrote the last %g seconds to %s (%s)\n",
+				trace_rank, trace_window, s_file.c_str(), reason);
+		} else {
+			fprintf(fp, "{\"traceEvents\":[\n");
+			write_rank_header(fp, true);
+			write_flight_events(fp, pm_trace_level, t_now);
+			fprintf(fp, "\n],\n\"displayTimeUnit\":\"ns\",\n\"otherData\":{\"producer\":\"PMlib %s\",\"rank\":%d,\"reason\":\"%s\",\"window\":%g,",
+				PM_VERSION, trace_rank, reason, trace_window);
+			write_trace_clock(fp, trace_clock_uncertainty(), fabs(trace_clock_drift()));
+			fprintf(fp, "\"counter\":");
+			write_json_string(fp, trace_counter);
+			fprintf(fp, "}}\n");
+			fclose(fp);
+			fprintf(stderr, "*** PMlib flight recorder. rank %d wrote the last %g seconds to %s (%s)\n",
+				trace_rank, trace_window, s_file.c_str(), reason);
+		}
+	}
+	trace_dumping.store(false);
+}
+
+
+void pm_trace_dump (const std::string& reason)
+{
+	if (!trace_flight || pm_trace_level == 0) return;
+	trace_flight_dump(reason.c_str(), 0.0, false);
+}
+
+
+  /// the records dropped by PMLIB_TRACE_MIN_DURATION are summarized per thread
+  /// by an instant event at the end of the trace
+  ///
+static void write_short_events (FILE* fp)
+{
+	if (trace_min_duration <= 0.0) return;
+	for (int t=0; t<Max_nthreads; t++) {
+		trace_ring* ring = trace_rings[t].load(std::memory_order_acquire);
+		if (ring == NULL || ring->short_count.empty()) continue;
+		if (trace_binary) {
+			std::string s_block;
+			pmt_put_varint(s_block, t);
+			pmt_put_zigzag(s_block, llround((ring->short_last - trace_baseT) / pmt_tick));
+			size_t n_used = 0;
+			for (size_t i=0; i<ring->short_count.size(); i++) {
+				if (ring->short_count[i] > 0) n_used++;
+			}
+			pmt_put_varint(s_block, n_used);
+			for (size_t i=0; i<ring->short_count.size(); i++) {
+				if (ring->short_count[i] == 0) continue;
+				pmt_put_varint(s_block, i);
+				pmt_put_varint(s_block, ring->short_count[i]);
+				pmt_put_double(s_block, ring->short_time[i]);
+			}
+			std::string s;
+			pmt_put_block(s, pmt_short, s_block);
+			fwrite(s.data(), 1, s.size(), fp);
+			continue;
+		}
+		fprintf(fp, ",\n{\"name\":\"short sections\",\"cat\":\"PMlib\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"args\":{",
+			trace_rank, t, trace_us(ring->short_last));
+		bool first = true;
+		for (size_t i=0; i<ring->short_count.size(); i++) {
+			if (ring->short_count[i] == 0) continue;
+			if (!first) fputc(',', fp);
+			first = false;
+			write_json_string(fp, trace_labels[i]);
+			fprintf(fp, ":{\"count\":%ld,\"time_us\":%.3f}", ring->short_count[i], ring->short_time[i] * 1.0e+6);
+		}
+		fprintf(fp, "}}");
+	}
+}
+
+
+  /// the events of this process, i.e. the metadata and the records of
+  /// the spool file or of the flight recorder
+  ///
+static void write_process_events (FILE* fp, int level, bool first)
+{
+	write_rank_header(fp, first);
+	if (trace_flight) {
+		write_flight_events(fp, level, 0.0);
+	} else {
+		write_spool_events(fp, level);
+	}
+	write_short_events(fp);
+}
+
+
+  /// the end of the trace file
+  ///
+  ///   @param[in] n_procs  number of the processes in the file
+  ///   @param[in] i_node   node number of the file. -1 if the file holds all the nodes
+  ///
+static void write_trace_footer (FILE* fp, int n_procs, int i_node)
+{
+	if (trace_binary) {
+		write_binary_footer(fp, n_procs, i_node, -1, trace_dropped_total, trace_clock_max[0], trace_clock_max[1],
+			trace_flight ? "finalize" : "");
+		return;
+	}
+	fprintf(fp, "\n],\n\"displayTimeUnit\":\"ns\",\n\"otherData\":{\"producer\":\"PMlib %s\",\"processes\":%d,\"dropped\":%ld,",
+		PM_VERSION, n_procs, trace_dropped_total);
+	if (i_node >= 0) fprintf(fp, "\"node\":%d,", i_node);
+	if (trace_flight) fprintf(fp, "\"reason\":\"finalize\",\"window\":%g,", trace_window);
+	write_trace_clock(fp, trace_clock_max[0], trace_clock_max[1]);
+	fprintf(fp, "\"counter\":");
+	write_json_string(fp, trace_counter);
+	fprintf(fp, "}}\n");
+}
+
+
+  /// The processes append their events to the file in the order of rank.
+  /// The token tells the next process whether the file is still valid.
+  ///
+static void write_trace_shared (int level)
+{
+	int token = 0;
+#ifndef DISABLE_MPI
+	if (trace_rank > 0) {
+		MPI_Recv(&token, 1, MPI_INT, trace_rank-1, trace_tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+	}
+#endif
+	if (token == 0) {
+		FILE* fp = fopen(trace_filename.c_str(), (trace_rank == 0) ? "wb" : "ab");
+		if (fp == NULL) {
+			fprintf(stderr, "*** PMlib warning. <pm_trace_finalize> can not write the trace file %s\n",
+				trace_filename.c_str());
+			token = 1;
+		} else {
+			if (trace_rank == 0) {
+				std::string s_head = trace_file_head(level);
+				fwrite(s_head.data(), 1, s_head.size(), fp);
+			}
+			write_process_events(fp, level, trace_rank == 0);
+			if (trace_rank == trace_nprocs-1) {
+				write_trace_footer(fp, trace_nprocs, -1);
+			}
+			fclose(fp);
+		}
+	}
+#ifndef DISABLE_MPI
+	if (trace_rank < trace_nprocs-1) {
+		MPI_Send(&token, 1, MPI_INT, trace_rank+1, trace_tag, MPI_COMM_WORLD);
+	}
+#endif
+}
+
+
+#ifndef DISABLE_MPI
+static const long trace_block_bytes = 4*1024*1024;	// bytes per message and per write of the aggregation
+
+  /// Take the next block of the events of process j of the node. The events of
+  /// the leader itself are read from its file, and the others are received.
+  ///
+  ///   @return  bytes of the block, at most trace_block_bytes
+  ///
+static long trace_take_block (FILE* fp, int j, long n_left, std::vector<char>& buf, MPI_Comm comm)
+{
+	long m = std::min(trace_block_bytes, n_left);
+	buf.resize(trace_block_bytes);
+	if (j == 0) {
+		if ((long)fread(&buf[0], 1, m, fp) != m) memset(&buf[0], ' ', m);
+	} else {
+		MPI_Recv(&buf[0], (int)m, MPI_BYTE, j, trace_tag, comm, MPI_STATUS_IGNORE);
+	}
+	return m;
+}
+
+  /// Send the events of this process to the leader of the node, block by block
+  ///
+static void trace_send_events (FILE* fp, long n, MPI_Comm comm)
+{
+	std::vector<char> buf(trace_block_bytes);
+	for (long i=0; i<n; i+=trace_block_bytes) {
+		long m = std::min(trace_block_bytes, n - i);
+		if (fp == NULL || (long)fread(&buf[0], 1, m, fp) != m) memset(&buf[0], ' ', m);
+		MPI_Send(&buf[0], (int)m, MPI_BYTE, 0, trace_tag, comm);
+	}
+}
+#endif
+
+
+  /// The processes send their events to the leader of the node (local rank 0).
+  /// With I_trace_node the leader writes <stem>.node<k>.json (or .pmt), and with I_trace_mpiio
+  /// the leaders write their parts of the trace file at the offsets given by MPI_Exscan.
+  /// Rank 0 writes <stem>.index, the file, offset and bytes of the events of each process.
+  ///
+static void write_trace_aggregated (int level)
+{
+#ifndef DISABLE_MPI
+	const bool is_node_file = (trace_aggregate == I_trace_node);
+
+	// the processes of the node and the leaders
+	MPI_Comm comm_node, comm_leader;
+	int iret = MPI_ERR_OTHER;
+#if defined(MPI_VERSION) && (MPI_VERSION >= 3)
+	iret = MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, trace_rank, MPI_INFO_NULL, &comm_node);
+#endif
+	if (iret != MPI_SUCCESS) {
+		MPI_Comm_split(MPI_COMM_WORLD, trace_rank, 0, &comm_node);		// one process per node
+	}
+	int np_node, rank_on_node;
+	MPI_Comm_size(comm_node, &np_node);
+	MPI_Comm_rank(comm_node, &rank_on_node);
+	MPI_Comm_split(MPI_COMM_WORLD, (rank_on_node == 0) ? 0 : MPI_UNDEFINED, trace_rank, &comm_leader);
+	int v_node[2] = {0, 1};		// node number and number of the nodes
+	if (rank_on_node == 0) {
+		MPI_Comm_rank(comm_leader, &v_node[0]);
+		MPI_Comm_size(comm_leader, &v_node[1]);
+	}
+	MPI_Bcast(v_node, 2, MPI_INT, 0, comm_node);
+	const int i_node = v_node[0];
+	const int n_nodes = v_node[1];
+
+	std::string s_file = trace_filename;
+	if (is_node_file) {
+		char c_node[32];
+		snprintf(c_node, sizeof(c_node), ".node%d", i_node);
+		s_file = trace_file_stem() + c_node + trace_file_suffix();
+	}
+
+	// the events of this process in a temporary file, which is streamed to the leader
+	// in blocks. In the MPI-IO file the events of rank 0 start with the head of the file
+	// and the others with the separator.
+	const std::string s_head = trace_file_head(level);
+	const char* c_sep = trace_separator();
+	long n_prefix = 0;
+	const std::string s_events = trace_spool_path(".events");
+	FILE* fp_events = fopen(s_events.c_str(), "w+b");
+	if (fp_events == NULL) {
+		fprintf(stderr, "*** PMlib warning. <pm_trace_finalize> can not write %s. The trace events of rank %d are dropped.\n",
+			s_events.c_str(), trace_rank);
+	} else {
+		setvbuf(fp_events, NULL, _IOFBF, trace_block_bytes);
+		if (!is_node_file) {
+			if (trace_rank == 0) fwrite(s_head.data(), 1, s_head.size(), fp_events);
+			n_prefix = (trace_rank == 0) ? s_head.size() : strlen(c_sep);
+		}
+		write_process_events(fp_events, level, is_node_file || trace_rank == 0);
+		fflush(fp_events);
+	}
+	long n_bytes = (fp_events != NULL) ? ftell(fp_events) : 0;
+	if (n_bytes < 0) n_bytes = 0;
+	if (n_bytes == 0) n_prefix = 0;
+	if (fp_events != NULL) rewind(fp_events);
+	FILE* fp = NULL;
+	std::vector<long> v_bytes(np_node);
+	std::vector<long> v_offset(np_node);
+	MPI_Gather(&n_bytes, 1, MPI_LONG, &v_bytes[0], 1, MPI_LONG, 0, comm_node);
+
+	if (rank_on_node == 0) {
+		char* footer = NULL;
+		size_t n_footer = 0;
+		fp = open_memstream(&footer, &n_footer);
+		write_trace_footer(fp, is_node_file ? np_node : trace_nprocs, is_node_file ? i_node : -1);
+		fclose(fp);
+		const bool has_footer = is_node_file || (i_node == n_nodes-1);
+		std::vector<char> buf;
+
+		if (is_node_file) {
+			fp = fopen(s_file.c_str(), "wb");
+			if (fp == NULL) {
+				fprintf(stderr, "*** PMlib warning. <pm_trace_finalize> can not write the trace file %s\n", s_file.c_str());
+			}
+			long offset = s_head.size();
+			if (fp != NULL) fwrite(s_head.data(), 1, s_head.size(), fp);
+			bool is_first = true;
+			for (int j=0; j<np_node; j++) {
+				if (v_bytes[j] > 0 && !is_first) {
+					if (fp != NULL) fputs(c_sep, fp);
+					offset += strlen(c_sep);
+				}
+				if (v_bytes[j] > 0) is_first = false;
+				v_offset[j] = offset;
+				for (long i=0; i<v_bytes[j]; ) {
+					long m = trace_take_block(fp_events, j, v_bytes[j] - i, buf, comm_node);
+					if (fp != NULL) fwrite(&buf[0], 1, m, fp);
+					i += m;
+				}
+				offset += v_bytes[j];
+			}
+			if (fp != NULL) {
+				fwrite(footer, 1, n_footer, fp);
+				fclose(fp);
+			}
+		} else {
+			long node_bytes = has_footer ? n_footer : 0;
+			for (int j=0; j<np_node; j++) node_bytes += v_bytes[j];
+			long offset = 0;
+			MPI_Exscan(&node_bytes, &offset, 1, MPI_LONG, MPI_SUM, comm_leader);
+			if (i_node == 0) offset = 0;
+
+			MPI_File fh;
+			iret = MPI_File_open(comm_leader, (char*)s_file.c_str(), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fh);
+			if (iret == MPI_SUCCESS) {
+				MPI_File_set_size(fh, 0);
+			} else if (i_node == 0) {
+				fprintf(stderr, "*** PMlib warning. <pm_trace_finalize> can not open the trace file %s with MPI-IO\n", s_file.c_str());
+			}
+			for (int j=0; j<np_node; j++) {
+				v_offset[j] = offset;
+				for (long i=0; i<v_bytes[j]; ) {
+					long m = trace_take_block(fp_events, j, v_bytes[j] - i, buf, comm_node);
+					if (iret == MPI_SUCCESS) {
+						MPI_File_write_at(fh, (MPI_Offset)offset, &buf[0], (int)m, MPI_BYTE, MPI_STATUS_IGNORE);
+					}
+					offset += m;
+					i += m;
+				}
+			}
+			if (iret == MPI_SUCCESS) {
+				if (has_footer) {
+					MPI_File_write_at(fh, (MPI_Offset)offset, footer, (int)n_footer, MPI_BYTE, MPI_STATUS_IGNORE);
+				}
+				MPI_File_close(&fh);
+			}
+		}
+		free(footer);
+		MPI_Comm_free(&comm_leader);
+	} else {
+		trace_send_events(fp_events, n_bytes, comm_node);
+	}
+	if (fp_events != NULL) {
+		fclose(fp_events);
+		remove(s_events.c_str());
+	}
+
+	// the index of the events of the processes without the separators
+	long v_index[3];
+	MPI_Scatter(&v_offset[0], 1, MPI_LONG, &v_index[1], 1, MPI_LONG, 0, comm_node);
+	v_index[0] = i_node;
+	v_index[1] += n_prefix;
+	v_index[2] = n_bytes - n_prefix;
+	MPI_Comm_free(&comm_node);
+
+	std::vector<long> v_all((trace_rank == 0) ? 3*trace_nprocs : 3);
+	MPI_Gather(v_index, 3, MPI_LONG, &v_all[0], 3, MPI_LONG, 0, MPI_COMM_WORLD);
+	if (trace_rank == 0) {
+		std::string s_index = trace_file_stem() + ".index";
+		fp = fopen(s_index.c_str(), "w");
+		if (fp == NULL) {
+			fprintf(stderr, "*** PMlib warning. <pm_trace_finalize> can not write the trace index %s\n", s_index.c_str());
+			return;
+		}
+		fprintf(fp, "# PMlib %s trace index. %d processes on %d nodes\n", PM_VERSION, trace_nprocs, n_nodes);
+		fprintf(fp, "# rank node offset bytes file\n");
+		for (int i=0; i<trace_nprocs; i++) {
+			int k = (int)v_all[3*i];
+			std::string s_name = trace_filename;
+			if (is_node_file) {
+				char c_node[32];
+				snprintf(c_node, sizeof(c_node), ".node%d", k);
+				s_name = trace_file_stem() + c_node + trace_file_suffix();
+			}
+			fprintf(fp, "%d %d %ld %ld %s\n", i, k, v_all[3*i+1], v_all[3*i+2], s_name.c_str());
+		}
+		fclose(fp);
+	}
+#endif
+}
+
+
+void pm_trace_finalize (const std::string& s_counter)
+{
+	if (!trace_initialized || pm_trace_level == 0) return;
+	int level = pm_trace_level;
+	pm_trace_level = 0;		// no more records
+	trace_counter = s_counter;
+
+	// stop the writer and take the rest of the records
+	#ifdef _OPENMP
+	if (trace_writer_running) {
+		trace_writer_stop.store(true, std::memory_order_release);
+		pthread_join(trace_writer, NULL);
+		trace_writer_running = false;
+	}
+	#endif
+	if (trace_flight) {
+		while (trace_dumping.exchange(true)) {}	// wait for a dump in progress. no more dumps
+	} else {
+		trace_drain_all();
+	}
+	if (trace_spool != NULL) fflush(trace_spool);
+
+	long n_dropped = 0;
+	for (int t=0; t<Max_nthreads; t++) {
+		trace_ring* ring = trace_rings[t].load(std::memory_order_acquire);
+		if (ring != NULL) n_dropped += ring->dropped.load();
+	}
+	trace_dropped_total = n_dropped;
+	double v_clock[2] = {trace_clock_uncertainty(), fabs(trace_clock_drift())};
+	trace_clock_max[0] = v_clock[0];
+	trace_clock_max[1] = v_clock[1];
+#ifndef DISABLE_MPI
+	MPI_Allreduce(&n_dropped, &trace_dropped_total, 1, MPI_LONG, MPI_SUM, MPI_COMM_WORLD);
+	MPI_Allreduce(v_clock, trace_clock_max, 2, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+#endif
+	if (n_dropped > 0) {
+		fprintf(stderr, "*** PMlib warning. <pm_trace_finalize> rank %d dropped %ld trace events."
+			" Increase PMLIB_TRACE_BUFFER or set PMLIB_TRACE_POLICY=stall.\n", trace_rank, n_dropped);
+	}
+
+	if (trace_aggregate == I_trace_shared) {
+		write_trace_shared(level);
+	} else {
+		write_trace_aggregated(level);
+	}
+
+	if (trace_spool != NULL) {
+		fclose(trace_spool);
+		trace_spool = NULL;
+		remove(trace_spool_name.c_str());
+	}
+	for (int t=0; t<Max_nthreads; t++) {
+		trace_ring* ring = trace_rings[t].exchange(NULL);
+		if (ring == NULL) continue;
+		delete[] ring->rec;
+		delete ring;
+	}
+}
+
+} /* namespace pm_lib */
@@ -18,7 +18,7 @@
 //! @file   PerfWatch.cpp
 //! @brief  PerfWatch class
 
-// When compiling with USE_PAPI macro, openmp option should be enabled.
+// When compiling with USE_HWPC macro, openmp option should be enabled.
 #include <string>
 #include <cstdlib>
 #include <cstdio>
@@ -33,6 +33,18 @@
 #endif
 
 #include "PerfWatch.h"
+#include "pmlib_ompt.h"
+#include "pmlib_sampling.h"
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <sched.h>
+#endif
 
 extern void sortPapiCounterList ();
 extern void outputPapiCounterHeader (FILE*, std::string);
@@ -47,6 +59,48 @@ namespace pm_lib {
   double cpu_clock_freq;        /// processor clock frequency, i.e. Hz
   double second_per_cycle;  /// real time to take each cycle
   struct pmlib_power_chooser power;
+  static bool is_trace_clock_synced = false;	/// the trace clock was synchronized at initializeTrace()
+
+  // the values of m_traceMetrics other than the HWPC sorted index
+  enum trace_metric_code {
+	I_trace_count = -2,		// flopPerTask * iterationCount given by the user
+	I_trace_rate = -1,		// traceRate(), the default
+  };
+
+  /// OpenMP thread number flattened over the nested parallel levels
+  ///
+  /// @note same as omp_get_thread_num() unless the parallel regions are nested.
+  ///
+  int flat_thread_num(void)
+  {
+#ifdef _OPENMP
+	int level = omp_get_level();
+	if (level <= 1) return omp_get_thread_num();
+	int i_flat = 0;
+	for (int l=1; l<=level; l++) {
+		i_flat = i_flat * omp_get_team_size(l) + omp_get_ancestor_thread_num(l);
+	}
+	return i_flat;
+#else
+	return 0;
+#endif
+  }
+
+#ifdef _OPENMP
+
+  /// The number of threads running concurrently, i.e. the product of the nested team sizes
+  ///
+  static int flat_team_size(void)
+  {
+	int level = omp_get_level();
+	if (level <= 1) return omp_get_num_threads();
+	int n_flat = 1;
+	for (int l=1; l<=level; l++) {
+		n_flat *= omp_get_team_size(l);
+	}
+	return n_flat;
+  }
+#endif
 
   ///
   /// 単位変換.
@@ -62,6 +116,8 @@ namespace pm_lib {
   ///              = 5: HWPC が自動測定する cache hit, miss,
   ///              = 6: HWPC が自動測定する cycles, instructions
   ///              = 7: HWPC が自動測定する load/store instruction type
+  ///              = 9: HWPC が自動測定する top-down pipeline slots
+  ///              =10: HWPC が自動測定する data TLB misses, page walk cycles
   ///   @return  単位変換後の数値
   ///
   ///   @note is_unitは通常PerfWatch::statsSwitch()で事前に決定されている
@@ -114,11 +170,35 @@ namespace pm_lib {
       }
     } else
 
-    if ( (is_unit == 4) || (is_unit == 5) || (is_unit == 7) )  {
+    if ( (is_unit == 4) || (is_unit == 5) || (is_unit == 7) || (is_unit == 9) )  {
         ret = fops;
         unit = "(%)";
     } else
 
+    if ( is_unit == 10 )  {
+        ret = fops;
+        unit = "(/KI)";
+    } else
+
+    if ( is_unit == 8 )  {
+      if      ( fops > P ) {
+        ret = fops / P;
+        unit = "P.ev/s";
+      }
+      else if ( fops > T ) {
+        ret = fops / T;
+        unit = "T.ev/s";
+      }
+      else if ( fops > G ) {
+        ret = fops / G;
+        unit = "G.ev/s";
+      }
+      else {
+        ret = fops / M;
+        unit = "M.ev/s";
+      }
+    } else
+
     if ( is_unit == 6 )  {
       if      ( fops > P ) {
         ret = fops / P;
@@ -205,6 +285,7 @@ namespace pm_lib {
   ///   5: HWPC が自動的に測定する cache hit, miss
   ///   6: HWPC が自動的に測定する cycles, instructions
   ///   7: HWPC が自動的に測定する load/store instruction type
+  ///   8: HWPC が測定するユーザー指定のイベント (HWPC_CHOOSER=CUSTOM)
   ///
   /// @note
   /// 計算量としてユーザー申告値を用いるかHWPC計測値を用いるかの決定を行う
@@ -222,6 +303,9 @@ namespace pm_lib {
     // 5: CACHE     : HWPC measured cache hit/miss
     // 6: CYCLE     : HWPC measured cycles, instructions
     // 7: LOADSTORE : HWPC measured load/store instruction type
+    // 8: CUSTOM    : HWPC measured user specified events
+    // 9: TOPDOWN   : HWPC measured top-down pipeline slots
+    //10: TLB       : HWPC measured data TLB misses and page walks
 
     if (hwpc_group.number[I_bandwidth] > 0) {
       is_unit=2;
@@ -235,6 +319,12 @@ namespace pm_lib {
       is_unit=6;
     } else if (hwpc_group.number[I_loadstore] > 0) {
       is_unit=7;
+    } else if (hwpc_group.number[I_topdown] > 0) {
+      is_unit=9;
+    } else if (hwpc_group.number[I_tlb] > 0) {
+      is_unit=10;
+    } else if (hwpc_group.number[I_custom] > 0) {
+      is_unit=8;
     } else if (m_typeCalc == 0) {
 		is_unit=0;
     } else if (m_typeCalc == 1) {
@@ -247,6 +337,98 @@ namespace pm_lib {
   }
 
 
+  /// statsSwitch()の値に対応するHWPC出力グループ
+  ///
+  ///   @param[in] is_unit  statsSwitch()の値 (2..10)
+  ///   @return  hwpc_output_group
+  ///
+  static int hwpc_unit_group(int is_unit)
+  {
+    static const int i_groups[] = { I_elapse, I_elapse,
+      I_bandwidth, I_flops, I_vector, I_cache, I_cycle, I_loadstore, I_custom, I_topdown, I_tlb };
+    if (is_unit < 0 || is_unit > 10) return I_elapse;
+    return i_groups[is_unit];
+  }
+
+  /// グループのsorted値のうち名前がs_nameの値の位置
+  ///
+  ///   @param[in] p  sorted値を持つ構造体
+  ///   @param[in] i_group  hwpc_output_group
+  ///   @param[in] s_name  sorted値の名前 (例 "Total_FP", "[Bytes]")
+  ///   @return  my_papi.v_sorted[]の位置. 無い場合は -1
+  ///
+  static int hwpc_sorted_position(const pmlib_papi_chooser& p, int i_group, const std::string& s_name)
+  {
+    for (int i=p.sorted_index[i_group]; i<p.sorted_index[i_group]+p.sorted_number[i_group]; i++) {
+      if (p.s_sorted[i] == s_name) return i;
+    }
+    return -1;
+  }
+
+
+
+  /// sorted値の位置kを含むグループ
+  ///
+  ///   @param[in] p  sorted値を持つ構造体
+  ///   @param[in] k  my_papi.v_sorted[]の位置
+  ///   @return  hwpc_output_group. 無い場合は -1
+  ///
+  static int hwpc_sorted_group(const pmlib_papi_chooser& p, int k)
+  {
+    for (int i=0; i<Max_hwpc_output_group; i++) {
+      if (p.sorted_number[i] > 0 && p.sorted_index[i] <= k && k < p.sorted_index[i]+p.sorted_number[i]) return i;
+    }
+    return -1;
+  }
+
+
+  /// ルーフラインレポートの演算量とメモリ転送量(全プロセスの平均値)を返す
+  ///
+  ///   @param[out] d_flop  浮動小数点演算量
+  ///   @param[out] d_byte  メモリ転送量(バイト)
+  ///   @param[out] c_flop  演算量の出典 'F':HWPC, 'f':ユーザ申告, '-':なし
+  ///   @param[out] c_byte  転送量の出典 'B':HWPC, 'b':ユーザ申告, '-':なし
+  ///
+  ///   @note  HWPCのFLOPS(またはVECTOR)グループのTotal_FP、BANDWIDTHグループの[Bytes]を
+  ///          計測している場合はそれを、そうでなければstop()の引数による申告値を用いる。
+  ///          gather()の後に呼び出す。
+  ///
+  void PerfWatch::getRooflineValues(double& d_flop, double& d_byte, char& c_flop, char& c_byte)
+  {
+	d_flop = d_byte = 0.0;
+	c_flop = c_byte = '-';
+	int i_flop = -1, i_byte = -1;
+	int n_sorted = my_papi.num_sorted;
+#ifdef USE_HWPC
+	if (m_sortedArrayHWPC != NULL && n_sorted > 0) {
+		if (hwpc_group.number[I_flops] > 0) {
+			i_flop = hwpc_sorted_position(my_papi, I_flops, "Total_FP");
+		} else if (hwpc_group.number[I_vector] > 0) {
+			i_flop = hwpc_sorted_position(my_papi, I_vector, "Total_FP");
+		}
+		if (hwpc_group.number[I_bandwidth] > 0) {
+			i_byte = hwpc_sorted_position(my_papi, I_bandwidth, "[Bytes]");
+		}
+	}
+#endif
+	if (i_flop >= 0) {
+		for (int i=0; i<num_process; i++) d_flop += m_sortedArrayHWPC[i*n_sorted + i_flop];
+		d_flop /= num_process;
+		c_flop = 'F';
+	} else if (m_roof[0] > 0.0) {
+		d_flop = m_roof[0];
+		c_flop = 'f';
+	}
+	if (i_byte >= 0) {
+		for (int i=0; i<num_process; i++) d_byte += m_sortedArrayHWPC[i*n_sorted + i_byte];
+		d_byte /= num_process;
+		c_byte = 'B';
+	} else if (m_roof[1] > 0.0) {
+		d_byte = m_roof[1];
+		c_byte = 'b';
+	}
+  }
+
 
   /// Allgather the process level HWPC event values for all processes in MPI_COMM_WORLD
   /// Calibrate some numbers to represent the process value as the sum of thread values
@@ -254,7 +436,7 @@ namespace pm_lib {
   ///
   void PerfWatch::gatherHWPC()
   {
-#ifdef USE_PAPI
+#ifdef USE_HWPC
 	int is_unit = statsSwitch();
 	if ( (is_unit == 0) || (is_unit == 1) ) {
 		return;
@@ -263,8 +445,14 @@ namespace pm_lib {
 
 	sortPapiCounterList ();
 
+	// the group chosen by statsSwitch(). The other multiplexed groups are reported as they are.
+	int i_group = hwpc_unit_group(is_unit);
+	double* v_group = my_papi.v_sorted + my_papi.sorted_index[i_group];
+	int n_group = my_papi.sorted_number[i_group];
+
 	double perf_rate=0.0;
 	if ( m_time > 0.0 ) { perf_rate = 1.0/m_time; }
+	int n_thread = get_team_size();	// the threads which actually ran the section
     // 0: user set bandwidth
     // 1: user set flop counts
     // 2: BANDWIDTH : HWPC measured data access bandwidth
@@ -273,43 +461,68 @@ namespace pm_lib {
     // 5: CACHE     : HWPC measured cache hit/miss
     // 6: CYCLE     : HWPC measured cycles, instructions
     // 7: LOADSTORE : HWPC measured load/store instruction type
+    // 8: CUSTOM    : HWPC measured user specified events
+    // 9: TOPDOWN   : HWPC measured top-down pipeline slots
+    //10: TLB       : HWPC measured data TLB misses and page walks
 	m_flop = 0.0;
 	m_percentage = 0.0;
 	if ( is_unit >= 0 && is_unit <= 1 ) {
 		m_flop = m_time * my_papi.v_sorted[my_papi.num_sorted-1] ;
 	} else 
 	if ( is_unit == 2 ) {
-		m_flop = my_papi.v_sorted[my_papi.num_sorted-1] ;		// BYTES
+		m_flop = v_group[n_group-1] ;		// BYTES
 	} else 
 	if ( is_unit == 3 ) {
-		m_flop = my_papi.v_sorted[my_papi.num_sorted-3] ;		// Total_FP
+		m_flop = v_group[n_group-3] ;		// Total_FP
 		// re-calculate Flops and peak % of the process values
-		my_papi.v_sorted[my_papi.num_sorted-1] = m_flop*perf_rate / (hwpc_group.corePERF*num_threads) * 100.0;	// peak %
+		v_group[n_group-1] = m_flop*perf_rate / (hwpc_group.corePERF*n_thread) * 100.0;	// peak %
 	} else 
 	if ( is_unit == 4 ) {
-		m_flop = my_papi.v_sorted[my_papi.num_sorted-3] ;		// Total_FP
-		m_percentage = my_papi.v_sorted[my_papi.num_sorted-1] ;	// [Vector %]
+		m_flop = v_group[n_group-3] ;		// Total_FP
+		m_percentage = v_group[n_group-1] ;	// [Vector %]
 
 	} else 
 	if ( is_unit == 5 ) {
-		m_flop = my_papi.v_sorted[0] + my_papi.v_sorted[1] ;	// load+store
+		m_flop = v_group[0] + v_group[1] ;	// load+store
 		if (hwpc_group.i_platform == 11 ) {
-			m_flop = my_papi.v_sorted[0] + my_papi.v_sorted[1] + my_papi.v_sorted[2] ;
+			m_flop = v_group[0] + v_group[1] + v_group[2] ;
 		}
-		m_percentage = my_papi.v_sorted[my_papi.num_sorted-1] ;	// [L*$ hit%]
+		m_percentage = v_group[n_group-1] ;	// [L*$ hit%]
 
 	} else
 	if ( is_unit == 6 ) {
-		my_papi.v_sorted[0] = my_papi.v_sorted[0] / num_threads;	// average cycles
-		m_flop = my_papi.v_sorted[1] ;								// TOT_INS
+		v_group[0] = v_group[0] / n_thread;	// average cycles
+		m_flop = v_group[1] ;								// TOT_INS
 
 	} else
 	if ( is_unit == 7 ) {
-		m_flop = my_papi.v_sorted[0] + my_papi.v_sorted[1] ;	// load+store
+		m_flop = v_group[0] + v_group[1] ;	// load+store
 		if (hwpc_group.i_platform == 11 ) {
-			m_flop = my_papi.v_sorted[0] + my_papi.v_sorted[1] + my_papi.v_sorted[2] ;
+			m_flop = v_group[0] + v_group[1] + v_group[2] ;
 		}
-		m_percentage = my_papi.v_sorted[my_papi.num_sorted-1] ;	// [Vector %]
+		m_percentage = v_group[n_group-1] ;	// [Vector %]
+	} else
+	if ( is_unit == 8 ) {
+		m_flop = v_group[0] ;							// the first event
+	} else
+	if ( is_unit == 9 ) {
+		m_flop = v_group[0] ;							// TOT_CYC
+		m_percentage = v_group[n_group-2] ;	// [Retire%]
+	} else
+	if ( is_unit == 10 ) {
+		m_flop = v_group[0] ;							// TOT_INS
+		m_percentage = v_group[n_group-2] ;	// [Miss/KI]
+	}
+
+	// the multiplexed FLOPS and CYCLE groups are calibrated in the same way
+	if ( is_unit != 3 && hwpc_group.number[I_flops] > 0 ) {
+		double* v_flops = my_papi.v_sorted + my_papi.sorted_index[I_flops];
+		int n_flops = my_papi.sorted_number[I_flops];
+		v_flops[n_flops-1] = v_flops[n_flops-3]*perf_rate / (hwpc_group.corePERF*n_thread) * 100.0;	// peak %
+	}
+	if ( is_unit != 6 && hwpc_group.number[I_cycle] > 0 ) {
+		double* v_cycle = my_papi.v_sorted + my_papi.sorted_index[I_cycle];
+		v_cycle[0] = v_cycle[0] / n_thread;	// average cycles
 	}
 
 	// The space is reserved only once as a fixed size array
@@ -347,7 +560,7 @@ namespace pm_lib {
   ///
   void PerfWatch::gatherThreadHWPC()
   {
-#ifdef USE_PAPI
+#ifdef USE_HWPC
 	int is_unit = statsSwitch();
 	if ( (is_unit == 0) || (is_unit == 1) ) {
 		return;
@@ -356,6 +569,11 @@ namespace pm_lib {
 
 	sortPapiCounterList ();
 
+	// the group chosen by statsSwitch(). The other multiplexed groups are reported as they are.
+	int i_group = hwpc_unit_group(is_unit);
+	double* v_group = my_papi.v_sorted + my_papi.sorted_index[i_group];
+	int n_group = my_papi.sorted_number[i_group];
+
 	double perf_rate=0.0;
 	if ( m_time > 0.0 ) { perf_rate = 1.0/m_time; }
     // 0: user set bandwidth
@@ -366,41 +584,55 @@ namespace pm_lib {
     // 5: CACHE     : HWPC measured cache hit/miss
     // 6: CYCLE     : HWPC measured cycles, instructions
     // 7: LOADSTORE : HWPC measured load/store instruction type
+    // 8: CUSTOM    : HWPC measured user specified events
+    // 9: TOPDOWN   : HWPC measured top-down pipeline slots
+    //10: TLB       : HWPC measured data TLB misses and page walks
 	m_flop = 0.0;
 	m_percentage = 0.0;
 	if ( is_unit >= 0 && is_unit <= 1 ) {
 		m_flop = m_time * my_papi.v_sorted[my_papi.num_sorted-1] ;
 	} else 
 	if ( is_unit == 2 ) {
-		m_flop = my_papi.v_sorted[my_papi.num_sorted-1] ;		// BYTES
+		m_flop = v_group[n_group-1] ;		// BYTES
 	} else 
 	if ( is_unit == 3 ) {
-		m_flop = my_papi.v_sorted[my_papi.num_sorted-3] ;		// Total_FP
-		my_papi.v_sorted[my_papi.num_sorted-1] = m_flop*perf_rate / hwpc_group.corePERF * 100.0;	// peak %
+		m_flop = v_group[n_group-3] ;		// Total_FP
+		v_group[n_group-1] = m_flop*perf_rate / hwpc_group.corePERF * 100.0;	// peak %
 	} else 
 	if ( is_unit == 4 ) {
-		m_flop = my_papi.v_sorted[my_papi.num_sorted-3] ;		// Total_FP
-		m_percentage = my_papi.v_sorted[my_papi.num_sorted-1] ;	// [Vector %]
+		m_flop = v_group[n_group-3] ;		// Total_FP
+		m_percentage = v_group[n_group-1] ;	// [Vector %]
 
 	} else 
 	if ( is_unit == 5 ) {
-		m_flop = my_papi.v_sorted[0] + my_papi.v_sorted[1] ;	// load+store
+		m_flop = v_group[0] + v_group[1] ;	// load+store
 		if (hwpc_group.i_platform == 11 ) {
-			m_flop = my_papi.v_sorted[0] + my_papi.v_sorted[1] + my_papi.v_sorted[2] ;
+			m_flop = v_group[0] + v_group[1] + v_group[2] ;
 		}
-		m_percentage = my_papi.v_sorted[my_papi.num_sorted-1] ;	// [L*$ hit%]
+		m_percentage = v_group[n_group-1] ;	// [L*$ hit%]
 
 	} else
 	if ( is_unit == 6 ) {
-		m_flop = my_papi.v_sorted[1] ;							// TOT_INS
+		m_flop = v_group[1] ;							// TOT_INS
 
 	} else
 	if ( is_unit == 7 ) {
-		m_flop = my_papi.v_sorted[0] + my_papi.v_sorted[1] ;	// load+store
+		m_flop = v_group[0] + v_group[1] ;	// load+store
 		if (hwpc_group.i_platform == 11 ) {
-			m_flop = my_papi.v_sorted[0] + my_papi.v_sorted[1] + my_papi.v_sorted[2] ;
+			m_flop = v_group[0] + v_group[1] + v_group[2] ;
 		}
-		m_percentage = my_papi.v_sorted[my_papi.num_sorted-1] ;	// [Vector %]
+		m_percentage = v_group[n_group-1] ;	// [Vector %]
+	} else
+	if ( is_unit == 8 ) {
+		m_flop = v_group[0] ;							// the first event
+	} else
+	if ( is_unit == 9 ) {
+		m_flop = v_group[0] ;							// TOT_CYC
+		m_percentage = v_group[n_group-2] ;	// [Retire%]
+	} else
+	if ( is_unit == 10 ) {
+		m_flop = v_group[0] ;							// TOT_INS
+		m_percentage = v_group[n_group-2] ;	// [Miss/KI]
 	}
 
 	// The space is reserved only once as a fixed size array
@@ -473,6 +705,75 @@ namespace pm_lib {
       if (MPI_Allgather(&m_count, 1, MPI_LONG, m_countArray, 1, MPI_LONG, MPI_COMM_WORLD) != MPI_SUCCESS) PM_Exit(0);
       if (MPI_Allreduce(&m_count, &m_count_sum, 1, MPI_LONG, MPI_SUM, MPI_COMM_WORLD) != MPI_SUCCESS) PM_Exit(0);
     }
+
+	// スレッド間の負荷バランス統計量. 最小値・最大値と最も遅いスレッドは全プロセス中で探し、
+	// 平均値は全プロセスの平均とする
+	if ( m_np == 1 ) {
+		m_thread_tmin = m_th_time[0];
+		m_thread_tav  = m_th_time[1];
+		m_thread_tmax = m_th_time[2];
+		m_thread_slowest = m_th_slowest;
+		m_rank_slowest = 0;
+	} else {
+		double th_stats[4] = { m_th_time[0], m_th_time[1], m_th_time[2], (double)m_th_slowest };
+		double* th_statsArray = new double[4*m_np];
+		if (MPI_Allgather(th_stats, 4, MPI_DOUBLE, th_statsArray, 4, MPI_DOUBLE, MPI_COMM_WORLD) != MPI_SUCCESS) PM_Exit(0);
+		m_thread_tmin = m_thread_tav = m_thread_tmax = 0.0;
+		m_rank_slowest = 0;
+		bool is_found = false;
+		for (int i=0; i<m_np; i++) {
+			m_thread_tav  += th_statsArray[4*i+1];
+			// the processes which did not run the section in parallel have no thread stats
+			if (th_statsArray[4*i+2] <= 0.0) continue;
+			if (!is_found || th_statsArray[4*i] < m_thread_tmin) m_thread_tmin = th_statsArray[4*i];
+			if (!is_found || th_statsArray[4*i+2] > m_thread_tmax) {
+				m_thread_tmax = th_statsArray[4*i+2];
+				m_rank_slowest = i;
+			}
+			is_found = true;
+		}
+		m_thread_tav  /= m_np;
+		m_thread_slowest = lround(th_statsArray[4*m_rank_slowest+3]);
+		delete[] th_statsArray;
+	}
+
+	// スレッドCPU時間の統計量. 全スレッド・全プロセスの合計値
+	if (level_CPU > 0) {
+		double cpu_stats[Max_cpu_stats+1];
+		for (int i=0; i<Max_cpu_stats; i++) {
+			cpu_stats[i] = 0.0;
+			for (int j=0; j<get_team_size(); j++) {
+				cpu_stats[i] += my_papi.th_cpu[j][i];
+			}
+		}
+		cpu_stats[Max_cpu_stats] = m_time;
+		if ( m_np == 1 ) {
+			for (int i=0; i<Max_cpu_stats; i++) m_cpu_stats[i] = cpu_stats[i];
+			m_cpu_time_all = m_time;
+		} else {
+			double cpu_sums[Max_cpu_stats+1] = { 0.0 };
+			if (MPI_Allreduce(cpu_stats, cpu_sums, Max_cpu_stats+1, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD) != MPI_SUCCESS) PM_Exit(0);
+			for (int i=0; i<Max_cpu_stats; i++) m_cpu_stats[i] = cpu_sums[i];
+			m_cpu_time_all = cpu_sums[Max_cpu_stats];
+		}
+	}
+
+	// ルーフライン用のユーザ申告値. 全スレッドの合計の全プロセス平均値
+	double roof_stats[Max_roof_stats];
+	for (int i=0; i<Max_roof_stats; i++) {
+		roof_stats[i] = 0.0;
+		for (int j=0; j<get_team_size(); j++) {
+			roof_stats[i] += my_papi.th_roof[j][i];
+		}
+	}
+	if ( m_np == 1 ) {
+		for (int i=0; i<Max_roof_stats; i++) m_roof[i] = roof_stats[i];
+	} else {
+		double roof_sums[Max_roof_stats] = { 0.0 };
+		if (MPI_Allreduce(roof_stats, roof_sums, Max_roof_stats, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD) != MPI_SUCCESS) PM_Exit(0);
+		for (int i=0; i<Max_roof_stats; i++) m_roof[i] = roof_sums[i] / m_np;
+	}
+
 	// Above arrays will be used by the subsequent routines, and should not be deleted here
 	// i.e. m_timeArray, m_flopArray, m_countArray
 
@@ -522,24 +823,46 @@ namespace pm_lib {
 
     int is_unit = statsSwitch();
 
+	int n_thread = get_team_size();
+
 	// In the following steps, "papi" shared structureis used as a scratch space.
 	// First, copy the master thread local "my_papi" to shared "papi"
 	if ( is_unit >= 2) { // PMlib HWPC counter mode
-		for (int j=0; j<num_threads; j++) {
+		for (int j=0; j<n_thread; j++) {
 			for (int i=0; i<my_papi.num_events; i++) {
 				papi.th_accumu[j][i] = my_papi.th_accumu[j][i];
+			}
+			for (int i=0; i<2*my_papi.num_events; i++) {
+				papi.th_mux[j][i] = my_papi.th_mux[j][i];
+			}
+			// th_v_sorted[j][0:2] hold count, time and flop even if num_events < 3
+			for (int i=0; i<std::max(my_papi.num_events, 3); i++) {
 				papi.th_v_sorted[j][i] = my_papi.th_v_sorted[j][i];
 			}
 		}
 
 	} else {	// PMlib user counter mode
-		for (int j=0; j<num_threads; j++) {
+		for (int j=0; j<n_thread; j++) {
 			for (int i=0; i<3; i++) {
 				papi.th_accumu[j][i] = my_papi.th_accumu[j][i];	// This is not necessary. Just keeping symmetry.
 				papi.th_v_sorted[j][i] = my_papi.th_v_sorted[j][i];
 			}
 		}
 	}
+	for (int j=0; j<n_thread; j++) {
+		for (int i=0; i<Max_cpu_stats; i++) {
+			papi.th_cpu[j][i] = my_papi.th_cpu[j][i];
+		}
+		for (int i=0; i<Max_place_stats; i++) {
+			papi.th_place[j][i] = my_papi.th_place[j][i];
+		}
+		for (int i=0; i<Max_roof_stats; i++) {
+			papi.th_roof[j][i] = my_papi.th_roof[j][i];
+		}
+		for (int i=0; i<Max_hwpc_output_group; i++) {
+			papi.th_group_time[j][i] = my_papi.th_group_time[j][i];
+		}
+	}
 	//  Note on the use of my_papi.th_v_sorted[][] array.
 	//  PerfWatch::stop() should have saved following variables (both for HWPC mode and USER mode)
 	//	my_papi.th_v_sorted[my_thread][0] = (double)m_count;	// call
@@ -576,7 +899,7 @@ namespace pm_lib {
 	if ( !(m_in_parallel) ) return;
 
 	int i_thread;
-	i_thread = omp_get_thread_num();
+	i_thread = std::min(flat_thread_num(), Max_nthreads-1);
 	if (i_thread != my_thread) {
 		// collection of thread values must be done by each thread instances
 		fprintf(stderr, "\n\t*** PMlib internal error <mergeParallelThread> [%s] my_thread:%d does not match OpenMP thread:%d\n ",
@@ -588,6 +911,11 @@ namespace pm_lib {
 	if ( is_unit >= 2) { // PMlib HWPC counter mode
 		for (int i=0; i<my_papi.num_events; i++) {
 			papi.th_accumu[my_thread][i] = my_papi.th_accumu[my_thread][i];
+		}
+		for (int i=0; i<2*my_papi.num_events; i++) {
+			papi.th_mux[my_thread][i] = my_papi.th_mux[my_thread][i];
+		}
+		for (int i=0; i<std::max(my_papi.num_events, 3); i++) {
 			papi.th_v_sorted[my_thread][i] = my_papi.th_v_sorted[my_thread][i];
 		}
 
@@ -596,6 +924,18 @@ namespace pm_lib {
 			papi.th_v_sorted[my_thread][i] = my_papi.th_v_sorted[my_thread][i];
 		}
 	}
+	for (int i=0; i<Max_cpu_stats; i++) {
+		papi.th_cpu[my_thread][i] = my_papi.th_cpu[my_thread][i];
+	}
+	for (int i=0; i<Max_place_stats; i++) {
+		papi.th_place[my_thread][i] = my_papi.th_place[my_thread][i];
+	}
+	for (int i=0; i<Max_roof_stats; i++) {
+		papi.th_roof[my_thread][i] = my_papi.th_roof[my_thread][i];
+	}
+	for (int i=0; i<Max_hwpc_output_group; i++) {
+		papi.th_group_time[my_thread][i] = my_papi.th_group_time[my_thread][i];
+	}
 
 	#ifdef DEBUG_PRINT_WATCH
 	if (my_rank == 0) {
@@ -650,12 +990,18 @@ namespace pm_lib {
 		// The thread stats should be merged after the thread has stopped.
 
     int is_unit = statsSwitch();
+	int n_thread = get_team_size();
 
 	if ( is_unit >= 2) { // PMlib HWPC counter mode
 
-		for (int j=0; j<num_threads; j++) {
+		for (int j=0; j<n_thread; j++) {
 			for (int i=0; i<my_papi.num_events; i++) {
 				my_papi.th_accumu[j][i] = papi.th_accumu[j][i] ;
+			}
+			for (int i=0; i<2*my_papi.num_events; i++) {
+				my_papi.th_mux[j][i] = papi.th_mux[j][i] ;
+			}
+			for (int i=0; i<std::max(my_papi.num_events, 3); i++) {
 				my_papi.th_v_sorted[j][i] = papi.th_v_sorted[j][i] ;
 			}
 		}
@@ -666,71 +1012,49 @@ namespace pm_lib {
 		//
 		for (int i=0; i<my_papi.num_events; i++) {
 			my_papi.accumu[i] = 0.0;
-			for (int j=0; j<num_threads; j++) {
+			for (int j=0; j<n_thread; j++) {
 				my_papi.accumu[i] += my_papi.th_accumu[j][i];
 			}
 		}
 
 		// Some events such as memory controller are outside compute cores, and their values are shared,
 		// i.e. their values should not be accumulated.
+		// The events of the socket or node scope count the same value on all the threads and
+		// on all the processes sharing the socket or node. Take one count and the share of this process.
+		for (int i=0; i<my_papi.num_events; i++) {
+			if (my_papi.scope[i] == I_scope_core) continue;
+			int np_share = (my_papi.scope[i] == I_scope_node) ? hwpc_group.np_node : hwpc_group.np_socket;
+			if (np_share < 1) np_share = 1;
+			my_papi.accumu[i] = my_papi.th_accumu[0][i] / np_share;
+		}
 
 		// Detect A64FX BANDWIDTH event whose counter values are counter per CMG, not separated per core
 		if ( ( is_unit == 2) && ( hwpc_group.i_platform == 21 ) ) {
 
-			int np_node;			//	the number of processes on this node
-			int my_rank_on_node;	// 	the local rank number of this process on this node
-
-			char* cp_env;
-			cp_env = std::getenv("PJM_PROC_BY_NODE");
-			if (cp_env == NULL) {
-				fprintf (stderr, "\n\t *** PMlib warning. BANDWIDTH option for A64FX is only supported on Fugaku.\n");
-				fprintf (stderr, "\t\t The environment variable PJM_PROC_BY_NODE is not set. \n");
-				fprintf (stderr, "\t\t The report will assume np_node(the number of processes per node) = 1. \n");
+			// the processes on this node and the local rank, detected by detectNodeLayout()
+			int np_node = hwpc_group.np_node;
+			int my_rank_on_node = hwpc_group.rank_on_node;
+			if (np_node < 1 || np_node > 48) {
+				fprintf (stderr, "\n\t *** PMlib warning. BANDWIDTH option for A64FX supports 1 <= np_node <= 48 processes per node,\n");
+				fprintf (stderr, "\t\t but %d processes are on the node. The report will assume np_node=1. \n", np_node);
 				np_node = 1;
-			} else {
-				np_node = atoi(cp_env);
-				if (np_node < 1 || np_node > 48) {
-				fprintf (stderr, "\n\t *** PMlib warning. BANDWIDTH option for A64FX is only supported on Fugaku.\n");
-					fprintf (stderr, "\t\t The number of processes per node should be 1 <= np_node <= 48,\n");
-					fprintf (stderr, "\t\t but the value is set as %d. \n", np_node);
-					fprintf (stderr, "\t\t The report will assume np_node=1. \n");
-					np_node = 1;
-				} else {
-					// np_node looks OK
-				}
-			}
-			cp_env = std::getenv("PLE_RANK_ON_NODE");
-			if (cp_env == NULL) {
-				// unable to obtain the rank number of this process
-				fprintf (stderr, "\n\t *** PMlib warning. The environment variable PLE_RANK_ON_NODE is not set. \n");
-				fprintf (stderr, "\t\t The report will assume there is only 1 process on this node. \n");
 				my_rank_on_node = 0;
-			} else {
-				my_rank_on_node = atoi(cp_env);
-				if (my_rank_on_node < 0 || my_rank_on_node > 47) {
-					fprintf (stderr, "\n\t *** PMlib warning. The value of PLE_RANK_ON_NODE should be 0 <= p <= 47.\n");
-					fprintf (stderr, "\t\t but the value is set as %d. \n", my_rank_on_node);
-					fprintf (stderr, "\t\t The report will assume my_rank_on_node=0. \n");
-					my_rank_on_node = 0;
-				} else {
-					//  my_rank_on_node looks OK
-				}
 			}
 			// by now, two important values are set as 1 <= np_node <= 48 and 0 <= my_rank_on_node <= 47
 			// The normal packed thread affinity is assumed. scattered affinity is not currently supported.
 			double share_ratio = 0.0;
 			if (np_node <= 4) {
-				int ncmg_proc = (num_threads-1)/12+1;		//	the number of occupied CMGs by this process
+				int ncmg_proc = (n_thread-1)/12+1;		//	the number of occupied CMGs by this process
 				for (int i=0; i<my_papi.num_events; i++) {
 					my_papi.accumu[i] = 0.0;
 					for (int k=0; k<ncmg_proc; k++) {
 						my_papi.accumu[i] += my_papi.th_accumu[12*k][i];
 					}
 				}
-				if (np_node == 3 && num_threads > 12) {
+				if (np_node == 3 && n_thread > 12) {
 					share_ratio = 1.0/3.0;
 					for (int i=0; i<my_papi.num_events; i++) {
-						my_papi.accumu[i] += my_papi.th_accumu[num_threads-1][i] * share_ratio;
+						my_papi.accumu[i] += my_papi.th_accumu[n_thread-1][i] * share_ratio;
 					}
 				}
 				#ifdef DEBUG_PRINT_PAPI_THREADS
@@ -758,13 +1082,32 @@ namespace pm_lib {
 
 
 	} else {	// PMlib user counter mode
-		for (int j=0; j<num_threads; j++) {
+		for (int j=0; j<n_thread; j++) {
 			for (int i=0; i<3; i++) {
 				my_papi.th_v_sorted[j][i] = papi.th_v_sorted[j][i] ;
 			}
 		}
 	}
 
+	for (int j=0; j<n_thread; j++) {
+		for (int i=0; i<Max_cpu_stats; i++) {
+			my_papi.th_cpu[j][i] = papi.th_cpu[j][i];
+			papi.th_cpu[j][i] = 0.0;
+		}
+		for (int i=0; i<Max_place_stats; i++) {
+			my_papi.th_place[j][i] = papi.th_place[j][i];
+			papi.th_place[j][i] = 0;
+		}
+		for (int i=0; i<Max_roof_stats; i++) {
+			my_papi.th_roof[j][i] = papi.th_roof[j][i];
+			papi.th_roof[j][i] = 0.0;
+		}
+		for (int i=0; i<Max_hwpc_output_group; i++) {
+			my_papi.th_group_time[j][i] = papi.th_group_time[j][i];
+			papi.th_group_time[j][i] = 0.0;
+		}
+	}
+
 	m_threads_merged = true;
 
 	double m_count_threads, m_time_threads, m_flop_threads;
@@ -773,7 +1116,7 @@ namespace pm_lib {
 	m_flop_threads  = 0.0;
 
 // 2021/9/2 Change the collective operations from max to summation
-	for (int j=0; j<num_threads; j++) {
+	for (int j=0; j<n_thread; j++) {
 		//	m_count_threads = std::max(m_count_threads, my_papi.th_v_sorted[j][0]);	// maximum counts among threads
 		//	m_time_threads = std::max(m_time_threads, my_papi.th_v_sorted[j][1]);	// longest time among threads
 		//	m_flop_threads += my_papi.th_v_sorted[j][2];		// total values of all threads
@@ -784,6 +1127,25 @@ namespace pm_lib {
 	m_count = lround(m_count_threads);
 	m_time = m_time_threads;
 	m_flop = m_flop_threads;
+	for (int i=0; i<Max_hwpc_output_group; i++) {
+		m_groupTime[i] = 0.0;
+		for (int j=0; j<n_thread; j++) {
+			m_groupTime[i] += my_papi.th_group_time[j][i];
+		}
+	}
+
+	// スレッド間の負荷バランス : 最小・平均・最大のスレッド時間と最も遅いスレッド
+	if (m_in_parallel) {
+		m_th_time[0] = my_papi.th_v_sorted[0][1];
+		m_th_time[2] = my_papi.th_v_sorted[0][1];
+		m_th_slowest = 0;
+		for (int j=1; j<n_thread; j++) {
+			double t = my_papi.th_v_sorted[j][1];
+			if (t < m_th_time[0]) m_th_time[0] = t;
+			if (t > m_th_time[2]) { m_th_time[2] = t; m_th_slowest = j; }
+		}
+		m_th_time[1] = m_time_threads / (double)n_thread;
+	}
 
 
 	#ifdef DEBUG_PRINT_PAPI_THREADS
@@ -795,13 +1157,13 @@ namespace pm_lib {
 			for (int i=0; i<my_papi.num_events; i++) {
 				fprintf(stderr, "\t [%s] : [%8s] my_papi.accumu[%d]=%llu \n",
 					m_label.c_str(), my_papi.s_name[i].c_str(), i, my_papi.accumu[i]);
-				for (int j=0; j<num_threads; j++) {
+				for (int j=0; j<n_thread; j++) {
 					fprintf(stderr, "\t\t my_papi.th_accumu[%d][%d]=%llu\n", j, i, my_papi.th_accumu[j][i]);
 				}
 			}
 		} else {	// ( is_unit == 0 | is_unit == 1) : PMlib user counter mode
     		fprintf(stderr, "\t\t [%s] user mode: my_thread=%d, m_flop=%e\n", m_label.c_str(), my_thread, m_flop);
-			for (int j=0; j<num_threads; j++) {
+			for (int j=0; j<n_thread; j++) {
 				fprintf (stderr, "\t my_papi.th_v_sorted[%d][0:2]: %e, %e, %e \n",
 					j, my_papi.th_v_sorted[j][0], my_papi.th_v_sorted[j][1], my_papi.th_v_sorted[j][2]);
 			}
@@ -814,14 +1176,14 @@ namespace pm_lib {
 // we should clean up "papi" after these steps.
 
 	if ( is_unit >= 2) { // PMlib HWPC counter mode
-		for (int j=0; j<num_threads; j++) {
+		for (int j=0; j<n_thread; j++) {
 			for (int i=0; i<my_papi.num_events; i++) {
 				papi.th_accumu[j][i] = 0;
 				papi.th_v_sorted[j][i] = 0.0;
 			}
 		}
 	} else {	// PMlib user counter mode
-		for (int j=0; j<num_threads; j++) {
+		for (int j=0; j<n_thread; j++) {
 			for (int i=0; i<3; i++) {
 				papi.th_accumu[j][i] = 0;
 				papi.th_v_sorted[j][i] = 0.0;
@@ -858,8 +1220,13 @@ namespace pm_lib {
 	m_threads_merged = true;
 #ifdef _OPENMP
 	m_in_parallel = omp_in_parallel();
-	my_thread = omp_get_thread_num();
+	my_thread = flat_thread_num();
 	m_threads_merged = false;
+	if (my_thread >= Max_nthreads) {
+		printError("setProperties", "[%s] thread %d exceeds Max_nthreads=%d. Its stats are merged into thread %d.\n",
+			label.c_str(), my_thread, Max_nthreads, Max_nthreads-1);
+		my_thread = Max_nthreads-1;
+	}
 #endif
 
 	if (!m_is_set) {
@@ -912,6 +1279,24 @@ namespace pm_lib {
     }
 #endif
 
+	// 環境変数PMLIB_CPU_STATS が指定された場合、スレッドCPU時間を測定する
+	// PMLIB_CPU_STATS = no(default) | yes | N (N回のstart/stop毎に1回測定)
+    level_CPU = 0;
+#ifndef _WIN32
+    {
+      char* cp_cpu = std::getenv("PMLIB_CPU_STATS");
+      if (cp_cpu != NULL) {
+        std::string s_cpu = cp_cpu;
+        std::transform(s_cpu.begin(), s_cpu.end(), s_cpu.begin(), toupper);
+        if ((s_cpu == "ON") || (s_cpu == "YES") ) {
+          level_CPU = 1;
+        } else if (atoi(cp_cpu) > 0) {
+          level_CPU = atoi(cp_cpu);
+        }
+      }
+    }
+#endif
+
 #ifdef DEBUG_PRINT_WATCH
     //	print the master process
     if (my_rank == 0) {
@@ -1022,6 +1407,137 @@ namespace pm_lib {
   }
 
 
+  /// 組み込みtrace出力(Chrome Trace Event形式)の初期化
+  ///
+  /// @note  環境変数 PMLIB_TRACE = off(default) | on | full
+  ///        環境変数 PMLIB_TRACE_FILE で出力ファイル名を指定する(default: pmlib_trace.json)
+  ///        環境変数 PMLIB_TRACE_FORMAT=binary の時は PMlib binary trace (default: pmlib_trace.pmt)
+  ///        環境変数 PMLIB_TRACE_BUFFER, PMLIB_TRACE_POLICY は pm_trace_initialize() を参照
+  ///
+  void PerfWatch::initializeTrace(void)
+  {
+    if (std::getenv("PMLIB_TRACE") == NULL) return;
+    if (pm_trace_level != 0) return;
+
+	// The time stamps are corrected to the clock of rank 0.
+	// The processes can not communicate if initialize() is called in a parallel region.
+	bool is_serial = true;
+#ifdef _OPENMP
+	is_serial = !omp_in_parallel();
+#endif
+	if (!is_serial) {
+		pm_trace_initialize(num_process, my_rank, getTime(), traceCounterName());
+		return;
+	}
+	double t_local, offset, error;
+	syncTraceClock(t_local, offset, error);
+	(void) MPI_Barrier(MPI_COMM_WORLD);
+	double baseT = getTime();
+	(void) MPI_Bcast(&baseT, 1, MPI_DOUBLE, 0, MPI_COMM_WORLD);
+    pm_trace_initialize(num_process, my_rank, baseT, traceCounterName());
+	pm_trace_clock(t_local, offset, error);
+	is_trace_clock_synced = true;
+  }
+
+
+  /// 組み込みtrace出力のファイルを書き出して終了する
+  ///
+  /// @note  全プロセスが呼び出す. 各プロセスがランク順に1つのファイルに追記する
+  ///
+  void PerfWatch::finalizeTrace(void)
+  {
+    if (pm_trace_level == 0) return;
+
+	// the second sample of the clock offset gives the drift
+	if (is_trace_clock_synced) {
+		double t_local, offset, error;
+		syncTraceClock(t_local, offset, error);
+		pm_trace_clock(t_local, offset, error);
+	}
+    pm_trace_finalize(traceCounterName());
+  }
+
+
+  /// ランク0の時計とのずれをCristianの方法で推定する
+  ///
+  ///   @param[out] t_local  推定に用いた往復の中央の自プロセスの時刻 [sec]
+  ///   @param[out] offset   ランク0の時刻 - 自プロセスの時刻 [sec]
+  ///   @param[out] error    推定誤差の上限. 最短の往復時間の1/2 [sec]
+  ///
+  ///   @note  全プロセスが呼び出す集団操作. ランク0が各プロセスと順に
+  ///          n_pingpong回の往復を行い、往復時間が最短の組を用いる
+  ///
+  void PerfWatch::syncTraceClock(double& t_local, double& offset, double& error)
+  {
+	t_local = getTime();
+	offset = 0.0;
+	error = 0.0;
+#ifndef DISABLE_MPI
+	const int n_pingpong = 10;
+	const int tag = 13;
+	if (my_rank == 0) {
+		for (int i=1; i<num_process; i++) {
+			for (int k=0; k<n_pingpong; k++) {
+				int i_dummy;
+				MPI_Recv(&i_dummy, 1, MPI_INT, i, tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+				double t_ref = getTime();
+				MPI_Send(&t_ref, 1, MPI_DOUBLE, i, tag, MPI_COMM_WORLD);
+			}
+		}
+	} else {
+		double rtt_min = 1.0e+30;
+		for (int k=0; k<n_pingpong; k++) {
+			double t_ref;
+			double t0 = getTime();
+			MPI_Send(&k, 1, MPI_INT, 0, tag, MPI_COMM_WORLD);
+			MPI_Recv(&t_ref, 1, MPI_DOUBLE, 0, tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+			double t1 = getTime();
+			if (t1 - t0 < rtt_min) {
+				rtt_min = t1 - t0;
+				t_local = 0.5 * (t0 + t1);
+				offset = t_ref - t_local;
+			}
+		}
+		error = 0.5 * rtt_min;
+	}
+#endif
+  }
+
+
+  /// flight recorder の直近の記録を自プロセスのファイルに書き出す
+  ///
+  /// @note  PMLIB_TRACE=flight:<秒> の時のみ有効. 他のプロセスとの同期は不要
+  ///
+  void PerfWatch::dumpTrace(void)
+  {
+    if (pm_trace_level == 0) return;
+    pm_trace_dump("api");
+  }
+
+
+  /// 組み込みtrace出力のcounter trackの名前
+  ///
+  ///   @return  ユーザ指定モードでは計算量の単位、HWPCモードでは
+  ///          statsSwitch()が選んだグループの最後の要素の名前
+  ///
+  std::string PerfWatch::traceCounterName(void)
+  {
+    std::string s_counter;
+    int is_unit = statsSwitch();
+	if ( is_unit == 0 || is_unit == 1 ) {
+		s_counter = "User defined rate [Flops or B/sec]";
+	} else if ( 2 <= is_unit && is_unit <= Max_hwpc_output_group ) {
+		int i_group = hwpc_unit_group(is_unit);
+		if (my_papi.sorted_number[i_group] == 0) {
+			sortPapiCounterList ();		// the names are set by the first sort
+		}
+		int i_last = my_papi.sorted_index[i_group] + my_papi.sorted_number[i_group] - 1;
+		s_counter = "HWPC " + ((i_last >= 0) ? my_papi.s_sorted[i_last] : "");
+	}
+	return s_counter;
+  }
+
+
   /// 測定区間のラベル情報をOTF に出力
   ///
   ///   @param[in] label     ラベル
@@ -1118,6 +1634,25 @@ namespace pm_lib {
     m_started = true;
     m_startTime = getTime();
 	m_threads_merged = false;
+#ifdef USE_HWPC
+	if (hwpc_group.n_multiplex > 1) readGroupClock(m_startTime, m_groupStart);
+#endif
+
+	m_cpu_sampled = (level_CPU > 0) && (m_count % level_CPU == 0);
+	if (m_cpu_sampled) {
+		// the serial section counts the worker threads of its parallel regions as well
+		readThreadCPU(m_cpuStart, !m_in_parallel);
+		readThreadPlace(m_placeStart[0], m_placeStart[1]);
+	}
+
+#ifdef _OPENMP
+	// The team size may change per phase by omp_set_num_threads() or by nested regions.
+	// Serial sections record the team size of the next parallel region.
+	int n_team = m_in_parallel ? flat_team_size() : omp_get_max_threads();
+	if (n_team > m_team_size) m_team_size = n_team;
+#else
+	m_team_size = 1;
+#endif
 
 	if ( m_in_parallel ) {
 		// The threads are active and running in parallel region
@@ -1127,6 +1662,11 @@ namespace pm_lib {
 		startSectionSerial();
 	}
 
+	// the counts of this start/stop pair are traced as the rate
+	if ( (pm_trace_level == 2 || level_OTF == 2) && statsSwitch() >= 2 ) {
+		sumThreadAccumu(m_traceStart);
+	}
+
 #ifdef USE_OTF
     if (level_OTF != 0) {
       int is_unit = statsSwitch();
@@ -1181,27 +1721,39 @@ namespace pm_lib {
 
     int is_unit = statsSwitch();
 	if ( is_unit >= 2) {
-#ifdef USE_PAPI
+#ifdef USE_HWPC
+	#if defined(USE_OMPT) && defined(_OPENMP)
+	pm_ompt_enter_internal();
+	#endif
 	#pragma omp parallel
 	{
 		//	parallel regionの全スレッドの処理
 		int i_thread = omp_get_thread_num();
-		struct pmlib_papi_chooser th_papi = my_papi;
+		long long th_values[Max_chooser_events];	// thread private counter values
 		int i_ret;
 
-		//	We call my_papi_bind_read() to preserve HWPC events for inclusive sections,
-		//	in stead of calling my_papi_bind_start() which clears out the event counters.
-		i_ret = my_papi_bind_read (th_papi.values, th_papi.num_events);
-		if ( i_ret != PAPI_OK ) {
-			fprintf(stderr, "*** error. <my_papi_bind_read> code: %d, thread:%d\n", i_ret, i_thread);
+		//	The threads joining the team for the first time are bound here.
+		bindHWPCthread();
+
+		//	We call hwpc_read() to preserve HWPC events for inclusive sections,
+		//	in stead of calling hwpc_backend->start() which clears out the event counters.
+		i_ret = hwpc_read (th_values, my_papi.num_events);
+		if ( i_ret != PM_HWPC_OK ) {
+			fprintf(stderr, "*** error. <hwpc read> code: %d, thread:%d\n", i_ret, i_thread);
 			//	PM_Exit(0);
 		}
 
+		if (i_thread < Max_nthreads) {
 		#pragma ivdep
 		for (int i=0; i<my_papi.num_events; i++) {
-			my_papi.th_values[i_thread][i] = th_papi.values[i];
+			my_papi.th_values[i_thread][i] = th_values[i];
 		}
+		}
+		readMuxCoverage(i_thread, false);
 	}	// end of #pragma omp parallel region
+	#if defined(USE_OMPT) && defined(_OPENMP)
+	pm_ompt_leave_internal();
+	#endif
 
 	#ifdef DEBUG_PRINT_PAPI_THREADS
 		if (my_rank == 0) {
@@ -1213,7 +1765,7 @@ namespace pm_lib {
 			}
 		}
 	#endif
-#endif // USE_PAPI
+#endif // USE_HWPC
 	} else {
 		;
 	}
@@ -1233,23 +1785,27 @@ namespace pm_lib {
 
     int is_unit = statsSwitch();
 	if ( is_unit >= 2) {
-#ifdef USE_PAPI
-	struct pmlib_papi_chooser th_papi = my_papi;
+#ifdef USE_HWPC
+	long long th_values[Max_chooser_events];	// thread private counter values
 	int i_ret;
 
-	//	we call my_papi_bind_read() to preserve HWPC events for inclusive sections in stead of
+	//	The threads joining the team for the first time are bound here.
+	bindHWPCthread();
+
+	//	we call hwpc_read() to preserve HWPC events for inclusive sections in stead of
 	//	calling my_papi_bind_start() which clears out the event counters.
-	i_ret = my_papi_bind_read (th_papi.values, th_papi.num_events);
-	if ( i_ret != PAPI_OK ) {
-		fprintf(stderr, "*** error. <my_papi_bind_read> code: %d, my_thread:%d\n", i_ret, my_thread);
+	i_ret = hwpc_read (th_values, my_papi.num_events);
+	if ( i_ret != PM_HWPC_OK ) {
+		fprintf(stderr, "*** error. <hwpc read> code: %d, my_thread:%d\n", i_ret, my_thread);
 		//	PM_Exit(0);
 	}
 
 	//	parallel regionの内側で呼ばれた場合は、my_threadはスレッドIDの値を持つ
 	#pragma ivdep
 	for (int i=0; i<my_papi.num_events; i++) {
-		my_papi.th_values[my_thread][i] = th_papi.values[i];
+		my_papi.th_values[my_thread][i] = th_values[i];
 	}
+	readMuxCoverage(my_thread, false);
 	#ifdef DEBUG_PRINT_PAPI_THREADS
 	//	#pragma omp critical
 	//	if (my_rank == 0) {
@@ -1259,7 +1815,7 @@ namespace pm_lib {
 	//		};	fprintf (stderr, "\n");
 	//	}
 	#endif
-#endif // USE_PAPI
+#endif // USE_HWPC
 	} else {
 		;
 	}
@@ -1278,7 +1834,7 @@ namespace pm_lib {
   ///          内部で自動計測するHWPC統計情報から計算量を決定決定する。\n
   ///          レポート出力する情報の選択方法はPerfMonitor::stop()の規則による。\n
   ///
-  void PerfWatch::stop(double flopPerTask, unsigned iterationCount)
+  void PerfWatch::stop(double flopPerTask, unsigned iterationCount, double bytePerTask)
   {
     if (!m_is_healthy) {
       printError("stop()",  "[%s] is marked Not healthy. Corrected. \n", m_label.c_str());
@@ -1297,6 +1853,44 @@ namespace pm_lib {
     m_time += m_stopTime - m_startTime;
     m_count++;
     m_started = false;
+#ifdef USE_HWPC
+	// the groups switched by setCounterGroup() count only a part of the time
+	if (hwpc_group.n_multiplex > 1) {
+		double clock[Max_hwpc_output_group];
+		readGroupClock(m_stopTime, clock);
+		for (int i=0; i<Max_hwpc_output_group; i++) m_groupTime[i] += clock[i] - m_groupStart[i];
+	}
+#endif
+
+	if (m_cpu_sampled) {
+		double cpu_now[Max_cpu_stats];
+		readThreadCPU(cpu_now, !m_in_parallel);
+		my_papi.th_cpu[my_thread][0] += cpu_now[0] - m_cpuStart[0];
+		my_papi.th_cpu[my_thread][1] += m_stopTime - m_startTime;
+		my_papi.th_cpu[my_thread][2] += cpu_now[2] - m_cpuStart[2];
+		my_papi.th_cpu[my_thread][3] += cpu_now[3] - m_cpuStart[3];
+		m_cpu_sampled = false;
+
+		int cpu, node;
+		readThreadPlace(cpu, node);
+		if (cpu >= 0 && m_placeStart[0] >= 0) {
+			int* place = my_papi.th_place[my_thread];
+			if (place[0] == 0) place[2] = place[3] = cpu;
+			place[2] = std::min(place[2], std::min(cpu, m_placeStart[0]));
+			place[3] = std::max(place[3], std::max(cpu, m_placeStart[0]));
+			place[0]++;
+			place[1] = cpu;
+			if (cpu != m_placeStart[0]) place[4]++;
+			place[5] = node;
+			if (node != m_placeStart[1]) place[6]++;
+		}
+	}
+
+	// the user provided values for the roofline report are kept in any mode
+	if (m_typeCalc == 1) {
+		my_papi.th_roof[my_thread][0] += flopPerTask * (double)iterationCount;
+	}
+	my_papi.th_roof[my_thread][1] += bytePerTask * (double)iterationCount;
 
 	if ( m_in_parallel ) {
 		// The threads are active and running in parallel region
@@ -1329,17 +1923,7 @@ namespace pm_lib {
 		my_otf_event_stop(my_rank, m_stopTime, m_id, is_unit, w);
 
 	} else if (level_OTF == 2) {
-		if ( (is_unit == 0) || (is_unit == 1) ) {
-			// ユーザが引数で指定した計算量/time(計算speed)
-    		w = (flopPerTask * (double)iterationCount) / (m_stopTime-m_startTime);
-		} else if ( (2 <= is_unit) && (is_unit <= Max_hwpc_output_group) ) {
-			// 自動計測されたHWPCイベントを分析した計算speed
-			sortPapiCounterList ();
-
-			// is_unitが2,3の時、v_sorted[]配列の最後の要素は速度の次元を持つ
-			// is_unitが4,5の時は...
-			w = my_papi.v_sorted[my_papi.num_sorted-1] ;
-		}
+		w = traceRate(flopPerTask, iterationCount);
 		my_otf_event_stop(my_rank, m_stopTime, m_id, is_unit, w);
 	}
 	#ifdef DEBUG_PRINT_OTF
@@ -1350,11 +1934,281 @@ namespace pm_lib {
 	#endif
 #endif	// end of #ifdef USE_OTF
 
-	// Remark: *.th_v_sorted[][] may have been overwritten by sortPapiCounterList() if level_OTF == 2.
+	if (pm_trace_level != 0) {
+		// the sections excluded by the trace filters get a negative id other than -1
+		if (m_trace_id == -1) m_trace_id = pm_trace_section(m_label);
+		if (m_trace_id >= 0) {
+			double v[Max_chooser_events + 2];
+			int n = (pm_trace_level == 2) ? traceValues(flopPerTask, iterationCount, v) : 0;
+			pm_trace_record(my_thread, m_trace_id, m_startTime, m_stopTime, v, n);
+		}
+	}
+
+	// Remark: *.th_v_sorted[][] may have been overwritten by sortPapiCounterList() if level_OTF == 2
+	// or pm_trace_level == 2.
 	// So save these values here.
 	my_papi.th_v_sorted[my_thread][0] = (double)m_count;
 	my_papi.th_v_sorted[my_thread][1] = m_time;
 	my_papi.th_v_sorted[my_thread][2] = m_flop;
+	for (int i=0; i<Max_hwpc_output_group; i++) {
+		my_papi.th_group_time[my_thread][i] = m_groupTime[i];
+	}
+  }
+
+
+  /// トレースに出力する測定区間の計算speed
+  ///
+  ///   @param[in] flopPerTask     測定区間の計算量(演算量Flopまたは通信量Byte)
+  ///   @param[in] iterationCount  計算量の乗数（反復回数）
+  ///
+  ///   @param[out] v_sorted       (省略可) HWPCモードでは今回のstart/stopのsorted値.
+  ///          m_traceGroup が1つのグループの時はそのグループの値だけが更新される
+  ///
+  ///   @return  ユーザ指定モードでは今回のstart/stopの計算量/time,
+  ///          HWPCモードではstatsSwitch()が選んだグループの最後の要素(速度など)
+  ///
+  ///   @note  stop()毎に呼ばれるので、出力するグループだけを sortPapiCounterList() で評価する
+  ///
+  double PerfWatch::traceRate(double flopPerTask, unsigned iterationCount, double* v_sorted)
+  {
+    int is_unit = statsSwitch();
+	double w = 0.0;
+	if ( (is_unit == 0) || (is_unit == 1) ) {
+		// ユーザが引数で指定した計算量/time(計算speed)
+		if (m_stopTime > m_startTime) {
+			w = (flopPerTask * (double)iterationCount) / (m_stopTime-m_startTime);
+		}
+	} else if ( (2 <= is_unit) && (is_unit <= Max_hwpc_output_group) ) {
+		// 自動計測されたHWPCイベントを分析した計算speed
+		// 今回のstart/stopのカウント数と時間で一時的に置き換えて分析する
+		long long v_accumu[Max_chooser_events];
+		double t_save = m_time;
+		double t_group[Max_hwpc_output_group];
+		sumThreadAccumu(v_accumu);
+		for (int i=0; i<my_papi.num_events; i++) {
+			long long v = v_accumu[i] - m_traceStart[i];
+			v_accumu[i] = my_papi.accumu[i];
+			my_papi.accumu[i] = v;
+		}
+		m_time = m_stopTime - m_startTime;
+		if (hwpc_group.n_multiplex > 1) {
+			readGroupClock(m_stopTime, t_group);
+			for (int i=0; i<Max_hwpc_output_group; i++) {
+				double t = t_group[i] - m_groupStart[i];
+				t_group[i] = m_groupTime[i];
+				m_groupTime[i] = t;
+			}
+		}
+		// is_unitが2,3の時、v_sorted[]配列の最後の要素は速度の次元を持つ
+		// 多重化時はstatsSwitch()が選んだグループの最後の要素
+		int i_group = hwpc_unit_group(is_unit);
+		sortPapiCounterList ((v_sorted == NULL) ? i_group : m_traceGroup);
+
+		w = my_papi.v_sorted[my_papi.sorted_index[i_group] + my_papi.sorted_number[i_group] - 1] ;
+		if (v_sorted != NULL) {
+			for (int i=0; i<my_papi.num_sorted; i++) v_sorted[i] = my_papi.v_sorted[i];
+		}
+
+		m_time = t_save;
+		if (hwpc_group.n_multiplex > 1) {
+			for (int i=0; i<Max_hwpc_output_group; i++) m_groupTime[i] = t_group[i];
+		}
+		for (int i=0; i<my_papi.num_events; i++) {
+			my_papi.accumu[i] = v_accumu[i];
+		}
+	}
+	return w;
+  }
+
+
+  /// 組み込みtraceのcounter trackに出力する値
+  ///
+  ///   @param[in] flopPerTask     測定区間の計算量(演算量Flopまたは通信量Byte)
+  ///   @param[in] iterationCount  計算量の乗数（反復回数）
+  ///   @param[out] v              PMLIB_TRACE_METRICSで選択された値
+  ///
+  ///   @return  v[]の要素数
+  ///
+  int PerfWatch::traceValues(double flopPerTask, unsigned iterationCount, double* v)
+  {
+	double v_sorted[Max_chooser_events];
+	if (!m_traceMetricsSet) selectTraceMetrics();
+	double w = traceRate(flopPerTask, iterationCount, v_sorted);
+
+	int n = m_traceMetrics.size();
+	for (int i=0; i<n; i++) {
+		int k = m_traceMetrics[i];
+		if (k == I_trace_rate) {
+			v[i] = w;
+		} else if (k == I_trace_count) {
+			v[i] = flopPerTask * (double)iterationCount;
+		} else {
+			v[i] = v_sorted[k];
+		}
+	}
+	return n;
+  }
+
+
+  /// 環境変数 PMLIB_TRACE_METRICS から測定区間のtraceに出力する値を選択する
+  ///
+  /// @note  PMLIB_TRACE_METRICS = [label=]metric,metric,...[;[label=]metric,...]
+  ///        label= のない指定は他の区間に適用される. metric は以下のいずれか (大文字小文字は区別しない)
+  ///        rate  : 従来のcounter track (default)
+  ///        count : ユーザが引数で指定した計算量 flopPerTask*iterationCount
+  ///        all   : count と全てのHWPC sorted値 (ユーザ指定モードでは count と rate)
+  ///        HWPC の sorted値の名前 (例 "[Flops]", "Mem [B/s]", "FP_OPS")
+  ///
+  void PerfWatch::selectTraceMetrics(void)
+  {
+	m_traceMetricsSet = true;
+	m_traceMetrics.clear();
+
+	// the list for this section, or the default list
+	std::string s_list = "rate";
+	bool is_labeled = false;
+	char* cp_env = std::getenv("PMLIB_TRACE_METRICS");
+	std::string s_env = (cp_env != NULL) ? cp_env : "";
+	size_t i0 = 0;
+	while (i0 <= s_env.size()) {
+		size_t i1 = s_env.find(';', i0);
+		if (i1 == std::string::npos) i1 = s_env.size();
+		std::string s_spec = s_env.substr(i0, i1 - i0);
+		size_t i_eq = s_spec.find('=');
+		if (i_eq == std::string::npos) {
+			if (!is_labeled && !s_spec.empty()) s_list = s_spec;
+		} else if (s_spec.substr(0, i_eq) == m_label) {
+			s_list = s_spec.substr(i_eq + 1);
+			is_labeled = true;
+		}
+		i0 = i1 + 1;
+	}
+
+	int is_unit = statsSwitch();
+	bool is_hwpc = (2 <= is_unit && is_unit <= Max_hwpc_output_group);
+	if (is_hwpc && my_papi.num_sorted == 0) {
+		sortPapiCounterList ();		// the names are set by the first sort
+	}
+	std::vector<std::string> names;
+	i0 = 0;
+	while (i0 <= s_list.size()) {
+		size_t i1 = s_list.find(',', i0);
+		if (i1 == std::string::npos) i1 = s_list.size();
+		std::string s = s_list.substr(i0, i1 - i0);
+		i0 = i1 + 1;
+		s.erase(0, s.find_first_not_of(" "));
+		s.erase(s.find_last_not_of(" ") + 1);
+		if (s.empty()) continue;
+		std::string s_upper = s;
+		for (size_t i=0; i<s_upper.size(); i++) s_upper[i] = toupper(s_upper[i]);
+
+		std::vector<int> codes;
+		if (s_upper == "RATE") {
+			codes.push_back(I_trace_rate);
+		} else if (s_upper == "COUNT") {
+			codes.push_back(I_trace_count);
+		} else if (s_upper == "ALL") {
+			codes.push_back(I_trace_count);
+			if (is_hwpc) {
+				for (int i=0; i<my_papi.num_sorted; i++) codes.push_back(i);
+			} else {
+				codes.push_back(I_trace_rate);
+			}
+		} else if (is_hwpc) {
+			for (int i=0; i<my_papi.num_sorted; i++) {
+				std::string s_name = my_papi.s_sorted[i];
+				for (size_t j=0; j<s_name.size(); j++) s_name[j] = toupper(s_name[j]);
+				if (s_name == s_upper) codes.push_back(i);
+			}
+		}
+		if (codes.empty() && my_rank == 0 && my_thread == 0) {
+			fprintf(stderr, "*** PMlib warning. PMLIB_TRACE_METRICS [%s] does not match any value of section [%s]\n",
+				s.c_str(), m_label.c_str());
+		}
+		for (size_t i=0; i<codes.size(); i++) {
+			int k = codes[i];
+			if (std::find(m_traceMetrics.begin(), m_traceMetrics.end(), k) != m_traceMetrics.end()) continue;
+			m_traceMetrics.push_back(k);
+			if (k == I_trace_rate) {
+				names.push_back(traceCounterName());
+			} else if (k == I_trace_count) {
+				names.push_back("User count [Flops or Bytes]");
+			} else {
+				names.push_back("HWPC " + my_papi.s_sorted[k]);
+			}
+		}
+	}
+	if (m_traceMetrics.empty()) {
+		m_traceMetrics.push_back(I_trace_rate);
+		names.push_back(traceCounterName());
+	}
+
+	// the group to be evaluated at each stop, if all the HWPC values belong to one group
+	m_traceGroup = -1;
+	if (is_hwpc) {
+		int i_rate = hwpc_unit_group(is_unit);
+		m_traceGroup = i_rate;
+		for (size_t i=0; i<m_traceMetrics.size(); i++) {
+			int k = m_traceMetrics[i];
+			int i_group = (k == I_trace_rate) ? i_rate : (k >= 0) ? hwpc_sorted_group(my_papi, k) : m_traceGroup;
+			if (i_group != m_traceGroup) {
+				// the rate is computed anyway, so the rate group is needed too
+				m_traceGroup = -1;
+				break;
+			}
+		}
+	}
+	pm_trace_metrics(m_trace_id, names);
+  }
+
+
+  /// HWPCイベントのスレッド別積算値の合計
+  ///
+  ///   @param[out] v  並列領域内の区間は自スレッドの値、それ以外は全スレッドの合計値
+  ///
+  void PerfWatch::sumThreadAccumu(long long* v)
+  {
+	for (int i=0; i<my_papi.num_events; i++) {
+		v[i] = 0;
+	}
+	int j0 = m_in_parallel ? my_thread : 0;
+	int j1 = m_in_parallel ? my_thread+1 : Max_nthreads;
+	for (int j=j0; j<j1; j++) {
+		for (int i=0; i<my_papi.num_events; i++) {
+			v[i] += my_papi.th_accumu[j][i];
+		}
+	}
+  }
+
+
+  /// 多重化されたHWPCイベントの enabled/running 時間を読み、区間の値として積算する
+  ///
+  ///   @param[in] i_thread  スレッド番号
+  ///   @param[in] is_stop  false: start時の値を保存する. true: start時からの差分を積算する
+  ///
+  ///   @note  hwpc_read() の直後に呼ぶ. backend が時間を知らない場合 (papi) は何もしない
+  ///
+  void PerfWatch::readMuxCoverage(int i_thread, bool is_stop)
+  {
+#ifdef USE_HWPC
+	if (hwpc_group.n_multiplex <= 1 || i_thread >= Max_nthreads) return;
+	double enabled[Max_chooser_events], running[Max_chooser_events];
+	if (hwpc_coverage (enabled, running, my_papi.num_events) != PM_HWPC_OK) return;
+
+	double* t_start = my_papi.th_mux_start[i_thread];
+	if (!is_stop) {
+		for (int i=0; i<my_papi.num_events; i++) {
+			t_start[2*i] = enabled[i];
+			t_start[2*i+1] = running[i];
+		}
+		return;
+	}
+	double* t_accumu = my_papi.th_mux[i_thread];
+	for (int i=0; i<my_papi.num_events; i++) {
+		t_accumu[2*i] += std::max(enabled[i] - t_start[2*i], 0.0);
+		t_accumu[2*i+1] += std::max(running[i] - t_start[2*i+1], 0.0);
+	}
+#endif
   }
 
 
@@ -1414,24 +2268,33 @@ namespace pm_lib {
 
     int is_unit = statsSwitch();
 	if ( is_unit >= 2) {
-#ifdef USE_PAPI
+#ifdef USE_HWPC
 	if (my_papi.num_events > 0) {
+	#if defined(USE_OMPT) && defined(_OPENMP)
+	pm_ompt_enter_internal();
+	#endif
 	#pragma omp parallel 
 	{
 		int i_thread = omp_get_thread_num();
-		struct pmlib_papi_chooser th_papi = my_papi;
+		long long th_values[Max_chooser_events];	// thread private counter values
 		int i_ret;
 
-		i_ret = my_papi_bind_read (th_papi.values, th_papi.num_events);
-		if ( i_ret != PAPI_OK ) {
-			printError("stop",  "<my_papi_bind_read> code: %d, i_thread:%d\n", i_ret, i_thread);
+		i_ret = hwpc_read (th_values, my_papi.num_events);
+		if ( i_ret != PM_HWPC_OK ) {
+			printError("stop",  "<hwpc read> code: %d, i_thread:%d\n", i_ret, i_thread);
 		}
 
+		if (i_thread < Max_nthreads) {
 		#pragma ivdep
 		for (int i=0; i<my_papi.num_events; i++) {
-			my_papi.th_accumu[i_thread][i] += (th_papi.values[i] - my_papi.th_values[i_thread][i]);
+			my_papi.th_accumu[i_thread][i] += (th_values[i] - my_papi.th_values[i_thread][i]);
+		}
 		}
+		readMuxCoverage(i_thread, true);
 	}	// end of #pragma omp parallel region
+	#if defined(USE_OMPT) && defined(_OPENMP)
+	pm_ompt_leave_internal();
+	#endif
 
 		#ifdef DEBUG_PRINT_PAPI_THREADS
 		if (my_rank == 0) {
@@ -1457,7 +2320,7 @@ namespace pm_lib {
 		}
 		#endif
 	}	// end of if (my_papi.num_events > 0) block
-#endif	// end of #ifdef USE_PAPI
+#endif	// end of #ifdef USE_HWPC
 	} else
 	if ( (is_unit == 0) || (is_unit == 1) ) {
 		// ユーザが引数で指定した計算量
@@ -1477,20 +2340,21 @@ namespace pm_lib {
 
     int is_unit = statsSwitch();
 	if ( is_unit >= 2) {
-#ifdef USE_PAPI
+#ifdef USE_HWPC
 	if (my_papi.num_events > 0) {
-	struct pmlib_papi_chooser th_papi = my_papi;
+	long long th_values[Max_chooser_events];	// thread private counter values
 	int i_ret;
 
-	i_ret = my_papi_bind_read (th_papi.values, th_papi.num_events);
-	if ( i_ret != PAPI_OK ) {
-		printError("stop",  "<my_papi_bind_read> code: %d, my_thread:%d\n", i_ret, my_thread);
+	i_ret = hwpc_read (th_values, my_papi.num_events);
+	if ( i_ret != PM_HWPC_OK ) {
+		printError("stop",  "<hwpc read> code: %d, my_thread:%d\n", i_ret, my_thread);
 	}
 
 	#pragma ivdep
 	for (int i=0; i<my_papi.num_events; i++) {
-		my_papi.th_accumu[my_thread][i] += (th_papi.values[i] - my_papi.th_values[my_thread][i]);
+		my_papi.th_accumu[my_thread][i] += (th_values[i] - my_papi.th_values[my_thread][i]);
 	}
+	readMuxCoverage(my_thread, true);
 
 	#ifdef DEBUG_PRINT_PAPI_THREADS
 	#pragma omp critical
@@ -1503,7 +2367,7 @@ namespace pm_lib {
 	}
 	#endif
 	}	// end of if (my_papi.num_events > 0) {
-#endif	// end of #ifdef USE_PAPI
+#endif	// end of #ifdef USE_HWPC
 	} else
 	if ( (is_unit == 0) || (is_unit == 1) ) {
 		// ユーザが引数で指定した計算量
@@ -1527,7 +2391,7 @@ namespace pm_lib {
     m_count = 0;
 	m_flop = 0.0;
 
-#ifdef USE_PAPI
+#ifdef USE_HWPC
 	if (my_papi.num_events > 0) {
 		for (int i=0; i<my_papi.num_events; i++) {
 			my_papi.accumu[i] = 0.0;
@@ -1535,16 +2399,55 @@ namespace pm_lib {
 		}
 	}
 	#ifdef _OPENMP
+			int n_thread = get_team_size();
+			#if defined(USE_OMPT) && defined(_OPENMP)
+			pm_ompt_enter_internal();
+			#endif
 			#pragma omp barrier
+			#if defined(USE_OMPT) && defined(_OPENMP)
+			pm_ompt_leave_internal();
+			#endif
 			#pragma omp master
-			for (int j=0; j<num_threads; j++) {
+			for (int j=0; j<n_thread; j++) {
 			for (int i=0; i<my_papi.num_events; i++) {
 				my_papi.th_accumu[j][i] = 0.0 ;
 				my_papi.th_v_sorted[j][i] = 0.0 ;
 			}
+			for (int i=0; i<2*my_papi.num_events; i++) {
+				my_papi.th_mux[j][i] = 0.0 ;
+			}
 			}
 	#endif
 #endif
+	m_team_size = 0;
+	m_th_time[0] = m_th_time[1] = m_th_time[2] = 0.0;
+	m_th_slowest = 0;
+
+	for (int j=0; j<Max_nthreads; j++) {
+		for (int i=0; i<Max_cpu_stats; i++) {
+			my_papi.th_cpu[j][i] = 0.0;
+		}
+		for (int i=0; i<Max_place_stats; i++) {
+			my_papi.th_place[j][i] = 0;
+		}
+		for (int i=0; i<Max_roof_stats; i++) {
+			my_papi.th_roof[j][i] = 0.0;
+		}
+		for (int i=0; i<Max_hwpc_output_group; i++) {
+			my_papi.th_group_time[j][i] = 0.0;
+		}
+	}
+	for (int i=0; i<Max_hwpc_output_group; i++) {
+		m_groupTime[i] = 0.0;
+	}
+	for (int i=0; i<Max_cpu_stats; i++) {
+		m_cpu_stats[i] = 0.0;
+	}
+	for (int i=0; i<Max_roof_stats; i++) {
+		m_roof[i] = 0.0;
+	}
+	m_cpu_time_all = 0.0;
+	m_cpu_sampled = false;
 
   }
 
@@ -1580,6 +2483,9 @@ namespace pm_lib {
     if (is_unit == 5) unit = "";		// 5: HWPC measured cache hit%
     if (is_unit == 6) unit = "";		// 6: HWPC measured instructions
     if (is_unit == 7) unit = "";		// 7: HWPC measured memory load/store (demand access, prefetch, writeback, streaming store)
+    if (is_unit == 8) unit = "";		// 8: CUSTOM    : HWPC measured user specified events
+    if (is_unit == 9) unit = "";		// 9: TOPDOWN   : HWPC measured top-down pipeline slots
+    if (is_unit == 10) unit = "";		//10: TLB       : HWPC measured data TLB misses and page walks
 
     long total_count = 0;
     for (int i = 0; i < m_np; i++) total_count += m_countArray[i];
@@ -1669,6 +2575,9 @@ namespace pm_lib {
     if (is_unit == 5) unit = "";		// 5: HWPC measured cache hit%
     if (is_unit == 6) unit = "";		// 6: HWPC measured instructions
     if (is_unit == 7) unit = "";		// 7: HWPC measured memory load/store (demand access, prefetch, writeback, streaming store)
+    if (is_unit == 8) unit = "";		// 8: CUSTOM    : HWPC measured user specified events
+    if (is_unit == 9) unit = "";		// 9: TOPDOWN   : HWPC measured top-down pipeline slots
+    if (is_unit == 10) unit = "";		//10: TLB       : HWPC measured data TLB misses and page walks
 
     long total_count = 0;
     for (int i = 0; i < m_np; i++) total_count += m_countArray[pp_ranks[i]];
@@ -1723,7 +2632,7 @@ namespace pm_lib {
   ///
   void PerfWatch::printBasicHWPCHeader(FILE* fp, int maxLabelLen)
   {
-#ifdef USE_PAPI
+#ifdef USE_HWPC
     if (my_papi.num_events == 0) return;
 
     std::string s;
@@ -1766,7 +2675,7 @@ namespace pm_lib {
   ///
   void PerfWatch::printBasicHWPCsums(FILE* fp, int maxLabelLen)
   {
-#ifdef USE_PAPI
+#ifdef USE_HWPC
     if (my_papi.num_events == 0) return;
     if ( m_count_sum == 0 ) return;
     if (my_rank != 0) return;
@@ -1814,7 +2723,7 @@ namespace pm_lib {
   ///
   void PerfWatch::printDetailHWPCsums(FILE* fp, std::string s_label)
   {
-#ifdef USE_PAPI
+#ifdef USE_HWPC
     if (my_papi.num_events == 0) return;
     //	if (!m_exclusive) return;
     if ( m_count_sum == 0 ) return;
@@ -1838,7 +2747,7 @@ namespace pm_lib {
   ///
   void PerfWatch::printGroupHWPCsums(FILE* fp, std::string s_label, MPI_Group p_group, int* pp_ranks)
   {
-#ifdef USE_PAPI
+#ifdef USE_HWPC
     if (my_papi.num_events == 0) return;
     //	if (!m_exclusive) return;
     if ( m_count_sum == 0 ) return;
@@ -1862,7 +2771,7 @@ namespace pm_lib {
 
 	fprintf(fp, "\tThe following cotroll variables are provided to PMlib as environment variable.\n");
 
-#ifdef USE_PAPI
+#ifdef USE_HWPC
 	cp_env = std::getenv("HWPC_CHOOSER");
 	if (cp_env == NULL) {
 		fprintf(fp, "\t\tHWPC_CHOOSER is not provided. USER is assumed.\n");
@@ -1874,14 +2783,23 @@ namespace pm_lib {
 			s_chooser == "CACHE" ||
 			s_chooser == "CYCLE" ||
 			s_chooser == "LOADSTORE" ||
-			s_chooser == "USER" ) {
+			s_chooser == "TOPDOWN" ||
+			s_chooser == "TLB" ||
+			s_chooser == "USER" ||
+			s_chooser.compare(0, 7, "CUSTOM:") == 0 ) {
 			fprintf(fp, "\t\tHWPC_CHOOSER=%s \n", s_chooser.c_str());
 			;
+		} else if (hwpc_group.n_multiplex > 1) {
+			fprintf(fp, "\t\tHWPC_CHOOSER=%s (%d groups multiplexed)\n",
+				hwpc_group.env_str_hwpc.c_str(), hwpc_group.n_multiplex);
 		} else {
 			;
 			//	fprintf(fp, "\tInvalid HWPC_CHOOSER value %s is ignored.\n", s_chooser.c_str());
 		}
 	}
+	if (hwpc_backend != NULL) {
+		fprintf(fp, "\t\tPMLIB_HWPC_BACKEND=%s (counter read: %s)\n", hwpc_backend->name, hwpc_backend->read_path());
+	}
 #endif
 
 #ifdef USE_POWER
@@ -1909,6 +2827,84 @@ namespace pm_lib {
     }
 #endif
 
+    cp_env = std::getenv("PMLIB_TRACE");
+    if (cp_env != NULL) {
+	  char* cp_file = std::getenv("PMLIB_TRACE_FILE");
+	  char* cp_format = std::getenv("PMLIB_TRACE_FORMAT");
+	  std::string s_format = (cp_format != NULL) ? cp_format : "";
+	  for (size_t i=0; i<s_format.size(); i++) s_format[i] = toupper(s_format[i]);
+	  bool is_binary = (s_format == "BINARY" || s_format == "PMT");
+	  fprintf(fp, "\t\tPMLIB_TRACE=%s (trace file: %s", cp_env,
+		(cp_file != NULL && cp_file[0] != '\0') ? cp_file : (is_binary ? "pmlib_trace.pmt" : "pmlib_trace.json"));
+	  if (is_binary) {
+		char* cp_compress = std::getenv("PMLIB_TRACE_COMPRESS");
+		fprintf(fp, ", PMLIB_TRACE_FORMAT=%s", cp_format);
+		if (cp_compress != NULL) fprintf(fp, ", PMLIB_TRACE_COMPRESS=%s", cp_compress);
+	  }
+	  char* cp_aggregate = std::getenv("PMLIB_TRACE_AGGREGATE");
+	  if (cp_aggregate != NULL) {
+		fprintf(fp, ", PMLIB_TRACE_AGGREGATE=%s", cp_aggregate);
+	  }
+	  if (pm_trace_dropped() > 0) {
+		fprintf(fp, ", %ld events dropped", pm_trace_dropped());
+	  }
+	  fprintf(fp, ")\n");
+    }
+
+#if defined(USE_OMPT) && defined(_OPENMP)
+    cp_env = std::getenv("PMLIB_OMPT");
+    if (cp_env != NULL) {
+	  fprintf(fp, "\t\tPMLIB_OMPT=%s (OMPT tool is %s)\n", cp_env,
+		pm_ompt_is_active() ? "active" : "not active");
+    }
+#endif
+
+    cp_env = std::getenv("PMLIB_CPU_STATS");
+    if (cp_env != NULL) {
+	  fprintf(fp, "\t\tPMLIB_CPU_STATS=%s \n", cp_env);
+    }
+
+    cp_env = std::getenv("PMLIB_SAMPLING");
+    if (cp_env != NULL) {
+	  if (pm_sampling_period > 0.0) {
+		fprintf(fp, "\t\tPMLIB_SAMPLING=%s (%.0f Hz. the sections are not timed)\n", cp_env, 1.0 / pm_sampling_period);
+	  } else {
+		fprintf(fp, "\t\tPMLIB_SAMPLING=%s (off)\n", cp_env);
+	  }
+    }
+
+    cp_env = std::getenv("PMLIB_ROOFLINE");
+    if (cp_env != NULL) {
+	  fprintf(fp, "\t\tPMLIB_ROOFLINE=%s \n", cp_env);
+    }
+
+    cp_env = std::getenv("PMLIB_CALIBRATE");
+    if (cp_env != NULL && !hwpc_group.calibration.empty()) {
+	  fprintf(fp, "\t\tPMLIB_CALIBRATE=%s (%s peak: %.2f GFlops per core, %.2f GB/s per process)\n", cp_env,
+		hwpc_group.calibration == "measured" ? "measured" : "file",
+		hwpc_group.measuredPERF * 1.0e-9, hwpc_group.measuredBW * 1.0e-9);
+    }
+
+	// スレッド配置に関する環境変数とプロセスが利用可能なCPU数(ランク0)
+	const char* s_affinity[] = { "OMP_PROC_BIND", "OMP_PLACES", "GOMP_CPU_AFFINITY", "KMP_AFFINITY" };
+	for (int i=0; i<4; i++) {
+		cp_env = std::getenv(s_affinity[i]);
+		if (cp_env != NULL) {
+			fprintf(fp, "\t\t%s=%s \n", s_affinity[i], cp_env);
+		}
+	}
+#if defined(__linux__) && defined(CPU_COUNT) && defined(_OPENMP)
+	cpu_set_t cpu_mask;
+	if (sched_getaffinity(0, sizeof(cpu_mask), &cpu_mask) == 0) {
+		int n_cpus = CPU_COUNT(&cpu_mask);
+		int n_threads = omp_get_max_threads();
+		fprintf(fp, "\t\t(rank 0 may run %d threads on %d CPUs)\n", n_threads, n_cpus);
+		if (n_threads > n_cpus) {
+			fprintf(fp, "\t\t*** PMlib warning. The threads are oversubscribed on the CPUs of rank 0.\n");
+		}
+	}
+#endif
+
 	cp_env = std::getenv("PMLIB_REPORT");
 	if (cp_env == NULL) {
 		fprintf(fp, "\t\tPMLIB_REPORT is not provided. BASIC is assumed.\n");
@@ -1953,16 +2949,48 @@ namespace pm_lib {
     if (is_unit == 5) unit = "";		// 5: CACHE     : HWPC measured cache hit/miss
     if (is_unit == 6) unit = "";		// 6: CYCLE     : HWPC measured cycles, instructions
     if (is_unit == 7) unit = "";		// 7: LOADSTORE : HWPC measured load/store instruction type
+    if (is_unit == 8) unit = "";		// 8: CUSTOM    : HWPC measured user specified events
+    if (is_unit == 9) unit = "";		// 9: TOPDOWN   : HWPC measured top-down pipeline slots
+    if (is_unit == 10) unit = "";		//10: TLB       : HWPC measured data TLB misses and page walks
+
+	// The team size of rank_ID is shown. gather() below is collective,
+	// so all the processes must loop over the same number of threads.
+	int n_thread = get_team_size();
+	int n_loop = n_thread;
+	if ( num_process > 1 ) {
+		if (MPI_Bcast(&n_thread, 1, MPI_INT, rank_ID, MPI_COMM_WORLD) != MPI_SUCCESS) PM_Exit(0);
+		int n_mine = get_team_size();
+		if (MPI_Allreduce(&n_mine, &n_loop, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD) != MPI_SUCCESS) PM_Exit(0);
+	}
+
+	// スレッドの配置. PMLIB_CPU_STATS 指定時にサンプリングされている
+	bool show_place = (level_CPU > 0);
+	int place[Max_nthreads][Max_place_stats];
+	int n_shared = 0;
+	if (show_place) {
+		for (int j=0; j<Max_nthreads; j++) {
+			for (int k=0; k<Max_place_stats; k++) {
+				place[j][k] = my_papi.th_place[j][k];
+			}
+		}
+		if ( num_process > 1 ) {
+			if (MPI_Bcast(place, Max_nthreads*Max_place_stats, MPI_INT, rank_ID, MPI_COMM_WORLD) != MPI_SUCCESS) PM_Exit(0);
+		}
+	}
 
 	if (my_rank == 0 && is_unit < 2) {
 	    //	fprintf(fp, "Label  %s%s\n", m_exclusive ? "" : "*", m_label.c_str());
-		fprintf(fp, "Section : %s%s%s\n", m_label.c_str(), m_exclusive? "":" (*)" , m_in_parallel? " (+)":"" );
+		fprintf(fp, "Section : %s%s%s  [team size: %d threads]\n",
+			m_label.c_str(), m_exclusive? "":" (*)" , m_in_parallel? " (+)":"", n_thread );
 
-    	fprintf(fp, "Thread  call  time[s]  t/tav[%%]  operations  performance\n");
+    	fprintf(fp, "Thread  call  time[s]  t/tav[%%]  operations  performance");
+		if (show_place) fprintf(fp, "     |  cpu [ min- max] node migr xnode");
+		fprintf(fp, "\n");
 	} else 
 	if (my_rank == 0 && is_unit >= 2) {
 	    //	fprintf(fp, "Label  %s%s\n", m_exclusive ? "" : "*", m_label.c_str());
-		fprintf(fp, "Section : %s%s%s\n", m_label.c_str(), m_exclusive? "":" (*)" , m_in_parallel? " (+)":"" );
+		fprintf(fp, "Section : %s%s%s  [team size: %d threads]\n",
+			m_label.c_str(), m_exclusive? "":" (*)" , m_in_parallel? " (+)":"", n_thread );
 
 		std::string s;
 		int ip, jp, kp;
@@ -1975,7 +3003,9 @@ namespace pm_lib {
 				s = my_papi.s_sorted[i].substr(kp+1);
 			}
 			fprintf (fp, " %10.10s", s.c_str() );
-		} fprintf (fp, "\n");
+		}
+		if (show_place) fprintf(fp, "  |  cpu [ min- max] node migr xnode");
+		fprintf (fp, "\n");
 	}
 
 	int i=rank_ID;
@@ -1986,10 +3016,17 @@ namespace pm_lib {
 	double save_m_time, save_m_flop, save_m_time_av;
 	save_m_count = m_count;
 	save_m_time  = m_time;
+	double save_m_groupTime[Max_hwpc_output_group];
+	for (int i=0; i<Max_hwpc_output_group; i++) save_m_groupTime[i] = m_groupTime[i];
 	save_m_flop  = m_flop;
 	save_m_time_av  = m_time_av;
 
-	for (int j=0; j<num_threads; j++)
+	// For the sections inside parallel region, the process time is the sum of thread times.
+	// t/tav shows the thread time relative to the average over the threads which actually ran.
+	double t_thread_av = m_time_av;
+	if (m_in_parallel && n_thread > 0) t_thread_av = m_time_av / (double)n_thread;
+
+	for (int j=0; j<n_loop; j++)
 	{
 		if ( !m_in_parallel && is_unit < 2 ) {
 
@@ -2019,16 +3056,15 @@ namespace pm_lib {
 		if (my_rank == 0) {
 			if (is_unit < 2) {
 			perf_rate = (m_countArray[i]==0) ? 0.0 : m_flopArray[i]/m_timeArray[i];
-			fprintf(fp, " %3d%8ld  %9.3e  %5.1f   %9.3e  %9.3e %s\n",
+			fprintf(fp, " %3d%8ld  %9.3e  %5.1f   %9.3e  %9.3e %-5s",
 				j,
 				m_countArray[i], // コール回数
 				m_timeArray[i],  // 時間
-				100*m_timeArray[i]/m_time_av, // 時間の比率
+				100*m_timeArray[i]/t_thread_av, // 時間の比率
 				m_flopArray[i],  // 演算数
 				perf_rate,       // スピード　Bytes/sec or Flops
 				unit.c_str()     // スピードの単位
 				);
-				(void) fflush(fp);
 			}
 			else 
 			if (is_unit >= 2) {
@@ -2036,19 +3072,36 @@ namespace pm_lib {
 				j,
 				m_countArray[i], // コール回数
 				m_timeArray[i],  // 時間
-				100*m_timeArray[i]/m_time_av);
+				100*m_timeArray[i]/t_thread_av);
 	
 				for(int n=0; n<my_papi.num_sorted; n++) {
 				fprintf (fp, "  %9.3e", fabs(m_sortedArrayHWPC[i*my_papi.num_sorted + n]));
 				}
-				fprintf (fp, "\n");
-				(void) fflush(fp);
 			}
+
+			// CPU番号, その範囲, NUMAノード, 区間内のCPU間・NUMAノード間のmigration回数
+			if (show_place && j < Max_nthreads && place[j][0] > 0) {
+				fprintf(fp, "  | %4d [%4d-%4d] %4d %4d %5d",
+					place[j][1], place[j][2], place[j][3], place[j][5], place[j][4], place[j][6]);
+				// 並列領域内で他のスレッドと同じCPUで実行していたか
+				bool shared = false;
+				for (int k=0; k<n_thread && m_in_parallel; k++) {
+					if (k != j && place[k][0] > 0 && place[k][1] == place[j][1]) shared = true;
+				}
+				if (shared) { fprintf(fp, " shared"); n_shared++; }
+			}
+			fprintf (fp, "\n");
+			(void) fflush(fp);
 		}	// end of if (my_rank == 0) 
 		#pragma omp barrier
-	}	// end of for (int j=0; j<num_threads; j++)
+	}	// end of for (int j=0; j<n_loop; j++)
+	if (my_rank == 0 && n_shared > 0) {
+		fprintf(fp, "\t*** PMlib warning. %d threads of this section ran on the same CPU as another thread.\n", n_shared);
+		fprintf(fp, "\t    The threads are oversubscribed or their affinity masks overlap.\n");
+	}
 	m_count = save_m_count;
 	m_time  = save_m_time;
+	for (int i=0; i<Max_hwpc_output_group; i++) m_groupTime[i] = save_m_groupTime[i];
 	m_flop  = save_m_flop;
 	m_time_av  = save_m_time_av;
   }
@@ -2076,6 +3129,10 @@ namespace pm_lib {
 		m_time = my_papi.th_v_sorted[0][1];
 		m_flop = my_papi.th_v_sorted[0][2];
 	}
+	int j_time = m_in_parallel ? i_thread : 0;
+	for (int i=0; i<Max_hwpc_output_group; i++) {
+		m_groupTime[i] = my_papi.th_group_time[j_time][i];
+	}
 
 #ifdef DEBUG_PRINT_PAPI_THREADS
 	//    if (my_rank == 0) {
@@ -2092,7 +3149,7 @@ namespace pm_lib {
   ///
   void PerfWatch::printHWPCLegend(FILE* fp)
   {
-#ifdef USE_PAPI
+#ifdef USE_HWPC
 	outputPapiCounterLegend (fp);
 #endif
 
@@ -2208,6 +3265,131 @@ namespace pm_lib {
   }
 
 
+  /// 呼び出したスレッド、またはプロセスの全スレッドのCPU時間とコンテキストスイッチ数を取得
+  ///
+  ///   @param[out] v  v[0]:CPU時間(user+system)[秒], v[1]:未使用,
+  ///                  v[2]:自発的コンテキストスイッチ数, v[3]:非自発的コンテキストスイッチ数
+  ///   @param[in] all_threads  true: プロセスの全スレッドの合計値, false: 呼び出したスレッドの値
+  ///
+  ///   @note CPU時間はCLOCK_THREAD_CPUTIME_ID (CLOCK_PROCESS_CPUTIME_ID)、
+  ///         コンテキストスイッチ数はgetrusage(RUSAGE_THREAD (RUSAGE_SELF))で得る。
+  ///         RUSAGE_THREADが無いシステムではプロセス全体の値となる。
+  ///         並列領域の外の区間はall_threads=trueで測定し、区間内の並列領域を
+  ///         実行したworkerスレッドの値を含める。
+  ///
+  void PerfWatch::readThreadCPU(double v[], bool all_threads)
+  {
+	v[0] = v[1] = v[2] = v[3] = 0.0;
+#ifndef _WIN32
+	struct rusage ru;
+	#if defined(RUSAGE_THREAD)
+	if (getrusage(all_threads ? RUSAGE_SELF : RUSAGE_THREAD, &ru) != 0) return;
+	#else
+	if (getrusage(RUSAGE_SELF, &ru) != 0) return;
+	#endif
+	v[2] = (double)ru.ru_nvcsw;
+	v[3] = (double)ru.ru_nivcsw;
+	#if defined(CLOCK_THREAD_CPUTIME_ID) && defined(CLOCK_PROCESS_CPUTIME_ID)
+	// ru_utime/ru_stime are too coarse for short sections. Use the CPU clocks.
+	struct timespec ts;
+	if (clock_gettime(all_threads ? CLOCK_PROCESS_CPUTIME_ID : CLOCK_THREAD_CPUTIME_ID, &ts) == 0) {
+		v[0] = (double)ts.tv_sec + (double)ts.tv_nsec * 1.0e-9;
+		return;
+	}
+	#endif
+	v[0] = (double)ru.ru_utime.tv_sec + (double)ru.ru_utime.tv_usec * 1.0e-6
+	     + (double)ru.ru_stime.tv_sec + (double)ru.ru_stime.tv_usec * 1.0e-6;
+#endif
+  }
+
+
+  /// 呼び出したスレッドが実行中のCPU番号とNUMAノード番号を取得
+  ///
+  ///   @param[out] cpu   CPU番号. 取得できない場合は-1
+  ///   @param[out] node  NUMAノード番号. 取得できない場合は-1
+  ///
+  void PerfWatch::readThreadPlace(int& cpu, int& node)
+  {
+	cpu = node = -1;
+#if defined(__linux__) && defined(SYS_getcpu)
+	unsigned int c, n;
+	if (syscall(SYS_getcpu, &c, &n, NULL) == 0) {
+		cpu = (int)c;
+		node = (int)n;
+	}
+#endif
+  }
+
+
+  /// ノードおよびソケットを共有するプロセス数を検出してhwpc_groupに保存する
+  ///
+  ///   @note  MPI_Comm_split_type(MPI_COMM_TYPE_SHARED)でノード内のプロセスを、
+  ///          さらに実行中CPUのphysical_package_idでソケット内のプロセスを数える。
+  ///          ノード・ソケット共有のHWPCイベントや電力の按分に用いる。
+  ///          並列領域内で呼ばれた場合は通信せず、1ノード1プロセスを仮定する。
+  ///
+  void PerfWatch::detectNodeLayout()
+  {
+	hwpc_group.n_nodes = 1;
+	hwpc_group.np_node = 1;
+	hwpc_group.rank_on_node = 0;
+	hwpc_group.np_socket = 1;
+
+	int i_socket = -1;
+	int cpu, node;
+	readThreadPlace(cpu, node);
+	if (cpu >= 0) {
+		char c_path[128];
+		sprintf(c_path, "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu);
+		FILE* fp = fopen(c_path, "r");
+		if (fp != NULL) {
+			if (fscanf(fp, "%d", &i_socket) != 1) i_socket = -1;
+			fclose(fp);
+		}
+	}
+
+	// The processes can not communicate if initialize() is called in a parallel region.
+	bool is_serial = true;
+#ifdef _OPENMP
+	is_serial = !omp_in_parallel();
+#endif
+	if (!is_serial) {
+#if !defined(DISABLE_MPI)
+		if (num_process > 1 && my_rank == 0) {
+			fprintf(stderr, "*** PMlib warning. <detectNodeLayout> PMlib is initialized in a parallel region. one process per node is assumed.\n");
+		}
+		hwpc_group.n_nodes = num_process;
+#endif
+		return;
+	}
+
+#if !defined(DISABLE_MPI) && defined(MPI_VERSION) && (MPI_VERSION >= 3)
+	MPI_Comm comm_node, comm_socket;
+	int iret = MPI_Comm_split_type(MPI_COMM_WORLD, MPI_COMM_TYPE_SHARED, my_rank, MPI_INFO_NULL, &comm_node);
+	if (iret != MPI_SUCCESS) {
+		printError("detectNodeLayout", "MPI_Comm_split_type failed. one process per node is assumed.\n");
+		return;
+	}
+	MPI_Comm_size(comm_node, &hwpc_group.np_node);
+	MPI_Comm_rank(comm_node, &hwpc_group.rank_on_node);
+
+	int i_leader = (hwpc_group.rank_on_node == 0) ? 1 : 0;
+	MPI_Allreduce(&i_leader, &hwpc_group.n_nodes, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+
+	// the processes whose socket is unknown are put together
+	MPI_Comm_split(comm_node, i_socket + 1, hwpc_group.rank_on_node, &comm_socket);
+	MPI_Comm_size(comm_socket, &hwpc_group.np_socket);
+	MPI_Comm_free(&comm_socket);
+	MPI_Comm_free(&comm_node);
+#elif !defined(DISABLE_MPI)
+	if (num_process > 1 && my_rank == 0) {
+		fprintf(stderr, "*** PMlib warning. <detectNodeLayout> MPI-3 is needed to detect the processes on a node. one process per node is assumed.\n");
+	}
+	hwpc_group.n_nodes = num_process;
+#endif
+  }
+
+
   void PerfWatch::read_cpu_clock_freq()
   {
 	cpu_clock_freq = 1.0;
@@ -40,6 +40,8 @@ typedef struct _HighLevelInfo
 void my_internal_cleanup_hl_info( HighLevelInfo * state );
 int my_internal_check_state( HighLevelInfo ** state );
 
+static int my_papi_multiplex = 0;	/* set by my_papi_set_multiplex() */
+
 
 void print_state_HighLevelInfo(HighLevelInfo *state)
 {
@@ -73,6 +75,18 @@ int my_papi_add_events ( int *events, int num_events)
 		return retval;
 	}
 
+	if ( my_papi_multiplex ) {
+		/* a multiplexed event set must be bound to the cpu component before PAPI_set_multiplex */
+		if (( retval = PAPI_assign_eventset_component( state->EventSet, 0 )) != PAPI_OK ) {
+			fprintf(stderr,"*** error. <my_papi_add_events> :: <PAPI_assign_eventset_component> retval=%d\n", retval);
+			return retval;
+		}
+		if (( retval = PAPI_set_multiplex( state->EventSet )) != PAPI_OK ) {
+			fprintf(stderr,"*** error. <my_papi_add_events> :: <PAPI_set_multiplex> retval=%d\n", retval);
+			return retval;
+		}
+	}
+
 	if (( retval = PAPI_add_events( state->EventSet, events, num_events )) != PAPI_OK ) {
 		fprintf(stderr,"*** error. <my_papi_add_events> :: <PAPI_add_events> state->EventSet=%d, num_events=%d\n", state->EventSet, num_events);
 
@@ -175,6 +189,20 @@ int my_papi_bind_read ( long long *values, int num_events)
 }
 
 
+int my_papi_set_multiplex ( void )
+{
+	int retval;
+
+	/* must be called after PAPI_library_init() and before my_papi_add_events() */
+	if ( ( retval = PAPI_multiplex_init() ) != PAPI_OK ) {
+		fprintf(stderr,"*** error. <my_papi_set_multiplex> :: <PAPI_multiplex_init> retval=%d\n", retval);
+		return retval;
+	}
+	my_papi_multiplex = 1;
+	return PAPI_OK;
+}
+
+
 void my_papi_name_to_code ( char* c_event, int* i_event)
 {
 	int retval;
@@ -0,0 +1,700 @@
+/*
+###################################################################################
+#
+# PMlib - Performance Monitor Library
+#
+# Copyright (c) 2010-2011 VCAD System Research Program, RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2012-2020 RIKEN Center for Computational Science(R-CCS), RIKEN.
+# All rights reserved.
+#
+# Copyright (c) 2016-2020 Research Institute for Information Technology(RIIT), Kyushu University.
+# All rights reserved.
+#
+###################################################################################
+ */
+
+//! @file   pmtrace.cpp
+//! @brief  pmtrace command. Converts the PMlib binary trace (PMLIB_TRACE_FORMAT=binary)
+//!         to the Chrome Trace Event format or CSV, and prints the summary of the sections.
+//!
+//!   pmtrace info    <file.pmt>              the processes and the blocks of the file
+//!   pmtrace summary <file.pmt>              statistics of the sections, the marks and the counters
+//!   pmtrace json    <file.pmt> [out.json]   for Perfetto UI or chrome://tracing
+//!   pmtrace csv     <file.pmt> [out.csv]    one line per event
+
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include "pmlib_trace_format.h"
+
+using namespace pm_lib;
+
+  /// the kinds of the labels. the same as pm_trace_kind of pmlib_trace.h
+enum { I_section = 0, I_mark, I_counter };
+
+
+  /// the 'P' block
+  ///
+struct trace_process {
+	int rank;
+	double baseT;
+	double tick;
+	int n_clock;
+	double clock_t[2];		// from baseT
+	double clock_offset[2];
+	double clock_error[2];
+	std::vector<std::string> labels;
+	std::vector< std::vector<std::string> > metrics;
+	std::vector<int> kinds;
+	std::string counter;
+
+	/// the time stamp corrected to the clock of rank 0 in micro seconds from baseT
+	double us (long long ticks) const
+	{
+		double t = ticks * tick;
+		double offset = 0.0;
+		if (n_clock == 1) {
+			offset = clock_offset[0];
+		} else if (n_clock == 2) {
+			offset = clock_offset[0] + (clock_offset[1] - clock_offset[0])
+				* (t - clock_t[0]) / (clock_t[1] - clock_t[0]);
+		}
+		return (t + offset) * 1.0e+6;
+	}
+
+	double drift (void) const
+	{
+		if (n_clock < 2) return 0.0;
+		return (clock_offset[1] - clock_offset[0]) / (clock_t[1] - clock_t[0]);
+	}
+
+	double uncertainty (void) const
+	{
+		double err = -1.0;
+		for (int i=0; i<n_clock; i++) err = std::max(err, clock_error[i]);
+		return err;
+	}
+
+	const std::string& label (int id) const
+	{
+		static const std::string unknown = "(unknown)";
+		return (id >= 0 && id < (int)labels.size()) ? labels[id] : unknown;
+	}
+
+	int kind (int id) const
+	{
+		return (id >= 0 && id < (int)kinds.size()) ? kinds[id] : I_section;
+	}
+};
+
+
+  /// the 'Z' block
+  ///
+struct trace_footer {
+	int n_procs;
+	int node;
+	int rank;
+	long dropped;
+	double uncertainty;
+	double drift;
+	std::string reason;
+	std::string counter;
+	std::string producer;
+};
+
+
+  /// The reader calls these functions in the order of the blocks in the file
+  ///
+class trace_visitor {
+public:
+	virtual ~trace_visitor () {}
+	virtual void info (int level, double window) {}
+	virtual void process (const trace_process& p) {}
+	virtual void block (char type, size_t bytes, size_t raw_bytes, size_t n_events) {}
+	virtual void event (const trace_process& p, int thread, int id, double ts, double dur,
+		const std::vector<double>& values) {}
+	virtual void short_events (const trace_process& p, int thread, double ts, int id, long count, double time) {}
+	virtual void footer (const trace_footer& z) {}
+};
+
+
+static bool read_varint (FILE* fp, unsigned long long& v)
+{
+	v = 0;
+	for (int shift=0; shift<64; shift+=7) {
+		int c = fgetc(fp);
+		if (c == EOF) return false;
+		v |= (unsigned long long)(c & 0x7f) << shift;
+		if ((c & 0x80) == 0) return true;
+	}
+	return false;
+}
+
+
+static bool decode_events (const trace_process& p, pmt_reader& r, trace_visitor& v)
+{
+	int thread = (int)r.varint();
+	size_t n_events = r.varint();
+	int codec = (r.p < r.end) ? *r.p++ : -1;
+	size_t n_raw = r.varint();
+	if (!r.ok) return false;
+
+	std::string s_raw;
+	const char* buf = (const char*)r.p;
+	size_t n_buf = r.end - r.p;
+	if (codec == pmt_lz) {
+		if (!pmt_lz_decompress(buf, n_buf, n_raw, s_raw)) return false;
+		buf = s_raw.data();
+		n_buf = s_raw.size();
+	} else if (codec != pmt_raw || n_buf != n_raw) {
+		return false;
+	}
+	v.block(pmt_events, r.end - r.p, n_raw, n_events);
+
+	pmt_reader e(buf, n_buf);
+	long long tick = 0;
+	std::vector<double> values;
+	for (size_t i=0; i<n_events && e.ok; i++) {
+		int id = (int)e.varint();
+		tick += e.zigzag();
+		long long duration = (long long)e.varint();
+		size_t n_values = e.varint();
+		if (!e.ok || n_values > (size_t)(e.end - e.p) / 8) return false;
+		values.resize(n_values);
+		for (size_t k=0; k<n_values; k++) values[k] = e.real();
+		double ts = p.us(tick);
+		v.event(p, thread, id, ts, p.us(tick + duration) - ts, values);
+	}
+	return e.ok;
+}
+
+
+  /// read the file and call the visitor. false if the file is broken
+  ///
+static bool read_trace (const char* filename, trace_visitor& v)
+{
+	FILE* fp = fopen(filename, "rb");
+	if (fp == NULL) {
+		fprintf(stderr, "pmtrace: can not open %s\n", filename);
+		return false;
+	}
+	char magic[sizeof(pmt_magic)];
+	unsigned long long version = 0;
+	if (fread(magic, 1, sizeof(magic), fp) != sizeof(magic) ||
+		memcmp(magic, pmt_magic, sizeof(magic)) != 0 || !read_varint(fp, version)) {
+		fprintf(stderr, "pmtrace: %s is not a PMlib binary trace\n", filename);
+		fclose(fp);
+		return false;
+	}
+	if (version != pmt_version) {
+		fprintf(stderr, "pmtrace: %s is version %llu. This pmtrace reads version %lu\n", filename, version, pmt_version);
+		fclose(fp);
+		return false;
+	}
+
+	trace_process p;
+	p.rank = -1;
+	bool ok = true;
+	std::vector<char> payload;
+	int c;
+	while (ok && (c = fgetc(fp)) != EOF) {
+		unsigned long long n = 0;
+		if (!read_varint(fp, n)) { ok = false; break; }
+		payload.resize(n + 1);
+		if (fread(&payload[0], 1, n, fp) != n) { ok = false; break; }
+		pmt_reader r(&payload[0], n);
+
+		switch (c) {
+		case pmt_info: {
+			int level = (int)r.varint();
+			double window = r.real();
+			if (r.ok) v.info(level, window);
+			break;
+		}
+		case pmt_process: {
+			p.rank = (int)r.varint();
+			p.baseT = r.real();
+			p.tick = r.real();
+			p.n_clock = std::min((int)r.varint(), 2);
+			for (int i=0; i<p.n_clock; i++) {
+				p.clock_t[i] = r.real();
+				p.clock_offset[i] = r.real();
+				p.clock_error[i] = r.real();
+			}
+			size_t n_labels = r.varint();
+			p.labels.clear();
+			p.metrics.clear();
+			for (size_t i=0; i<n_labels && r.ok; i++) {
+				p.labels.push_back(r.string());
+				p.metrics.push_back(std::vector<std::string>());
+				size_t n_names = r.varint();
+				for (size_t m=0; m<n_names && r.ok; m++) p.metrics[i].push_back(r.string());
+			}
+			p.counter = r.string();
+			p.kinds.clear();
+			if (r.ok && !r.done()) {		// the files without marks and counters may omit the kinds
+				size_t n_kinds = r.varint();
+				for (size_t i=0; i<n_kinds && r.ok; i++) p.kinds.push_back((int)r.varint());
+			}
+			if (r.ok) v.process(p);
+			v.block(pmt_process, n, n, 0);
+			break;
+		}
+		case pmt_events:
+			r.ok = (p.rank >= 0) && decode_events(p, r, v);
+			break;
+		case pmt_short: {
+			int thread = (int)r.varint();
+			double ts = p.us(r.zigzag());
+			size_t n_used = r.varint();
+			for (size_t i=0; i<n_used && r.ok; i++) {
+				int id = (int)r.varint();
+				long count = (long)r.varint();
+				double time = r.real();
+				if (r.ok) v.short_events(p, thread, ts, id, count, time);
+			}
+			v.block(pmt_short, n, n, 0);
+			break;
+		}
+		case pmt_footer: {
+			trace_footer z;
+			z.n_procs = (int)r.varint();
+			z.node = (int)r.zigzag();
+			z.rank = (int)r.zigzag();
+			z.dropped = (long)r.varint();
+			z.uncertainty = r.real();
+			z.drift = r.real();
+			z.reason = r.string();
+			z.counter = r.string();
+			z.producer = r.string();
+			if (r.ok) v.footer(z);
+			break;
+		}
+		default:
+			v.block((char)c, n, n, 0);	// unknown blocks of a later version are skipped
+			break;
+		}
+		ok = r.ok;
+	}
+	fclose(fp);
+	if (!ok) fprintf(stderr, "pmtrace: %s is broken or truncated\n", filename);
+	return ok;
+}
+
+
+static void write_json_string (FILE* fp, const std::string& s)
+{
+	fputc('"', fp);
+	for (size_t i=0; i<s.size(); i++) {
+		unsigned char c = s[i];
+		if (c == '"' || c == '\\') {
+			fputc('\\', fp);
+			fputc(c, fp);
+		} else if (c < 0x20) {
+			fprintf(fp, "\\u%04x", c);
+		} else {
+			fputc(c, fp);
+		}
+	}
+	fputc('"', fp);
+}
+
+
+  /// the same events as PMLIB_TRACE_FORMAT=json
+  ///
+class json_writer : public trace_visitor {
+public:
+	FILE* fp;
+	bool first;
+	bool closed;	// the footer has been written
+	int level;
+	double window;
+	int n_procs;
+	std::map<int, bool> named;		// threads of the current process
+
+	json_writer (FILE* f) : fp(f), first(true), closed(false), level(1), window(0.0), n_procs(0)
+	{
+		fprintf(fp, "{\"traceEvents\":[\n");
+	}
+
+	void separator (void)
+	{
+		if (!first) fprintf(fp, ",\n");
+		first = false;
+	}
+
+	virtual void info (int i_level, double d_window)
+	{
+		level = i_level;
+		window = d_window;
+	}
+
+	virtual void process (const trace_process& p)
+	{
+		n_procs++;
+		named.clear();
+		separator();
+		fprintf(fp, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"rank %d\"}}", p.rank, p.rank);
+		fprintf(fp, ",\n{\"name\":\"process_sort_index\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"sort_index\":%d}}", p.rank, p.rank);
+		if (p.n_clock > 0) {
+			fprintf(fp, ",\n{\"name\":\"process_labels\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"labels\":\"clock offset %.3f us, drift %.3f ppm, uncertainty %.3f us\"}}",
+				p.rank, p.clock_offset[p.n_clock-1] * 1.0e+6, p.drift() * 1.0e+6, p.uncertainty() * 1.0e+6);
+		}
+	}
+
+	virtual void event (const trace_process& p, int thread, int id, double ts, double dur,
+		const std::vector<double>& values)
+	{
+		if (!named[thread]) {
+			named[thread] = true;
+			fprintf(fp, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"thread %d\"}}",
+				p.rank, thread, thread);
+		}
+		const std::string& label = p.label(id);
+		if (p.kind(id) == I_mark) {
+			fprintf(fp, ",\n{\"name\":");
+			write_json_string(fp, label);
+			fprintf(fp, ",\"cat\":\"PMlib mark\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f}", p.rank, thread, ts);
+			return;
+		}
+		if (p.kind(id) == I_counter) {
+			fprintf(fp, ",\n{\"name\":");
+			write_json_string(fp, label);
+			fprintf(fp, ",\"cat\":\"PMlib counter\",\"ph\":\"C\",\"pid\":%d,\"ts\":%.3f,\"args\":{\"value\":%.17g}}",
+				p.rank, ts, values.empty() ? 0.0 : values[0]);
+			return;
+		}
+		fprintf(fp, ",\n{\"name\":");
+		write_json_string(fp, label);
+		fprintf(fp, ",\"cat\":\"PMlib\",\"ph\":\"X\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}", p.rank, thread, ts, dur);
+
+		for (size_t m=0; m<values.size(); m++) {
+			std::string s_track;
+			if (id < (int)p.metrics.size() && m < p.metrics[id].size()) {
+				s_track = p.metrics[id][m];
+			} else {
+				char c_value[32];
+				snprintf(c_value, sizeof(c_value), "value %d", (int)m);
+				s_track = (m == 0) ? p.counter : c_value;
+			}
+			char c_thread[32];
+			snprintf(c_thread, sizeof(c_thread), " thread %d", thread);
+			s_track += c_thread;
+			for (int k=0; k<2; k++) {
+				fprintf(fp, ",\n{\"name\":");
+				write_json_string(fp, s_track);
+				fprintf(fp, ",\"ph\":\"C\",\"pid\":%d,\"ts\":%.3f,\"args\":{", p.rank, (k == 0) ? ts : ts + dur);
+				write_json_string(fp, label);
+				fprintf(fp, ":%.17g}}", (k == 0) ? values[m] : 0.0);
+			}
+		}
+	}
+
+	virtual void short_events (const trace_process& p, int thread, double ts, int id, long count, double time)
+	{
+		fprintf(fp, ",\n{\"name\":\"short sections\",\"cat\":\"PMlib\",\"ph\":\"i\",\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"args\":{",
+			p.rank, thread, ts);
+		write_json_string(fp, p.label(id));
+		fprintf(fp, ":{\"count\":%ld,\"time_us\":%.3f}}}", count, time * 1.0e+6);
+	}
+
+	virtual void footer (const trace_footer& z)
+	{
+		fprintf(fp, "\n],\n\"displayTimeUnit\":\"ns\",\n\"otherData\":{\"producer\":");
+		write_json_string(fp, z.producer);
+		fprintf(fp, ",\"processes\":%d,\"dropped\":%ld,", z.n_procs, z.dropped);
+		if (z.node >= 0) fprintf(fp, "\"node\":%d,", z.node);
+		if (z.rank >= 0) fprintf(fp, "\"rank\":%d,", z.rank);
+		if (!z.reason.empty()) {
+			fprintf(fp, "\"reason\":");
+			write_json_string(fp, z.reason);
+			fprintf(fp, ",\"window\":%g,", window);
+		}
+		if (z.uncertainty < 0.0) {
+			fprintf(fp, "\"clock\":{\"reference\":\"none\"},");
+		} else {
+			fprintf(fp, "\"clock\":{\"reference\":\"rank 0\",\"uncertainty_us\":%.3f,\"max_drift_ppm\":%.3f},",
+				z.uncertainty * 1.0e+6, z.drift * 1.0e+6);
+		}
+		fprintf(fp, "\"counter\":");
+		write_json_string(fp, z.counter);
+		fprintf(fp, ",\"converter\":\"pmtrace\"}}\n");
+		closed = true;
+	}
+};
+
+
+class csv_writer : public trace_visitor {
+public:
+	FILE* fp;
+
+	csv_writer (FILE* f) : fp(f)
+	{
+		fprintf(fp, "rank,thread,kind,name,start_us,duration_us,values\n");
+	}
+
+	virtual void event (const trace_process& p, int thread, int id, double ts, double dur,
+		const std::vector<double>& values)
+	{
+		const std::string& label = p.label(id);
+		static const char* kind_names[] = { "section", "mark", "counter" };
+		int kind = p.kind(id);
+		fprintf(fp, "%d,%d,%s,", p.rank, thread, (kind >= 0 && kind <= I_counter) ? kind_names[kind] : "unknown");
+		if (label.find_first_of(",\"\n") == std::string::npos) {
+			fputs(label.c_str(), fp);
+		} else {
+			fputc('"', fp);
+			for (size_t i=0; i<label.size(); i++) {
+				if (label[i] == '"') fputc('"', fp);
+				fputc(label[i], fp);
+			}
+			fputc('"', fp);
+		}
+		fprintf(fp, ",%.3f,%.3f", ts, dur);
+		for (size_t m=0; m<values.size(); m++) fprintf(fp, ",%.17g", values[m]);
+		fputc('\n', fp);
+	}
+};
+
+
+class info_writer : public trace_visitor {
+public:
+	int n_procs;
+	std::map<char, size_t> bytes;
+	size_t n_events;
+	size_t raw_bytes;
+
+	info_writer () : n_procs(0), n_events(0), raw_bytes(0) {}
+
+	virtual void info (int level, double window)
+	{
+		printf("level      : %s\n", (level == 2) ? "full" : "on");
+		if (window > 0.0) printf("flight     : %g seconds\n", window);
+	}
+
+	virtual void process (const trace_process& p)
+	{
+		n_procs++;
+		printf("rank %6d : %d sections", p.rank, (int)p.labels.size());
+		if (p.n_clock > 0) {
+			printf(", clock offset %.3f us, drift %.3f ppm, uncertainty %.3f us",
+				p.clock_offset[p.n_clock-1] * 1.0e+6, p.drift() * 1.0e+6, p.uncertainty() * 1.0e+6);
+		}
+		printf("\n");
+	}
+
+	virtual void block (char type, size_t n_bytes, size_t n_raw, size_t n)
+	{
+		bytes[type] += n_bytes;
+		if (type == pmt_events) {
+			raw_bytes += n_raw;
+			n_events += n;
+		}
+	}
+
+	virtual void footer (const trace_footer& z)
+	{
+		printf("producer   : %s\n", z.producer.c_str());
+		printf("processes  : %d", z.n_procs);
+		if (z.node >= 0) printf(" on node %d", z.node);
+		printf("\n");
+		if (!z.reason.empty()) printf("reason     : %s\n", z.reason.c_str());
+		printf("dropped    : %ld events\n", z.dropped);
+		if (z.uncertainty >= 0.0) {
+			printf("clock      : uncertainty %.3f us, max drift %.3f ppm\n", z.uncertainty * 1.0e+6, z.drift * 1.0e+6);
+		}
+	}
+
+	void print_total (void)
+	{
+		size_t n_event_bytes = bytes[pmt_events];
+		printf("events     : %lu in %lu bytes", (unsigned long)n_events, (unsigned long)n_event_bytes);
+		if (n_events > 0) printf(", %.2f bytes/event", (double)n_event_bytes / n_events);
+		if (n_event_bytes < raw_bytes) printf(", compressed from %lu bytes", (unsigned long)raw_bytes);
+		printf("\n");
+		printf("metadata   : %lu bytes\n", (unsigned long)(bytes[pmt_process] + bytes[pmt_short]));
+	}
+};
+
+
+class summary_writer : public trace_visitor {
+public:
+	struct section_stat {
+		long count;
+		double sum;
+		double sum2;
+		double min;
+		double max;
+		long n_short;
+		double t_short;
+		std::map<int, double> rank_sum;
+		section_stat () : count(0), sum(0.0), sum2(0.0), min(HUGE_VAL), max(0.0), n_short(0), t_short(0.0) {}
+	};
+	/// the marks and the counters
+	struct value_stat {
+		long count;
+		double sum;
+		double min;
+		double max;
+		value_stat () : count(0), sum(0.0), min(HUGE_VAL), max(-HUGE_VAL) {}
+	};
+	std::map<std::string, section_stat> stats;
+	std::map<std::string, value_stat> marks;
+	std::map<std::string, value_stat> counters;
+	int n_procs;
+
+	summary_writer () : n_procs(0) {}
+
+	virtual void process (const trace_process& p) { n_procs++; }
+
+	virtual void event (const trace_process& p, int thread, int id, double ts, double dur,
+		const std::vector<double>& values)
+	{
+		int kind = p.kind(id);
+		if (kind == I_mark || kind == I_counter) {
+			value_stat& c = (kind == I_mark) ? marks[p.label(id)] : counters[p.label(id)];
+			double x = values.empty() ? 0.0 : values[0];
+			c.count++;
+			c.sum += x;
+			c.min = std::min(c.min, x);
+			c.max = std::max(c.max, x);
+			return;
+		}
+		section_stat& s = stats[p.label(id)];
+		s.count++;
+		s.sum += dur;
+		s.sum2 += dur * dur;
+		s.min = std::min(s.min, dur);
+		s.max = std::max(s.max, dur);
+		s.rank_sum[p.rank] += dur;
+	}
+
+	virtual void short_events (const trace_process& p, int thread, double ts, int id, long count, double time)
+	{
+		section_stat& s = stats[p.label(id)];
+		s.n_short += count;
+		s.t_short += time * 1.0e+6;
+	}
+
+	static bool by_total (const std::pair<std::string, const section_stat*>& a,
+		const std::pair<std::string, const section_stat*>& b)
+	{
+		return (a.second->sum + a.second->t_short) > (b.second->sum + b.second->t_short);
+	}
+
+	void print (void)
+	{
+		std::vector< std::pair<std::string, const section_stat*> > v;
+		for (std::map<std::string, section_stat>::const_iterator it=stats.begin(); it!=stats.end(); ++it) {
+			v.push_back(std::make_pair(it->first, &it->second));
+		}
+		std::sort(v.begin(), v.end(), by_total);
+
+		size_t n_width = 7;
+		for (size_t i=0; i<v.size(); i++) n_width = std::max(n_width, v[i].first.size());
+		printf("%d processes. The times are the sums over the processes and the threads.\n", n_procs);
+		printf("max/avg is the imbalance of the time per rank.\n\n");
+		printf("%-*s %10s %12s %12s %12s %12s %12s %8s %10s\n", (int)n_width, "Section",
+			"call", "total[s]", "mean[us]", "min[us]", "max[us]", "sdev[us]", "max/avg", "short");
+		for (size_t i=0; i<v.size(); i++) {
+			const section_stat& s = *v[i].second;
+			double mean = (s.count > 0) ? s.sum / s.count : 0.0;
+			double var = (s.count > 1) ? (s.sum2 - s.sum * mean) / (s.count - 1) : 0.0;
+			double r_max = 0.0, r_sum = 0.0;
+			for (std::map<int, double>::const_iterator it=s.rank_sum.begin(); it!=s.rank_sum.end(); ++it) {
+				r_max = std::max(r_max, it->second);
+				r_sum += it->second;
+			}
+			double imbalance = (r_sum > 0.0) ? r_max / (r_sum / s.rank_sum.size()) : 0.0;
+			printf("%-*s %10ld %12.6f %12.3f %12.3f %12.3f %12.3f %8.3f %10ld\n", (int)n_width, v[i].first.c_str(),
+				s.count, (s.sum + s.t_short) * 1.0e-6, mean, (s.count > 0) ? s.min : 0.0, s.max,
+				sqrt(std::max(var, 0.0)), imbalance, s.n_short);
+		}
+
+		if (!marks.empty()) {
+			n_width = 7;
+			for (std::map<std::string, value_stat>::const_iterator it=marks.begin(); it!=marks.end(); ++it) {
+				n_width = std::max(n_width, it->first.size());
+			}
+			printf("\n%-*s %10s\n", (int)n_width, "Mark", "count");
+			for (std::map<std::string, value_stat>::const_iterator it=marks.begin(); it!=marks.end(); ++it) {
+				printf("%-*s %10ld\n", (int)n_width, it->first.c_str(), it->second.count);
+			}
+		}
+		if (!counters.empty()) {
+			n_width = 7;
+			for (std::map<std::string, value_stat>::const_iterator it=counters.begin(); it!=counters.end(); ++it) {
+				n_width = std::max(n_width, it->first.size());
+			}
+			printf("\n%-*s %10s %14s %14s %14s\n", (int)n_width, "Counter", "samples", "min", "avg", "max");
+			for (std::map<std::string, value_stat>::const_iterator it=counters.begin(); it!=counters.end(); ++it) {
+				const value_stat& c = it->second;
+				printf("%-*s %10ld %14.6e %14.6e %14.6e\n", (int)n_width, it->first.c_str(),
+					c.count, c.min, c.sum / c.count, c.max);
+			}
+		}
+	}
+};
+
+
+static void usage (void)
+{
+	fprintf(stderr,
+		"usage: pmtrace <command> <file.pmt> [output]\n"
+		"  info     the processes and the blocks of the file\n"
+		"  summary  statistics of the sections, the marks and the counters\n"
+		"  json     convert to the Chrome Trace Event format (Perfetto UI, chrome://tracing)\n"
+		"  csv      convert to CSV, one line per event\n"
+		"The output of json and csv is written to stdout if it is omitted.\n");
+}
+
+
+int main (int argc, char** argv)
+{
+	if (argc < 3) {
+		usage();
+		return 1;
+	}
+	std::string s_cmd = argv[1];
+	const char* filename = argv[2];
+	bool ok;
+
+	if (s_cmd == "info") {
+		info_writer v;
+		ok = read_trace(filename, v);
+		v.print_total();
+	} else if (s_cmd == "summary") {
+		summary_writer v;
+		ok = read_trace(filename, v);
+		v.print();
+	} else if (s_cmd == "json" || s_cmd == "csv") {
+		FILE* fp = stdout;
+		if (argc > 3) {
+			fp = fopen(argv[3], "w");
+			if (fp == NULL) {
+				fprintf(stderr, "pmtrace: can not write %s\n", argv[3]);
+				return 1;
+			}
+		}
+		if (s_cmd == "json") {
+			json_writer v(fp);
+			ok = read_trace(filename, v);
+			if (!v.closed) fprintf(fp, "\n]}\n");		// no footer in the truncated file
+		} else {
+			csv_writer v(fp);
+			ok = read_trace(filename, v);
+		}
+		if (fp != stdout) fclose(fp);
+	} else {
+		usage();
+		return 1;
+	}
+	return ok ? 0 : 1;
+}